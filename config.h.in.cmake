@@ -84,6 +84,9 @@
 /* "Using upcoming LLVM 3.5" */
 #cmakedefine LLVM_3_5
 
+/* The full LLVM version, for the kernel cache keys */
+#define POCL_LLVM_VERSION "@LLVM_VERSION_FULL@"
+
 
 
 /* Defined to greatest expected alignment for extended types, in bytes. */
@@ -0,0 +1,71 @@
+/* pocl specific OpenCL extensions
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#ifndef __CL_EXT_POCL_H
+#define __CL_EXT_POCL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <CL/cl.h>
+
+/* cl_pocl_file_buffer extension
+ *
+ * Creates a buffer backed directly by a memory mapped file, e.g. for
+ * processing data sets larger than the host memory. The pages of the
+ * file are read in on demand when the kernels access them instead of
+ * copying the whole file into the buffer at creation.
+ *
+ * 'offset' and 'size' select the byte range of the file, a zero size
+ * selects the rest of the file. The mapping is private (copy-on-write):
+ * the kernels and the host can write to the buffer but the writes never
+ * reach the file. CL_MEM_USE_HOST_PTR,
+ * CL_MEM_ALLOC_HOST_PTR and CL_MEM_COPY_HOST_PTR are not allowed.
+ *
+ * Returns CL_INVALID_VALUE if the file cannot be opened or the range is
+ * outside of the file.
+ */
+#define cl_pocl_file_buffer 1
+
+typedef CL_API_ENTRY cl_mem
+(CL_API_CALL *clCreateBufferFromFilePOCL_fn)(cl_context   context,
+                                             cl_mem_flags flags,
+                                             const char * filename,
+                                             size_t       offset,
+                                             size_t       size,
+                                             cl_int *     errcode_ret);
+
+extern CL_API_ENTRY cl_mem CL_API_CALL
+clCreateBufferFromFilePOCL(cl_context   context,
+                           cl_mem_flags flags,
+                           const char * filename,
+                           size_t       offset,
+                           size_t       size,
+                           cl_int *     errcode_ret);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -55,25 +55,34 @@ struct _mem_mapping {
   void *host_ptr; /* the location of the mapped buffer chunk in the host memory */
   size_t offset; /* offset to the beginning of the buffer */
   size_t size;
+  cl_map_flags map_flags;
   mem_mapping_t *prev, *next;
 };
 
 // Command Queue datatypes
 
+struct pocl_kernel_variant;
+
 // clEnqueueNDRangeKernel
 typedef struct
 {
   void *data;
+  /* The directory of the work-group function. Owned by the variant. */
   char *tmp_dir; 
+  struct pocl_kernel_variant *variant;
   pocl_workgroup wg;
   cl_kernel kernel;
   /* A list of argument buffers to free after the command has 
-     been executed. */
+     been executed. Stored in the same block as the arguments. */
   cl_mem *arg_buffers;
   int arg_buffer_count;
   size_t local_x;
   size_t local_y;
   size_t local_z;
+  /* The dimension of the outermost work-item loop of the work-group 
+     function that can be split to multiple threads, -1 if the work 
+     group must be executed by a single thread. */
+  int sub_range_dim;
   struct pocl_context pc;
   struct pocl_argument *arguments;
 } _cl_command_run;
@@ -146,7 +155,7 @@ typedef struct
   mem_mapping_t *mapping;
 } _cl_command_unmap;
 
-/* clEnqueueFillImage */
+/* clEnqueueFillImage and clEnqueueFillBuffer */
 typedef struct
 {
   void *data;
@@ -157,6 +166,9 @@ typedef struct
   size_t slicepitch;
   void *fill_pixel;
   size_t pixel_size;
+  /* The filled buffer, retained until the fill has been executed. NULL
+     for images. */
+  cl_mem buffer;
 } _cl_command_fill_image;
 
 typedef struct
@@ -178,6 +190,20 @@ typedef union
   _cl_command_unmap unmap;
 } _cl_command_t;
 
+/* A buffer or a range of host memory accessed by a command, for the
+   dependency analysis of in-order queues. 'buffer' is NULL for a host
+   memory access. */
+typedef struct
+{
+  cl_mem buffer;
+  const char *host_ptr;
+  size_t size;
+  int write;
+} _cl_mem_access;
+
+/* The wait lists up to this length are stored in the command node. */
+#define POCL_INLINE_WAIT_LIST_LENGTH 4
+
 // one item in the command queue
 typedef struct
 {
@@ -188,6 +214,14 @@ typedef struct
   const cl_event *event_wait_list;
   cl_int num_events_in_wait_list;
   cl_device_id device;
+  /* The number of wait list events not completed yet, maintained by
+     the scheduler once the command has been flushed. */
+  cl_int num_unmet_deps;
+  /* The buffers the command reads and writes, or -1 accesses if the
+     command is not analyzed. */
+  _cl_mem_access *mem_accesses;
+  cl_int num_mem_accesses;
+  cl_event inline_wait_list[POCL_INLINE_WAIT_LIST_LENGTH];
 } _cl_command_node;
 
 #endif /* POCL_H */
@@ -36,7 +36,14 @@ struct pocl_context {
   size_t num_groups[3];
   size_t group_id[3];
   size_t global_offset[3];
-  
+  /* The work-item range [begin, end) of the outermost work-item loop
+     to execute, and the function to call at the work-group barriers
+     with the 'team' pointer. Used only by the work-group functions
+     compiled for executing a single work group with multiple threads
+     (see _cl_device_id.wi_sub_ranges). */
+  size_t local_range[2];
+  void (*barrier) (void *team);
+  void *team;
 };
 
 typedef void (*pocl_workgroup) (void **, struct pocl_context *);
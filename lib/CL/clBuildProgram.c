@@ -28,6 +28,9 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include "pocl_llvm.h"
+#include "pocl_cache.h"
+#include "pocl_compiler_threads.h"
+#include "pocl_util.h"
 
 /* supported compiler parameters which should pass to the frontend directly
    by using -Xclang */
@@ -53,6 +56,171 @@ static char cl_parameters_not_yet_supported_by_clang[] =
 #define MEM_ASSERT(x, err_jmp) do{ if (x){errcode = CL_OUT_OF_HOST_MEMORY;goto err_jmp;}} while(0)
 #define COMMAND_LENGTH 4096
 
+/* An asynchronous build (a clBuildProgram() call with pfn_notify), shared
+   by the build tasks of its devices running on the compiler threads. */
+typedef struct build_job
+{
+  cl_program program;
+  char *user_options;
+  void (CL_CALLBACK *pfn_notify) (cl_program program, void *user_data);
+  void *user_data;
+  unsigned num_devices;
+  /* The number of the devices not built yet and non-zero if a build
+     failed, protected by the program lock. */
+  unsigned pending;
+  int failed;
+} build_job;
+
+typedef struct build_task
+{
+  build_job *job;
+  cl_device_id device;
+  int device_i;
+} build_task;
+
+/* Must be called with the program lock held. */
+static void
+set_build_status (cl_program program, cl_device_id device,
+                  cl_build_status status)
+{
+  unsigned i;
+
+  for (i = 0; i < program->num_devices; ++i)
+    {
+      if (program->devices[i] == device)
+        program->build_status[i] = status;
+    }
+}
+
+/* Frees the binaries of a failed build so that the program can be built
+   again. Must be called with the program lock held. */
+static void
+discard_binaries (cl_program program, unsigned num_devices)
+{
+  unsigned i;
+
+  if (program->binaries != NULL)
+    {
+      for (i = 0; i < num_devices; ++i)
+        free (program->binaries[i]);
+    }
+  free (program->binaries);
+  program->binaries = NULL;
+  free (program->binary_sizes);
+  program->binary_sizes = NULL;
+  pocl_llvm_free_program (program);
+  free (program->llvm_irs);
+  program->llvm_irs = NULL;
+}
+
+/* Builds the fully linked non-parallel bitcode of the program for the
+   device. Accesses only the per-device data of the program, thus the
+   devices can be built in parallel. */
+static int
+build_device (cl_program program, cl_device_id device, int device_i,
+              const char *user_options)
+{
+  char tmpdir[POCL_FILENAME_LENGTH];
+  char device_tmpdir[POCL_FILENAME_LENGTH];
+  char binary_file_name[POCL_FILENAME_LENGTH];
+  FILE *binary_file;
+  unsigned char *binary;
+  size_t n;
+  int error;
+
+  snprintf (tmpdir, POCL_FILENAME_LENGTH, "%s/", program->temp_dir);
+  pocl_program_device_dir (device_tmpdir, program, device);
+  mkdir (device_tmpdir, S_IRWXU);
+
+  snprintf 
+    (binary_file_name, POCL_FILENAME_LENGTH, "%s/%s", 
+     device_tmpdir, POCL_PROGRAM_BC_FILENAME);
+
+  /* Built by an earlier process with the same options. */
+  if (pocl_cache_get_program (program, device, binary_file_name))
+    error = 0;
+  else
+    {
+      error = pocl_llvm_build_program
+        (program, device, device_i, tmpdir,
+         binary_file_name, device_tmpdir,
+         user_options);
+      if (error == 0)
+        pocl_cache_put_program (program, device, binary_file_name);
+    }
+
+  if (error != 0)
+    return CL_BUILD_PROGRAM_FAILURE;
+
+  /* In case we cached the llvm::Module, we might not have
+     dumped the bitcode yet. FIXME: always assume this and
+     fix this in the binary query API. */
+  if (program->llvm_irs[device_i] == NULL)
+    {
+      binary_file = fopen(binary_file_name, "r");
+      if (binary_file == NULL)
+        return CL_OUT_OF_HOST_MEMORY;
+
+      fseek(binary_file, 0, SEEK_END);
+      
+      program->binary_sizes[device_i] = ftell(binary_file);
+      fseek(binary_file, 0, SEEK_SET);
+
+      binary = (unsigned char *) malloc(program->binary_sizes[device_i]);
+      if (binary == NULL)
+        {
+          fclose (binary_file);
+          return CL_OUT_OF_HOST_MEMORY;
+        }
+
+      n = fread(binary, 1, program->binary_sizes[device_i], binary_file);
+      fclose (binary_file);
+      if (n < program->binary_sizes[device_i])
+        {
+          free (binary);
+          return CL_OUT_OF_HOST_MEMORY;
+        }
+      program->binaries[device_i] = binary;
+    }
+  return CL_SUCCESS;
+}
+
+static void
+build_task_main (void *arg)
+{
+  build_task *task = (build_task*)arg;
+  build_job *job = task->job;
+  cl_program program = job->program;
+  int error;
+  int last;
+
+  error = build_device (program, task->device, task->device_i,
+                        job->user_options);
+
+  POCL_LOCK_OBJ (program);
+  set_build_status (program, task->device,
+                    error == CL_SUCCESS ? CL_BUILD_SUCCESS : CL_BUILD_ERROR);
+  if (error != CL_SUCCESS)
+    job->failed = 1;
+  last = --job->pending == 0;
+  if (last)
+    {
+      if (job->failed)
+        discard_binaries (program, job->num_devices);
+      program->build_in_progress = 0;
+    }
+  POCL_UNLOCK_OBJ (program);
+  free (task);
+
+  if (!last)
+    return;
+
+  job->pfn_notify (program, job->user_data);
+  POname(clReleaseProgram) (program);
+  free (job->user_options);
+  free (job);
+}
+
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clBuildProgram)(cl_program program,
                        cl_uint num_devices,
@@ -67,11 +235,9 @@ CL_API_SUFFIX__VERSION_1_0
   char device_tmpdir[POCL_FILENAME_LENGTH];
   char source_file_name[POCL_FILENAME_LENGTH], binary_file_name[POCL_FILENAME_LENGTH];
   FILE *source_file, *binary_file;
-  size_t n;
   int errcode;
   int i;
   int error;
-  unsigned char *binary;
   unsigned real_num_devices;
   const cl_device_id *real_device_list;
   /* The default build script for .cl files. */
@@ -95,7 +261,7 @@ CL_API_SUFFIX__VERSION_1_0
   }
 
   POCL_LOCK_OBJ(program);
-  if (program->kernels)
+  if (program->kernels || program->build_in_progress)
   {
     errcode = CL_INVALID_OPERATION;
     goto ERROR;
@@ -209,6 +375,15 @@ CL_API_SUFFIX__VERSION_1_0
       real_device_list = device_list;
     }
 
+  if (program->build_status == NULL)
+    {
+      program->build_status = (cl_build_status*)
+        malloc (sizeof (cl_build_status) * program->num_devices);
+      MEM_ASSERT (program->build_status == NULL, ERROR_CLEAN_OPTIONS);
+      for (i = 0; i < program->num_devices; ++i)
+        program->build_status[i] = CL_BUILD_NONE;
+    }
+
   if (program->binaries == NULL)
     {
       snprintf (tmpdir, POCL_FILENAME_LENGTH, "%s/", program->temp_dir);
@@ -229,65 +404,70 @@ CL_API_SUFFIX__VERSION_1_0
         goto ERROR_CLEAN_BINARIES;
       }
 
-      /* Build the fully linked non-parallel bitcode for all
-         devices. */
+      /* The cache keys are computed before starting the builds as they
+         are stored to an array shared by the devices. */
       for (device_i = 0; device_i < real_num_devices; ++device_i)
         {
-          program->binaries[device_i] = NULL;
-          cl_device_id device = real_device_list[device_i];
-          snprintf (device_tmpdir, POCL_FILENAME_LENGTH, "%s/%s", 
-                    program->temp_dir, device->short_name);
-          mkdir (device_tmpdir, S_IRWXU);
-
-          snprintf 
-            (binary_file_name, POCL_FILENAME_LENGTH, "%s/%s", 
-             device_tmpdir, POCL_PROGRAM_BC_FILENAME);
+          pocl_cache_init_program (program, real_device_list[device_i],
+                                   device_i);
+          set_build_status (program, real_device_list[device_i],
+                            CL_BUILD_IN_PROGRESS);
+        }
 
-          error = pocl_llvm_build_program
-              (program, device, device_i, tmpdir,
-               binary_file_name, device_tmpdir,
-               user_options);     
+      if (pfn_notify != NULL)
+        {
+          /* Build the devices in parallel on the compiler threads and
+             return immediately. The tasks hold a reference to the
+             program until the callback has been called. */
+          build_job *job = (build_job*)malloc (sizeof (build_job));
+          MEM_ASSERT (job == NULL, ERROR_CLEAN_BINARIES);
+          job->user_options = strdup (user_options);
+          if (job->user_options == NULL)
+            {
+              free (job);
+              errcode = CL_OUT_OF_HOST_MEMORY;
+              goto ERROR_CLEAN_BINARIES;
+            }
+          job->program = program;
+          job->num_devices = real_num_devices;
+          job->pfn_notify = pfn_notify;
+          job->user_data = user_data;
+          job->pending = real_num_devices;
+          job->failed = 0;
+          program->build_in_progress = 1;
+          /* Retained while holding the lock, the tasks lock the program
+             when done. */
+          program->pocl_refcount++;
+          POCL_UNLOCK_OBJ (program);
+          for (device_i = 0; device_i < real_num_devices; ++device_i)
+            {
+              build_task *task = (build_task*)malloc (sizeof (build_task));
+              if (task == NULL)
+                POCL_ABORT ("pocl: could not allocate a build task\n");
+              task->job = job;
+              task->device = real_device_list[device_i];
+              task->device_i = device_i;
+              pocl_run_compiler_task (build_task_main, task);
+            }
+          free (modded_options);
+          return CL_SUCCESS;
+        }
 
-          if (error != 0)
+      for (device_i = 0; device_i < real_num_devices; ++device_i)
+        {
+          cl_device_id device = real_device_list[device_i];
+          error = build_device (program, device, device_i, user_options);
+          set_build_status (program, device, error == CL_SUCCESS ?
+                            CL_BUILD_SUCCESS : CL_BUILD_ERROR);
+          if (error != CL_SUCCESS)
           {
-            errcode = CL_BUILD_PROGRAM_FAILURE;
+            /* The rest of the devices were not built. */
+            for (i = device_i + 1; i < real_num_devices; ++i)
+              set_build_status (program, real_device_list[i], CL_BUILD_NONE);
+            errcode = error;
             goto ERROR_CLEAN_BINARIES;
           }
-
-          /* In case we cached the llvm::Module, we might not have
-             dumped the bitcode yet. FIXME: always assume this and
-             fix this in the binary query API. */
-          if (program->llvm_irs[device->dev_id] == NULL)
-            {
-              binary_file = fopen(binary_file_name, "r");
-              if (binary_file == NULL)
-                {
-                  errcode = CL_OUT_OF_HOST_MEMORY;
-                  goto ERROR_CLEAN_BINARIES;
-                }
-
-              fseek(binary_file, 0, SEEK_END);
-              
-              program->binary_sizes[device_i] = ftell(binary_file);
-              fseek(binary_file, 0, SEEK_SET);
-
-              binary = (unsigned char *) malloc(program->binary_sizes[device_i]);
-              if (binary == NULL)
-                {
-                  errcode = CL_OUT_OF_HOST_MEMORY;
-                  goto ERROR_CLEAN_BINARIES;
-                }
-
-              n = fread(binary, 1, program->binary_sizes[device_i], binary_file);
-              if (n < program->binary_sizes[device_i])
-                {
-                  errcode = CL_OUT_OF_HOST_MEMORY;
-                  goto ERROR_CLEAN_BINARIES;
-                }
-              program->binaries[device_i] = binary;
-            }
         }
-        
     }
   else
     {
@@ -296,8 +476,8 @@ CL_API_SUFFIX__VERSION_1_0
       for (device_i = 0; device_i < real_num_devices; ++device_i)
         {
           int count;
-          count = snprintf (device_tmpdir, POCL_FILENAME_LENGTH, "%s/%s", 
-                    program->temp_dir, real_device_list[device_i]->short_name);
+          count = pocl_program_device_dir (device_tmpdir, program,
+                                           real_device_list[device_i]);
           MEM_ASSERT(count >= POCL_FILENAME_LENGTH, ERROR_CLEAN_PROGRAM);
 
           error = mkdir (device_tmpdir, S_IRWXU);
@@ -315,21 +495,30 @@ CL_API_SUFFIX__VERSION_1_0
                   binary_file);
 
           fclose (binary_file);
+
+          /* The kernels compiled from the binary are cached as well. */
+          pocl_cache_init_program (program, real_device_list[device_i],
+                                   device_i);
+          set_build_status (program, real_device_list[device_i],
+                            CL_BUILD_SUCCESS);
         }      
     }
 
   POCL_UNLOCK_OBJ(program);
+  free (modded_options);
+  /* The synchronous builds have finished already. */
+  if (pfn_notify != NULL)
+    pfn_notify (program, user_data);
   return CL_SUCCESS;
 
   /* Set pointers to NULL during cleanup so that clProgramRelease won't
    * cause a double free. */
 
 ERROR_CLEAN_BINARIES:
-  for(i = 0; i < device_i; i++)
-  {
-    free(program->binaries[i]);
-    program->binaries[i] = NULL;
-  }
+  discard_binaries (program, real_num_devices);
+  free (modded_options);
+  POCL_UNLOCK_OBJ(program);
+  return errcode;
 ERROR_CLEAN_PROGRAM:
   free(program->binaries);
   program->binaries = NULL;
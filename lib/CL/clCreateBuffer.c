@@ -24,13 +24,11 @@
 
 #include "pocl_cl.h"
 #include "devices.h"
+#include "pocl_util.h"
 
-CL_API_ENTRY cl_mem CL_API_CALL
-POname(clCreateBuffer)(cl_context context,
-               cl_mem_flags flags,
-               size_t size,
-               void *host_ptr,
-               cl_int *errcode_ret) CL_API_SUFFIX__VERSION_1_0
+cl_mem
+pocl_create_buffer (cl_context context, cl_mem_flags flags, size_t size,
+                    void *host_ptr, int check_size, cl_int *errcode_ret)
 {
   cl_mem mem;
   cl_device_id device;
@@ -115,7 +113,7 @@ POname(clCreateBuffer)(cl_context context,
         }
     }
   
-  for (i = 0; i < context->num_devices; ++i)
+  for (i = 0; check_size && i < context->num_devices; ++i)
     {
       cl_ulong max_alloc;
       
@@ -132,11 +130,14 @@ POname(clCreateBuffer)(cl_context context,
   
   POCL_INIT_OBJECT(mem);
   mem->parent = NULL;
+  mem->origin = 0;
   mem->map_count = 0;
   mem->mappings = NULL;
   mem->type = CL_MEM_OBJECT_BUFFER;
   mem->flags = flags;
   mem->is_image = CL_FALSE;
+  mem->file_map = NULL;
+  mem->file_map_size = 0;
   
   /* Store the per device buffer pointers always to a known
      location in the buffer (dev_id), even though the context
@@ -164,6 +165,12 @@ POname(clCreateBuffer)(cl_context context,
         POname(clRetainMemObject) (mem);
       device = context->devices[i];
       assert (device->ops->alloc_mem_obj != NULL);
+      /* Unless there is host data to copy or use, the memory is 
+         allocated at the first command using the buffer on the device
+         (see pocl_mem_alloc_for_device()) to not waste memory on the
+         devices or buffers never used. */
+      if (!(flags & (CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR)))
+        continue;
       if (device->ops->alloc_mem_obj (device, mem) != CL_SUCCESS)
         {
           errcode = CL_MEM_OBJECT_ALLOCATION_FAILURE;
@@ -193,4 +200,14 @@ POname(clCreateBuffer)(cl_context context,
     }
   return NULL;
 }
+
+CL_API_ENTRY cl_mem CL_API_CALL
+POname(clCreateBuffer)(cl_context context,
+               cl_mem_flags flags,
+               size_t size,
+               void *host_ptr,
+               cl_int *errcode_ret) CL_API_SUFFIX__VERSION_1_0
+{
+  return pocl_create_buffer (context, flags, size, host_ptr, 1, errcode_ret);
+}
 POsym(clCreateBuffer)
@@ -0,0 +1,115 @@
+/* OpenCL runtime library: clCreateBufferFromFilePOCL()
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_cl.h"
+#include "pocl_util.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+CL_API_ENTRY cl_mem CL_API_CALL
+POname(clCreateBufferFromFilePOCL)(cl_context   context,
+                                   cl_mem_flags flags,
+                                   const char * filename,
+                                   size_t       offset,
+                                   size_t       size,
+                                   cl_int *     errcode_ret)
+{
+  struct stat st;
+  size_t page_offset;
+  size_t map_size;
+  void *map;
+  cl_mem mem;
+  cl_int errcode;
+  int fd;
+
+  if (context == NULL)
+    {
+      errcode = CL_INVALID_CONTEXT;
+      goto ERROR;
+    }
+
+  if (filename == NULL ||
+      flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR |
+               CL_MEM_COPY_HOST_PTR))
+    {
+      errcode = CL_INVALID_VALUE;
+      goto ERROR;
+    }
+
+  fd = open (filename, O_RDONLY);
+  if (fd == -1)
+    {
+      errcode = CL_INVALID_VALUE;
+      goto ERROR;
+    }
+
+  if (fstat (fd, &st) != 0 || offset >= (size_t)st.st_size ||
+      size > (size_t)st.st_size - offset)
+    {
+      close (fd);
+      errcode = CL_INVALID_VALUE;
+      goto ERROR;
+    }
+  if (size == 0)
+    size = st.st_size - offset;
+
+  /* The mapping must start at a page boundary. The host commands may
+     write also to a CL_MEM_READ_ONLY buffer, thus the mapping is always
+     a writable copy-on-write one. */
+  page_offset = offset % sysconf (_SC_PAGESIZE);
+  map_size = size + page_offset;
+  map = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+              fd, offset - page_offset);
+  close (fd);
+  if (map == MAP_FAILED)
+    {
+      errcode = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+      goto ERROR;
+    }
+
+  /* The CPU devices use the mapping directly as the buffer. The pages
+     are not backed by the host memory until touched, thus the size is
+     not limited by the maximum allocation size. */
+  mem = pocl_create_buffer (context, flags | CL_MEM_USE_HOST_PTR, size,
+                            (char*)map + page_offset, 0, &errcode);
+  if (mem == NULL)
+    {
+      munmap (map, map_size);
+      goto ERROR;
+    }
+  mem->file_map = map;
+  mem->file_map_size = map_size;
+
+  if (errcode_ret != NULL)
+    *errcode_ret = CL_SUCCESS;
+  return mem;
+
+ ERROR:
+  if (errcode_ret != NULL)
+    *errcode_ret = errcode;
+  return NULL;
+}
+POsymAlways(clCreateBufferFromFilePOCL)
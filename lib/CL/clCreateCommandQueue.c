@@ -23,6 +23,7 @@
 
 #include "pocl_cl.h"
 #include "pocl_util.h"
+#include "pocl_runtime_config.h"
 
 CL_API_ENTRY cl_command_queue CL_API_CALL
 POname(clCreateCommandQueue)(cl_context context, 
@@ -41,13 +42,6 @@ POname(clCreateCommandQueue)(cl_context context,
     goto ERROR;
   }
 
-  /* we don't handle out-of-order queues yet */
-  if (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) 
-  {
-    errcode = CL_INVALID_QUEUE_PROPERTIES;
-    goto ERROR;
-  }
-
   for (i=0; i<context->num_devices; i++)
     {
       if (context->devices[i] == device)
@@ -73,6 +67,15 @@ POname(clCreateCommandQueue)(cl_context context,
   command_queue->device = device;
   command_queue->properties = properties;
   command_queue->root = NULL;
+  command_queue->last_event = NULL;
+  command_queue->barrier_event = NULL;
+  command_queue->outstanding_commands = NULL;
+  command_queue->num_outstanding_commands = 0;
+  command_queue->outstanding_commands_size = 0;
+  command_queue->analyze_dependencies = 
+    !(properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) &&
+    pocl_get_bool_option ("POCL_DEPENDENCY_ANALYSIS", 0);
+  command_queue->num_pending = 0;
 
   if (errcode_ret != NULL)
     *errcode_ret = CL_SUCCESS;
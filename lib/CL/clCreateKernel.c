@@ -24,6 +24,9 @@
 
 #include "pocl_cl.h"
 #include "pocl_llvm.h"
+#include "pocl_cache.h"
+#include "pocl_precompile.h"
+#include "pocl_util.h"
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -56,7 +59,10 @@ POname(clCreateKernel)(cl_program program,
     goto ERROR;
   }
 
-  if (program->binaries == NULL || program->binary_sizes == NULL)
+  /* The binaries of an asynchronous build are not usable until the
+     build has finished. */
+  if (program->binaries == NULL || program->binary_sizes == NULL ||
+      program->build_in_progress)
   {
     errcode = CL_INVALID_PROGRAM_EXECUTABLE;
     goto ERROR;
@@ -70,19 +76,26 @@ POname(clCreateKernel)(cl_program program,
   }
 
   POCL_INIT_OBJECT (kernel);
+  POCL_INIT_LOCK (kernel->compile_lock);
+  kernel->reqd_wg_size = NULL;
 
   for (device_i = 0; device_i < program->num_devices; ++device_i)
     {
       if (device_i > 0)
         POname(clRetainKernel) (kernel);
 
-      snprintf (device_tmpdir, POCL_FILENAME_LENGTH, "%s/%s", 
-                program->temp_dir, program->devices[device_i]->short_name);
+      pocl_program_device_dir (device_tmpdir, program, 
+                               program->devices[device_i]);
 
       /* If there is no device dir for this device, the program was
          not built for that device in clBuildProgram. This seems to
          be OK by the standard. */
       if (access (device_tmpdir, F_OK) != 0) continue;
+
+      if (pocl_cache_get_kernel_metadata 
+          (program, program->devices[device_i], kernel, kernel_name,
+           device_tmpdir))
+        continue;
  
       error = pocl_llvm_get_kernel_metadata 
           (program, kernel, device_i, kernel_name, 
@@ -93,6 +106,9 @@ POname(clCreateKernel)(cl_program program,
           goto ERROR_CLEAN_KERNEL;
         } 
 
+      pocl_cache_put_kernel_metadata 
+        (program, program->devices[device_i], kernel, kernel_name);
+
       /* when using the API, there is no descriptor file */
     }
 
@@ -102,6 +118,8 @@ POname(clCreateKernel)(cl_program program,
 
   kernel->context = program->context;
   kernel->program = program;
+  kernel->variants = NULL;
+  kernel->free_arg_blocks = NULL;
   kernel->next = NULL;
 
   POCL_LOCK_OBJ (program);
@@ -112,6 +130,8 @@ POname(clCreateKernel)(cl_program program,
 
   POCL_RETAIN_OBJECT(program);
 
+  pocl_precompile_kernel (kernel);
+
   if (errcode_ret != NULL)
     *errcode_ret = CL_SUCCESS;
   return kernel;
@@ -17,9 +17,13 @@ POname(clCreateKernelsInProgram)(cl_program      program ,
 {
   int idx;
   int num_kern_found;
+  const char** knames;
+
+  if (program->binaries == NULL || program->build_in_progress)
+    return CL_INVALID_PROGRAM_EXECUTABLE;
   
   /* Get list of kernel names in program */
-  const char** knames = (const char**)malloc( num_kernels*sizeof(const char *) ); 
+  knames = (const char**)malloc( num_kernels*sizeof(const char *) ); 
   if (knames == NULL) 
     return CL_OUT_OF_HOST_MEMORY;
   num_kern_found = pocl_llvm_get_kernel_names (program, knames, num_kernels);
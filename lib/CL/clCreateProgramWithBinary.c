@@ -108,6 +108,10 @@ POname(clCreateProgramWithBinary)(cl_context                     context,
   program->binaries = NULL;
   program->compiler_options = NULL;
   program->llvm_irs = NULL;
+  program->cache_keys = NULL;
+  program->build_status = NULL;
+  program->build_in_progress = 0;
+  POCL_INIT_LOCK (program->llvm_lock);
 
   /* Allocate a continuous chunk of memory for all the binaries. */
   if ((program->binary_sizes = 
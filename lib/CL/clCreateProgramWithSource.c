@@ -109,6 +109,10 @@ POname(clCreateProgramWithSource)(cl_context context,
   program->binaries = NULL;
   program->kernels = NULL;
   program->llvm_irs = NULL;
+  program->cache_keys = NULL;
+  program->build_status = NULL;
+  program->build_in_progress = 0;
+  POCL_INIT_LOCK (program->llvm_lock);
 
   /* Create the temporary directory where all kernel files and compilation
      (intermediate) results are stored. */
@@ -23,8 +23,8 @@
 
 #include "pocl_cl.h"
 #include "devices.h"
+#include "pocl_util.h"
 
-/* NOTE: this function is untested! */
 CL_API_ENTRY cl_mem CL_API_CALL
 POname(clCreateSubBuffer)(cl_mem                   buffer,
                   cl_mem_flags             flags,
@@ -65,6 +65,20 @@ POname(clCreateSubBuffer)(cl_mem                   buffer,
     goto ERROR;
   }
 
+  /* The sub buffer shares the memory of the parent, thus its origin 
+     must be aligned for some device. */
+  for (i = 0; i < buffer->context->num_devices; ++i)
+    {
+      cl_uint align = buffer->context->devices[i]->mem_base_addr_align;
+      if (align == 0 || info->origin % align == 0)
+        break;
+    }
+  if (i == buffer->context->num_devices)
+  {
+    errcode = CL_MISALIGNED_SUB_BUFFER_OFFSET;
+    goto ERROR;
+  }
+
   mem = (cl_mem) malloc(sizeof(struct _cl_mem));
   if (mem == NULL)
   {
@@ -74,7 +88,13 @@ POname(clCreateSubBuffer)(cl_mem                   buffer,
 
   POCL_INIT_OBJECT(mem);
   mem->mappings = NULL;
+  mem->map_count = 0;
   mem->parent = buffer;
+  mem->origin = info->origin;
+  mem->is_image = CL_FALSE;
+  mem->buffer = NULL;
+  mem->file_map = NULL;
+  mem->file_map_size = 0;
 
   mem->type = CL_MEM_OBJECT_BUFFER;
   mem->size = info->size;
@@ -123,13 +143,14 @@ POname(clCreateSubBuffer)(cl_mem                   buffer,
     (buffer->flags & CL_MEM_ALLOC_HOST_PTR) |
     (buffer->flags & CL_MEM_COPY_HOST_PTR);
 
-  if (mem->flags & CL_MEM_USE_HOST_PTR)
-    {
-      mem->mem_host_ptr = buffer->mem_host_ptr + info->origin;
-    }
+  /* The host memory of a CL_MEM_USE_HOST_PTR parent is shared too. */
+  if (buffer->flags & CL_MEM_USE_HOST_PTR && buffer->mem_host_ptr != NULL)
+    mem->mem_host_ptr = (char*)buffer->mem_host_ptr + info->origin;
+  else
+    mem->mem_host_ptr = NULL;
 
   mem->device_ptrs = 
-    malloc(pocl_num_devices * sizeof(pocl_mem_identifier *));
+    malloc(pocl_num_devices * sizeof(pocl_mem_identifier));
   if (mem->device_ptrs == NULL)
     {
         errcode = CL_OUT_OF_HOST_MEMORY;
@@ -143,10 +164,19 @@ POname(clCreateSubBuffer)(cl_mem                   buffer,
     {
       device = mem->context->devices[i];
 
+      if (pocl_mem_alloc_for_device (buffer, device) != CL_SUCCESS)
+        {
+          errcode = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+          goto ERROR_CLEAN_MEM_AND_DEVPTR;
+        }
+
       /* device_ptrs can contain a pointer to a book keeping
          structure instead of the actual buffer in memory, therefore
          call the device driver layer to produce the sub buffer
-         reference */
+         reference. The CPU devices just offset the pointer, the sub
+         buffer is a view to the memory of the parent. */
+      mem->device_ptrs[device->dev_id].global_mem_id = 
+        buffer->device_ptrs[device->dev_id].global_mem_id;
       if (device->ops->create_sub_buffer != NULL)
         mem->device_ptrs[device->dev_id].mem_ptr = 
           device->ops->create_sub_buffer
@@ -164,10 +194,8 @@ POname(clCreateSubBuffer)(cl_mem                   buffer,
     *errcode_ret = CL_SUCCESS;
   return mem;
 
-#if 0
 ERROR_CLEAN_MEM_AND_DEVPTR:
     free(mem->device_ptrs);
-#endif
 ERROR_CLEAN_MEM:
     free(mem);
 ERROR:
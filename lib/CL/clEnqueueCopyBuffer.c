@@ -67,6 +67,12 @@ CL_API_SUFFIX__VERSION_1_0
     }
   assert(i < command_queue->context->num_devices);
 
+  errcode = pocl_mem_alloc_for_device (src_buffer, device_id);
+  if (errcode == CL_SUCCESS)
+    errcode = pocl_mem_alloc_for_device (dst_buffer, device_id);
+  if (errcode != CL_SUCCESS)
+    return errcode;
+
   errcode = pocl_create_command (&cmd, command_queue, CL_COMMAND_COPY_BUFFER, 
                                  event, num_events_in_wait_list, 
                                  event_wait_list);
@@ -32,6 +32,12 @@ CL_API_SUFFIX__VERSION_1_0
     
   cl_device_id device_id = command_queue->device;
 
+  if (pocl_mem_alloc_for_device (image, device_id) != CL_SUCCESS)
+    {
+      free (temp);
+      return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+    }
+
   device_id->ops->read
     (device_id->data, 
      temp, 
@@ -0,0 +1,113 @@
+/* OpenCL runtime library: clEnqueueFillBuffer()
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_cl.h"
+#include "pocl_util.h"
+#include <string.h>
+
+/* The largest pattern, the size of a double16. */
+#define MAX_PATTERN_SIZE 128
+
+CL_API_ENTRY cl_int CL_API_CALL
+POname(clEnqueueFillBuffer)(cl_command_queue  command_queue,
+                            cl_mem            buffer,
+                            const void *      pattern,
+                            size_t            pattern_size,
+                            size_t            offset,
+                            size_t            size,
+                            cl_uint           num_events_in_wait_list,
+                            const cl_event*   event_wait_list,
+                            cl_event*         event)
+CL_API_SUFFIX__VERSION_1_2
+{
+  cl_device_id device;
+  _cl_command_node *cmd = NULL;
+  void *fill_pattern;
+  int errcode;
+
+  if (command_queue == NULL)
+    return CL_INVALID_COMMAND_QUEUE;
+
+  if (buffer == NULL)
+    return CL_INVALID_MEM_OBJECT;
+
+  if (command_queue->context != buffer->context)
+    return CL_INVALID_CONTEXT;
+
+  /* The pattern size must be a power of two up to 128 and the filled 
+     range a whole number of patterns. */
+  if (pattern == NULL || pattern_size == 0 || 
+      pattern_size > MAX_PATTERN_SIZE ||
+      (pattern_size & (pattern_size - 1)) != 0 ||
+      offset % pattern_size != 0 || size % pattern_size != 0 ||
+      offset > buffer->size || size > buffer->size - offset)
+    return CL_INVALID_VALUE;
+
+  if ((event_wait_list == NULL && num_events_in_wait_list > 0) ||
+      (event_wait_list != NULL && num_events_in_wait_list == 0))
+    return CL_INVALID_EVENT_WAIT_LIST;
+
+  device = command_queue->device;
+
+  errcode = pocl_mem_alloc_for_device (buffer, device);
+  if (errcode != CL_SUCCESS)
+    return errcode;
+
+  /* The pattern may be reused by the application as soon as this 
+     returns. */
+  fill_pattern = malloc (pattern_size);
+  if (fill_pattern == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+  memcpy (fill_pattern, pattern, pattern_size);
+
+  errcode = pocl_create_command (&cmd, command_queue, CL_COMMAND_FILL_BUFFER,
+                                 event, num_events_in_wait_list, 
+                                 event_wait_list);
+  if (errcode != CL_SUCCESS)
+    {
+      free (fill_pattern);
+      return errcode;
+    }
+
+  /* The fill is a single row of size / pattern_size "pixels". */
+  cmd->command.fill_image.data = device->data;
+  cmd->command.fill_image.device_ptr = 
+    buffer->device_ptrs[device->dev_id].mem_ptr;
+  cmd->command.fill_image.buffer_origin[0] = offset / pattern_size;
+  cmd->command.fill_image.buffer_origin[1] = 0;
+  cmd->command.fill_image.buffer_origin[2] = 0;
+  cmd->command.fill_image.region[0] = size / pattern_size;
+  cmd->command.fill_image.region[1] = 1;
+  cmd->command.fill_image.region[2] = 1;
+  cmd->command.fill_image.rowpitch = 0;
+  cmd->command.fill_image.slicepitch = 0;
+  cmd->command.fill_image.fill_pixel = fill_pattern;
+  cmd->command.fill_image.pixel_size = pattern_size;
+  cmd->command.fill_image.buffer = buffer;
+  POname(clRetainMemObject) (buffer);
+
+  pocl_command_enqueue (command_queue, cmd);
+
+  return CL_SUCCESS;
+}
+POsym(clEnqueueFillBuffer)
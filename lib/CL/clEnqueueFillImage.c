@@ -159,6 +159,10 @@ CL_API_SUFFIX__VERSION_1_2
   tuned_origin[1] = image->image_height - region[1] - origin[1];
   tuned_origin[2] = origin[2];
 
+  errcode = pocl_mem_alloc_for_device (image, command_queue->device);
+  if (errcode != CL_SUCCESS)
+    return errcode;
+
   errcode = pocl_create_command (&cmd, command_queue, CL_COMMAND_FILL_IMAGE, 
                                  event, num_events_in_wait_list, 
                                  event_wait_list);
@@ -175,6 +179,7 @@ CL_API_SUFFIX__VERSION_1_2
   cmd->command.fill_image.slicepitch = image->image_slice_pitch;
   cmd->command.fill_image.fill_pixel = fill_pixel;
   cmd->command.fill_image.pixel_size = image->image_elem_size * image->image_channels;
+  cmd->command.fill_image.buffer = NULL;
   pocl_command_enqueue(command_queue, cmd);
   
   free (supported_image_formats);
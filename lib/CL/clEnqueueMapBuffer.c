@@ -26,6 +26,7 @@
 #include <assert.h>
 #include "pocl_util.h"
 #include "clEnqueueMapBuffer.h"
+#include "pocl_mem_management.h"
 
 CL_API_ENTRY void * CL_API_CALL
 POname(clEnqueueMapBuffer)(cl_command_queue command_queue,
@@ -43,6 +44,7 @@ POname(clEnqueueMapBuffer)(cl_command_queue command_queue,
   void *host_ptr = NULL;
   mem_mapping_t *mapping_info = NULL;
   int errcode;
+  cl_event map_event;
   _cl_command_node *cmd = NULL;
 
   if (buffer == NULL)
@@ -66,24 +68,22 @@ POname(clEnqueueMapBuffer)(cl_command_queue command_queue,
       map_flags & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION))
     POCL_ERROR(CL_INVALID_OPERATION);
 
+  if ((event_wait_list == NULL && num_events_in_wait_list > 0) ||
+      (event_wait_list != NULL && num_events_in_wait_list == 0))
+    POCL_ERROR(CL_INVALID_EVENT_WAIT_LIST);
+
   device = command_queue->device;
- 
-  /* Ensure the parent buffer is not freed prematurely. */
-  POname(clRetainMemObject) (buffer);
 
-  mapping_info = (mem_mapping_t*) calloc (1, sizeof (mem_mapping_t));
-  if (mapping_info == NULL)
-    {
-      errcode = CL_OUT_OF_HOST_MEMORY;
-      goto ERROR;
-    }
+  errcode = pocl_mem_alloc_for_device (buffer, device);
+  if (errcode != CL_SUCCESS)
+    POCL_ERROR(errcode);
 
   if (buffer->flags & CL_MEM_USE_HOST_PTR)
     {
       /* In this case it should use the given host_ptr + offset as
          the mapping area in the host memory. */   
       assert (buffer->mem_host_ptr != NULL);
-      host_ptr = buffer->mem_host_ptr + offset;
+      host_ptr = (char*)buffer->mem_host_ptr + offset;
     }
   else
     {
@@ -99,54 +99,75 @@ POname(clEnqueueMapBuffer)(cl_command_queue command_queue,
     }
 
   if (host_ptr == NULL)
+    POCL_ERROR(CL_MAP_FAILURE);
+
+  mapping_info = pocl_mem_manager_new_mapping ();
+  if (mapping_info == NULL)
+    POCL_ERROR(CL_OUT_OF_HOST_MEMORY);
+  mapping_info->host_ptr = host_ptr;
+  mapping_info->offset = offset;
+  mapping_info->size = size;
+  mapping_info->map_flags = map_flags;
+
+  /* In case the host pointer is the device memory (the CPU devices) and
+     the mapping does not have to wait for other commands writing the 
+     buffer, there is nothing to be done later, thus the mapping is 
+     completed right away, blocking or not. */
+  if (pocl_mapping_is_zero_copy (buffer, device, mapping_info) &&
+      pocl_command_can_run_now (command_queue, buffer, 
+                                map_flags != CL_MAP_READ,
+                                num_events_in_wait_list, event_wait_list))
     {
-      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
-      errcode = CL_MAP_FAILURE;
-      goto ERROR;
+      errcode = pocl_create_complete_event (event, command_queue, 
+                                            CL_COMMAND_MAP_BUFFER);
+      if (errcode != CL_SUCCESS)
+        {
+          pocl_mem_manager_free_mapping (mapping_info);
+          POCL_ERROR(errcode);
+        }
+      POCL_LOCK_OBJ (buffer);
+      DL_APPEND (buffer->mappings, mapping_info);
+      buffer->map_count++;
+      POCL_UNLOCK_OBJ (buffer);
+      POCL_SUCCESS ();
+      return host_ptr;
     }
 
   errcode = pocl_create_command (&cmd, command_queue, CL_COMMAND_MAP_BUFFER, 
                                  event, num_events_in_wait_list, 
                                  event_wait_list);
-  
   if (errcode != CL_SUCCESS)
-      goto ERROR;
-  
+    {
+      pocl_mem_manager_free_mapping (mapping_info);
+      POCL_ERROR(errcode);
+    }
+
+  /* Ensure the buffer is not freed before the command is executed. */
+  POname(clRetainMemObject) (buffer);
   cmd->command.map.buffer = buffer;
   cmd->command.map.mapping = mapping_info;
-    
-  mapping_info->host_ptr = host_ptr;
-  mapping_info->offset = offset;
-  mapping_info->size = size;
+
   POCL_LOCK_OBJ (buffer);
   DL_APPEND (buffer->mappings, mapping_info);  
   POCL_UNLOCK_OBJ (buffer);
+
+  /* A blocking map waits only for the map command, not for the rest of
+     the queue. */
+  map_event = cmd->event;
+  if (blocking_map)
+    POname(clRetainEvent) (map_event);
   pocl_command_enqueue(command_queue, cmd);
 
-  if (blocking_map != CL_TRUE)
+  if (blocking_map)
     {
-      POCL_SUCCESS ();
-      return mapping_info->host_ptr;
+      errcode = POname(clWaitForEvents) (1, &map_event);
+      POname(clReleaseEvent) (map_event);
+      if (errcode != CL_SUCCESS)
+        POCL_ERROR(errcode);
     }
-  else
-    errcode = POname(clFinish) (command_queue);
-
-  if (errcode_ret)
-    *errcode_ret = errcode;
-  
 
   POCL_SUCCESS ();
   return host_ptr;
-
- ERROR:
-  if (event)
-    free(*event);
-  free(cmd);
-  free(event);
-  free (mapping_info);
-  if (errcode_ret)
-    *errcode_ret = errcode;
-  return NULL;
 }
 POsym(clEnqueueMapBuffer)
 
@@ -155,15 +176,64 @@ pocl_map_mem_cmd(cl_device_id device,
                  cl_mem buffer, 
                  mem_mapping_t *mapping_info) {
 
-
-  
-  /* The second call ensures the memory is flushed/updated to the
-     host location. */
-  device->ops->map_mem 
-    (device->data, buffer->device_ptrs[device->dev_id].mem_ptr, 
-     mapping_info->offset, mapping_info->size, mapping_info->host_ptr);
+  /* The whole region is overwritten by the host, no need to make it up
+     to date. */
+  if (mapping_info->map_flags & CL_MAP_WRITE_INVALIDATE_REGION ||
+      pocl_mapping_is_zero_copy (buffer, device, mapping_info))
+    ;
+  else if (buffer->flags & CL_MEM_USE_HOST_PTR)
+    {
+      /* The device caches the host memory, copy the region back. */
+      device->ops->read
+        (device->data, mapping_info->host_ptr,
+         (char*)buffer->device_ptrs[device->dev_id].mem_ptr + 
+         mapping_info->offset, mapping_info->size);
+    }
+  else
+    {
+      /* The second call ensures the memory is flushed/updated to the
+         host location. */
+      device->ops->map_mem 
+        (device->data, buffer->device_ptrs[device->dev_id].mem_ptr, 
+         mapping_info->offset, mapping_info->size, mapping_info->host_ptr);
+    }
   
+  POCL_LOCK_OBJ (buffer);
   buffer->map_count++;
+  POCL_UNLOCK_OBJ (buffer);
   return mapping_info->host_ptr;
+}
+
+void
+pocl_unmap_mem_cmd(cl_device_id device,
+                   cl_mem buffer,
+                   mem_mapping_t *mapping_info)
+{
+  int written = mapping_info->map_flags == 0 ||
+    mapping_info->map_flags & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION);
 
+  if (!written || pocl_mapping_is_zero_copy (buffer, device, mapping_info))
+    ;
+  else if (buffer->flags & CL_MEM_USE_HOST_PTR)
+    {
+      /* The device caches the host memory, copy the region to it. */
+      device->ops->write
+        (device->data, mapping_info->host_ptr,
+         (char*)buffer->device_ptrs[device->dev_id].mem_ptr + 
+         mapping_info->offset, mapping_info->size);
+    }
+  else if (device->ops->unmap_mem != NULL)
+    {
+      /* TODO: fixme. The offset computation must be done at the device 
+         driver. */
+      device->ops->unmap_mem
+        (device->data, mapping_info->host_ptr, 
+         buffer->device_ptrs[device->dev_id].mem_ptr, mapping_info->size);
+    }
+
+  POCL_LOCK_OBJ (buffer);
+  DL_DELETE (buffer->mappings, mapping_info);
+  buffer->map_count--;
+  POCL_UNLOCK_OBJ (buffer);
+  pocl_mem_manager_free_mapping (mapping_info);
 }
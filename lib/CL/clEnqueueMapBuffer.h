@@ -30,4 +30,11 @@ pocl_map_mem_cmd(cl_device_id device,
                  cl_mem buffer, 
                  mem_mapping_t *mapping_info);
 
+/* Writes the mapped region back to the device unless the mapping is 
+   zero-copy or read-only, and removes the mapping. */
+void
+pocl_unmap_mem_cmd(cl_device_id device,
+                   cl_mem buffer,
+                   mem_mapping_t *mapping_info);
+
 #endif
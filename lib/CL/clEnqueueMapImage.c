@@ -25,6 +25,7 @@
 #include "pocl_image_util.h"
 #include "pocl_util.h"
 #include "utlist.h"
+#include "pocl_mem_management.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -73,6 +74,10 @@ CL_API_SUFFIX__VERSION_1_0
       goto ERROR;
     }
 
+  errcode = pocl_mem_alloc_for_device (image, device);
+  if (errcode != CL_SUCCESS)
+    goto ERROR;
+
   errcode = pocl_check_image_origin_region(image, origin, region);
   if (errcode != CL_SUCCESS)
     goto ERROR;
@@ -96,7 +101,7 @@ CL_API_SUFFIX__VERSION_1_0
   
   offset = image->image_channels * image->image_elem_size * origin[0];
   
-  mapping_info = (mem_mapping_t*) malloc (sizeof (mem_mapping_t));
+  mapping_info = pocl_mem_manager_new_mapping ();
   if (mapping_info == NULL)
     {
       errcode = CL_OUT_OF_HOST_MEMORY;
@@ -139,6 +144,7 @@ CL_API_SUFFIX__VERSION_1_0
   mapping_info->host_ptr = map;
   mapping_info->offset = offset;
   mapping_info->size = 0;/* not needed ?? */
+  mapping_info->map_flags = map_flags;
   POCL_LOCK_OBJ (image);
   DL_APPEND (image->mappings, mapping_info);
   POCL_UNLOCK_OBJ (image);
@@ -150,6 +156,7 @@ CL_API_SUFFIX__VERSION_1_0
     goto ERROR;
       
   
+  POname(clRetainMemObject) (image);
   cmd->command.map.buffer = image;
   cmd->command.map.mapping = mapping_info;
   pocl_command_enqueue(command_queue, cmd);
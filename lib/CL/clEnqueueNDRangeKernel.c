@@ -26,6 +26,7 @@
 #include "pocl_cl.h"
 #include "pocl_llvm.h"
 #include "pocl_util.h"
+#include "pocl_precompile.h"
 #include "utlist.h"
 #include <assert.h>
 #include <sys/stat.h>
@@ -52,15 +53,11 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
   size_t offset_x, offset_y, offset_z;
   size_t global_x, global_y, global_z;
   size_t local_x, local_y, local_z;
-  char tmpdir[POCL_FILENAME_LENGTH];
-  char kernel_filename[POCL_FILENAME_LENGTH];
-  FILE *kernel_file;
-  char parallel_filename[POCL_FILENAME_LENGTH];
-  size_t n;
-  int i, count;
-  int error;
+  int i;
+  cl_int error;
   struct pocl_context pc;
   _cl_command_node *command_node;
+  pocl_kernel_variant *variant;
 
   if (command_queue == NULL)
     return CL_INVALID_COMMAND_QUEUE;
@@ -110,6 +107,10 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
       local_y = work_dim > 1 ? local_work_size[1] : 1;
       local_z = work_dim > 2 ? local_work_size[2] : 1;
     } 
+  else if (kernel->reqd_wg_size != NULL && kernel->reqd_wg_size[0] > 0)
+    /* The local size must be given for a kernel with 
+       reqd_work_group_size. */
+    return CL_INVALID_WORK_GROUP_SIZE;
   else 
     {
       size_t preferred_wg_multiple;
@@ -163,74 +164,30 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
       (event_wait_list != NULL && num_events_in_wait_list == 0))
     return CL_INVALID_EVENT_WAIT_LIST;
 
-  snprintf (tmpdir, POCL_FILENAME_LENGTH, "%s/%s/%s/%zu-%zu-%zu", 
-            kernel->program->temp_dir, command_queue->device->short_name, 
-            kernel->name, 
-            local_x, local_y, local_z);
-  mkdir (tmpdir, S_IRWXU);
-
-  
-  error = snprintf
-    (parallel_filename, POCL_FILENAME_LENGTH,
-     "%s/%s", tmpdir, POCL_PARALLEL_BC_FILENAME);
-  if (error < 0)
-    return CL_OUT_OF_HOST_MEMORY;
+  /* Usually generated already at an earlier launch or ahead of time
+     when the kernel was created. */
+  variant = pocl_generate_kernel_variant (kernel, command_queue->device, 
+                                          local_x, local_y, local_z, &error);
+  if (variant == NULL)
+    return error;
 
-  if (kernel->program->llvm_irs[0] == NULL)
+  /* Allocate the buffers not used on the device before. */
+  for (i = 0; i < kernel->num_args; ++i)
     {
-      error = snprintf
-        (kernel_filename, POCL_FILENAME_LENGTH,
-         "%s/%s/%s/kernel.bc", kernel->program->temp_dir, 
-         command_queue->device->short_name, kernel->name);
-
-      if (error < 0)
-        return CL_OUT_OF_HOST_MEMORY;
-
-      if (access (kernel_filename, F_OK) != 0) 
-        {
-          kernel_file = fopen(kernel_filename, "w+");
-          if (kernel_file == NULL)
-            return CL_OUT_OF_HOST_MEMORY;
-
-          n = fwrite(kernel->program->binaries[command_queue->device->dev_id], 1,
-                     kernel->program->binary_sizes[command_queue->device->dev_id], 
-                     kernel_file);
-          if (n < kernel->program->binary_sizes[command_queue->device->dev_id])
-            return CL_OUT_OF_HOST_MEMORY;
-  
-          fclose(kernel_file);
-
-#ifdef DEBUG_NDRANGE
-          printf("[kernel bc written] ");
-#endif
-        }
-      else
-        {
-#ifdef DEBUG_NDRANGE
-          printf("[kernel bc already written] ");
-#endif
-        }
+      struct pocl_argument_info *ai = &kernel->arg_info[i];
+      cl_mem buf;
+      if (ai->is_local || kernel->dyn_arguments[i].value == NULL ||
+          (ai->type != POCL_ARG_TYPE_POINTER && 
+           ai->type != POCL_ARG_TYPE_IMAGE))
+        continue;
+      buf = *(cl_mem*)kernel->dyn_arguments[i].value;
+      if (buf == NULL)
+        continue;
+      error = pocl_mem_alloc_for_device (buf, command_queue->device);
+      if (error != CL_SUCCESS)
+        return error;
     }
 
-  if (access (parallel_filename, F_OK) != 0) 
-    {
-      error = pocl_llvm_generate_workgroup_function
-          (command_queue->device,
-           kernel, local_x, local_y, local_z,
-           parallel_filename, kernel_filename);
-      if (error) return error;
-
-#ifdef DEBUG_NDRANGE
-      printf("[parallel bc created]\n");
-#endif
-    }
-  else
-    {
-#ifdef DEBUG_NDRANGE
-      printf("[parallel bc already created]\n");
-#endif
-    }
-  
   error = pocl_create_command (&command_node, command_queue,
                                CL_COMMAND_NDRANGE_KERNEL,
                                event, num_events_in_wait_list,
@@ -245,83 +202,44 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
   pc.global_offset[0] = offset_x;
   pc.global_offset[1] = offset_y;
   pc.global_offset[2] = offset_z;
+  /* By default the work-group functions execute all the work items. */
+  pc.local_range[0] = 0;
+  pc.local_range[1] = local_z > 1 ? local_z : (local_y > 1 ? local_y : local_x);
+  pc.barrier = NULL;
+  pc.team = NULL;
 
   command_node->type = CL_COMMAND_NDRANGE_KERNEL;
   command_node->command.run.data = command_queue->device->data;
-  command_node->command.run.tmp_dir = strdup(tmpdir);
+  command_node->command.run.tmp_dir = variant->tmp_dir;
+  command_node->command.run.variant = variant;
   command_node->command.run.kernel = kernel;
   command_node->command.run.pc = pc;
   command_node->command.run.local_x = local_x;
   command_node->command.run.local_y = local_y;
   command_node->command.run.local_z = local_z;
+  command_node->command.run.sub_range_dim = -1;
 
   /* Copy the currently set kernel arguments because the same kernel 
      object can be reused for new launches with different arguments. */
   command_node->command.run.arguments = 
-    (struct pocl_argument *) malloc ((kernel->num_args + kernel->num_locals) *
-                                     sizeof (struct pocl_argument));
-
-  for (i = 0; i < kernel->num_args + kernel->num_locals; ++i)
-    {
-      struct pocl_argument *arg = &command_node->command.run.arguments[i];
-      size_t arg_alloc_size = kernel->dyn_arguments[i].size;
-      arg->size = arg_alloc_size;
-
-      if (kernel->dyn_arguments[i].value == NULL)
-        {
-          arg->value = NULL;
-        }
-      else
-        {
-          /* FIXME: this is a cludge to determine an acceptable alignment,
-           * we should probably extract the argument alignment from the
-           * LLVM bytecode during kernel header generation. */
-          size_t arg_alignment = pocl_size_ceil2(arg_alloc_size);
-          if (arg_alignment >= MAX_EXTENDED_ALIGNMENT)
-            arg_alignment = MAX_EXTENDED_ALIGNMENT;
-          if (arg_alloc_size < arg_alignment)
-            arg_alloc_size = arg_alignment;
-         
-          arg->value = pocl_aligned_malloc (arg_alignment, arg_alloc_size);
-          memcpy (arg->value, kernel->dyn_arguments[i].value, arg->size);
-        }
-    }
+    pocl_copy_kernel_arguments (kernel, &command_node->command.run.arg_buffers,
+                                &command_node->command.run.arg_buffer_count);
+  if (command_node->command.run.arguments == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
 
   command_node->next = NULL; 
   
   POname(clRetainCommandQueue) (command_queue);
   POname(clRetainKernel) (kernel);
 
-  command_node->command.run.arg_buffer_count = 0;
-  for (i = 0; i < kernel->num_args; ++i)
-  {
-    struct pocl_argument *al = &(kernel->dyn_arguments[i]);
-    if (!kernel->arg_info[i].is_local && kernel->arg_info[i].type == POCL_ARG_TYPE_POINTER && al->value != NULL)
-      ++command_node->command.run.arg_buffer_count;
-  }
-  
-  /* Copy the argument buffers just so we can free them after execution. */
-  command_node->command.run.arg_buffers = 
-    (cl_mem *) malloc (sizeof (struct _cl_mem) * command_node->command.run.arg_buffer_count);
-  count = 0;
-  for (i = 0; i < kernel->num_args; ++i)
-  {
-    struct pocl_argument *al = &(kernel->dyn_arguments[i]);
-    if (!kernel->arg_info[i].is_local && kernel->arg_info[i].type == POCL_ARG_TYPE_POINTER && al->value != NULL)
-      {
-        cl_mem buf;
-#if 0
-        printf ("### retaining arg %d - the buffer %x of kernel %s\n", i, buf, kernel->function_name);
-#endif
-        buf = *(cl_mem *) (al->value);
-        /* Retain all memobjects so they won't get freed before the
-           queued kernel has been executed. */
-        if (buf != NULL)
-          POname(clRetainMemObject) (buf);
-        command_node->command.run.arg_buffers[count] = buf;
-        ++count;
-      }
-  }
+  /* Retain all memobjects so they won't get freed before the
+     queued kernel has been executed. */
+  for (i = 0; i < command_node->command.run.arg_buffer_count; ++i)
+    {
+      cl_mem buf = command_node->command.run.arg_buffers[i];
+      if (buf != NULL)
+        POname(clRetainMemObject) (buf);
+    }
 
   pocl_command_enqueue (command_queue, command_node);
 
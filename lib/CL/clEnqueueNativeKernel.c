@@ -92,6 +92,15 @@ POname(clEnqueueNativeKernel)(cl_command_queue   command_queue ,
           return CL_INVALID_MEM_OBJECT;
         }
 
+      if (pocl_mem_alloc_for_device (mem_list[i], command_queue->device)
+          != CL_SUCCESS)
+        {
+          free (args_copy);
+          free (mem_list_copy);
+          free (command_node);
+          return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+        }
+
       /* put the device ptr of the clmem in the argument */
       buf = mem_list[i]->device_ptrs[command_queue->device->dev_id].mem_ptr;
 
@@ -73,6 +73,10 @@ POname(clEnqueueReadBuffer)(cl_command_queue command_queue,
             break;
     }
   assert(i < command_queue->context->num_devices);
+
+  errcode = pocl_mem_alloc_for_device (buffer, device);
+  if (errcode != CL_SUCCESS)
+    return errcode;
   
   errcode = pocl_create_command (&cmd, command_queue, CL_COMMAND_READ_BUFFER, 
                                  event, num_events_in_wait_list, 
@@ -76,22 +76,20 @@ POname(clEnqueueReadBufferRect)(cl_command_queue command_queue,
     }
   assert(i < command_queue->context->num_devices);
 
+  errcode = pocl_mem_alloc_for_device (buffer, device);
+  if (errcode != CL_SUCCESS)
+    return errcode;
+
   /* execute directly */
   /* TODO: enqueue the read_rect if this is a non-blocking read (see
      clEnqueueReadBuffer) */
-  if (command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
-    {
-      /* wait for the event in event_wait_list to finish */
-      POCL_ABORT_UNIMPLEMENTED();
-    }
-  else
-    {
-      /* in-order queue - all previously enqueued commands must 
-       * finish before this read */
-      // ensure our buffer is not freed yet
-      POname(clRetainMemObject) (buffer);
-      POname(clFinish)(command_queue);
-    }
+  /* all previously enqueued commands (and in an out-of-order queue, at 
+     least the ones in the event wait list) must finish before this read */
+  // ensure our buffer is not freed yet
+  POname(clRetainMemObject) (buffer);
+  POname(clFinish)(command_queue);
+  if (num_events_in_wait_list > 0)
+    POname(clWaitForEvents)(num_events_in_wait_list, event_wait_list);
   POCL_UPDATE_EVENT_SUBMITTED(event, command_queue);
   POCL_UPDATE_EVENT_RUNNING(event, command_queue);
 
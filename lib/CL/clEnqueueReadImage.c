@@ -56,6 +56,10 @@ CL_API_SUFFIX__VERSION_1_0
   if (command_queue->context != image->context)
     return CL_INVALID_CONTEXT;
 
+  status = pocl_mem_alloc_for_device (image, command_queue->device);
+  if (status != CL_SUCCESS)
+    return status;
+
   size_t tuned_origin[3] = {origin[0] * image->image_elem_size * image->image_channels, origin[1], 
                             origin[2]};
   size_t tuned_region[3] = {region[0] * image->image_elem_size * image->image_channels, region[1], 
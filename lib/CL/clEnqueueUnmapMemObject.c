@@ -25,6 +25,7 @@
 #include "utlist.h"
 #include <assert.h>
 #include "pocl_util.h"
+#include "clEnqueueMapBuffer.h"
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clEnqueueUnmapMemObject)(cl_command_queue command_queue,
@@ -70,12 +71,26 @@ POname(clEnqueueUnmapMemObject)(cl_command_queue command_queue,
 
   assert(i < command_queue->context->num_devices);
 
+  /* Nothing to write back, complete the unmap right away unless there 
+     are commands it must wait for. */
+  if (pocl_mapping_is_zero_copy (memobj, device_id, mapping) &&
+      pocl_command_can_run_now (command_queue, memobj, 1,
+                                num_events_in_wait_list, event_wait_list))
+    {
+      errcode = pocl_create_complete_event (event, command_queue, 
+                                            CL_COMMAND_UNMAP_MEM_OBJECT);
+      if (errcode != CL_SUCCESS)
+        return errcode;
+      pocl_unmap_mem_cmd (device_id, memobj, mapping);
+      return CL_SUCCESS;
+    }
+
   errcode = pocl_create_command (&cmd, command_queue, 
                                  CL_COMMAND_UNMAP_MEM_OBJECT, 
                                  event, num_events_in_wait_list, 
                                  event_wait_list);
   if (errcode != CL_SUCCESS)
-    goto ERROR;
+    return errcode;
   
   cmd->command.unmap.data = command_queue->device->data;
   cmd->command.unmap.memobj = memobj;
@@ -83,10 +98,5 @@ POname(clEnqueueUnmapMemObject)(cl_command_queue command_queue,
   pocl_command_enqueue(command_queue, cmd);
 
   return CL_SUCCESS;
-
- ERROR:
-  free (*event);
-  free (cmd);
-  return errcode;
 }
 POsym(clEnqueueUnmapMemObject)
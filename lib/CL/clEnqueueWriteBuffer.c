@@ -76,6 +76,10 @@ POname(clEnqueueWriteBuffer)(cl_command_queue command_queue,
     }
   assert(i < command_queue->context->num_devices);
 
+  errcode = pocl_mem_alloc_for_device (buffer, device);
+  if (errcode != CL_SUCCESS)
+    return errcode;
+
   errcode = pocl_create_command (&cmd, command_queue, 
                                  CL_COMMAND_WRITE_BUFFER, 
                                  event, num_events_in_wait_list, 
@@ -84,7 +88,7 @@ POname(clEnqueueWriteBuffer)(cl_command_queue command_queue,
     return errcode;
   
   cmd->command.write.host_ptr = ptr;
-  cmd->command.write.device_ptr = buffer->device_ptrs[i].mem_ptr+offset;
+  cmd->command.write.device_ptr = buffer->device_ptrs[device->dev_id].mem_ptr+offset;
   cmd->command.write.cb = cb;
   cmd->command.write.buffer = buffer;
   POname(clRetainMemObject) (buffer);
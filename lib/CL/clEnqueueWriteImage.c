@@ -35,6 +35,10 @@ POname(clEnqueueWriteImage)(cl_command_queue    command_queue,
   if (command_queue->context != image->context)
     return CL_INVALID_CONTEXT;
 
+  status = pocl_mem_alloc_for_device (image, command_queue->device);
+  if (status != CL_SUCCESS)
+    return status;
+
   if (ptr == NULL)
     return CL_INVALID_VALUE;
 
@@ -16,6 +16,8 @@ CL_EXT_SUFFIX__VERSION_1_0
 #endif
   if( strcmp(func_name, "clGetPlatformInfo")==0 )
     return (void *)&POname(clGetPlatformInfo);
+  if( strcmp(func_name, "clCreateBufferFromFilePOCL")==0 )
+    return (void *)&POname(clCreateBufferFromFilePOCL);
   
   return NULL;
 }
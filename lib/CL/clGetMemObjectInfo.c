@@ -66,10 +66,7 @@ POname(clGetMemObjectInfo)(cl_mem      memobj ,
   case CL_MEM_ASSOCIATED_MEMOBJECT:
     POCL_RETURN_MEM_INFO (cl_mem, memobj->parent);
   case CL_MEM_OFFSET:
-    if (memobj->parent == NULL)
-      POCL_RETURN_MEM_INFO (size_t, 0);
-
-    POCL_ABORT_UNIMPLEMENTED();
+    POCL_RETURN_MEM_INFO (size_t, memobj->origin);
   }
   return CL_INVALID_VALUE;
 }
@@ -22,6 +22,7 @@
 */
 
 #include "pocl_cl.h"
+#include "pocl_util.h"
 #include <string.h>
 
 CL_API_ENTRY cl_int CL_API_CALL
@@ -46,25 +47,28 @@ POname(clGetProgramBuildInfo)(cl_program            program,
   switch (param_name) {
   case CL_PROGRAM_BUILD_STATUS:
     {
-      size_t const value_size = strlen(retval) + 1;
-      if (param_value)
-      {
-        if (param_value_size < value_size) return CL_INVALID_VALUE;
-        memcpy(param_value, retval, value_size);
-      }
-      if (param_value_size_ret)
-        *param_value_size_ret = value_size;
-
-      return CL_SUCCESS;
+      /* Updated by the compiler threads in an asynchronous build. */
+      cl_build_status status = CL_BUILD_NONE;
+      POCL_LOCK_OBJ (program);
+      if (program->build_status != NULL)
+        {
+          for (i = 0; i < program->num_devices; i++)
+            if (device == program->devices[i])
+              status = program->build_status[i];
+        }
+      POCL_UNLOCK_OBJ (program);
+      POCL_RETURN_GETINFO (cl_build_status, status);
     }
     
   case CL_PROGRAM_BUILD_OPTIONS:
     {
-      size_t const value_size = strlen(retval) + 1;
+      const char *options = program->compiler_options != NULL ?
+        program->compiler_options : "";
+      size_t const value_size = strlen(options) + 1;
       if (param_value)
       {
         if (param_value_size < value_size) return CL_INVALID_VALUE;
-        memcpy(param_value, retval, value_size);
+        memcpy(param_value, options, value_size);
       }
       if (param_value_size_ret)
         *param_value_size_ret = value_size;
@@ -37,6 +37,7 @@ POname(clReleaseCommandQueue)(cl_command_queue command_queue) CL_API_SUFFIX__VER
   POCL_RELEASE_OBJECT(command_queue, new_refcount);
   if (new_refcount == 0)
     {
+      free (command_queue->outstanding_commands);
       free (command_queue);
       /* TODO: should clReleaseContext()? */
     }
@@ -69,6 +69,8 @@ POname(clReleaseKernel)(cl_kernel kernel) CL_API_SUFFIX__VERSION_1_0
 
       free (kernel->dyn_arguments);
       free (kernel->reqd_wg_size);
+      pocl_free_kernel_variants (kernel);
+      POCL_DESTROY_LOCK (kernel->compile_lock);
       free (kernel);
     }
   
@@ -23,14 +23,17 @@
 
 #include "utlist.h"
 #include "pocl_cl.h"
+#include <sys/mman.h>
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clReleaseMemObject)(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
 {
   int new_refcount;
   cl_device_id device_id;
+  cl_mem parent;
   unsigned i;
   mem_mapping_t *mapping, *temp;
+  cl_mem_flags flags;
 
   if (memobj == NULL)
     return CL_INVALID_MEM_OBJECT;
@@ -52,14 +55,24 @@ POname(clReleaseMemObject)(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
           for (i = 0; i < memobj->context->num_devices; ++i)
             {
               device_id = memobj->context->devices[i];
-              device_id->ops->free(device_id->data, memobj->flags, memobj->device_ptrs[device_id->dev_id].mem_ptr);
+              /* never used on the device */
+              if (memobj->device_ptrs[device_id->dev_id].mem_ptr == NULL)
+                continue;
+              flags = memobj->flags;
+              /* the device memory caching the host memory is owned by
+                 the device */
+              if (flags & CL_MEM_USE_HOST_PTR && 
+                  memobj->device_ptrs[device_id->dev_id].mem_ptr != 
+                  memobj->mem_host_ptr)
+                flags &= ~CL_MEM_USE_HOST_PTR;
+              device_id->ops->free(device_id->data, flags, memobj->device_ptrs[device_id->dev_id].mem_ptr);
               memobj->device_ptrs[device_id->dev_id].mem_ptr = NULL;
             }
         } else 
         {
           /* a sub buffer object does not free the memory from
-             the device */          
-          POCL_RELEASE_OBJECT(memobj->parent, new_refcount);
+             the device, the parent is released after the sub buffer
+             has been freed */
         }
       POCL_RELEASE_OBJECT(memobj->context, new_refcount);
       DL_FOREACH_SAFE(memobj->mappings, mapping, temp)
@@ -67,9 +80,15 @@ POname(clReleaseMemObject)(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
           free (mapping);
         }
       memobj->mappings = NULL;
+
+      if (memobj->file_map != NULL)
+        munmap (memobj->file_map, memobj->file_map_size);
       
+      parent = memobj->parent;
       free(memobj->device_ptrs);
       free(memobj);
+      if (parent != NULL)
+        POname(clReleaseMemObject) (parent);
     }
   return CL_SUCCESS;
 }
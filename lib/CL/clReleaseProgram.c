@@ -26,6 +26,7 @@
 #include <unistd.h>
 
 #include "pocl_cl.h"
+#include "pocl_llvm.h"
 #include "pocl_util.h"
 #include "pocl_runtime_config.h"
 
@@ -34,6 +35,7 @@ POname(clReleaseProgram)(cl_program program) CL_API_SUFFIX__VERSION_1_0
 {
   int new_refcount;
   cl_kernel k;
+  unsigned i;
 
   POCL_RELEASE_OBJECT (program, new_refcount);
 
@@ -64,7 +66,16 @@ POname(clReleaseProgram)(cl_program program) CL_API_SUFFIX__VERSION_1_0
           remove_directory (program->temp_dir);
         }
 
+      pocl_llvm_free_program (program);
       free (program->llvm_irs);
+      POCL_DESTROY_LOCK (program->llvm_lock);
+      if (program->cache_keys != NULL)
+        {
+          for (i = 0; i < program->num_devices; ++i)
+            free (program->cache_keys[i]);
+          free (program->cache_keys);
+        }
+      free (program->build_status);
       free (program->temp_dir);
       free (program);
     }
@@ -22,17 +22,25 @@
 */
 
 #include "pocl_cl.h"
+#include "pocl_scheduler.h"
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clWaitForEvents)(cl_uint              num_events ,
                   const cl_event *     event_list ) CL_API_SUFFIX__VERSION_1_0
 {
   int event_i;
-  // dummy implementation, waits until *all* events have completed.
+
+  if (num_events == 0 || event_list == NULL)
+    return CL_INVALID_VALUE;
+
   for (event_i = 0; event_i < num_events; ++event_i)
     {
-      POname(clFinish)(event_list[event_i]->queue);
+      if (event_list[event_i] == NULL)
+        return CL_INVALID_EVENT;
     }
+
+  for (event_i = 0; event_i < num_events; ++event_i)
+    pocl_wait_for_event (event_list[event_i]);
   return CL_SUCCESS;
 }
 POsym(clWaitForEvents)
@@ -28,6 +28,9 @@
 #include "common.h"
 #include "utlist.h"
 #include "devices.h"
+#include "rect_transfer.h"
+#include "pocl_cache.h"
+#include "pocl_llvm.h"
 
 #include <assert.h>
 #include <string.h>
@@ -46,6 +49,10 @@ struct data {
   cl_kernel current_kernel;
   /* Loaded kernel dynamic library handle. */
   lt_dlhandle current_dlhandle;
+  /* The configured work-group traversal order. */
+  pocl_wg_traversal wg_traversal;
+  /* The copies at least this large use non-temporal stores. */
+  size_t nontemporal_copy_size;
 };
 
 const cl_image_format supported_image_formats[] = {
@@ -194,6 +201,7 @@ pocl_basic_init_device_ops(struct pocl_device_ops *ops)
   ops->init = pocl_basic_init;
   ops->alloc_mem_obj = pocl_basic_alloc_mem_obj;
   ops->free = pocl_basic_free;
+  ops->create_sub_buffer = pocl_basic_create_sub_buffer;
   ops->read = pocl_basic_read;
   ops->read_rect = pocl_basic_read_rect;
   ops->write = pocl_basic_write;
@@ -203,9 +211,11 @@ pocl_basic_init_device_ops(struct pocl_device_ops *ops)
   ops->fill_rect = pocl_basic_fill_rect;
   ops->map_mem = pocl_basic_map_mem;
   ops->compile_submitted_kernels = pocl_basic_compile_submitted_kernels;
+  ops->precompile_kernel = pocl_basic_precompile_kernel;
   ops->run = pocl_basic_run;
   ops->run_native = pocl_basic_run_native;
   ops->get_timer_value = pocl_basic_get_timer_value;
+  ops->print_stats = pocl_basic_print_stats;
   ops->get_supported_image_formats = pocl_basic_get_supported_image_formats;
 }
 
@@ -331,9 +341,12 @@ pocl_basic_init (cl_device_id device, const char* parameters)
   
   d->current_kernel = NULL;
   d->current_dlhandle = 0;
+  pocl_get_wg_traversal_option (&d->wg_traversal);
   device->data = d;
   pocl_topology_detect_device_info(device);
   pocl_cpuinfo_detect_device_info(device);
+  d->nontemporal_copy_size = pocl_nontemporal_copy_min_size ();
+  device->jit_workgroup_functions = pocl_llvm_jit_available ();
 
   /* The basic driver represents only one "compute unit" as
      it doesn't exploit multiple hardware threads. Multiple
@@ -388,15 +401,16 @@ pocl_basic_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
   /* if memory for this global memory is not yet allocated -> do it */
   if (mem_obj->device_ptrs[device->global_mem_id].mem_ptr == NULL)
     {
-      if (flags & CL_MEM_USE_HOST_PTR && mem_obj->mem_host_ptr != NULL)
-        {
-          b = mem_obj->mem_host_ptr;
-        }
-      else if (posix_memalign (&b, MAX_EXTENDED_ALIGNMENT, 
+      if (flags & CL_MEM_USE_HOST_PTR && mem_obj->mem_host_ptr != NULL &&
+          (b = pocl_use_host_ptr (mem_obj)) != NULL)
+        ;
+      else if ((b = pocl_alloc_mapped_buffer (mem_obj->size)) == NULL &&
+               posix_memalign (&b, MAX_EXTENDED_ALIGNMENT, 
                                mem_obj->size) != 0)
         return CL_MEM_OBJECT_ALLOCATION_FAILURE;
 
-      if (flags & CL_MEM_COPY_HOST_PTR)
+      if (flags & (CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR) &&
+          b != mem_obj->mem_host_ptr)
         memcpy (b, mem_obj->mem_host_ptr, mem_obj->size);
     
       mem_obj->device_ptrs[device->global_mem_id].mem_ptr = b;
@@ -410,22 +424,67 @@ pocl_basic_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
   return CL_SUCCESS;
 }
 
+void *
+pocl_basic_create_sub_buffer (void *data, void *buffer, size_t origin,
+                              size_t size)
+{
+  /* The sub buffers are views to the memory of the parent. */
+  return (char*)buffer + origin;
+}
+
 void
 pocl_basic_free (void *data, cl_mem_flags flags, void *ptr)
 {
   if (flags & CL_MEM_USE_HOST_PTR)
     return;
   
+  if (pocl_free_mapped_buffer (ptr))
+    return;
+
   free (ptr);
 }
 
+void
+pocl_basic_print_stats (cl_device_id device)
+{
+  size_t plain_bytes, thp_bytes, hugetlb_bytes;
+  unsigned num_mapped_buffers;
+
+  pocl_get_mapped_buffer_stats (&num_mapped_buffers, &plain_bytes, 
+                                &thp_bytes, &hugetlb_bytes);
+  fprintf (stderr, "  mapped buffers: %u, %llu MB normal pages, "
+           "%llu MB transparent huge pages, %llu MB hugetlbfs\n", 
+           num_mapped_buffers,
+           (unsigned long long)(plain_bytes / (1024 * 1024)),
+           (unsigned long long)(thp_bytes / (1024 * 1024)),
+           (unsigned long long)(hugetlb_bytes / (1024 * 1024)));
+}
+
+/* The basic device copies with the calling thread only, the pthread
+   device splits the large copies to its workers. */
+static void
+copy_memory (struct data *d, void *dst, const void *src, size_t size)
+{
+  if (size >= d->nontemporal_copy_size)
+    pocl_memcpy_nontemporal (dst, src, size);
+  else
+    memcpy (dst, src, size);
+}
+
+static void
+run_rect (struct data *d, pocl_rect_transfer *t)
+{
+  t->nontemporal = pocl_rect_total_size (t) >= d->nontemporal_copy_size;
+  pocl_rect_execute (t, 0, pocl_rect_num_units (t));
+}
+
 void
 pocl_basic_read (void *data, void *host_ptr, const void *device_ptr, size_t cb)
 {
   if (host_ptr == device_ptr)
     return;
 
-  memcpy (host_ptr, device_ptr, cb);
+  copy_memory ((struct data*)data, host_ptr, device_ptr, cb);
 }
 
 void
@@ -434,7 +493,7 @@ pocl_basic_write (void *data, const void *host_ptr, void *device_ptr, size_t cb)
   if (host_ptr == device_ptr)
     return;
 
-  memcpy (device_ptr, host_ptr, cb);
+  copy_memory ((struct data*)data, device_ptr, host_ptr, cb);
 }
 
 
@@ -469,7 +528,10 @@ pocl_basic_run
         }
     }
 
-  void *arguments[kernel->num_args + kernel->num_locals];
+  /* One extra element keeps the arrays non-empty for kernels 
+     without arguments. */
+  void *arguments[kernel->num_args + kernel->num_locals + 1];
+  void *local_ptrs[kernel->num_args + kernel->num_locals + 1];
 
   /* Process the kernel arguments. Convert the opaque buffer
      pointers to real device pointers, allocate dynamic local 
@@ -478,10 +540,7 @@ pocl_basic_run
     {
       al = &(cmd->command.run.arguments[i]);
       if (kernel->arg_info[i].is_local)
-        {
-          arguments[i] = malloc (sizeof (void *));
-          *(void **)(arguments[i]) = pocl_basic_malloc(data, 0, al->size, NULL);
-        }
+        continue;
       else if (kernel->arg_info[i].type == POCL_ARG_TYPE_POINTER)
         {
           /* It's legal to pass a NULL pointer to clSetKernelArguments. In 
@@ -520,37 +579,44 @@ pocl_basic_run
           arguments[i] = al->value;
         }
     }
-  for (i = kernel->num_args;
-       i < kernel->num_args + kernel->num_locals;
-       ++i)
-    {
-      al = &(cmd->command.run.arguments[i]);
-      arguments[i] = malloc (sizeof (void *));
-      *(void **)(arguments[i]) = pocl_basic_malloc (data, 0, al->size, NULL);
-    }
+  /* The __local arguments and the automatic locals. */
+  pocl_setup_local_arguments (kernel, cmd->command.run.arguments, arguments,
+                              local_ptrs);
 
-  for (z = 0; z < pc->num_groups[2]; ++z)
+  pocl_wg_traversal traversal;
+  pocl_choose_wg_traversal (&d->wg_traversal, pc, &traversal);
+  if (traversal.order == POCL_WG_ORDER_RASTER)
     {
-      for (y = 0; y < pc->num_groups[1]; ++y)
+      for (z = 0; z < pc->num_groups[2]; ++z)
         {
-          for (x = 0; x < pc->num_groups[0]; ++x)
+          for (y = 0; y < pc->num_groups[1]; ++y)
             {
-              pc->group_id[0] = x;
-              pc->group_id[1] = y;
-              pc->group_id[2] = z;
+              for (x = 0; x < pc->num_groups[0]; ++x)
+                {
+                  pc->group_id[0] = x;
+                  pc->group_id[1] = y;
+                  pc->group_id[2] = z;
 
-              cmd->command.run.wg (arguments, pc);
+                  cmd->command.run.wg (arguments, pc);
 
+                }
             }
         }
     }
-  for (i = 0; i < kernel->num_args; ++i)
+  else
     {
-      if (kernel->arg_info[i].is_local)
+      size_t num_groups = 
+        pc->num_groups[0] * pc->num_groups[1] * pc->num_groups[2];
+      for (x = 0; x < num_groups; ++x)
         {
-          pocl_basic_free (data, 0, *(void **)(arguments[i]));
-          free (arguments[i]);
+          pocl_wg_index_to_group_id (&traversal, pc, x, pc->group_id);
+          cmd->command.run.wg (arguments, pc);
         }
+    }
+  for (i = 0; i < kernel->num_args; ++i)
+    {
+      if (kernel->arg_info[i].is_local)
+        continue;
       else if (kernel->arg_info[i].type == POCL_ARG_TYPE_IMAGE)
         {
           pocl_basic_free (data, 0, *(void **)(arguments[i]));
@@ -562,13 +628,6 @@ pocl_basic_run
           free (arguments[i]);
         }
     }
-  for (i = kernel->num_args;
-       i < kernel->num_args + kernel->num_locals;
-       ++i)
-    {
-      pocl_basic_free(data, 0, *(void **)(arguments[i]));
-      free (arguments[i]);
-    }
 }
 
 void
@@ -585,7 +644,7 @@ pocl_basic_copy (void *data, const void *src_ptr, void *__restrict__ dst_ptr, si
   if (src_ptr == dst_ptr)
     return;
   
-  memcpy (dst_ptr, src_ptr, cb);
+  copy_memory ((struct data*)data, dst_ptr, src_ptr, cb);
 }
 
 void
@@ -600,22 +659,13 @@ pocl_basic_copy_rect (void *data,
                       size_t const dst_row_pitch,
                       size_t const dst_slice_pitch)
 {
-  char const *__restrict const adjusted_src_ptr = 
-    (char const*)src_ptr +
-    src_origin[0] + src_row_pitch * src_origin[1] + src_slice_pitch * src_origin[2];
-  char *__restrict__ const adjusted_dst_ptr = 
-    (char*)dst_ptr +
-    dst_origin[0] + dst_row_pitch * dst_origin[1] + dst_slice_pitch * dst_origin[2];
-  
-  size_t j, k;
+  pocl_rect_transfer t;
 
   /* TODO: handle overlaping regions */
-  
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      memcpy (adjusted_dst_ptr + dst_row_pitch * j + dst_slice_pitch * k,
-              adjusted_src_ptr + src_row_pitch * j + src_slice_pitch * k,
-              region[0]);
+  pocl_rect_init_copy (&t, dst_ptr, dst_origin, dst_row_pitch, 
+                       dst_slice_pitch, src_ptr, src_origin, src_row_pitch,
+                       src_slice_pitch, region);
+  run_rect ((struct data*)data, &t);
 }
 
 void
@@ -630,22 +680,12 @@ pocl_basic_write_rect (void *data,
                        size_t const host_row_pitch,
                        size_t const host_slice_pitch)
 {
-  char *__restrict const adjusted_device_ptr = 
-    (char*)device_ptr +
-    buffer_origin[0] + buffer_row_pitch * buffer_origin[1] + buffer_slice_pitch * buffer_origin[2];
-  char const *__restrict__ const adjusted_host_ptr = 
-    (char const*)host_ptr +
-    host_origin[0] + host_row_pitch * host_origin[1] + host_slice_pitch * host_origin[2];
-  
-  size_t j, k;
+  pocl_rect_transfer t;
 
-  /* TODO: handle overlaping regions */
-  
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      memcpy (adjusted_device_ptr + buffer_row_pitch * j + buffer_slice_pitch * k,
-              adjusted_host_ptr + host_row_pitch * j + host_slice_pitch * k,
-              region[0]);
+  pocl_rect_init_copy (&t, device_ptr, buffer_origin, buffer_row_pitch,
+                       buffer_slice_pitch, host_ptr, host_origin,
+                       host_row_pitch, host_slice_pitch, region);
+  run_rect ((struct data*)data, &t);
 }
 
 void
@@ -660,22 +700,12 @@ pocl_basic_read_rect (void *data,
                       size_t const host_row_pitch,
                       size_t const host_slice_pitch)
 {
-  char const *__restrict const adjusted_device_ptr = 
-    (char const*)device_ptr +
-    buffer_origin[0] + buffer_row_pitch * (buffer_origin[1] + buffer_slice_pitch * buffer_origin[2]);
-  char *__restrict__ const adjusted_host_ptr = 
-    (char*)host_ptr +
-    host_origin[0] + host_row_pitch * (host_origin[1] + host_slice_pitch * host_origin[2]);
-  
-  size_t j, k;
-  
-  /* TODO: handle overlaping regions */
-  
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      memcpy (adjusted_host_ptr + host_row_pitch * j + host_slice_pitch * k,
-              adjusted_device_ptr + buffer_row_pitch * j + buffer_slice_pitch * k,
-              region[0]);
+  pocl_rect_transfer t;
+
+  pocl_rect_init_copy (&t, host_ptr, host_origin, host_row_pitch,
+                       host_slice_pitch, device_ptr, buffer_origin,
+                       buffer_row_pitch, buffer_slice_pitch, region);
+  run_rect ((struct data*)data, &t);
 }
 
 /* origin and region must be in original shape unlike in copy/read/write_rect()
@@ -690,19 +720,15 @@ pocl_basic_fill_rect (void *data,
                       void *fill_pixel,
                       size_t pixel_size)                    
 {
-  char *__restrict const adjusted_device_ptr = (char*)device_ptr 
-    + buffer_origin[0] * pixel_size 
-    + buffer_row_pitch * buffer_origin[1] 
-    + buffer_slice_pitch * buffer_origin[2];
-    
-  size_t i, j, k;
-
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      for (i = 0; i < region[0]; ++i)
-        memcpy (adjusted_device_ptr + pixel_size * i 
-                + buffer_row_pitch * j 
-                + buffer_slice_pitch * k, fill_pixel, pixel_size);
+  pocl_rect_transfer t;
+  size_t origin[3] = { buffer_origin[0] * pixel_size, buffer_origin[1], 
+                       buffer_origin[2] };
+  size_t byte_region[3] = { region[0] * pixel_size, region[1], region[2] };
+
+  pocl_rect_init_fill (&t, device_ptr, origin, buffer_row_pitch, 
+                       buffer_slice_pitch, byte_region, fill_pixel, 
+                       pixel_size);
+  run_rect ((struct data*)data, &t);
 }
 
 void *
@@ -752,21 +778,40 @@ struct compiler_cache_item
   char *tmp_dir;
   char *function_name;
   pocl_workgroup wg;
+  int sub_range_dim;
   compiler_cache_item *next;
 };
 
 static compiler_cache_item *compiler_cache;
-static pocl_lock_t compiler_cache_lock;
+static pocl_lock_t compiler_cache_lock = POCL_LOCK_INITIALIZER;
 
-void check_compiler_cache (_cl_command_node *cmd)
+static void
+free_compiler_cache_item (compiler_cache_item *ci)
+{
+  free (ci->tmp_dir);
+  free (ci->function_name);
+  free (ci);
+}
+
+/* Compiles and loads the work-group function of the command unless done
+   earlier. A failure aborts, or returns non-zero if 'may_fail' is set. */
+static int
+load_workgroup_function (_cl_command_node *cmd, int may_fail)
 {
   char workgroup_string[WORKGROUP_STRING_LENGTH];
   lt_dlhandle dlhandle;
   compiler_cache_item *ci = NULL;
-  
-  if (compiler_cache == NULL)
-    POCL_INIT_LOCK (compiler_cache_lock);
+  pocl_kernel_variant *variant = cmd->command.run.variant;
+  const int *sub_range_dim;
 
+  /* Resolved at an earlier launch of the same variant. */
+  if (variant != NULL && variant->wg != NULL)
+    {
+      cmd->command.run.wg = variant->wg;
+      cmd->command.run.sub_range_dim = variant->sub_range_dim;
+      return 0;
+    }
+  
   POCL_LOCK (compiler_cache_lock);
   LL_FOREACH (compiler_cache, ci)
     {
@@ -776,17 +821,52 @@ void check_compiler_cache (_cl_command_node *cmd)
         {
           POCL_UNLOCK (compiler_cache_lock);
           cmd->command.run.wg = ci->wg;
-          return;
+          cmd->command.run.sub_range_dim = ci->sub_range_dim;
+          goto publish;
         }
     }
   ci = malloc (sizeof (compiler_cache_item));
   ci->next = NULL;
   ci->tmp_dir = strdup(cmd->command.run.tmp_dir);
   ci->function_name = strdup (cmd->command.run.kernel->function_name);
+
+  if (cmd->device->jit_workgroup_functions)
+    {
+      if (pocl_llvm_jit_workgroup_function (cmd->device,
+                                            cmd->command.run.kernel,
+                                            cmd->command.run.local_x,
+                                            cmd->command.run.local_y,
+                                            cmd->command.run.local_z,
+                                            &ci->wg, &ci->sub_range_dim))
+        {
+          if (!may_fail)
+            POCL_ABORT ("pocl error: JIT compiling the work-group function "
+                        "failed.\n");
+          POCL_UNLOCK (compiler_cache_lock);
+          free_compiler_cache_item (ci);
+          return 1;
+        }
+      cmd->command.run.wg = ci->wg;
+      cmd->command.run.sub_range_dim = ci->sub_range_dim;
+      LL_APPEND (compiler_cache, ci);
+      POCL_UNLOCK (compiler_cache_lock);
+      goto publish;
+    }
+
   const char* module_fn = llvm_codegen (cmd->command.run.tmp_dir,
                                         cmd->command.run.kernel,
                                         cmd->device);
+  pocl_cache_put_workgroup_function (cmd->command.run.kernel, cmd->device,
+                                     cmd->command.run.local_x,
+                                     cmd->command.run.local_y,
+                                     cmd->command.run.local_z, module_fn);
   dlhandle = lt_dlopen (module_fn);     
+  if (dlhandle == NULL && may_fail)
+    {
+      POCL_UNLOCK (compiler_cache_lock);
+      free_compiler_cache_item (ci);
+      return 1;
+    }
   if (dlhandle == NULL)
     {
       printf ("pocl error: lt_dlopen(\"%s\") failed with '%s'.\n", 
@@ -800,9 +880,31 @@ void check_compiler_cache (_cl_command_node *cmd)
   cmd->command.run.wg = ci->wg = 
     (pocl_workgroup) lt_dlsym (dlhandle, workgroup_string);
 
+  /* The compiler exports the split dimension in case the work-group 
+     function can execute a sub-range of the work items. */
+  snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+            "_%s_sub_range_dim", cmd->command.run.kernel->function_name);
+  sub_range_dim = (const int*) lt_dlsym (dlhandle, workgroup_string);
+  cmd->command.run.sub_range_dim = ci->sub_range_dim = 
+    sub_range_dim != NULL ? *sub_range_dim : -1;
+
   LL_APPEND (compiler_cache, ci);
   POCL_UNLOCK (compiler_cache_lock);
 
+ publish:
+  if (variant != NULL)
+    {
+      variant->sub_range_dim = cmd->command.run.sub_range_dim;
+      /* the lock-free readers check wg only */
+      __sync_synchronize ();
+      variant->wg = cmd->command.run.wg;
+    }
+  return 0;
+}
+
+void check_compiler_cache (_cl_command_node *cmd)
+{
+  load_workgroup_function (cmd, 0);
 }
 
 void
@@ -812,3 +914,9 @@ pocl_basic_compile_submitted_kernels (_cl_command_node *cmd)
     check_compiler_cache (cmd);
 
 }
+
+int
+pocl_basic_precompile_kernel (_cl_command_node *cmd)
+{
+  return load_workgroup_function (cmd, 1);
+}
@@ -24,6 +24,7 @@
 */
 #include "common.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -35,9 +36,20 @@
 #include "pocl_mem_management.h"
 #include "pocl_runtime_config.h"
 #include "pocl_llvm.h"
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "topology/pocl_topology.h"
 
 #define COMMAND_LENGTH 2048
 
+/* Used in case hwloc does not know the size of the last-level cache. */
+#define DEFAULT_LLC_SIZE (8 * 1024 * 1024)
+
 /**
  * Generate code from the final bitcode using the LLVM
  * tools.
@@ -140,3 +152,498 @@ void fill_dev_image_t (dev_image_t* di, struct pocl_argument* parg,
                               mem->image_channel_data_type, &(di->num_channels),
                               &(di->elem_size));
 }
+
+#define WG_ORDER_ENV "POCL_WORK_GROUP_ORDER"
+#define WG_TILE_ENV "POCL_WORK_GROUP_TILE"
+#define DEFAULT_WG_TILE 8
+
+void
+pocl_get_wg_traversal_option (pocl_wg_traversal *t)
+{
+  const char *order = pocl_get_string_option (WG_ORDER_ENV, "auto");
+  int tile = pocl_get_int_option (WG_TILE_ENV, DEFAULT_WG_TILE);
+
+  if (strcmp (order, "raster") == 0)
+    t->order = POCL_WG_ORDER_RASTER;
+  else if (strcmp (order, "tiled") == 0)
+    t->order = POCL_WG_ORDER_TILED;
+  else if (strcmp (order, "morton") == 0)
+    t->order = POCL_WG_ORDER_MORTON;
+  else
+    t->order = POCL_WG_ORDER_AUTO;
+
+  t->tile = tile > 1 ? tile : DEFAULT_WG_TILE;
+}
+
+void
+pocl_choose_wg_traversal (const pocl_wg_traversal *config, 
+                          const struct pocl_context *pc,
+                          pocl_wg_traversal *t)
+{
+  *t = *config;
+  if (t->order == POCL_WG_ORDER_MORTON || t->order == POCL_WG_ORDER_AUTO)
+    t->tile = pocl_size_ceil2 (t->tile);
+
+  if (t->order != POCL_WG_ORDER_AUTO)
+    return;
+
+  /* Tiling pays off only when there are at least a tile's worth of 
+     neighbouring groups in both the x and the y dimension. Otherwise 
+     the tiles would degenerate to rows. */
+  if (pc->num_groups[0] >= t->tile && pc->num_groups[1] >= t->tile)
+    t->order = POCL_WG_ORDER_MORTON;
+  else
+    t->order = POCL_WG_ORDER_RASTER;
+}
+
+/* Extracts the even bits of x to the lower half. */
+static size_t
+compact_bits (size_t x)
+{
+  x &= 0x55555555;
+  x = (x | (x >> 1)) & 0x33333333;
+  x = (x | (x >> 2)) & 0x0f0f0f0f;
+  x = (x | (x >> 4)) & 0x00ff00ff;
+  x = (x | (x >> 8)) & 0x0000ffff;
+  return x;
+}
+
+void
+pocl_wg_index_to_group_id (const pocl_wg_traversal *t, 
+                           const struct pocl_context *pc,
+                           size_t index, size_t *group_id)
+{
+  size_t nx = pc->num_groups[0];
+  size_t ny = pc->num_groups[1];
+  size_t plane = nx * ny;
+  size_t tile = t->tile;
+  size_t i, row, col, base_x, base_y, tile_w, tile_h, pos;
+
+  group_id[2] = index / plane;
+  i = index % plane;
+
+  if (t->order == POCL_WG_ORDER_RASTER)
+    {
+      group_id[0] = i % nx;
+      group_id[1] = i / nx;
+      return;
+    }
+
+  /* The plane is split to rows of tiles, each full row containing
+     tile * nx groups. Only the last row and the last tile in each
+     row can be narrower than the tile size. */
+  row = i / (tile * nx);
+  base_y = row * tile;
+  tile_h = min (tile, ny - base_y);
+  i -= row * tile * nx;
+  col = i / (tile_h * tile);
+  base_x = col * tile;
+  tile_w = min (tile, nx - base_x);
+  pos = i - col * tile_h * tile;
+
+  if (t->order == POCL_WG_ORDER_MORTON && tile_w == tile && tile_h == tile)
+    {
+      group_id[0] = base_x + compact_bits (pos);
+      group_id[1] = base_y + compact_bits (pos >> 1);
+    }
+  else
+    {
+      group_id[0] = base_x + pos % tile_w;
+      group_id[1] = base_y + pos / tile_w;
+    }
+}
+
+/* The buffers are aligned to the cache line so that the buffers of
+   different threads never share a line. */
+#define LOCAL_ARENA_ALIGNMENT 64
+#if MAX_EXTENDED_ALIGNMENT > LOCAL_ARENA_ALIGNMENT
+#undef LOCAL_ARENA_ALIGNMENT
+#define LOCAL_ARENA_ALIGNMENT MAX_EXTENDED_ALIGNMENT
+#endif
+/* The arenas grow in multiples of this. */
+#define LOCAL_ARENA_GRANULE 4096
+
+typedef struct local_arena
+{
+  char *base;
+  size_t size;
+} local_arena;
+
+static pthread_key_t local_arena_key;
+static pthread_once_t local_arena_once = PTHREAD_ONCE_INIT;
+static volatile size_t local_arena_bytes = 0;
+static volatile size_t local_arena_max_bytes = 0;
+static volatile unsigned num_local_arenas = 0;
+
+static void
+free_local_arena (void *p)
+{
+  local_arena *arena = (local_arena*)p;
+
+  __sync_sub_and_fetch (&local_arena_bytes, arena->size);
+  __sync_sub_and_fetch (&num_local_arenas, 1);
+  free (arena->base);
+  free (arena);
+}
+
+static void
+create_local_arena_key ()
+{
+  pthread_key_create (&local_arena_key, free_local_arena);
+}
+
+/* Returns the arena of the calling thread grown to at least 'size'. */
+static char *
+get_local_arena (size_t size)
+{
+  local_arena *arena;
+  size_t max;
+  void *base;
+
+  pthread_once (&local_arena_once, create_local_arena_key);
+  arena = (local_arena*)pthread_getspecific (local_arena_key);
+  if (arena != NULL && arena->size >= size)
+    return arena->base;
+
+  if (arena == NULL)
+    {
+      arena = (local_arena*)calloc (1, sizeof (local_arena));
+      if (arena == NULL)
+        POCL_ABORT ("pocl: could not allocate the local memory arena\n");
+      pthread_setspecific (local_arena_key, arena);
+      __sync_add_and_fetch (&num_local_arenas, 1);
+    }
+
+  size = (size + LOCAL_ARENA_GRANULE - 1) & ~(size_t)(LOCAL_ARENA_GRANULE - 1);
+  if (posix_memalign (&base, LOCAL_ARENA_ALIGNMENT, size) != 0)
+    POCL_ABORT ("pocl: could not allocate the local memory arena\n");
+  /* first touch by the owner thread */
+  memset (base, 0, size);
+  free (arena->base);
+  __sync_add_and_fetch (&local_arena_bytes, size - arena->size);
+  arena->base = (char*)base;
+  arena->size = size;
+
+  while ((max = local_arena_max_bytes) < size &&
+         !__sync_bool_compare_and_swap (&local_arena_max_bytes, max, size))
+    ;
+  return arena->base;
+}
+
+#define ALIGN_LOCAL(__SIZE__) \
+  (((__SIZE__) + LOCAL_ARENA_ALIGNMENT - 1) & \
+   ~(size_t)(LOCAL_ARENA_ALIGNMENT - 1))
+
+void
+pocl_setup_local_arguments (cl_kernel kernel, 
+                            struct pocl_argument *kernel_args,
+                            void **arguments, void **local_ptrs)
+{
+  unsigned num_args = kernel->num_args + kernel->num_locals;
+  size_t size = 0;
+  char *arena;
+  unsigned i;
+
+  for (i = 0; i < num_args; ++i)
+    {
+      if (i < kernel->num_args && !kernel->arg_info[i].is_local)
+        continue;
+      size += ALIGN_LOCAL (kernel_args[i].size);
+    }
+  if (size == 0)
+    return;
+
+  arena = get_local_arena (size);
+  for (i = 0; i < num_args; ++i)
+    {
+      if (i < kernel->num_args && !kernel->arg_info[i].is_local)
+        continue;
+      local_ptrs[i] = arena;
+      arguments[i] = &local_ptrs[i];
+      arena += ALIGN_LOCAL (kernel_args[i].size);
+    }
+}
+
+void
+pocl_get_local_arena_stats (size_t *total_bytes, unsigned *num_arenas,
+                            size_t *max_bytes)
+{
+  *total_bytes = local_arena_bytes;
+  *num_arenas = num_local_arenas;
+  *max_bytes = local_arena_max_bytes;
+}
+
+#define HUGE_PAGES_ENV "POCL_HUGE_PAGES"
+#define HUGE_PAGE_MIN_SIZE_ENV "POCL_HUGE_PAGE_MIN_SIZE"
+/* In megabytes. */
+#define DEFAULT_HUGE_PAGE_MIN_SIZE 32
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+/* The buffers of at least this many megabytes are mapped directly so
+   that the pages never touched by the commands cost no memory. By 
+   default only the buffers getting huge pages are mapped, the others
+   are left to the allocator of the device. */
+#define MAPPED_BUFFER_MIN_SIZE_ENV "POCL_MAPPED_BUFFER_MIN_SIZE"
+
+enum
+{
+  HUGE_PAGES_UNINITIALIZED = 0,
+  HUGE_PAGES_OFF,
+  HUGE_PAGES_THP,
+  HUGE_PAGES_HUGETLB
+};
+
+enum
+{
+  MAPPING_PLAIN = 0,
+  MAPPING_THP,
+  MAPPING_HUGETLB
+};
+
+/* The mappings are needed for unmapping. There are only few of them
+   as the buffers are large. */
+typedef struct mapped_buffer mapped_buffer;
+struct mapped_buffer
+{
+  void *ptr;
+  size_t size;
+  int kind;
+  mapped_buffer *next;
+};
+
+static pocl_lock_t mapped_buffer_lock = POCL_LOCK_INITIALIZER;
+static mapped_buffer *mapped_buffers = NULL;
+static volatile unsigned num_mapped_buffers = 0;
+static size_t mapped_bytes[3] = { 0, 0, 0 };
+static int huge_page_mode = HUGE_PAGES_UNINITIALIZED;
+static size_t huge_page_min_size;
+static size_t mapped_buffer_min_size;
+
+static void
+init_huge_page_config ()
+{
+  const char *mode = pocl_get_string_option (HUGE_PAGES_ENV, "thp");
+  int min_size;
+
+  huge_page_min_size = (size_t)pocl_get_int_option 
+    (HUGE_PAGE_MIN_SIZE_ENV, DEFAULT_HUGE_PAGE_MIN_SIZE) * 1024 * 1024;
+  if (strcmp (mode, "hugetlb") == 0)
+    huge_page_mode = HUGE_PAGES_HUGETLB;
+  else if (strcmp (mode, "thp") == 0 || strcmp (mode, "1") == 0)
+    huge_page_mode = HUGE_PAGES_THP;
+  else
+    huge_page_mode = HUGE_PAGES_OFF;
+
+  if (pocl_is_option_set (MAPPED_BUFFER_MIN_SIZE_ENV) &&
+      (min_size = pocl_get_int_option (MAPPED_BUFFER_MIN_SIZE_ENV, 0)) > 0)
+    mapped_buffer_min_size = (size_t)min_size * 1024 * 1024;
+  else if (huge_page_mode != HUGE_PAGES_OFF)
+    mapped_buffer_min_size = huge_page_min_size;
+  else
+    mapped_buffer_min_size = SIZE_MAX;
+}
+
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+
+/* Maps 'size' bytes aligned to 'alignment', a multiple of the page 
+   size, by over-mapping and unmapping the excess. */
+static char *
+map_aligned (size_t size, size_t alignment)
+{
+  char *raw = (char*)mmap (NULL, size + alignment, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, 
+                           -1, 0);
+  size_t head;
+
+  if (raw == MAP_FAILED)
+    return NULL;
+  head = (alignment - ((size_t)raw & (alignment - 1))) & (alignment - 1);
+  if (head > 0)
+    munmap (raw, head);
+  munmap (raw + head + size, alignment - head);
+  return raw + head;
+}
+
+void *
+pocl_alloc_mapped_buffer (size_t size)
+{
+  mapped_buffer *buf;
+  size_t map_size;
+  char *p = NULL;
+  int kind = MAPPING_PLAIN;
+
+  POCL_LOCK (mapped_buffer_lock);
+  if (huge_page_mode == HUGE_PAGES_UNINITIALIZED)
+    init_huge_page_config ();
+  POCL_UNLOCK (mapped_buffer_lock);
+
+  if (size < mapped_buffer_min_size)
+    return NULL;
+
+  buf = (mapped_buffer*)malloc (sizeof (mapped_buffer));
+  if (buf == NULL)
+    return NULL;
+
+  if (huge_page_mode != HUGE_PAGES_OFF && size >= huge_page_min_size)
+    {
+      map_size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+      if (huge_page_mode == HUGE_PAGES_HUGETLB)
+        {
+          /* Fails if the huge page pool has not enough pages reserved. */
+          p = (char*)mmap (NULL, map_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+          if (p == MAP_FAILED)
+            p = NULL;
+          else
+            kind = MAPPING_HUGETLB;
+        }
+#endif
+#ifdef MADV_HUGEPAGE
+      /* The kernel can use huge pages only for 2 MB aligned ranges. 
+         Without THP support the mapping works as a normal buffer. */
+      if (p == NULL && (p = map_aligned (map_size, HUGE_PAGE_SIZE)) != NULL &&
+          madvise (p, map_size, MADV_HUGEPAGE) == 0)
+        kind = MAPPING_THP;
+#endif
+    }
+  if (p == NULL)
+    {
+      size_t page_size = sysconf (_SC_PAGESIZE);
+      map_size = (size + page_size - 1) & ~(page_size - 1);
+      p = map_aligned (map_size, page_size);
+    }
+  if (p == NULL)
+    {
+      free (buf);
+      return NULL;
+    }
+
+  buf->ptr = p;
+  buf->size = map_size;
+  buf->kind = kind;
+  POCL_LOCK (mapped_buffer_lock);
+  buf->next = mapped_buffers;
+  mapped_buffers = buf;
+  ++num_mapped_buffers;
+  mapped_bytes[kind] += map_size;
+  POCL_UNLOCK (mapped_buffer_lock);
+  return p;
+}
+
+int
+pocl_free_mapped_buffer (void *ptr)
+{
+  mapped_buffer **prev;
+  mapped_buffer *buf = NULL;
+
+  if (num_mapped_buffers == 0)
+    return 0;
+
+  POCL_LOCK (mapped_buffer_lock);
+  for (prev = &mapped_buffers; *prev != NULL; prev = &(*prev)->next)
+    {
+      if ((*prev)->ptr == ptr)
+        {
+          buf = *prev;
+          *prev = buf->next;
+          --num_mapped_buffers;
+          mapped_bytes[buf->kind] -= buf->size;
+          break;
+        }
+    }
+  POCL_UNLOCK (mapped_buffer_lock);
+
+  if (buf == NULL)
+    return 0;
+  munmap (buf->ptr, buf->size);
+  free (buf);
+  return 1;
+}
+
+#else
+
+void *
+pocl_alloc_mapped_buffer (size_t size)
+{
+  return NULL;
+}
+
+int
+pocl_free_mapped_buffer (void *ptr)
+{
+  return 0;
+}
+
+#endif
+
+void
+pocl_get_mapped_buffer_stats (unsigned *num_buffers, size_t *plain_bytes,
+                              size_t *thp_bytes, size_t *hugetlb_bytes)
+{
+  POCL_LOCK (mapped_buffer_lock);
+  *num_buffers = num_mapped_buffers;
+  *plain_bytes = mapped_bytes[MAPPING_PLAIN];
+  *thp_bytes = mapped_bytes[MAPPING_THP];
+  *hugetlb_bytes = mapped_bytes[MAPPING_HUGETLB];
+  POCL_UNLOCK (mapped_buffer_lock);
+}
+
+void *
+pocl_use_host_ptr (cl_mem mem)
+{
+  /* The file-backed buffers are always used directly, copying would 
+     defeat their purpose. */
+  if (mem->file_map != NULL ||
+      (uintptr_t)mem->mem_host_ptr % MAX_EXTENDED_ALIGNMENT == 0)
+    return mem->mem_host_ptr;
+  return NULL;
+}
+
+void
+pocl_memcpy_nontemporal (void *__restrict__ dst, const void *__restrict__ src,
+                         size_t size)
+{
+#ifdef __SSE2__
+  char *d = (char*)dst;
+  const char *s = (const char*)src;
+  /* The streaming stores need an aligned destination. */
+  size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+
+  if (size < head + 64)
+    {
+      memcpy (dst, src, size);
+      return;
+    }
+  memcpy (d, s, head);
+  d += head;
+  s += head;
+  size -= head;
+
+  /* Write whole cache lines at a time so the write-combining buffers
+     get flushed full. */
+  for (; size >= 64; size -= 64, d += 64, s += 64)
+    {
+      __m128i a = _mm_loadu_si128 ((const __m128i*)s);
+      __m128i b = _mm_loadu_si128 ((const __m128i*)(s + 16));
+      __m128i c = _mm_loadu_si128 ((const __m128i*)(s + 32));
+      __m128i e = _mm_loadu_si128 ((const __m128i*)(s + 48));
+      _mm_stream_si128 ((__m128i*)d, a);
+      _mm_stream_si128 ((__m128i*)(d + 16), b);
+      _mm_stream_si128 ((__m128i*)(d + 32), c);
+      _mm_stream_si128 ((__m128i*)(d + 48), e);
+    }
+  /* The streaming stores are weakly ordered, make them visible before
+     the command is signaled complete. */
+  _mm_sfence ();
+  memcpy (d, s, size);
+#else
+  memcpy (dst, src, size);
+#endif
+}
+
+size_t
+pocl_nontemporal_copy_min_size ()
+{
+  size_t llc = pocl_topology_cache_size (0);
+  return llc > 0 ? llc : DEFAULT_LLC_SIZE;
+}
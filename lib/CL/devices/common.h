@@ -80,4 +80,98 @@ const char* llvm_codegen (const char* tmpdir,
 void fill_dev_image_t (dev_image_t* di, struct pocl_argument* parg, 
                        cl_int device);
 
+/* The orders in which the CPU devices can traverse the work groups of
+   an NDRange. Tiled and Morton orders traverse the x-y plane in square 
+   tiles of work groups so that the groups executed close in time share 
+   more of their (halo) data in the caches. In the Morton order the groups 
+   inside a tile are further visited in the Z-order. */
+typedef enum {
+  POCL_WG_ORDER_AUTO = 0,
+  POCL_WG_ORDER_RASTER,
+  POCL_WG_ORDER_TILED,
+  POCL_WG_ORDER_MORTON
+} pocl_wg_order;
+
+typedef struct pocl_wg_traversal {
+  pocl_wg_order order;
+  /* The edge length of a tile in work groups. A power of two for the 
+     Morton order. */
+  size_t tile;
+} pocl_wg_traversal;
+
+/* Reads the user's traversal order preference from the runtime 
+   configuration (POCL_WORK_GROUP_ORDER and POCL_WORK_GROUP_TILE). */
+void pocl_get_wg_traversal_option (pocl_wg_traversal *t);
+
+/* Resolves the automatic order based on the shape of the NDRange. */
+void pocl_choose_wg_traversal (const pocl_wg_traversal *config, 
+                               const struct pocl_context *pc,
+                               pocl_wg_traversal *t);
+
+/* Converts the index of a work group in the traversal order to the
+   work-group id. */
+void pocl_wg_index_to_group_id (const pocl_wg_traversal *t, 
+                                const struct pocl_context *pc,
+                                size_t index, size_t *group_id);
+
+/* The __local buffers of the work-group functions executed by a thread
+   are carved from a scratch arena of the thread. The arena is allocated
+   and first touched by the thread itself, thus it resides on the NUMA
+   node of the thread, and it grows to the largest local memory size
+   launched on the thread. It is freed when the thread exits. */
+
+/* Points arguments[i] of each __local argument and automatic local of 
+   the kernel to local_ptrs[i] which is set to the buffer in the arena 
+   of the calling thread. The buffers stay valid until the thread sets
+   up the next launch. */
+void pocl_setup_local_arguments (cl_kernel kernel, 
+                                 struct pocl_argument *kernel_args,
+                                 void **arguments, void **local_ptrs);
+
+/* The total size of the arenas, the number of threads having one and
+   the largest single arena, for POCL_DEVICE_STATS. */
+void pocl_get_local_arena_stats (size_t *total_bytes, unsigned *num_arenas,
+                                 size_t *max_bytes);
+
+/* Allocates a large buffer as an anonymous memory mapping whose pages
+   get memory only when first touched. The buffers of at least 
+   POCL_HUGE_PAGE_MIN_SIZE megabytes are backed by huge pages as 
+   configured with POCL_HUGE_PAGES: transparent huge pages are requested
+   with madvise() on a 2 MB aligned mapping, explicit huge pages with
+   MAP_HUGETLB. The smaller buffers are mapped with normal pages only
+   if POCL_MAPPED_BUFFER_MIN_SIZE is set. Returns NULL if the buffer is
+   not to be mapped or the mapping failed, in which case it should be
+   allocated the normal way. */
+void *pocl_alloc_mapped_buffer (size_t size);
+
+/* Unmaps the buffer in case it was allocated with 
+   pocl_alloc_mapped_buffer(). Returns zero if it was not. */
+int pocl_free_mapped_buffer (void *ptr);
+
+/* Returns the host pointer of a CL_MEM_USE_HOST_PTR buffer if it can be
+   used as the device memory of a CPU device directly, NULL if the buffer
+   must be cached in device allocated memory because the host memory is
+   not aligned for the kernels (CL_DEVICE_MEM_BASE_ADDR_ALIGN). The cached
+   copy is synchronized with the host memory at map and unmap. */
+void *pocl_use_host_ptr (cl_mem mem);
+
+/* Copies the memory with non-temporal (streaming) stores which bypass
+   the caches. Used for copies larger than the last-level cache, for
+   which the normal stores would only evict the useful cache contents
+   and read in the destination lines before overwriting them. */
+void pocl_memcpy_nontemporal (void *__restrict__ dst, 
+                              const void *__restrict__ src, size_t size);
+
+/* The size from which on the bulk copies of the CPU devices should use
+   pocl_memcpy_nontemporal(): the size of the last-level cache as 
+   reported by hwloc. */
+size_t pocl_nontemporal_copy_min_size ();
+
+/* The number of the mapped buffers and their total size by the backing.
+   The backing of the transparent huge page mappings is up to the 
+   kernel. */
+void pocl_get_mapped_buffer_stats (unsigned *num_buffers, 
+                                   size_t *plain_bytes, size_t *thp_bytes,
+                                   size_t *hugetlb_bytes);
+
 #endif
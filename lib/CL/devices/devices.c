@@ -28,6 +28,8 @@
 
 #include "devices.h"
 #include "common.h"
+#include "pocl_runtime_config.h"
+#include "pocl_cache.h"
 #include "basic/basic.h"
 #include "pthread/pocl-pthread.h"
 
@@ -164,6 +166,22 @@ str_toupper(char *out, const char *in)
   out[i] = '\0';
 }
 
+static void
+pocl_print_device_stats()
+{
+  unsigned int i;
+
+  for (i = 0; i < pocl_num_devices; ++i)
+    {
+      if (pocl_devices[i].ops->print_stats == NULL)
+        continue;
+      fprintf (stderr, "pocl: statistics of device %u (%s):\n", i,
+               pocl_devices[i].short_name);
+      pocl_devices[i].ops->print_stats (&pocl_devices[i]);
+    }
+  pocl_cache_print_stats ();
+}
+
 void 
 pocl_init_devices()
 {
@@ -232,6 +250,9 @@ pocl_init_devices()
         }
     }
 
+  if (pocl_get_bool_option ("POCL_DEVICE_STATS", 0))
+    atexit (pocl_print_device_stats);
+
   init_done = 1;
   POCL_UNLOCK(pocl_init_lock);
 }
@@ -0,0 +1,128 @@
+/* pocl-pthread_pool.h - a persistent worker thread pool for the pthread device
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/**
+ * @file pocl-pthread_pool.h
+ *
+ * The worker threads of the pthread device are created once at device
+ * initialization and kept alive for the lifetime of the device. A job
+ * is executed by a "team" which consists of the calling thread and
+ * the idle pool workers that could be claimed for it. Each team member
+ * calls the job function with its own member index.
+ *
+ * Idle workers and the thread waiting for a job to finish first spin
+ * for a configurable time (POCL_PTHREAD_SPIN_USEC) and then sleep on
+ * a futex (or on a condition variable on non-Linux hosts).
+ */
+
+#ifndef POCL_PTHREAD_POOL_H
+#define POCL_PTHREAD_POOL_H
+
+#include <pthread.h>
+
+#pragma GCC visibility push(hidden)
+
+#define POCL_CACHELINE_SIZE 64
+
+typedef struct pool_job pool_job;
+typedef struct pool_worker pool_worker;
+typedef struct pocl_pthread_pool pocl_pthread_pool;
+
+/* The job function. 'member' is the index of the calling thread in the
+   team executing the job, in range [0, team_size). */
+typedef void (*pool_job_fn) (void *data, unsigned member, unsigned team_size);
+
+struct pool_job
+{
+  pool_job_fn fn;
+  void *data;
+  unsigned team_size;
+  /* The number of claimed workers still executing the job. The
+     highest bit is set when the dispatching thread sleeps waiting
+     for the job to finish. */
+  volatile int pending;
+};
+
+struct pool_worker
+{
+  pthread_t thread;
+  pocl_pthread_pool *pool;
+  unsigned id;
+  /* Non-zero while the worker is claimed by a team. */
+  volatile int busy;
+  /* Bumped each time a job is posted to this worker. */
+  volatile int wake;
+  volatile int sleeping;
+  pool_job *volatile job;
+  unsigned member;
+} __attribute__ ((aligned (POCL_CACHELINE_SIZE)));
+
+struct pocl_pthread_pool
+{
+  unsigned num_workers;
+  pool_worker *workers;
+  /* How long idle threads spin before going to sleep, in microseconds. */
+  unsigned spin_usec;
+  volatile int shutdown;
+  /* Used for sleeping only in case futexes are not available. */
+  pthread_mutex_t sleep_lock;
+  pthread_cond_t sleep_cond;
+};
+
+/* A barrier for the members of a team. */
+typedef struct pool_barrier
+{
+  volatile int arrived;
+  /* Bumped each time all the members have arrived. */
+  volatile int generation;
+  volatile int sleepers;
+} __attribute__ ((aligned (POCL_CACHELINE_SIZE))) pool_barrier;
+
+/* Creates 'num_workers' worker threads. If 'bind' is non-zero, worker i
+   is bound to the processing unit i. Returns 0 on success. */
+int pocl_pthread_pool_init (pocl_pthread_pool *pool, unsigned num_workers,
+                            int bind);
+
+/* Stops and joins all the workers. */
+void pocl_pthread_pool_uninit (pocl_pthread_pool *pool);
+
+/* Executes the job with the calling thread and at most 'max_team_size - 1'
+   idle pool workers. Returns after all the team members have finished.
+   If 'member_slots' is not NULL, member_slots[m] is set to the slot of
+   the team member m before the members start: 0 for the calling thread
+   and i + 1 for the worker i, i.e., the processing unit a bound worker
+   runs on. */
+void pocl_pthread_pool_run (pocl_pthread_pool *pool, pool_job_fn fn,
+                            void *data, unsigned max_team_size,
+                            unsigned *member_slots);
+
+void pocl_pthread_pool_barrier_init (pool_barrier *barrier);
+
+/* Waits until 'team_size' threads have arrived at the barrier. */
+void pocl_pthread_pool_barrier_wait (pocl_pthread_pool *pool,
+                                     pool_barrier *barrier,
+                                     unsigned team_size);
+
+#pragma GCC visibility pop
+
+#endif
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include "pocl_runtime_config.h"
 #include "utlist.h"
 #include "cpuinfo.h"
@@ -38,6 +39,10 @@
 #include "devices.h"
 #include "pocl_util.h"
 #include "pocl_mem_management.h"
+#include "pocl_llvm.h"
+#include "pocl-pthread_pool.h"
+#include "sfalloc.h"
+#include "rect_transfer.h"
 
 #ifdef CUSTOM_BUFFER_ALLOCATOR
 
@@ -67,6 +72,10 @@
 /* CUSTOM_BUFFER_ALLOCATOR */
 #endif
 
+/* Selects the buffer allocator: "default" for the allocator chosen at
+   build time, "segregated" for the scalable allocator of sfalloc.c. */
+#define ALLOCATOR_ENV "POCL_PTHREAD_ALLOCATOR"
+
 #define COMMAND_LENGTH 2048
 #define WORKGROUP_STRING_LENGTH 128
 
@@ -74,19 +83,130 @@
    for the thread execution. */
 #define THREAD_COUNT_ENV "POCL_MAX_PTHREAD_COUNT"
 
-typedef struct thread_arguments thread_arguments;
-struct thread_arguments 
+/* The name of the environment variable used to set the time the idle
+   worker threads spin before going to sleep, in microseconds. */
+#define SPIN_USEC_ENV "POCL_PTHREAD_SPIN_USEC"
+#define DEFAULT_SPIN_USEC 100
+
+/* The name of the environment variable used to disable binding the
+   worker threads to processing units. */
+#define AFFINITY_ENV "POCL_AFFINITY"
+
+/* The name of the environment variable used to disable placing the pages
+   of large buffers to the NUMA nodes of the threads likely touching them. */
+#define NUMA_PLACEMENT_ENV "POCL_NUMA_PLACEMENT"
+
+/* Buffers smaller than this are left where the allocator put them. */
+#define NUMA_PLACEMENT_MIN_SIZE (1024 * 1024)
+
+/* The name of the environment variable used to disable executing a single
+   work group with multiple threads. */
+#define SPLIT_WORK_GROUPS_ENV "POCL_PTHREAD_SPLIT_WORK_GROUPS"
+
+/* The name of the environment variable used to set how many commands
+   (e.g. independent kernels of an out-of-order queue) may be executed 
+   at the same time. The worker threads are shared by the commands. */
+#define CONCURRENT_COMMANDS_ENV "POCL_PTHREAD_CONCURRENT_COMMANDS"
+#define DEFAULT_CONCURRENT_COMMANDS 4
+
+/* A team member claims 1/GUIDED_CHUNK_DIVISOR of the work groups left in
+   a range at a time. Smaller divisors reduce the scheduling overheads,
+   larger ones leave more work to be stolen for balancing the load. */
+#define GUIDED_CHUNK_DIVISOR 4
+
+/* The bulk memory copies and fills are split to chunks of the size of
+   the largest per-core cache, but at least this large, claimed by the 
+   team members one at a time. Transfers smaller than two chunks are done
+   by the calling thread alone. */
+#define MIN_COPY_CHUNK_SIZE (256 * 1024)
+
+/* A range of flattened work-group indices initially assigned to one
+   team member. The other members steal chunks from it after their own
+   range has been exhausted. */
+typedef struct group_range group_range;
+struct group_range
+{
+  volatile size_t next;
+  size_t end;
+} __attribute__ ((aligned (POCL_CACHELINE_SIZE)));
+
+/* A buffer argument backed by a mapped file, see prefetch_groups(). */
+typedef struct file_buffer file_buffer;
+struct file_buffer
+{
+  char *start;
+  size_t size;
+};
+
+/* The shared descriptor of a kernel command the worker team pulls the
+   work-group ranges from. */
+typedef struct kernel_run_command kernel_run_command;
+struct kernel_run_command
 {
   void *data;
   cl_kernel kernel;
   unsigned device;
   struct pocl_context pc;
-  int last_gid_x; 
   pocl_workgroup workgroup;
   struct pocl_argument *kernel_args;
-  thread_arguments *volatile next;
+  /* The x-y-z work-group space flattened to a single index range, 
+     split to num_ranges equal ranges. */
+  size_t num_groups;
+  unsigned num_ranges;
+  group_range *ranges;
+  /* The order in which the flattened indices map to the work groups. */
+  pocl_wg_traversal traversal;
+  /* The argument array of the work-group function resolved once for the
+     command. The members copy it and fill in their own __local buffers,
+     except when a single work group is split to the team, in which case
+     the __local buffers are shared too. */
+  void **arguments;
+  /* In case a single work group is split to the team: the local size in
+     the split dimension and the barrier the members meet at the 
+     work-group barriers. */
+  size_t local_size;
+  pool_barrier barrier;
+  /* The file-backed buffer arguments the pages of which are prefetched
+     ahead of the work groups. */
+  unsigned num_file_buffers;
+  file_buffer *file_buffers;
+  /* The team slot of each member, set when the team is formed. A member
+     starts from the range of its slot, whose buffer pages place_buffer()
+     put on the NUMA node of the member. */
+  unsigned *member_slots;
 };
 
+/* A memory copy or fill split to the worker team. */
+typedef struct rect_job rect_job;
+struct rect_job
+{
+  const pocl_rect_transfer *transfer;
+  size_t num_units;
+  /* The number of units a member claims at a time. */
+  size_t units_per_claim;
+  volatile size_t next;
+};
+
+/* The storage the arguments passed by reference point to. */
+typedef struct arg_storage arg_storage;
+struct arg_storage
+{
+  void *ptr;
+  union
+  {
+    dev_image_t image;
+    dev_sampler_t sampler;
+  } desc;
+};
+
+/* The 'team' of the context of a work group split to multiple threads. */
+typedef struct sub_range_member sub_range_member;
+struct sub_range_member
+{
+  pocl_pthread_pool *pool;
+  pool_barrier *barrier;
+  unsigned team_size;
+};
 
 #ifdef CUSTOM_BUFFER_ALLOCATOR
 typedef struct _mem_regions_management{
@@ -100,52 +220,53 @@ struct data {
   cl_kernel current_kernel;
   /* Loaded kernel dynamic library handle. */
   lt_dlhandle current_dlhandle;
+  /* The maximum number of threads executing a kernel command. */
+  int max_threads;
+  /* The number of kernel commands being executed. The worker threads
+     are split evenly to the concurrently executing commands. */
+  volatile int running_kernels;
+  /* The persistent worker threads. The thread calling run() acts as
+     the first member of the team, thus there are max_threads - 1 
+     workers in the pool. */
+  pocl_pthread_pool pool;
+  /* The configured work-group traversal order. */
+  pocl_wg_traversal wg_traversal;
+  /* The number of NUMA nodes the buffers are distributed to, 1 if
+     the placement is disabled. */
+  unsigned num_numa_nodes;
+  /* The bulk copies at least this large use non-temporal stores. */
+  size_t nontemporal_copy_size;
+  /* The size of the chunks the team members copy at a time. */
+  size_t copy_chunk_size;
+  /* The NUMA node of the team slot i, i.e., of the processing unit the
+     worker i - 1 is bound to. Slot 0 is the calling thread. */
+  unsigned *slot_node;
+  /* The number of buffer bytes placed to each NUMA node. */
+  volatile size_t *numa_placed_bytes;
 
 #ifdef CUSTOM_BUFFER_ALLOCATOR
   /* Lock for protecting the mem_regions linked list. Held when new mem_regions
      are created or old ones freed. */
   mem_regions_management* mem_regions;
 #endif
+  /* The segregated-fit heap shared by the pthread devices, NULL if the
+     default allocator is used. */
+  sfa_heap *heap;
 
 };
 
 
-static thread_arguments *volatile thread_argument_pool = 0;
-static int argument_pool_initialized = 0;
-pocl_lock_t ta_pool_lock;
 static int get_max_thread_count();
-static void * workgroup_thread (void *p);
-
-static void pocl_init_thread_argument_manager (void)
-{
-  if (!argument_pool_initialized)
-    {
-      argument_pool_initialized = 1;
-      POCL_INIT_LOCK (ta_pool_lock);
-    }
-}
-
-static thread_arguments* new_thread_arguments ()
-{
-  thread_arguments *ta = NULL;
-  POCL_LOCK (ta_pool_lock);
-  if (ta = thread_argument_pool)
-    {
-      LL_DELETE (thread_argument_pool, ta);
-      POCL_UNLOCK (ta_pool_lock);
-      return ta;
-    }
-  POCL_UNLOCK (ta_pool_lock);
-    
-  return calloc (1, sizeof (thread_arguments));
-}
-
-static void free_thread_arguments (thread_arguments *ta)
-{
-  POCL_LOCK (ta_pool_lock);
-  LL_PREPEND (thread_argument_pool, ta);
-  POCL_UNLOCK (ta_pool_lock);
-}
+static void workgroup_thread (void *p, unsigned member, unsigned team_size);
+static void sub_range_thread (void *p, unsigned member, unsigned team_size);
+static void sub_range_barrier (void *team);
+static void setup_kernel_arguments (kernel_run_command *k, void **arguments,
+                                    arg_storage *storage);
+static void prefetch_groups (kernel_run_command *k, size_t first, 
+                             size_t last);
+static void bulk_copy (struct data *d, void *dst, const void *src, 
+                       size_t size);
+static void run_rect (struct data *d, pocl_rect_transfer *t);
 
 void
 pocl_pthread_init_device_ops(struct pocl_device_ops *ops)
@@ -165,8 +286,13 @@ pocl_pthread_init_device_ops(struct pocl_device_ops *ops)
   ops->write = pocl_pthread_write;
   ops->copy = pocl_pthread_copy;
   ops->copy_rect = pocl_pthread_copy_rect;
+  ops->read_rect = pocl_pthread_read_rect;
+  ops->write_rect = pocl_pthread_write_rect;
+  ops->fill_rect = pocl_pthread_fill_rect;
   ops->run = pocl_pthread_run;
   ops->compile_submitted_kernels = pocl_basic_compile_submitted_kernels;
+  ops->precompile_kernel = pocl_basic_precompile_kernel;
+  ops->print_stats = pocl_pthread_print_stats;
 
 }
 
@@ -203,7 +329,9 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
   static mem_regions_management* mrm = NULL;
 #endif
   static int global_mem_id;
+  static sfa_heap *heap = NULL;
   int i;
+  int affinity;
 
   // TODO: this checks if the device was already initialized previously.
   // Should we instead have a separate bool field in device, or do the
@@ -215,6 +343,7 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
   
   d->current_kernel = NULL;
   d->current_dlhandle = 0;
+  d->running_kernels = 0;
 
   device->data = d;
 #ifdef CUSTOM_BUFFER_ALLOCATOR  
@@ -226,6 +355,19 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
     }
   d->mem_regions = mrm;
 #endif  
+  d->heap = NULL;
+  if (strcmp (pocl_get_string_option (ALLOCATOR_ENV, "default"), 
+              "segregated") == 0)
+    {
+      if (heap == NULL)
+        {
+          heap = malloc (sizeof (sfa_heap));
+          if (heap == NULL)
+            POCL_ABORT ("pocl error: could not allocate the buffer heap.\n");
+          sfa_init (heap, pocl_get_bool_option ("POCL_DEVICE_STATS", 0));
+        }
+      d->heap = heap;
+    }
 
   device->address_bits = sizeof(void*) * 8;
 
@@ -270,8 +412,47 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
   device->has_64bit_long=0;
   #endif
 
-  pocl_init_thread_argument_manager();
-  
+  pocl_get_wg_traversal_option (&d->wg_traversal);
+  device->wi_sub_ranges = pocl_get_bool_option (SPLIT_WORK_GROUPS_ENV, 1);
+  device->jit_workgroup_functions = pocl_llvm_jit_available ();
+
+  d->max_threads = get_max_thread_count (device);
+  if (d->max_threads < 1)
+    d->max_threads = 1;
+  d->pool.spin_usec = pocl_get_int_option (SPIN_USEC_ENV, DEFAULT_SPIN_USEC);
+  affinity = pocl_get_bool_option (AFFINITY_ENV, 1);
+  if (pocl_pthread_pool_init (&d->pool, d->max_threads - 1, affinity) != 0)
+    POCL_ABORT ("pocl error: could not create the pthread worker pool.\n");
+
+  /* One core cannot saturate the memory bandwidth, thus the large copies
+     are split to the team. The copies not fitting to the last-level 
+     cache would only evict its contents, so they stream past it. */
+  d->nontemporal_copy_size = pocl_nontemporal_copy_min_size ();
+  d->copy_chunk_size = pocl_topology_cache_size (2);
+  if (d->copy_chunk_size < MIN_COPY_CHUNK_SIZE)
+    d->copy_chunk_size = MIN_COPY_CHUNK_SIZE;
+
+  device->max_concurrent_commands = 
+    pocl_get_int_option (CONCURRENT_COMMANDS_ENV, 
+                         min (DEFAULT_CONCURRENT_COMMANDS, d->max_threads));
+  if (device->max_concurrent_commands < 1)
+    device->max_concurrent_commands = 1;
+
+  /* The placement relies on the worker threads staying on their NUMA 
+     nodes. The pool binds the worker of team slot i to the processing 
+     unit i. The calling thread (slot 0) is not bound, assume it to run 
+     on the first node. */
+  d->num_numa_nodes = 1;
+  if (affinity && pocl_get_bool_option (NUMA_PLACEMENT_ENV, 1))
+    d->num_numa_nodes = pocl_topology_num_numa_nodes ();
+
+  d->slot_node = calloc (d->max_threads, sizeof (unsigned));
+  d->numa_placed_bytes = calloc (d->num_numa_nodes, sizeof (size_t));
+  if (d->slot_node == NULL || d->numa_placed_bytes == NULL)
+    POCL_ABORT ("pocl error: could not allocate the NUMA node tables.\n");
+  if (d->num_numa_nodes > 1)
+    for (i = 1; i < d->max_threads; ++i)
+      d->slot_node[i] = pocl_topology_pu_numa_node (i);
 }
 
 void
@@ -288,6 +469,9 @@ pocl_pthread_uninit (cl_device_id device)
     }
   d->mem_regions->mem_regions = NULL;
 #endif  
+  pocl_pthread_pool_uninit (&d->pool);
+  free (d->slot_node);
+  free ((void*)d->numa_placed_bytes);
   free (d);
   device->data = NULL;
 }
@@ -295,7 +479,8 @@ pocl_pthread_uninit (cl_device_id device)
 
 #ifdef CUSTOM_BUFFER_ALLOCATOR
 static int
-allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment, size_t size) 
+default_allocate_aligned_buffer (struct data* d, void **memptr, 
+                                 size_t alignment, size_t size) 
 {
   BA_LOCK(d->mem_regions->mem_regions_lock);
   chunk_info_t *chunk = alloc_buffer (d->mem_regions->mem_regions, size);
@@ -356,13 +541,69 @@ allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment, size_t
 #else
 
 static int
-allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment, size_t size) 
+default_allocate_aligned_buffer (struct data* d, void **memptr, 
+                                 size_t alignment, size_t size) 
 {
   return posix_memalign (memptr, alignment, size);
 }
 
 #endif
 
+static int
+allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment, size_t size) 
+{
+  if (d->heap == NULL)
+    return default_allocate_aligned_buffer (d, memptr, alignment, size);
+
+  assert (alignment <= SFA_ALIGNMENT);
+  *memptr = sfa_alloc (d->heap, size);
+  return *memptr != NULL ? 0 : ENOMEM;
+}
+
+/* Distributes the pages of a large buffer to the NUMA nodes of the team
+   slots the same way the work-group index space is split among them in
+   pocl_pthread_run(). Kernels that access the buffer linearly with the
+   group id then find most of their data in the local node. The pages not
+   yet touched get placed on the first touch. */
+static void
+place_buffer (struct data *d, void *ptr, size_t size)
+{
+  size_t page_size, slice, start, end, s;
+  unsigned r;
+
+  if (d->num_numa_nodes < 2 || size < NUMA_PLACEMENT_MIN_SIZE)
+    return;
+
+  page_size = sysconf (_SC_PAGESIZE);
+  start = ((size_t)ptr + page_size - 1) & ~(page_size - 1);
+  end = ((size_t)ptr + size) & ~(page_size - 1);
+  if (end <= start)
+    return;
+
+  slice = ((end - start) / d->max_threads + page_size - 1) 
+    & ~(page_size - 1);
+  if (slice == 0)
+    slice = page_size;
+
+  /* Bind consecutive slices of the same node with a single call. */
+  s = start;
+  for (r = 0; r < d->max_threads && s < end; )
+    {
+      unsigned node = d->slot_node[r];
+      size_t len = 0;
+      while (r < d->max_threads && d->slot_node[r] == node && s + len < end)
+        {
+          len += slice;
+          ++r;
+        }
+      if (s + len > end)
+        len = end - s;
+      if (pocl_topology_bind_memory ((void*)s, len, node) == 0)
+        __sync_fetch_and_add (&d->numa_placed_bytes[node], len);
+      s += len;
+    }
+}
+
 void *
 pocl_pthread_malloc (void *device_data, cl_mem_flags flags, size_t size, void *host_ptr)
 {
@@ -373,7 +614,7 @@ pocl_pthread_malloc (void *device_data, cl_mem_flags flags, size_t size, void *h
     {
       if (allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, size) == 0)
         {
-          memcpy (b, host_ptr, size);
+          bulk_copy (d, b, host_ptr, size);
           return b;
         }
       
@@ -401,16 +642,22 @@ pocl_pthread_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
   /* if memory for this global memory is not yet allocated -> do it */
   if (mem_obj->device_ptrs[device->global_mem_id].mem_ptr == NULL)
     {
-      if (flags & CL_MEM_USE_HOST_PTR && mem_obj->mem_host_ptr != NULL)
+      if (flags & CL_MEM_USE_HOST_PTR && mem_obj->mem_host_ptr != NULL &&
+          (b = pocl_use_host_ptr (mem_obj)) != NULL)
+        ;
+      else
         {
-          b = mem_obj->mem_host_ptr;
+          b = pocl_alloc_mapped_buffer (mem_obj->size);
+          if (b == NULL && 
+              allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, 
+                                       mem_obj->size) != 0)
+            return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+          place_buffer (d, b, mem_obj->size);
         }
-      else if (allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, 
-                                        mem_obj->size) != 0)
-        return CL_MEM_OBJECT_ALLOCATION_FAILURE;
 
-      if (flags & CL_MEM_COPY_HOST_PTR)
-        memcpy (b, mem_obj->mem_host_ptr, mem_obj->size);
+      if (flags & (CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR) &&
+          b != mem_obj->mem_host_ptr)
+        bulk_copy (d, b, mem_obj->mem_host_ptr, mem_obj->size);
     
       mem_obj->device_ptrs[device->global_mem_id].mem_ptr = b;
       mem_obj->device_ptrs[device->global_mem_id].global_mem_id = 
@@ -424,8 +671,8 @@ pocl_pthread_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
 }
 
 #ifdef CUSTOM_BUFFER_ALLOCATOR
-void
-pocl_pthread_free (void *device_data, cl_mem_flags flags, void *ptr)
+static void
+default_free (void *device_data, cl_mem_flags flags, void *ptr)
 {
   struct data* d = (struct data*) device_data;
   memory_region_t *region = NULL;
@@ -456,8 +703,8 @@ pocl_pthread_free (void *device_data, cl_mem_flags flags, void *ptr)
 
 #else
 
-void
-pocl_pthread_free (void *data, cl_mem_flags flags, void *ptr)
+static void
+default_free (void *data, cl_mem_flags flags, void *ptr)
 {
   if (flags & CL_MEM_COPY_HOST_PTR)
     return;
@@ -466,13 +713,32 @@ pocl_pthread_free (void *data, cl_mem_flags flags, void *ptr)
 }
 #endif
 
+void
+pocl_pthread_free (void *device_data, cl_mem_flags flags, void *ptr)
+{
+  struct data* d = (struct data*) device_data;
+
+  if (!(flags & CL_MEM_USE_HOST_PTR) && pocl_free_mapped_buffer (ptr))
+    return;
+
+  if (d->heap == NULL)
+    {
+      default_free (device_data, flags, ptr);
+      return;
+    }
+
+  if (flags & CL_MEM_USE_HOST_PTR)
+    return; /* The host code should free the host ptr. */
+  sfa_free (d->heap, ptr);
+}
+
 void
 pocl_pthread_read (void *data, void *host_ptr, const void *device_ptr, size_t cb)
 {
   if (host_ptr == device_ptr)
     return;
 
-  memcpy (host_ptr, device_ptr, cb);
+  bulk_copy ((struct data*)data, host_ptr, device_ptr, cb);
 }
 
 void
@@ -481,7 +747,7 @@ pocl_pthread_write (void *data, const void *host_ptr, void *device_ptr, size_t c
   if (host_ptr == device_ptr)
     return;
   
-  memcpy (device_ptr, host_ptr, cb);
+  bulk_copy ((struct data*)data, device_ptr, host_ptr, cb);
 }
 
 
@@ -491,7 +757,7 @@ pocl_pthread_copy (void *data, const void *src_ptr, void *__restrict__ dst_ptr,
   if (src_ptr == dst_ptr)
     return;
   
-  memcpy (dst_ptr, src_ptr, cb);
+  bulk_copy ((struct data*)data, dst_ptr, src_ptr, cb);
 }
 
 void
@@ -506,22 +772,131 @@ pocl_pthread_copy_rect (void *data,
                         size_t const dst_row_pitch,
                         size_t const dst_slice_pitch)
 {
-  char const *__restrict const adjusted_src_ptr = 
-    (char const*)src_ptr +
-    src_origin[0] + src_row_pitch * (src_origin[1] + src_slice_pitch * src_origin[2]);
-  char *__restrict__ const adjusted_dst_ptr = 
-    (char*)dst_ptr +
-    dst_origin[0] + dst_row_pitch * (dst_origin[1] + dst_slice_pitch * dst_origin[2]);
-  
-  size_t j, k;
+  pocl_rect_transfer t;
 
   /* TODO: handle overlaping regions */
-  
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      memcpy (adjusted_dst_ptr + dst_row_pitch * j + dst_slice_pitch * k,
-              adjusted_src_ptr + src_row_pitch * j + src_slice_pitch * k,
-              region[0]);
+  pocl_rect_init_copy (&t, dst_ptr, dst_origin, dst_row_pitch, 
+                       dst_slice_pitch, src_ptr, src_origin, src_row_pitch,
+                       src_slice_pitch, region);
+  run_rect ((struct data*)data, &t);
+}
+
+void
+pocl_pthread_write_rect (void *data,
+                         const void *__restrict__ const host_ptr,
+                         void *__restrict__ const device_ptr,
+                         const size_t *__restrict__ const buffer_origin,
+                         const size_t *__restrict__ const host_origin, 
+                         const size_t *__restrict__ const region,
+                         size_t const buffer_row_pitch,
+                         size_t const buffer_slice_pitch,
+                         size_t const host_row_pitch,
+                         size_t const host_slice_pitch)
+{
+  pocl_rect_transfer t;
+
+  pocl_rect_init_copy (&t, device_ptr, buffer_origin, buffer_row_pitch,
+                       buffer_slice_pitch, host_ptr, host_origin,
+                       host_row_pitch, host_slice_pitch, region);
+  run_rect ((struct data*)data, &t);
+}
+
+void
+pocl_pthread_read_rect (void *data,
+                        void *__restrict__ const host_ptr,
+                        void *__restrict__ const device_ptr,
+                        const size_t *__restrict__ const buffer_origin,
+                        const size_t *__restrict__ const host_origin, 
+                        const size_t *__restrict__ const region,
+                        size_t const buffer_row_pitch,
+                        size_t const buffer_slice_pitch,
+                        size_t const host_row_pitch,
+                        size_t const host_slice_pitch)
+{
+  pocl_rect_transfer t;
+
+  pocl_rect_init_copy (&t, host_ptr, host_origin, host_row_pitch,
+                       host_slice_pitch, device_ptr, buffer_origin,
+                       buffer_row_pitch, buffer_slice_pitch, region);
+  run_rect ((struct data*)data, &t);
+}
+
+void
+pocl_pthread_fill_rect (void *data,
+                        void *__restrict__ const device_ptr,
+                        const size_t *__restrict__ const buffer_origin,
+                        const size_t *__restrict__ const region,
+                        size_t const buffer_row_pitch,
+                        size_t const buffer_slice_pitch,
+                        void *fill_pixel,
+                        size_t pixel_size)                    
+{
+  pocl_rect_transfer t;
+  size_t origin[3] = { buffer_origin[0] * pixel_size, buffer_origin[1], 
+                       buffer_origin[2] };
+  size_t byte_region[3] = { region[0] * pixel_size, region[1], region[2] };
+
+  pocl_rect_init_fill (&t, device_ptr, origin, buffer_row_pitch, 
+                       buffer_slice_pitch, byte_region, fill_pixel, 
+                       pixel_size);
+  run_rect ((struct data*)data, &t);
+}
+
+void
+pocl_pthread_print_stats (cl_device_id device)
+{
+  struct data *d = (struct data*)device->data;
+  unsigned i;
+
+  size_t arena_bytes, max_arena_bytes;
+  unsigned num_arenas;
+  size_t plain_bytes, thp_bytes, hugetlb_bytes;
+  unsigned num_mapped_buffers;
+
+  fprintf (stderr, "  threads: %d, NUMA nodes: %u\n", d->max_threads,
+           d->num_numa_nodes);
+  pocl_get_local_arena_stats (&arena_bytes, &num_arenas, &max_arena_bytes);
+  fprintf (stderr, "  local memory arenas: %u, %llu kB in total, "
+           "largest %llu kB\n", num_arenas,
+           (unsigned long long)(arena_bytes / 1024),
+           (unsigned long long)(max_arena_bytes / 1024));
+  pocl_get_mapped_buffer_stats (&num_mapped_buffers, &plain_bytes, 
+                                &thp_bytes, &hugetlb_bytes);
+  fprintf (stderr, "  mapped buffers: %u, %llu MB normal pages, "
+           "%llu MB transparent huge pages, %llu MB hugetlbfs\n", 
+           num_mapped_buffers,
+           (unsigned long long)(plain_bytes / (1024 * 1024)),
+           (unsigned long long)(thp_bytes / (1024 * 1024)),
+           (unsigned long long)(hugetlb_bytes / (1024 * 1024)));
+  if (d->heap != NULL)
+    {
+      sfa_stats st;
+      sfa_get_stats (d->heap, &st);
+      fprintf (stderr, "  buffer heap: %llu kB reserved, %llu kB allocated, "
+               "%llu kB in slabs, %llu kB free (largest block %llu kB)\n",
+               (unsigned long long)(st.reserved_bytes / 1024),
+               (unsigned long long)(st.allocated_bytes / 1024),
+               (unsigned long long)(st.slab_bytes / 1024),
+               (unsigned long long)(st.free_bytes / 1024),
+               (unsigned long long)(st.largest_free_block / 1024));
+      if (st.num_allocs > 0)
+        fprintf (stderr, "  buffer heap: %llu allocations, %llu frees, "
+                 "%.1f%% from thread caches, %.1f%% rounding overhead, "
+                 "%llu ns average / %llu ns max allocation latency\n",
+                 st.num_allocs, st.num_frees,
+                 100.0 * st.cache_hits / st.num_allocs,
+                 100.0 * (st.rounded_bytes - st.requested_bytes) / 
+                 st.rounded_bytes,
+                 st.total_alloc_ns / st.num_allocs, st.max_alloc_ns);
+    }
+  if (d->num_numa_nodes < 2)
+    return;
+  for (i = 0; i < d->num_numa_nodes; ++i)
+    fprintf (stderr, "  node %u: %llu MB local memory, "
+             "%llu kB of buffers placed\n", i,
+             (unsigned long long)(pocl_topology_numa_node_memory (i) 
+                                  / (1024 * 1024)),
+             (unsigned long long)(d->numa_placed_bytes[i] / 1024));
 }
 
 #define FALLBACK_MAX_THREAD_COUNT 8
@@ -549,18 +924,29 @@ pocl_pthread_run
  _cl_command_node* cmd)
 {
   struct data *d;
-  int error;
-  char workgroup_string[WORKGROUP_STRING_LENGTH];
   unsigned device;
-  cl_device_id device_ptr;
   unsigned i;
   cl_kernel kernel = cmd->command.run.kernel;
   struct pocl_context *pc = &cmd->command.run.pc;
-  struct thread_arguments *arguments;
-  static int max_threads = 0; /* this needs to be asked only once */
+  kernel_run_command k;
+  int max_threads;
+  unsigned num_args = kernel->num_args + kernel->num_locals;
+  /* One extra element keeps the arrays non-empty for kernels 
+     without arguments. */
+  void *arguments[num_args + 1];
+  arg_storage storage[num_args + 1];
+  file_buffer file_buffers[num_args + 1];
 
   d = (struct data *) data;
 
+  /* Kernels executed concurrently get an equal share of the workers.
+     The ones started earlier may hold more, the pool gives out only 
+     the idle workers. */
+  max_threads = d->max_threads / 
+    __sync_add_and_fetch (&d->running_kernels, 1);
+  if (max_threads < 1)
+    max_threads = 1;
+
   /* Find which device number within the context correspond
      to current device.  */
   for (i = 0; i < kernel->context->num_devices; ++i)
@@ -568,72 +954,92 @@ pocl_pthread_run
       if (kernel->context->devices[i]->data == data)
         {
           device = i;
-          device_ptr = kernel->context->devices[i];
           break;
         }
     }
 
-
-  int num_groups_x = pc->num_groups[0];
-  /* TODO: distributing the work groups in the x dimension is not always the
-     best option. This assumes x dimension has enough work groups to utilize
-     all the threads. */
-  if (max_threads == 0)
-    max_threads = get_max_thread_count(device_ptr);
-
-  int num_threads = min(max_threads, num_groups_x);
-  pthread_t *threads = (pthread_t*) malloc (sizeof (pthread_t)*num_threads);
-  
-  int wgs_per_thread = num_groups_x / num_threads;
-  /* In case the work group count is not divisible by the
-     number of threads, we have to execute the remaining
-     workgroups in one of the threads. */
-  /* TODO: This is inefficient; it is better to round up when
-     calculating wgs_per_thread */
-  int leftover_wgs = num_groups_x - (num_threads*wgs_per_thread);
+  size_t num_groups = pc->num_groups[0] * pc->num_groups[1] * 
+    pc->num_groups[2];
+  unsigned num_threads = min(max_threads, num_groups);
 
 #ifdef DEBUG_MT    
-  printf("### creating %d work group threads\n", num_threads);
-  printf("### wgs per thread==%d leftover wgs==%d\n", wgs_per_thread, leftover_wgs);
+  printf("### running the kernel with at most %d threads\n", num_threads);
 #endif
-  
-  int first_gid_x = 0;
-  int last_gid_x = wgs_per_thread - 1;
-  for (i = 0; i < num_threads; 
-       ++i, first_gid_x += wgs_per_thread, last_gid_x += wgs_per_thread) {
 
-    if (i + 1 == num_threads) last_gid_x += leftover_wgs;
+  /* Split the flattened work-group space to one range per team slot.
+     In case some of the workers are busy, the ranges of the slots 
+     without a member get stolen by the rest of the team. */
+  group_range ranges[num_threads];
+  unsigned member_slots[num_threads];
+  size_t groups_per_range = num_groups / num_threads;
+  size_t leftover_groups = num_groups % num_threads;
+  size_t first = 0;
+  for (i = 0; i < num_threads; ++i)
+    {
+      ranges[i].next = first;
+      first += groups_per_range + (i < leftover_groups ? 1 : 0);
+      ranges[i].end = first;
+    }
 
-#ifdef DEBUG_MT       
-    printf("### creating wg thread: first_gid_x==%d, last_gid_x==%d\n",
-           first_gid_x, last_gid_x);
-#endif
-    arguments = new_thread_arguments();
-    arguments->data = data;
-    arguments->kernel = kernel;
-    arguments->device = device;
-    arguments->pc = *pc;
-    arguments->pc.group_id[0] = first_gid_x;
-    arguments->workgroup = cmd->command.run.wg;
-    arguments->last_gid_x = last_gid_x;
-    arguments->kernel_args = cmd->command.run.arguments;
-
-    /* TODO: pool of worker threads to avoid syscalls here */
-    error = pthread_create (&threads[i],
-                            NULL,
-                            workgroup_thread,
-                            arguments);
-    assert(!error);
-  }
-
-  for (i = 0; i < num_threads; ++i) {
-    pthread_join(threads[i], NULL);
-#ifdef DEBUG_MT       
-    printf("### thread %u finished\n", (unsigned)threads[i]);
-#endif
-  }
+  pocl_choose_wg_traversal (&d->wg_traversal, pc, &k.traversal);
+  k.num_groups = num_groups;
+  k.num_ranges = num_threads;
+  k.ranges = ranges;
+  k.data = data;
+  k.kernel = kernel;
+  k.device = device;
+  k.pc = *pc;
+  k.pc.barrier = sub_range_barrier;
+  k.pc.team = NULL;
+  k.workgroup = cmd->command.run.wg;
+  k.kernel_args = cmd->command.run.arguments;
+  k.arguments = arguments;
+  k.num_file_buffers = 0;
+  k.file_buffers = file_buffers;
+  k.member_slots = member_slots;
+  setup_kernel_arguments (&k, arguments, storage);
+
+  /* A single work group gets split to the team in the outermost 
+     dimension of its work-item loops, if the compiler could generate
+     a work-group function for it. */
+  if (num_groups == 1 && max_threads > 1 && 
+      cmd->command.run.sub_range_dim >= 0)
+    {
+      size_t local_size = 
+        cmd->command.run.sub_range_dim == 2 ? cmd->command.run.local_z :
+        (cmd->command.run.sub_range_dim == 1 ? cmd->command.run.local_y :
+         cmd->command.run.local_x);
+      if (local_size > 1)
+        {
+          void *local_ptrs[num_args + 1];
+          k.local_size = local_size;
+          pocl_pthread_pool_barrier_init (&k.barrier);
+          /* The team shares the local memory of the calling thread. */
+          pocl_setup_local_arguments (kernel, k.kernel_args, arguments,
+                                      local_ptrs);
+          pocl_pthread_pool_run (&d->pool, sub_range_thread, &k, 
+                                 min (max_threads, local_size), NULL);
+          __sync_sub_and_fetch (&d->running_kernels, 1);
+          return;
+        }
+    }
+
+  /* Start reading in the file pages of the first chunk of each range.
+     The team members prefetch the following chunks as they go. */
+  if (k.num_file_buffers > 0)
+    {
+      for (i = 0; i < num_threads; ++i)
+        {
+          size_t chunk = (ranges[i].end - ranges[i].next) / 
+            GUIDED_CHUNK_DIVISOR;
+          prefetch_groups (&k, ranges[i].next, 
+                           ranges[i].next + (chunk > 0 ? chunk : 1));
+        }
+    }
 
-  free(threads);
+  pocl_pthread_pool_run (&d->pool, workgroup_thread, &k, num_threads,
+                         member_slots);
+  __sync_sub_and_fetch (&d->running_kernels, 1);
 }
 
 void *
@@ -645,29 +1051,121 @@ pocl_pthread_map_mem (void *data, void *buf_ptr,
   return (char*)buf_ptr + offset;
 }
 
-void *
-workgroup_thread (void *p)
+/* Claims the next chunk [*first, *last) of work groups from the range.
+   Returns zero if the range is already exhausted. */
+static int
+claim_groups (group_range *range, size_t *first, size_t *last)
 {
-  struct thread_arguments *ta = (struct thread_arguments *) p;
-  void **arguments = (void**)alloca((ta->kernel->num_args + ta->kernel->num_locals)*sizeof(void*));
-  struct pocl_argument *al;  
-  unsigned i = 0;
+  for (;;)
+    {
+      size_t next = range->next;
+      size_t chunk;
+      if (next >= range->end)
+        return 0;
+      chunk = (range->end - next) / GUIDED_CHUNK_DIVISOR;
+      if (chunk == 0)
+        chunk = 1;
+      if (__sync_bool_compare_and_swap (&range->next, next, next + chunk))
+        {
+          *first = next;
+          *last = next + chunk;
+          return 1;
+        }
+    }
+}
 
-  /* TODO: refactor this to share code with basic.c 
+/* Hints the OS to read in the pages of the file-backed buffers the work
+   groups [first, last) are likely to access. The buffers are assumed to
+   be accessed linearly by the flattened group index, which is the common
+   case of kernels streaming through a data set. */
+static void
+prefetch_groups (kernel_run_command *k, size_t first, size_t last)
+{
+#ifdef MADV_WILLNEED
+  size_t page_size = sysconf (_SC_PAGESIZE);
+  unsigned i;
 
-     To function 
-     void setup_kernel_arg_array(void **arguments, cl_kernel kernel)
-     or similar
-  */
-  cl_kernel kernel = ta->kernel;
-  for (i = 0; i < kernel->num_args; ++i)
+  if (last > k->num_groups)
+    last = k->num_groups;
+  if (first >= last)
+    return;
+
+  for (i = 0; i < k->num_file_buffers; ++i)
     {
-      al = &(ta->kernel_args[i]);
-      if (kernel->arg_info[i].is_local)
+      file_buffer *fb = &k->file_buffers[i];
+      /* Computed in floating point to not overflow with large files. */
+      size_t begin = (double)fb->size * first / k->num_groups;
+      size_t end = (double)fb->size * last / k->num_groups;
+      char *addr = fb->start + begin;
+      size_t misalign = (size_t)addr % page_size;
+
+      if (end > fb->size)
+        end = fb->size;
+      if (end <= begin)
+        continue;
+      madvise (addr - misalign, end - begin + misalign, MADV_WILLNEED);
+    }
+#endif
+}
+
+/* Executes the work groups with the flattened indices [first, last). */
+static void
+run_groups (kernel_run_command *k, void **arguments, struct pocl_context *pc,
+            size_t first, size_t last)
+{
+  size_t num_groups_x = pc->num_groups[0];
+  size_t num_groups_y = pc->num_groups[1];
+  size_t gid_x = first % num_groups_x;
+  size_t gid_y = (first / num_groups_x) % num_groups_y;
+  size_t gid_z = first / (num_groups_x * num_groups_y);
+  size_t i;
+
+  if (k->traversal.order != POCL_WG_ORDER_RASTER)
+    {
+      for (i = first; i < last; ++i)
+        {
+          pocl_wg_index_to_group_id (&k->traversal, pc, i, pc->group_id);
+          k->workgroup (arguments, pc);
+        }
+      return;
+    }
+
+  for (i = first; i < last; ++i)
+    {
+      pc->group_id[0] = gid_x;
+      pc->group_id[1] = gid_y;
+      pc->group_id[2] = gid_z;
+      k->workgroup (arguments, pc);
+
+      if (++gid_x == num_groups_x)
         {
-          arguments[i] = malloc (sizeof (void *));
-          *(void **)(arguments[i]) = pocl_pthread_malloc(ta->data, 0, al->size, NULL);
+          gid_x = 0;
+          if (++gid_y == num_groups_y)
+            {
+              gid_y = 0;
+              ++gid_z;
+            }
         }
+    }
+}
+
+/* Builds the argument array of the work-group function, except for the
+   __local buffers. The pointer cells and the image and sampler 
+   descriptors the arguments point to are stored to 'storage' which 
+   must outlive the command. */
+static void
+setup_kernel_arguments (kernel_run_command *k, void **arguments,
+                        arg_storage *storage)
+{
+  struct pocl_argument *al;  
+  cl_kernel kernel = k->kernel;
+  unsigned i;
+
+  for (i = 0; i < kernel->num_args; ++i)
+    {
+      al = &(k->kernel_args[i]);
+      if (kernel->arg_info[i].is_local)
+        arguments[i] = NULL;
       else if (kernel->arg_info[i].type == POCL_ARG_TYPE_POINTER)
       {
         /* It's legal to pass a NULL pointer to clSetKernelArguments. In 
@@ -676,92 +1174,167 @@ workgroup_thread (void *p)
            pointers stored in the cl_mem. */
         if (al->value == NULL) 
           {
-            arguments[i] = malloc (sizeof (void *));
-            *(void **)arguments[i] = NULL;
+            storage[i].ptr = NULL;
+            arguments[i] = &storage[i].ptr;
           }
         else
           {
-            arguments[i] = 
-              &((*(cl_mem *)(al->value))->device_ptrs[ta->device].mem_ptr);
+            cl_mem m = *(cl_mem *)(al->value);
+            cl_mem parent = m->parent != NULL ? m->parent : m;
+            arguments[i] = &m->device_ptrs[k->device].mem_ptr;
+            if (parent->file_map != NULL)
+              {
+                file_buffer *fb = &k->file_buffers[k->num_file_buffers++];
+                fb->start = (char*)m->device_ptrs[k->device].mem_ptr;
+                fb->size = m->size;
+              }
           }
       }
       else if (kernel->arg_info[i].type == POCL_ARG_TYPE_IMAGE)
         {
-          dev_image_t di;
-          fill_dev_image_t(&di, al, ta->device);
-          void* devptr = pocl_pthread_malloc(ta->data, 0, sizeof(dev_image_t), NULL);
-          arguments[i] = malloc (sizeof (void *));
-          *(void **)(arguments[i]) = devptr;       
-          pocl_pthread_write (ta->data, &di, devptr, sizeof(dev_image_t));
+          /* The device memory of the CPU devices is host memory, thus
+             the descriptor can be passed directly. */
+          fill_dev_image_t (&storage[i].desc.image, al, k->device);
+          storage[i].ptr = &storage[i].desc.image;
+          arguments[i] = &storage[i].ptr;
         }
       else if (kernel->arg_info[i].type == POCL_ARG_TYPE_SAMPLER)
         {
-          dev_sampler_t ds;
-          
-          arguments[i] = malloc (sizeof (void *));
-          *(void **)(arguments[i]) = pocl_pthread_malloc 
-            (ta->data, 0, sizeof(dev_sampler_t), NULL);
-          pocl_pthread_write (ta->data, &ds, *(void**)arguments[i], 
-                              sizeof(dev_sampler_t));
+          storage[i].desc.sampler = 0;
+          storage[i].ptr = &storage[i].desc.sampler;
+          arguments[i] = &storage[i].ptr;
         }
       else
         arguments[i] = al->value;
     }
 
-  /* Allocate the automatic local buffers which are implemented as implicit
-     extra arguments at the end of the kernel argument list. */
-  for (i = kernel->num_args;
-       i < kernel->num_args + kernel->num_locals;
-       ++i)
-    {
-      al = &(ta->kernel_args[i]);
-      arguments[i] = malloc (sizeof (void *));
-      *(void **)(arguments[i]) = pocl_pthread_malloc (ta->data, 0, al->size, 
-                                                      NULL);
-    }
+  /* The automatic locals are implemented as implicit extra arguments at
+     the end of the kernel argument list. */
+  for (i = kernel->num_args; i < kernel->num_args + kernel->num_locals; ++i)
+    arguments[i] = NULL;
+}
 
-  int first_gid_x = ta->pc.group_id[0];
-  unsigned gid_z, gid_y, gid_x;
-  for (gid_z = 0; gid_z < ta->pc.num_groups[2]; ++gid_z)
+static void
+workgroup_thread (void *p, unsigned member, unsigned team_size)
+{
+  kernel_run_command *k = (kernel_run_command *) p;
+  struct pocl_context pc = k->pc;
+  unsigned num_args = k->kernel->num_args + k->kernel->num_locals;
+  void *arguments[num_args + 1];
+  void *local_ptrs[num_args + 1];
+
+  memcpy (arguments, k->arguments, num_args * sizeof (void*));
+  pocl_setup_local_arguments (k->kernel, k->kernel_args, arguments,
+                              local_ptrs);
+
+  /* First process the range of the own slot, then steal from the 
+     others. */
+  size_t first, last;
+  unsigned home = k->member_slots[member] % k->num_ranges;
+  unsigned r;
+  for (r = 0; r < k->num_ranges; ++r)
     {
-      for (gid_y = 0; gid_y < ta->pc.num_groups[1]; ++gid_y)
+      group_range *range = &k->ranges[(home + r) % k->num_ranges];
+      while (claim_groups (range, &first, &last))
         {
-          for (gid_x = first_gid_x; gid_x <= ta->last_gid_x; ++gid_x)
-            {
-              ta->pc.group_id[0] = gid_x;
-              ta->pc.group_id[1] = gid_y;
-              ta->pc.group_id[2] = gid_z;
-              ta->workgroup (arguments, &(ta->pc));              
-            }
+#ifdef DEBUG_MT       
+          printf("### team member %u: groups %zu..%zu\n",
+                 member, first, last - 1);
+#endif
+          /* Prefetch for the next chunk of the range while running 
+             this one. */
+          if (k->num_file_buffers > 0)
+            prefetch_groups (k, last, last + (last - first));
+          run_groups (k, arguments, &pc, first, last);
         }
     }
+}
 
-  for (i = 0; i < kernel->num_args; ++i)
-    {
-      if (kernel->arg_info[i].is_local )
-        {
-          pocl_pthread_free (ta->data, 0, *(void **)(arguments[i]));
-          free (arguments[i]);
-        }
-      else if (kernel->arg_info[i].type == POCL_ARG_TYPE_IMAGE)
-        {
-          pocl_pthread_free (ta->data, 0, *(void **)(arguments[i]));
-          free (arguments[i]);            
-        }
-      else if (kernel->arg_info[i].type == POCL_ARG_TYPE_SAMPLER || 
-               (kernel->arg_info[i].type == POCL_ARG_TYPE_POINTER && *(void**)arguments[i] == NULL))
-        {
-          free (arguments[i]);
-        }
-    }
-  for (i = kernel->num_args;
-       i < kernel->num_args + kernel->num_locals;
-       ++i)
+/* Executes a slice of the work items of a single work group. The team 
+   members share the arguments, thus also the local memory. */
+static void
+sub_range_thread (void *p, unsigned member, unsigned team_size)
+{
+  kernel_run_command *k = (kernel_run_command *) p;
+  struct pocl_context pc = k->pc;
+  sub_range_member team;
+
+  team.pool = &((struct data*)k->data)->pool;
+  team.barrier = &k->barrier;
+  team.team_size = team_size;
+
+  /* The team is never larger than the local size, thus all the slices
+     are non-empty. */
+  pc.local_range[0] = k->local_size * member / team_size;
+  pc.local_range[1] = k->local_size * (member + 1) / team_size;
+  pc.team = &team;
+  pc.group_id[0] = pc.group_id[1] = pc.group_id[2] = 0;
+
+#ifdef DEBUG_MT       
+  printf("### team member %u: work items %zu..%zu\n",
+         member, pc.local_range[0], pc.local_range[1] - 1);
+#endif
+  k->workgroup (k->arguments, &pc);
+}
+
+static void
+sub_range_barrier (void *team)
+{
+  sub_range_member *m = (sub_range_member*)team;
+
+  if (m == NULL || m->team_size < 2)
+    return;
+  pocl_pthread_pool_barrier_wait (m->pool, m->barrier, m->team_size);
+}
+
+static void
+rect_thread (void *p, unsigned member, unsigned team_size)
+{
+  rect_job *job = (rect_job*)p;
+  size_t first;
+
+  while ((first = __sync_fetch_and_add (&job->next, job->units_per_claim))
+         < job->num_units)
+    pocl_rect_execute (job->transfer, first, 
+                       min (first + job->units_per_claim, job->num_units));
+}
+
+/* Executes the transfer with the calling thread and the idle workers. 
+   The units are claimed dynamically, thus it does not matter how many 
+   workers the concurrently executing kernels leave for the transfer. */
+static void
+run_rect (struct data *d, pocl_rect_transfer *t)
+{
+  rect_job job;
+  size_t size = pocl_rect_total_size (t);
+  size_t unit_size;
+  size_t num_claims;
+
+  t->nontemporal = size >= d->nontemporal_copy_size;
+  if (size / d->copy_chunk_size < 2 || d->max_threads < 2)
     {
-      pocl_pthread_free (ta->data, 0, *(void **)(arguments[i]));
-      free (arguments[i]);
+      pocl_rect_execute (t, 0, pocl_rect_num_units (t));
+      return;
     }
-  free_thread_arguments (ta);
 
-  return NULL;
+  job.transfer = t;
+  job.num_units = pocl_rect_split_rows (t, d->copy_chunk_size);
+  unit_size = min (t->part_size, t->row_size);
+  job.units_per_claim = max (d->copy_chunk_size / unit_size, 1);
+  job.next = 0;
+  num_claims = (job.num_units + job.units_per_claim - 1) / 
+    job.units_per_claim;
+  pocl_pthread_pool_run (&d->pool, rect_thread, &job, 
+                         min ((size_t)d->max_threads, num_claims), NULL);
+}
+
+static void
+bulk_copy (struct data *d, void *dst, const void *src, size_t size)
+{
+  pocl_rect_transfer t;
+  size_t origin[3] = { 0, 0, 0 };
+  size_t region[3] = { size, 1, 1 };
+
+  pocl_rect_init_copy (&t, dst, origin, 0, 0, src, origin, 0, 0, region);
+  run_rect (d, &t);
 }
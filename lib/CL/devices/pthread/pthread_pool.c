@@ -0,0 +1,341 @@
+/* pthread_pool.c - a persistent worker thread pool for the pthread device
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_cl.h"
+#include "pocl-pthread_pool.h"
+#include "topology/pocl_topology.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* The bit of pool_job::pending telling the dispatcher sleeps. */
+#define JOB_WAITER_BIT 0x40000000
+
+/* Check the clock only every this many spin iterations. */
+#define SPIN_CLOCK_INTERVAL 64
+
+static unsigned long long
+usec_now ()
+{
+  struct timeval current;
+  gettimeofday (&current, NULL);
+  return (unsigned long long)current.tv_sec * 1000000 + current.tv_usec;
+}
+
+/* Sleeps until *addr no longer contains 'val'. May return spuriously. */
+static void
+pool_sleep (pocl_pthread_pool *pool, volatile int *addr, int val)
+{
+#ifdef __linux__
+  syscall (SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+  pthread_mutex_lock (&pool->sleep_lock);
+  if (*addr == val)
+    pthread_cond_wait (&pool->sleep_cond, &pool->sleep_lock);
+  pthread_mutex_unlock (&pool->sleep_lock);
+#endif
+}
+
+/* Wakes up the threads sleeping on addr. The address might already be
+   dead from the waiter's point of view, thus it must not be dereferenced. */
+static void
+pool_wakeup (pocl_pthread_pool *pool, volatile int *addr)
+{
+#ifdef __linux__
+  syscall (SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, 0x7fffffff,
+           NULL, NULL, 0);
+#else
+  pthread_mutex_lock (&pool->sleep_lock);
+  pthread_cond_broadcast (&pool->sleep_cond);
+  pthread_mutex_unlock (&pool->sleep_lock);
+#endif
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+#define CPU_RELAX() __asm__ __volatile__ ("pause")
+#else
+#define CPU_RELAX() do { } while (0)
+#endif
+
+/* Spins until *addr differs from 'val' or the spin time runs out.
+   Returns non-zero if the value changed. */
+static int
+pool_spin (pocl_pthread_pool *pool, volatile int *addr, int val)
+{
+  unsigned long long deadline = 0;
+  unsigned i = 0;
+
+  while (*addr == val)
+    {
+      if (++i % SPIN_CLOCK_INTERVAL == 0)
+        {
+          unsigned long long now = usec_now ();
+          if (deadline == 0)
+            deadline = now + pool->spin_usec;
+          else if (now >= deadline)
+            return 0;
+        }
+      CPU_RELAX ();
+    }
+  return 1;
+}
+
+/* Spins until *addr becomes zero or the spin time runs out. Returns 
+   non-zero if the value reached zero. */
+static int
+pool_spin_until_zero (pocl_pthread_pool *pool, volatile int *addr)
+{
+  unsigned long long deadline = 0;
+  unsigned i = 0;
+
+  while (*addr != 0)
+    {
+      if (++i % SPIN_CLOCK_INTERVAL == 0)
+        {
+          unsigned long long now = usec_now ();
+          if (deadline == 0)
+            deadline = now + pool->spin_usec;
+          else if (now >= deadline)
+            return 0;
+        }
+      CPU_RELAX ();
+    }
+  return 1;
+}
+
+static void *
+pool_worker_main (void *p)
+{
+  pool_worker *w = (pool_worker*)p;
+  pocl_pthread_pool *pool = w->pool;
+  int seen = 0;
+
+  for (;;)
+    {
+      pool_job *job;
+      int left;
+
+      if (!pool_spin (pool, &w->wake, seen))
+        {
+          w->sleeping = 1;
+          __sync_synchronize ();
+          while (w->wake == seen)
+            pool_sleep (pool, &w->wake, seen);
+          w->sleeping = 0;
+        }
+      seen = w->wake;
+      __sync_synchronize ();
+
+      if (pool->shutdown)
+        break;
+
+      job = w->job;
+      assert (job != NULL);
+      job->fn (job->data, w->member, job->team_size);
+      w->job = NULL;
+      w->busy = 0;
+
+      /* The job descriptor must not be touched after the decrement as
+         the dispatcher is free to return as soon as it sees zero. */
+      left = __sync_sub_and_fetch (&job->pending, 1);
+      if (left == JOB_WAITER_BIT)
+        pool_wakeup (pool, &job->pending);
+    }
+  return NULL;
+}
+
+struct worker_start
+{
+  pool_worker *worker;
+  int bind;
+};
+
+static void *
+pool_worker_start (void *p)
+{
+  struct worker_start *start = (struct worker_start*)p;
+  pool_worker *w = start->worker;
+
+  /* The calling thread is the member 0 of every team and runs unbound,
+     thus start binding the workers from the second processing unit. */
+  if (start->bind)
+    pocl_topology_bind_thread (w->id + 1);
+  free (start);
+  return pool_worker_main (w);
+}
+
+int
+pocl_pthread_pool_init (pocl_pthread_pool *pool, unsigned num_workers,
+                        int bind)
+{
+  unsigned i;
+
+  pool->num_workers = 0;
+  pool->shutdown = 0;
+  pthread_mutex_init (&pool->sleep_lock, NULL);
+  pthread_cond_init (&pool->sleep_cond, NULL);
+
+  pool->workers = NULL;
+  if (num_workers == 0)
+    return 0;
+
+  if (posix_memalign ((void**)&pool->workers, POCL_CACHELINE_SIZE,
+                      num_workers * sizeof (pool_worker)) != 0)
+    return -1;
+  memset (pool->workers, 0, num_workers * sizeof (pool_worker));
+
+  for (i = 0; i < num_workers; ++i)
+    {
+      pool_worker *w = &pool->workers[i];
+      struct worker_start *start = malloc (sizeof (struct worker_start));
+      if (start == NULL)
+        break;
+      w->pool = pool;
+      w->id = i;
+      start->worker = w;
+      start->bind = bind;
+      if (pthread_create (&w->thread, NULL, pool_worker_start, start) != 0)
+        {
+          free (start);
+          break;
+        }
+      pool->num_workers++;
+    }
+  return pool->num_workers == num_workers ? 0 : -1;
+}
+
+void
+pocl_pthread_pool_uninit (pocl_pthread_pool *pool)
+{
+  unsigned i;
+
+  pool->shutdown = 1;
+  __sync_synchronize ();
+  for (i = 0; i < pool->num_workers; ++i)
+    {
+      __sync_fetch_and_add (&pool->workers[i].wake, 1);
+      pool_wakeup (pool, &pool->workers[i].wake);
+    }
+  for (i = 0; i < pool->num_workers; ++i)
+    pthread_join (pool->workers[i].thread, NULL);
+
+  free (pool->workers);
+  pool->workers = NULL;
+  pool->num_workers = 0;
+  pthread_mutex_destroy (&pool->sleep_lock);
+  pthread_cond_destroy (&pool->sleep_cond);
+}
+
+void
+pocl_pthread_pool_run (pocl_pthread_pool *pool, pool_job_fn fn,
+                       void *data, unsigned max_team_size,
+                       unsigned *member_slots)
+{
+  pool_worker *claimed[pool->num_workers + 1];
+  unsigned num_claimed = 0;
+  unsigned i;
+  pool_job job;
+  int pending;
+
+  for (i = 0; i < pool->num_workers && num_claimed + 1 < max_team_size; ++i)
+    {
+      pool_worker *w = &pool->workers[i];
+      if (w->busy == 0 && __sync_bool_compare_and_swap (&w->busy, 0, 1))
+        claimed[num_claimed++] = w;
+    }
+
+  job.fn = fn;
+  job.data = data;
+  job.team_size = num_claimed + 1;
+  job.pending = num_claimed;
+
+  /* The workers claimed are not necessarily the first ones. */
+  if (member_slots != NULL)
+    {
+      member_slots[0] = 0;
+      for (i = 0; i < num_claimed; ++i)
+        member_slots[i + 1] = claimed[i]->id + 1;
+    }
+
+  for (i = 0; i < num_claimed; ++i)
+    {
+      pool_worker *w = claimed[i];
+      w->job = &job;
+      w->member = i + 1;
+      __sync_fetch_and_add (&w->wake, 1);
+      if (w->sleeping)
+        pool_wakeup (pool, &w->wake);
+    }
+
+  fn (data, 0, job.team_size);
+
+  if (num_claimed == 0)
+    return;
+
+  if (!pool_spin_until_zero (pool, &job.pending))
+    {
+      __sync_fetch_and_or (&job.pending, JOB_WAITER_BIT);
+      while ((pending = job.pending) != JOB_WAITER_BIT)
+        pool_sleep (pool, &job.pending, pending);
+    }
+}
+
+void
+pocl_pthread_pool_barrier_init (pool_barrier *barrier)
+{
+  barrier->arrived = 0;
+  barrier->generation = 0;
+  barrier->sleepers = 0;
+}
+
+void
+pocl_pthread_pool_barrier_wait (pocl_pthread_pool *pool,
+                                pool_barrier *barrier, unsigned team_size)
+{
+  int generation = barrier->generation;
+
+  if (__sync_add_and_fetch (&barrier->arrived, 1) == (int)team_size)
+    {
+      barrier->arrived = 0;
+      __sync_fetch_and_add (&barrier->generation, 1);
+      if (barrier->sleepers > 0)
+        pool_wakeup (pool, &barrier->generation);
+      return;
+    }
+
+  if (pool_spin (pool, &barrier->generation, generation))
+    return;
+
+  __sync_fetch_and_add (&barrier->sleepers, 1);
+  while (barrier->generation == generation)
+    pool_sleep (pool, &barrier->generation, generation);
+  __sync_fetch_and_sub (&barrier->sleepers, 1);
+}
@@ -0,0 +1,234 @@
+/* OpenCL runtime/device driver library: rectangular copies and fills
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "rect_transfer.h"
+#include "common.h"
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Returns non-zero if the pitches of both memories equal the given
+   sizes, i.e., the next dimension continues right after the previous. */
+static int
+contiguous (const pocl_rect_transfer *t, size_t dst_size, size_t src_size,
+            size_t dst_pitch, size_t src_pitch)
+{
+  return dst_pitch == dst_size && (t->src == NULL || src_pitch == src_size);
+}
+
+static void
+collapse (pocl_rect_transfer *t)
+{
+  /* Slices following each other are more rows. */
+  if (t->slices == 1 ||
+      contiguous (t, t->rows * t->dst_row_pitch, t->rows * t->src_row_pitch,
+                  t->dst_slice_pitch, t->src_slice_pitch))
+    {
+      t->rows *= t->slices;
+      t->slices = 1;
+    }
+
+  /* Rows following each other are a longer row. A single row is replaced
+     by the slices, which may follow each other as well. */
+  if (t->rows == 1 ||
+      contiguous (t, t->row_size, t->row_size,
+                  t->dst_row_pitch, t->src_row_pitch))
+    {
+      t->row_size *= t->rows;
+      t->rows = t->slices;
+      t->slices = 1;
+      t->dst_row_pitch = t->dst_slice_pitch;
+      t->src_row_pitch = t->src_slice_pitch;
+      if (t->rows > 1 &&
+          contiguous (t, t->row_size, t->row_size,
+                      t->dst_row_pitch, t->src_row_pitch))
+        {
+          t->row_size *= t->rows;
+          t->rows = 1;
+        }
+    }
+}
+
+void
+pocl_rect_init_copy (pocl_rect_transfer *t,
+                     void *dst, const size_t *dst_origin,
+                     size_t dst_row_pitch, size_t dst_slice_pitch,
+                     const void *src, const size_t *src_origin,
+                     size_t src_row_pitch, size_t src_slice_pitch,
+                     const size_t *region)
+{
+  t->dst = (char*)dst + dst_origin[0] + dst_row_pitch * dst_origin[1] +
+    dst_slice_pitch * dst_origin[2];
+  t->src = (const char*)src + src_origin[0] + src_row_pitch * src_origin[1] +
+    src_slice_pitch * src_origin[2];
+  t->row_size = region[0];
+  t->rows = region[1];
+  t->slices = region[2];
+  t->dst_row_pitch = dst_row_pitch;
+  t->dst_slice_pitch = dst_slice_pitch;
+  t->src_row_pitch = src_row_pitch;
+  t->src_slice_pitch = src_slice_pitch;
+  t->nontemporal = 0;
+  t->pattern = NULL;
+  t->pattern_size = 0;
+  t->tiled = 0;
+  collapse (t);
+  t->part_size = t->row_size;
+  t->parts_per_row = 1;
+}
+
+void
+pocl_rect_init_fill (pocl_rect_transfer *t,
+                     void *dst, const size_t *origin,
+                     size_t row_pitch, size_t slice_pitch,
+                     const size_t *region,
+                     const void *pattern, size_t pattern_size)
+{
+  size_t n;
+
+  t->dst = (char*)dst + origin[0] + row_pitch * origin[1] +
+    slice_pitch * origin[2];
+  t->src = NULL;
+  t->row_size = region[0];
+  t->rows = region[1];
+  t->slices = region[2];
+  t->dst_row_pitch = row_pitch;
+  t->dst_slice_pitch = slice_pitch;
+  t->src_row_pitch = t->src_slice_pitch = 0;
+  t->nontemporal = 0;
+  t->pattern = (const char*)pattern;
+  t->pattern_size = pattern_size;
+  /* Tile the pattern by doubling it until the block is full. */
+  t->tiled = POCL_RECT_FILL_BLOCK_SIZE % pattern_size == 0;
+  if (t->tiled)
+    {
+      memcpy (t->block, pattern, pattern_size);
+      for (n = pattern_size; n < sizeof (t->block); n *= 2)
+        memcpy (t->block + n, t->block,
+                n < sizeof (t->block) - n ? n : sizeof (t->block) - n);
+    }
+  collapse (t);
+  t->part_size = t->row_size;
+  t->parts_per_row = 1;
+}
+
+size_t
+pocl_rect_total_size (const pocl_rect_transfer *t)
+{
+  return t->row_size * t->rows * t->slices;
+}
+
+size_t
+pocl_rect_split_rows (pocl_rect_transfer *t, size_t part_size)
+{
+  /* The parts must start at the beginning of the pattern. */
+  size_t unit = t->src != NULL || t->tiled ?
+    POCL_RECT_FILL_BLOCK_SIZE : t->pattern_size;
+
+  part_size = (part_size + unit - 1) / unit * unit;
+  if (t->row_size > part_size)
+    {
+      t->part_size = part_size;
+      t->parts_per_row = (t->row_size + part_size - 1) / part_size;
+    }
+  return pocl_rect_num_units (t);
+}
+
+size_t
+pocl_rect_num_units (const pocl_rect_transfer *t)
+{
+  return t->rows * t->slices * t->parts_per_row;
+}
+
+static void
+fill_part (const pocl_rect_transfer *t, char *dst, size_t size)
+{
+  size_t n;
+
+#ifdef __SSE2__
+  if (t->tiled)
+    {
+      size_t i, j;
+      size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+      if (head > size)
+        head = size;
+      memcpy (dst, t->block, head);
+      /* j is the position of dst + i in the block. */
+      for (i = j = head; i + 16 <= size; i += 16)
+        {
+          __m128i v = _mm_loadu_si128 ((const __m128i*)(t->block + j));
+          if (t->nontemporal)
+            _mm_stream_si128 ((__m128i*)(dst + i), v);
+          else
+            _mm_store_si128 ((__m128i*)(dst + i), v);
+          j += 16;
+          if (j >= POCL_RECT_FILL_BLOCK_SIZE)
+            j -= POCL_RECT_FILL_BLOCK_SIZE;
+        }
+      memcpy (dst + i, t->block + j, size - i);
+      if (t->nontemporal)
+        _mm_sfence ();
+      return;
+    }
+#endif
+
+  /* Double the filled part until the whole part is filled. */
+  n = size < t->pattern_size ? size : t->pattern_size;
+  memcpy (dst, t->pattern, n);
+  while (n < size)
+    {
+      size_t c = n < size - n ? n : size - n;
+      memcpy (dst + n, dst, c);
+      n += c;
+    }
+}
+
+void
+pocl_rect_execute (const pocl_rect_transfer *t, size_t first, size_t last)
+{
+  size_t u;
+
+  for (u = first; u < last; ++u)
+    {
+      size_t row = u / t->parts_per_row;
+      size_t offset = (u % t->parts_per_row) * t->part_size;
+      size_t y = row % t->rows;
+      size_t z = row / t->rows;
+      size_t size = t->row_size - offset < t->part_size ?
+        t->row_size - offset : t->part_size;
+      char *dst = t->dst + z * t->dst_slice_pitch + y * t->dst_row_pitch +
+        offset;
+
+      if (t->src == NULL)
+        fill_part (t, dst, size);
+      else if (t->nontemporal)
+        pocl_memcpy_nontemporal (dst, t->src + z * t->src_slice_pitch +
+                                 y * t->src_row_pitch + offset, size);
+      else
+        memcpy (dst, t->src + z * t->src_slice_pitch +
+                y * t->src_row_pitch + offset, size);
+    }
+}
@@ -0,0 +1,117 @@
+/* OpenCL runtime/device driver library: rectangular copies and fills
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+/**
+ * The buffer and image transfers of the CPU devices: rectangular copies
+ * between two memory areas with their own row and slice pitches, and
+ * fills of a rectangular region with a repeated pattern.
+ *
+ * The dimensions laid out back to back in both memories are collapsed,
+ * thus e.g. a rect copy of whole rows is a single memcpy. The work is
+ * described as "units", parts of the (collapsed) rows, which the device
+ * can execute in any order and split to multiple threads.
+ *
+ * @file rect_transfer.h
+ */
+
+#ifndef POCL_RECT_TRANSFER_H
+#define POCL_RECT_TRANSFER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The fill patterns dividing this size are tiled to a block of this size
+   which is stored with vector stores. The rows are split to parts of a
+   multiple of this size. */
+#define POCL_RECT_FILL_BLOCK_SIZE 128
+
+typedef struct pocl_rect_transfer
+{
+  /* The first byte of the region in the destination and the source. The
+     source is NULL for a fill. */
+  char *dst;
+  const char *src;
+  size_t row_size;
+  size_t rows;
+  size_t slices;
+  size_t dst_row_pitch;
+  size_t dst_slice_pitch;
+  size_t src_row_pitch;
+  size_t src_slice_pitch;
+  /* The rows are split to parts_per_row parts of part_size bytes, the
+     last part of a row may be shorter. */
+  size_t part_size;
+  size_t parts_per_row;
+  /* Non-zero for using non-temporal stores. */
+  int nontemporal;
+  /* The fill pattern and, in case tiled is non-zero, the pattern tiled
+     over the block and 16 bytes past it for the unaligned loads. */
+  const char *pattern;
+  size_t pattern_size;
+  int tiled;
+  char block[POCL_RECT_FILL_BLOCK_SIZE + 16] __attribute__ ((aligned (16)));
+} pocl_rect_transfer;
+
+#pragma GCC visibility push(hidden)
+
+/* Sets up a copy of 'region' (the width in bytes) from 'src' to 'dst'.
+   The origins are in bytes in the first dimension and in rows and slices
+   in the others. */
+void pocl_rect_init_copy (pocl_rect_transfer *t,
+                          void *dst, const size_t *dst_origin,
+                          size_t dst_row_pitch, size_t dst_slice_pitch,
+                          const void *src, const size_t *src_origin,
+                          size_t src_row_pitch, size_t src_slice_pitch,
+                          const size_t *region);
+
+/* Sets up a fill of 'region' (the width in bytes, a multiple of the
+   pattern size) with the pattern. The pattern is not copied, it must
+   stay valid until the fill has been executed. */
+void pocl_rect_init_fill (pocl_rect_transfer *t,
+                          void *dst, const size_t *origin,
+                          size_t row_pitch, size_t slice_pitch,
+                          const size_t *region,
+                          const void *pattern, size_t pattern_size);
+
+/* The total number of bytes written. */
+size_t pocl_rect_total_size (const pocl_rect_transfer *t);
+
+/* Splits the rows longer than 'part_size' bytes to parts for executing
+   them in parallel. Returns the number of units. */
+size_t pocl_rect_split_rows (pocl_rect_transfer *t, size_t part_size);
+
+size_t pocl_rect_num_units (const pocl_rect_transfer *t);
+
+/* Executes the units [first, last). */
+void pocl_rect_execute (const pocl_rect_transfer *t, size_t first,
+                        size_t last);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,639 @@
+/* OpenCL runtime/device driver library: segregated-fit buffer allocator
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+/**
+ * The segregated-fit allocator, see sfalloc.h for an overview.
+ *
+ * Each page of an arena has an info record. The first page of a buddy
+ * block records whether the block is free or allocated and its order,
+ * the other pages of a block are "interior" pages, except that all the
+ * pages of a slab record the size class of the slab so that a small
+ * object can be freed by looking up the page it is in. The slabs are
+ * never returned to the buddy allocator and the arenas are only freed
+ * when the heap is destroyed.
+ *
+ * @file sfalloc.c
+ */
+
+#include "sfalloc.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum
+{
+  PAGE_INTERIOR = 0,
+  PAGE_FREE,
+  PAGE_LARGE,
+  PAGE_SLAB
+};
+
+typedef struct page_info
+{
+  unsigned char state;
+  unsigned char order;
+  unsigned char size_class;
+} page_info;
+
+struct sfa_arena
+{
+  char *base;
+  page_info pages[1 << SFA_MAX_ORDER];
+};
+
+/* Stored in the free buddy blocks themselves. */
+struct sfa_free_block
+{
+  sfa_free_block *next;
+  sfa_free_block *prev;
+};
+
+/* A buffer allocated from the system directly. */
+struct sfa_huge
+{
+  void *ptr;
+  size_t size;
+  sfa_huge *next;
+};
+
+/* A thread caches at most this many bytes of objects of a size class,
+   but at least two objects. Half of the cache is moved at a time from
+   and to the central free list. */
+#define THREAD_CACHE_BYTES (64 * 1024)
+
+typedef struct thread_cache
+{
+  sfa_heap *heap;
+  void *head[SFA_NUM_CLASSES];
+  unsigned count[SFA_NUM_CLASSES];
+} thread_cache;
+
+/* Multiples of SFA_ALIGNMENT with four classes per doubling, keeping
+   the internal fragmentation under 25% above the smallest class. */
+static const size_t class_sizes[SFA_NUM_CLASSES] =
+  { 128, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192 };
+
+#define SLAB_SIZE ((size_t)SFA_PAGE_SIZE << SFA_SLAB_ORDER)
+#define HUGE_MIN (SFA_ARENA_SIZE / 4)
+
+#define STAT_ADD(__HEAP__, __FIELD__, __N__)                            \
+  do {                                                                  \
+    if ((__HEAP__)->collect_stats)                                      \
+      __sync_fetch_and_add (&(__HEAP__)->stats.__FIELD__, (__N__));     \
+  } while (0)
+
+static int
+size_class (size_t size)
+{
+  int c = 0;
+  while (class_sizes[c] < size)
+    ++c;
+  return c;
+}
+
+static unsigned
+cache_limit (int c)
+{
+  unsigned limit = THREAD_CACHE_BYTES / class_sizes[c];
+  return limit < 2 ? 2 : limit;
+}
+
+static unsigned
+block_order (size_t size)
+{
+  size_t pages = (size + SFA_PAGE_SIZE - 1) >> SFA_PAGE_SHIFT;
+  unsigned order = 0;
+  while (((size_t)1 << order) < pages)
+    ++order;
+  return order;
+}
+
+static sfa_arena *
+find_arena (sfa_heap *heap, const void *ptr)
+{
+  char *base = (char*)((uintptr_t)ptr & ~(uintptr_t)(SFA_ARENA_SIZE - 1));
+  unsigned n = heap->num_arenas;
+  unsigned i;
+
+  for (i = 0; i < n; ++i)
+    {
+      if (heap->arenas[i]->base == base)
+        return heap->arenas[i];
+    }
+  return NULL;
+}
+
+/* The buddy allocator functions must be called with the heap lock held. */
+
+static void
+push_free_block (sfa_heap *heap, sfa_arena *arena, size_t page,
+                 unsigned order)
+{
+  sfa_free_block *block =
+    (sfa_free_block*)(arena->base + (page << SFA_PAGE_SHIFT));
+
+  arena->pages[page].state = PAGE_FREE;
+  arena->pages[page].order = order;
+  block->prev = NULL;
+  block->next = heap->free_blocks[order];
+  if (block->next != NULL)
+    block->next->prev = block;
+  heap->free_blocks[order] = block;
+  heap->stats.free_bytes += (size_t)SFA_PAGE_SIZE << order;
+}
+
+static void
+remove_free_block (sfa_heap *heap, sfa_free_block *block, unsigned order)
+{
+  if (block->prev != NULL)
+    block->prev->next = block->next;
+  else
+    heap->free_blocks[order] = block->next;
+  if (block->next != NULL)
+    block->next->prev = block->prev;
+  heap->stats.free_bytes -= (size_t)SFA_PAGE_SIZE << order;
+}
+
+static int
+add_arena (sfa_heap *heap)
+{
+  unsigned n = heap->num_arenas;
+  sfa_arena *arena;
+  void *base;
+
+  if (n == SFA_MAX_ARENAS)
+    return -1;
+  arena = (sfa_arena*)calloc (1, sizeof (sfa_arena));
+  if (arena == NULL)
+    return -1;
+  /* The arenas are aligned to their size to find the arena of a
+     pointer by masking. The pages are not touched until used. */
+  if (posix_memalign (&base, SFA_ARENA_SIZE, SFA_ARENA_SIZE) != 0)
+    {
+      free (arena);
+      return -1;
+    }
+  arena->base = (char*)base;
+  push_free_block (heap, arena, 0, SFA_MAX_ORDER);
+  heap->stats.reserved_bytes += SFA_ARENA_SIZE;
+
+  heap->arenas[n] = arena;
+  /* the lock-free searchers must see an initialized arena */
+  __sync_synchronize ();
+  heap->num_arenas = n + 1;
+  return 0;
+}
+
+/* Returns a block of 2^order pages and its arena and first page. */
+static void *
+buddy_alloc (sfa_heap *heap, unsigned order, sfa_arena **arena_p,
+             size_t *page_p)
+{
+  sfa_free_block *block;
+  sfa_arena *arena;
+  size_t page;
+  unsigned k;
+
+  for (k = order; k <= SFA_MAX_ORDER; ++k)
+    {
+      if (heap->free_blocks[k] != NULL)
+        break;
+    }
+  if (k > SFA_MAX_ORDER)
+    {
+      if (add_arena (heap) != 0)
+        return NULL;
+      k = SFA_MAX_ORDER;
+    }
+
+  block = heap->free_blocks[k];
+  remove_free_block (heap, block, k);
+  arena = find_arena (heap, block);
+  assert (arena != NULL);
+  page = ((char*)block - arena->base) >> SFA_PAGE_SHIFT;
+
+  /* return the upper halves until the block is of the right size */
+  while (k > order)
+    {
+      --k;
+      push_free_block (heap, arena, page + ((size_t)1 << k), k);
+    }
+  arena->pages[page].order = order;
+  *arena_p = arena;
+  *page_p = page;
+  return block;
+}
+
+static void
+buddy_free (sfa_heap *heap, sfa_arena *arena, size_t page)
+{
+  unsigned order = arena->pages[page].order;
+
+  while (order < SFA_MAX_ORDER)
+    {
+      size_t buddy = page ^ ((size_t)1 << order);
+      if (arena->pages[buddy].state != PAGE_FREE ||
+          arena->pages[buddy].order != order)
+        break;
+      remove_free_block
+        (heap, (sfa_free_block*)(arena->base + (buddy << SFA_PAGE_SHIFT)),
+         order);
+      arena->pages[buddy].state = PAGE_INTERIOR;
+      arena->pages[page].state = PAGE_INTERIOR;
+      if (buddy < page)
+        page = buddy;
+      ++order;
+    }
+  push_free_block (heap, arena, page, order);
+}
+
+/* Carves a new slab to the central free list of the size class. Must
+   be called with the lock of the class held. */
+static int
+refill_class (sfa_heap *heap, int c)
+{
+  sfa_class *cls = &heap->classes[c];
+  sfa_arena *arena;
+  size_t page, i, offset;
+  char *slab;
+
+  POCL_LOCK (heap->lock);
+  slab = (char*)buddy_alloc (heap, SFA_SLAB_ORDER, &arena, &page);
+  if (slab == NULL)
+    {
+      POCL_UNLOCK (heap->lock);
+      return -1;
+    }
+  for (i = 0; i < ((size_t)1 << SFA_SLAB_ORDER); ++i)
+    {
+      arena->pages[page + i].state = PAGE_SLAB;
+      arena->pages[page + i].size_class = c;
+    }
+  heap->stats.slab_bytes += SLAB_SIZE;
+  POCL_UNLOCK (heap->lock);
+
+  for (offset = 0; offset + cls->size <= SLAB_SIZE; offset += cls->size)
+    {
+      *(void**)(slab + offset) = cls->free_list;
+      cls->free_list = slab + offset;
+    }
+  return 0;
+}
+
+static thread_cache *
+get_thread_cache (sfa_heap *heap)
+{
+  thread_cache *cache = (thread_cache*)pthread_getspecific (heap->cache_key);
+
+  if (cache != NULL)
+    return cache;
+  cache = (thread_cache*)calloc (1, sizeof (thread_cache));
+  if (cache == NULL)
+    return NULL;
+  cache->heap = heap;
+  pthread_setspecific (heap->cache_key, cache);
+  return cache;
+}
+
+/* Moves 'n' objects of the class from the thread cache to the central
+   free list. */
+static void
+flush_cache_class (thread_cache *cache, int c, unsigned n)
+{
+  sfa_class *cls = &cache->heap->classes[c];
+
+  POCL_LOCK (cls->lock);
+  while (n-- > 0 && cache->head[c] != NULL)
+    {
+      void *obj = cache->head[c];
+      cache->head[c] = *(void**)obj;
+      --cache->count[c];
+      *(void**)obj = cls->free_list;
+      cls->free_list = obj;
+    }
+  POCL_UNLOCK (cls->lock);
+}
+
+/* The destructor of the thread caches. */
+static void
+free_thread_cache (void *p)
+{
+  thread_cache *cache = (thread_cache*)p;
+  int c;
+
+  for (c = 0; c < SFA_NUM_CLASSES; ++c)
+    flush_cache_class (cache, c, cache->count[c]);
+  free (cache);
+}
+
+static void *
+alloc_small (sfa_heap *heap, int c)
+{
+  thread_cache *cache = get_thread_cache (heap);
+  sfa_class *cls = &heap->classes[c];
+  unsigned batch;
+  void *obj;
+
+  if (cache != NULL && (obj = cache->head[c]) != NULL)
+    {
+      cache->head[c] = *(void**)obj;
+      --cache->count[c];
+      STAT_ADD (heap, cache_hits, 1);
+      return obj;
+    }
+
+  POCL_LOCK (cls->lock);
+  if (cls->free_list == NULL && refill_class (heap, c) != 0)
+    {
+      POCL_UNLOCK (cls->lock);
+      return NULL;
+    }
+  obj = cls->free_list;
+  cls->free_list = *(void**)obj;
+
+  /* take a batch to the thread cache for the next allocations */
+  if (cache != NULL)
+    {
+      batch = cache_limit (c) / 2;
+      while (batch-- > 0 && cls->free_list != NULL)
+        {
+          void *next = cls->free_list;
+          cls->free_list = *(void**)next;
+          *(void**)next = cache->head[c];
+          cache->head[c] = next;
+          ++cache->count[c];
+        }
+    }
+  POCL_UNLOCK (cls->lock);
+  return obj;
+}
+
+static void
+free_small (sfa_heap *heap, int c, void *obj)
+{
+  thread_cache *cache = get_thread_cache (heap);
+  sfa_class *cls = &heap->classes[c];
+
+  if (cache == NULL)
+    {
+      POCL_LOCK (cls->lock);
+      *(void**)obj = cls->free_list;
+      cls->free_list = obj;
+      POCL_UNLOCK (cls->lock);
+      return;
+    }
+
+  *(void**)obj = cache->head[c];
+  cache->head[c] = obj;
+  if (++cache->count[c] > cache_limit (c))
+    flush_cache_class (cache, c, cache_limit (c) / 2);
+}
+
+static void *
+alloc_huge (sfa_heap *heap, size_t size)
+{
+  sfa_huge *h = (sfa_huge*)malloc (sizeof (sfa_huge));
+
+  if (h == NULL)
+    return NULL;
+  if (posix_memalign (&h->ptr, SFA_PAGE_SIZE, size) != 0)
+    {
+      free (h);
+      return NULL;
+    }
+  h->size = size;
+  POCL_LOCK (heap->lock);
+  h->next = heap->huge;
+  heap->huge = h;
+  heap->stats.reserved_bytes += size;
+  POCL_UNLOCK (heap->lock);
+  return h->ptr;
+}
+
+static size_t
+free_huge (sfa_heap *heap, void *ptr)
+{
+  sfa_huge **prev;
+  sfa_huge *h = NULL;
+  size_t size = 0;
+
+  POCL_LOCK (heap->lock);
+  for (prev = &heap->huge; *prev != NULL; prev = &(*prev)->next)
+    {
+      if ((*prev)->ptr == ptr)
+        {
+          h = *prev;
+          *prev = h->next;
+          size = h->size;
+          heap->stats.reserved_bytes -= size;
+          break;
+        }
+    }
+  POCL_UNLOCK (heap->lock);
+
+  assert (h != NULL && "Freeing a pointer not allocated from the heap.");
+  free (ptr);
+  free (h);
+  return size;
+}
+
+static unsigned long long
+nsec_since (const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (unsigned long long)(now.tv_sec - start->tv_sec) * 1000000000ULL +
+    now.tv_nsec - start->tv_nsec;
+}
+
+void
+sfa_init (sfa_heap *heap, int collect_stats)
+{
+  int c;
+
+  memset (heap, 0, sizeof (sfa_heap));
+  for (c = 0; c < SFA_NUM_CLASSES; ++c)
+    {
+      POCL_INIT_LOCK (heap->classes[c].lock);
+      heap->classes[c].size = class_sizes[c];
+    }
+  POCL_INIT_LOCK (heap->lock);
+  pthread_key_create (&heap->cache_key, free_thread_cache);
+  heap->collect_stats = collect_stats;
+}
+
+void
+sfa_uninit (sfa_heap *heap)
+{
+  thread_cache *cache;
+  unsigned i;
+  int c;
+
+  /* The caches of the other threads are leaked, they only hold pointers
+     to the memory released here. */
+  cache = (thread_cache*)pthread_getspecific (heap->cache_key);
+  pthread_setspecific (heap->cache_key, NULL);
+  free (cache);
+  pthread_key_delete (heap->cache_key);
+
+  for (i = 0; i < heap->num_arenas; ++i)
+    {
+      free (heap->arenas[i]->base);
+      free (heap->arenas[i]);
+      heap->stats.reserved_bytes -= SFA_ARENA_SIZE;
+    }
+  heap->num_arenas = 0;
+  while (heap->huge != NULL)
+    {
+      sfa_huge *h = heap->huge;
+      heap->huge = h->next;
+      heap->stats.reserved_bytes -= h->size;
+      free (h->ptr);
+      free (h);
+    }
+
+  /* Nothing is left allocated or free, the statistics printed after
+     this agree with the released memory. */
+  memset (heap->free_blocks, 0, sizeof (heap->free_blocks));
+  heap->stats.free_bytes = 0;
+  heap->stats.slab_bytes = 0;
+  heap->stats.allocated_bytes = 0;
+
+  for (c = 0; c < SFA_NUM_CLASSES; ++c)
+    {
+      heap->classes[c].free_list = NULL;
+      POCL_DESTROY_LOCK (heap->classes[c].lock);
+    }
+  POCL_DESTROY_LOCK (heap->lock);
+}
+
+void *
+sfa_alloc (sfa_heap *heap, size_t size)
+{
+  struct timespec start;
+  unsigned long long ns, max;
+  size_t rounded;
+  void *ptr;
+
+  if (heap->collect_stats)
+    clock_gettime (CLOCK_MONOTONIC, &start);
+  if (size == 0)
+    size = 1;
+
+  if (size <= SFA_SMALL_MAX)
+    {
+      int c = size_class (size);
+      rounded = class_sizes[c];
+      ptr = alloc_small (heap, c);
+    }
+  else if (size <= HUGE_MIN)
+    {
+      unsigned order = block_order (size);
+      sfa_arena *arena;
+      size_t page;
+
+      rounded = (size_t)SFA_PAGE_SIZE << order;
+      POCL_LOCK (heap->lock);
+      ptr = buddy_alloc (heap, order, &arena, &page);
+      if (ptr != NULL)
+        arena->pages[page].state = PAGE_LARGE;
+      POCL_UNLOCK (heap->lock);
+    }
+  else
+    {
+      rounded = (size + SFA_PAGE_SIZE - 1) & ~(size_t)(SFA_PAGE_SIZE - 1);
+      ptr = alloc_huge (heap, rounded);
+    }
+
+  if (ptr == NULL || !heap->collect_stats)
+    return ptr;
+
+  ns = nsec_since (&start);
+  __sync_fetch_and_add (&heap->stats.allocated_bytes, rounded);
+  __sync_fetch_and_add (&heap->stats.requested_bytes, size);
+  __sync_fetch_and_add (&heap->stats.rounded_bytes, rounded);
+  __sync_fetch_and_add (&heap->stats.num_allocs, 1);
+  __sync_fetch_and_add (&heap->stats.total_alloc_ns, ns);
+  while ((max = heap->stats.max_alloc_ns) < ns &&
+         !__sync_bool_compare_and_swap (&heap->stats.max_alloc_ns, max, ns))
+    ;
+  return ptr;
+}
+
+void
+sfa_free (sfa_heap *heap, void *ptr)
+{
+  sfa_arena *arena;
+  page_info *info;
+  size_t page;
+  size_t size;
+
+  if (ptr == NULL)
+    return;
+
+  arena = find_arena (heap, ptr);
+  if (arena == NULL)
+    size = free_huge (heap, ptr);
+  else
+    {
+      page = ((char*)ptr - arena->base) >> SFA_PAGE_SHIFT;
+      info = &arena->pages[page];
+      if (info->state == PAGE_SLAB)
+        {
+          size = class_sizes[info->size_class];
+          free_small (heap, info->size_class, ptr);
+        }
+      else
+        {
+          assert (info->state == PAGE_LARGE);
+          size = (size_t)SFA_PAGE_SIZE << info->order;
+          POCL_LOCK (heap->lock);
+          buddy_free (heap, arena, page);
+          POCL_UNLOCK (heap->lock);
+        }
+    }
+
+  STAT_ADD (heap, allocated_bytes, -size);
+  STAT_ADD (heap, num_frees, 1);
+}
+
+void
+sfa_get_stats (sfa_heap *heap, sfa_stats *stats)
+{
+  int k;
+
+  POCL_LOCK (heap->lock);
+  memcpy (stats, (const void*)&heap->stats, sizeof (sfa_stats));
+  stats->largest_free_block = 0;
+  for (k = SFA_MAX_ORDER; k >= 0; --k)
+    {
+      if (heap->free_blocks[k] != NULL)
+        {
+          stats->largest_free_block = (size_t)SFA_PAGE_SIZE << k;
+          break;
+        }
+    }
+  POCL_UNLOCK (heap->lock);
+}
@@ -0,0 +1,141 @@
+/* OpenCL runtime/device driver library: segregated-fit buffer allocator
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+/**
+ * A scalable host memory allocator for the buffers of the CPU devices,
+ * an alternative to the region allocator of bufalloc.c for workloads
+ * with many short-lived buffers.
+ *
+ * The memory is reserved from the system in arenas of SFA_ARENA_SIZE
+ * bytes managed with a binary buddy allocator in units of pages. The
+ * buffers up to SFA_SMALL_MAX bytes are rounded up to one of the size
+ * classes and carved from slabs taken from the buddy allocator. Each
+ * size class has a central free list and each thread a cache of freed
+ * objects per class, thus most of the small allocations and frees take
+ * no lock. The buffers larger than a quarter of an arena are allocated
+ * from the system directly.
+ *
+ * @file sfalloc.h
+ */
+
+#ifndef SFALLOC_H
+#define SFALLOC_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "pocl_cl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SFA_PAGE_SHIFT 12
+#define SFA_PAGE_SIZE (1 << SFA_PAGE_SHIFT)
+/* The largest buddy block is a whole arena of 2^SFA_MAX_ORDER pages. */
+#define SFA_MAX_ORDER 14
+#define SFA_ARENA_SIZE ((size_t)SFA_PAGE_SIZE << SFA_MAX_ORDER)
+#define SFA_MAX_ARENAS 256
+/* The slabs the small allocations are carved from are buddy blocks of
+   this order. */
+#define SFA_SLAB_ORDER 4
+#define SFA_SMALL_MAX 8192
+#define SFA_NUM_CLASSES 12
+/* The alignment of all the returned buffers. */
+#define SFA_ALIGNMENT 128
+
+typedef struct sfa_arena sfa_arena;
+typedef struct sfa_free_block sfa_free_block;
+typedef struct sfa_huge sfa_huge;
+
+/* The central free list of a size class. */
+typedef struct sfa_class
+{
+  pocl_lock_t lock;
+  void *free_list;
+  size_t size;
+} __attribute__ ((aligned (64))) sfa_class;
+
+typedef struct sfa_stats
+{
+  /* The bytes reserved from the system. */
+  size_t reserved_bytes;
+  /* The bytes currently allocated, rounded up to the size class or
+     the buddy block size. */
+  size_t allocated_bytes;
+  /* The bytes held by the slabs of the small size classes. */
+  size_t slab_bytes;
+  /* The free bytes of the buddy allocator and its largest free block.
+     Their ratio tells the external fragmentation. */
+  size_t free_bytes;
+  size_t largest_free_block;
+  /* The total requested and rounded-up bytes of all the allocations
+     made, for the internal fragmentation. */
+  unsigned long long requested_bytes;
+  unsigned long long rounded_bytes;
+  unsigned long long num_allocs;
+  unsigned long long num_frees;
+  /* The small allocations served from the thread caches. */
+  unsigned long long cache_hits;
+  unsigned long long total_alloc_ns;
+  unsigned long long max_alloc_ns;
+} sfa_stats;
+
+typedef struct sfa_heap
+{
+  sfa_class classes[SFA_NUM_CLASSES];
+  /* Protects the buddy free lists, adding arenas and the huge
+     allocation list. */
+  pocl_lock_t lock;
+  sfa_free_block *free_blocks[SFA_MAX_ORDER + 1];
+  /* Only appended to, searched without the lock. */
+  sfa_arena * volatile arenas[SFA_MAX_ARENAS];
+  volatile unsigned num_arenas;
+  sfa_huge *huge;
+  /* The per-thread caches of the small objects. */
+  pthread_key_t cache_key;
+  /* The byte and allocation counters are updated only if non-zero. */
+  int collect_stats;
+  volatile sfa_stats stats;
+} sfa_heap;
+
+#pragma GCC visibility push(hidden)
+
+void sfa_init (sfa_heap *heap, int collect_stats);
+
+/* Releases all the memory of the heap. */
+void sfa_uninit (sfa_heap *heap);
+
+/* Returns a buffer aligned to SFA_ALIGNMENT, or NULL if out of memory. */
+void *sfa_alloc (sfa_heap *heap, size_t size);
+
+void sfa_free (sfa_heap *heap, void *ptr);
+
+void sfa_get_stats (sfa_heap *heap, sfa_stats *stats);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,18 +25,42 @@
 #include <hwloc.h>
 
 #include "pocl_topology.h"
+#include "pocl_runtime_config.h"
+
+#if HWLOC_API_VERSION >= 0x00020000
+#define IS_DATA_CACHE(obj) hwloc_obj_type_is_dcache((obj)->type)
+#else
+#define IS_DATA_CACHE(obj) ((obj)->type == HWLOC_OBJ_CACHE)
+#endif
+
+/* The machine topology. Loaded once and kept for the lifetime of the
+   process for binding threads and memory. */
+static hwloc_topology_t pocl_topology;
+static int pocl_topology_loaded = 0;
+static pocl_lock_t pocl_topology_lock = POCL_LOCK_INITIALIZER;
+
+static hwloc_topology_t
+get_topology()
+{
+  POCL_LOCK(pocl_topology_lock);
+  if (!pocl_topology_loaded)
+    {
+      int ret = hwloc_topology_init(&pocl_topology);
+      if (ret == -1)
+        POCL_ABORT("Cannot initialize the topology.\n");
+      ret = hwloc_topology_load(pocl_topology);
+      if (ret == -1)
+        POCL_ABORT("Cannot load the topology.\n");
+      pocl_topology_loaded = 1;
+    }
+  POCL_UNLOCK(pocl_topology_lock);
+  return pocl_topology;
+}
 
 void
 pocl_topology_detect_device_info(cl_device_id device)
 {
-  hwloc_topology_t pocl_topology;
-
-  int ret = hwloc_topology_init(&pocl_topology);
-  if (ret == -1)
-    POCL_ABORT("Cannot initialize the topology.\n");
-  ret = hwloc_topology_load(pocl_topology);
-  if (ret == -1)
-    POCL_ABORT("Cannot load the topology.\n");
+  hwloc_topology_t pocl_topology = get_topology();
 
   device->global_mem_size = hwloc_get_root_obj(pocl_topology)->memory.total_memory;
 
@@ -47,14 +71,121 @@ pocl_topology_detect_device_info(cl_device_id device)
 
   device->local_mem_size = device->max_constant_buffer_size = device->max_mem_alloc_size;
 
+  /* The buffers are allocated at first use and the large ones mapped
+     without reserving swap, thus on 64-bit hosts a single buffer can
+     be allowed to use all the memory if asked for. */
+  if (sizeof (void*) >= 8 && pocl_get_bool_option ("POCL_UNCAPPED_MEM_ALLOC", 0))
+    device->max_mem_alloc_size = device->global_mem_size;
+
   // Try to get the number of CPU cores from topology
   int depth = hwloc_get_type_depth(pocl_topology, HWLOC_OBJ_PU);
   if(depth != HWLOC_TYPE_DEPTH_UNKNOWN)
     device->max_compute_units = hwloc_get_nbobjs_by_depth(pocl_topology, depth);
+}
 
-  // Destroy topology object and return
-  hwloc_topology_destroy(pocl_topology);
+int
+pocl_topology_bind_thread(unsigned pu)
+{
+  hwloc_topology_t topology = get_topology();
+  hwloc_obj_t obj;
+  int num_pus;
+
+  num_pus = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_PU);
+  if (num_pus <= 0)
+    return -1;
 
+  obj = hwloc_get_obj_by_type(topology, HWLOC_OBJ_PU, pu % num_pus);
+  if (obj == NULL)
+    return -1;
+
+  return hwloc_set_cpubind(topology, obj->cpuset, HWLOC_CPUBIND_THREAD);
 }
 
+unsigned
+pocl_topology_num_numa_nodes()
+{
+  int nodes = hwloc_get_nbobjs_by_type(get_topology(), HWLOC_OBJ_NODE);
+  return nodes > 0 ? nodes : 1;
+}
+
+unsigned
+pocl_topology_pu_numa_node(unsigned pu)
+{
+  hwloc_topology_t topology = get_topology();
+  int num_pus = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_PU);
+  int num_nodes = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_NODE);
+  hwloc_obj_t pu_obj;
+  int i;
 
+  if (num_pus <= 0 || num_nodes <= 1)
+    return 0;
+
+  pu_obj = hwloc_get_obj_by_type(topology, HWLOC_OBJ_PU, pu % num_pus);
+  if (pu_obj == NULL)
+    return 0;
+
+  for (i = 0; i < num_nodes; ++i)
+    {
+      hwloc_obj_t node = hwloc_get_obj_by_type(topology, HWLOC_OBJ_NODE, i);
+      if (node != NULL && hwloc_bitmap_isincluded(pu_obj->cpuset, node->cpuset))
+        return i;
+    }
+  return 0;
+}
+
+cl_ulong
+pocl_topology_numa_node_memory(unsigned node)
+{
+  hwloc_obj_t obj = 
+    hwloc_get_obj_by_type(get_topology(), HWLOC_OBJ_NODE, node);
+  if (obj == NULL)
+    return 0;
+  return obj->memory.local_memory;
+}
+
+int
+pocl_topology_bind_memory(const void *addr, size_t len, unsigned node)
+{
+  hwloc_topology_t topology = get_topology();
+  hwloc_obj_t obj = hwloc_get_obj_by_type(topology, HWLOC_OBJ_NODE, node);
+  if (obj == NULL)
+    return -1;
+
+  /* Migrate the pages that were already touched. The rest are placed 
+     to the node on the first touch. */
+  return hwloc_set_area_membind_nodeset(topology, addr, len, obj->nodeset,
+                                        HWLOC_MEMBIND_BIND,
+                                        HWLOC_MEMBIND_MIGRATE);
+}
+
+size_t
+pocl_topology_cache_size(unsigned level)
+{
+  hwloc_topology_t topology = get_topology();
+  int depth = (int)hwloc_topology_get_depth(topology);
+  unsigned found_level = 0;
+  size_t size = 0;
+  int d, i, n;
+
+  for (d = 0; d < depth; ++d)
+    {
+      n = hwloc_get_nbobjs_by_depth(topology, d);
+      for (i = 0; i < n; ++i)
+        {
+          hwloc_obj_t obj = hwloc_get_obj_by_depth(topology, d, i);
+          unsigned obj_level;
+          if (obj == NULL || !IS_DATA_CACHE(obj))
+            continue;
+          obj_level = obj->attr->cache.depth;
+          if (level == 0 ? obj_level < found_level : obj_level != level)
+            continue;
+          /* A deeper last-level cache replaces the ones found so far. */
+          if (obj_level > found_level)
+            size = 0;
+          found_level = obj_level;
+          if (obj->attr->cache.size > size)
+            size = obj->attr->cache.size;
+        }
+    }
+  return size;
+}
@@ -35,6 +35,30 @@
 
 #pragma GCC visibility push(hidden)
 void pocl_topology_detect_device_info(cl_device_id device);
+
+/* Binds the calling thread to the processing unit with the given logical
+   index (wrapped around the number of PUs in the machine). Returns 0 on
+   success, -1 if the binding is not supported or failed. */
+int pocl_topology_bind_thread(unsigned pu);
+
+/* Returns the number of NUMA nodes in the machine (at least 1). */
+unsigned pocl_topology_num_numa_nodes();
+
+/* Returns the logical index of the NUMA node the processing unit with
+   the given logical index belongs to. */
+unsigned pocl_topology_pu_numa_node(unsigned pu);
+
+/* Returns the amount of memory local to the given NUMA node in bytes. */
+cl_ulong pocl_topology_numa_node_memory(unsigned node);
+
+/* Binds the pages of the given memory area to the NUMA node. Returns 0
+   on success. */
+int pocl_topology_bind_memory(const void *addr, size_t len, unsigned node);
+
+/* Returns the size of the largest data cache of the given level in bytes,
+   or of the last-level cache if 'level' is 0. Returns 0 if hwloc does
+   not know the caches. */
+size_t pocl_topology_cache_size(unsigned level);
 #pragma GCC visibility pop
 
 #endif /* POCL_TOPOLOGY_H */
@@ -0,0 +1,836 @@
+/* OpenCL runtime library: the persistent kernel cache
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_cache.h"
+#include "pocl_hash.h"
+#include "pocl_runtime_config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+/* The default size limit of the cache in megabytes. */
+#define DEFAULT_CACHE_SIZE 256
+/* The temporary files of the processes that crashed while writing an
+   entry are removed after this many seconds. */
+#define STALE_TEMP_FILE_AGE 3600
+#define KEY_LENGTH (2 * POCL_SHA1_DIGEST_SIZE + 1)
+#define METADATA_HEADER "pocl kernel metadata 1\n"
+/* Sanity limit for reading corrupted metadata. */
+#define MAX_METADATA_ARGS 4096
+
+typedef enum
+{
+  ENTRY_PROGRAM,
+  ENTRY_METADATA,
+  ENTRY_WORKGROUP,
+  ENTRY_OBJECT,
+  NUM_ENTRY_KINDS
+} entry_kind;
+
+static const char *entry_suffix[NUM_ENTRY_KINDS] = 
+  { ".bc", ".md", ".so", ".o" };
+static const char *entry_name[NUM_ENTRY_KINDS] = 
+  { "program bitcode", "kernel metadata", "work-group functions",
+    "work-group function objects" };
+
+/* The environment variables read by the kernel compiler passes. */
+static const char *compiler_options[] = 
+  { "POCL_WORK_GROUP_METHOD", "POCL_FULL_REPLICATION_THRESHOLD",
+    "POCL_WILOOPS_MAX_UNROLL_COUNT", NULL };
+
+typedef struct entry_info
+{
+  time_t mtime;
+  off_t size;
+  char name[KEY_LENGTH + 3];
+} entry_info;
+
+static pocl_lock_t init_lock = POCL_LOCK_INITIALIZER;
+static volatile int initialized = 0;
+/* NULL if the cache is disabled. */
+static char *cache_dir = NULL;
+static size_t cache_max_size;
+
+static unsigned long hits[NUM_ENTRY_KINDS];
+static unsigned long misses[NUM_ENTRY_KINDS];
+static unsigned long stores;
+static unsigned long evictions;
+
+/* Creates the directory and its missing parents. */
+static int
+make_dirs (char *path)
+{
+  struct stat st;
+  char *p;
+
+  for (p = strchr (path + 1, '/'); ; p = strchr (p + 1, '/'))
+    {
+      if (p != NULL)
+        *p = '\0';
+      if (mkdir (path, S_IRWXU) != 0 && errno != EEXIST)
+        {
+          if (p != NULL)
+            *p = '/';
+          return -1;
+        }
+      if (p == NULL)
+        break;
+      *p = '/';
+    }
+  return stat (path, &st) == 0 && S_ISDIR (st.st_mode) ? 0 : -1;
+}
+
+int
+pocl_cache_enabled (void)
+{
+  char path[POCL_FILENAME_LENGTH];
+  const char *base;
+
+  if (initialized)
+    return cache_dir != NULL;
+
+  POCL_LOCK (init_lock);
+  /* The kernel library of a build tree changes without the version
+     changing, thus POCL_BUILDING disables the cache by default. */
+  if (!initialized &&
+      pocl_get_bool_option ("POCL_KERNEL_CACHE", 
+                            !pocl_get_bool_option ("POCL_BUILDING", 0)))
+    {
+      path[0] = '\0';
+      if ((base = pocl_get_string_option ("POCL_KERNEL_CACHE_DIR", NULL))
+          != NULL)
+        snprintf (path, POCL_FILENAME_LENGTH, "%s", base);
+      else if ((base = getenv ("XDG_CACHE_HOME")) != NULL && *base != '\0')
+        snprintf (path, POCL_FILENAME_LENGTH, "%s/pocl/kcache", base);
+      else if ((base = getenv ("HOME")) != NULL)
+        snprintf (path, POCL_FILENAME_LENGTH, "%s/.cache/pocl/kcache", base);
+
+      if (path[0] != '\0' && make_dirs (path) == 0)
+        cache_dir = strdup (path);
+      cache_max_size = (size_t)pocl_get_int_option 
+        ("POCL_KERNEL_CACHE_SIZE", DEFAULT_CACHE_SIZE) << 20;
+    }
+  __sync_synchronize ();
+  initialized = 1;
+  POCL_UNLOCK (init_lock);
+  return cache_dir != NULL;
+}
+
+static void
+hash_string (pocl_sha1_ctx *ctx, const char *s)
+{
+  /* The terminating zero separates the strings. */
+  if (s == NULL)
+    s = "";
+  pocl_sha1_update (ctx, s, strlen (s) + 1);
+}
+
+static void
+final_key (pocl_sha1_ctx *ctx, char *key)
+{
+  unsigned char digest[POCL_SHA1_DIGEST_SIZE];
+  int i;
+
+  pocl_sha1_final (ctx, digest);
+  for (i = 0; i < POCL_SHA1_DIGEST_SIZE; ++i)
+    sprintf (key + 2 * i, "%02x", digest[i]);
+}
+
+/* Returns non-zero if the build may read headers other than the ones
+   of pocl: the build options add include directories or headers (-I,
+   -include, -isystem etc.) or the source has an #include directive.
+   The key does not cover the contents of such headers, thus these
+   builds are not cached. */
+static int
+includes_files (cl_program program)
+{
+  static const char *const include_options[] =
+    { "-I", "-include", "-imacros", "-isystem", "-iquote", "-idirafter" };
+  const char *s = program->compiler_options;
+  unsigned i;
+
+  while (s != NULL && (s = strchr (s, '-')) != NULL)
+    {
+      if (s == program->compiler_options || s[-1] == ' ')
+        {
+          for (i = 0; i < sizeof (include_options) / sizeof (char*); ++i)
+            {
+              if (strncmp (s, include_options[i],
+                           strlen (include_options[i])) == 0)
+                return 1;
+            }
+        }
+      ++s;
+    }
+
+  for (s = program->source; s != NULL; s = strchr (s, '\n'))
+    {
+      while (*s == '\n' || *s == ' ' || *s == '\t')
+        ++s;
+      if (*s != '#')
+        continue;
+      ++s;
+      while (*s == ' ' || *s == '\t')
+        ++s;
+      if (strncmp (s, "include", 7) == 0)
+        return 1;
+    }
+  return 0;
+}
+
+/* Returns the key of the program build for the device, NULL if not
+   cached. */
+static const char *
+program_key (cl_program program, cl_device_id device)
+{
+  unsigned i;
+
+  if (program == NULL || program->cache_keys == NULL)
+    return NULL;
+  for (i = 0; i < program->num_devices; ++i)
+    {
+      if (program->devices[i] == device)
+        return program->cache_keys[i];
+    }
+  return NULL;
+}
+
+/* The key of the metadata of a kernel if 'local_size' is NULL, otherwise
+   the key of its work-group function for the local size. */
+static const char *
+kernel_key (cl_program program, cl_device_id device, const char *kernel_name,
+            const size_t *local_size, char *key)
+{
+  const char *pkey = program_key (program, device);
+  pocl_sha1_ctx ctx;
+
+  if (pkey == NULL)
+    return NULL;
+  pocl_sha1_init (&ctx);
+  hash_string (&ctx, pkey);
+  hash_string (&ctx, kernel_name);
+  if (local_size != NULL)
+    pocl_sha1_update (&ctx, local_size, 3 * sizeof (size_t));
+  final_key (&ctx, key);
+  return key;
+}
+
+static void
+entry_path (const char *key, entry_kind kind, char *path)
+{
+  snprintf (path, POCL_FILENAME_LENGTH, "%s/%s%s", cache_dir, key,
+            entry_suffix[kind]);
+}
+
+/* Returns 0 on success. 'dst' is removed if the copying fails after
+   creating it. */
+static int
+copy_file (const char *src, const char *dst)
+{
+  char buf[65536];
+  ssize_t n = 0;
+  int in, out;
+
+  in = open (src, O_RDONLY);
+  if (in == -1)
+    return -1;
+  out = open (dst, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (out == -1)
+    {
+      close (in);
+      return -1;
+    }
+  while ((n = read (in, buf, sizeof (buf))) > 0)
+    {
+      if (write (out, buf, n) != n)
+        {
+          n = -1;
+          break;
+        }
+    }
+  close (in);
+  if (close (out) != 0 || n != 0)
+    {
+      unlink (dst);
+      return -1;
+    }
+  return 0;
+}
+
+/* Counts a hit and marks the entry as recently used. */
+static void
+entry_used (const char *path, entry_kind kind)
+{
+  /* The modification time orders the entries for the eviction. */
+  utime (path, NULL);
+  __sync_fetch_and_add (&hits[kind], 1);
+}
+
+static int
+fetch (const char *key, entry_kind kind, const char *filename)
+{
+  char path[POCL_FILENAME_LENGTH];
+
+  entry_path (key, kind, path);
+  if (copy_file (path, filename) != 0)
+    {
+      __sync_fetch_and_add (&misses[kind], 1);
+      return 0;
+    }
+  entry_used (path, kind);
+  return 1;
+}
+
+static int
+compare_mtime (const void *a, const void *b)
+{
+  time_t ta = ((const entry_info*)a)->mtime;
+  time_t tb = ((const entry_info*)b)->mtime;
+  return ta < tb ? -1 : ta > tb;
+}
+
+/* Removes the least recently used entries until the cache fits to its
+   size limit. Called with the cache locked. */
+static void
+evict (void)
+{
+  char path[POCL_FILENAME_LENGTH];
+  entry_info *entries = NULL;
+  entry_info *grown;
+  size_t num_entries = 0;
+  size_t capacity = 0;
+  size_t total = 0;
+  size_t i;
+  time_t now = time (NULL);
+  struct dirent *de;
+  struct stat st;
+  DIR *dir;
+
+  dir = opendir (cache_dir);
+  if (dir == NULL)
+    return;
+  while ((de = readdir (dir)) != NULL)
+    {
+      if (de->d_name[0] == '.' || strcmp (de->d_name, "lock") == 0)
+        continue;
+      snprintf (path, POCL_FILENAME_LENGTH, "%s/%s", cache_dir, de->d_name);
+      if (stat (path, &st) != 0 || !S_ISREG (st.st_mode))
+        continue;
+      if (strncmp (de->d_name, "tmp-", 4) == 0)
+        {
+          if (now - st.st_mtime > STALE_TEMP_FILE_AGE)
+            unlink (path);
+          continue;
+        }
+      if (strlen (de->d_name) >= sizeof (entries->name))
+        continue;
+      if (num_entries == capacity)
+        {
+          capacity = capacity ? 2 * capacity : 256;
+          grown = (entry_info*)realloc (entries, 
+                                        capacity * sizeof (entry_info));
+          if (grown == NULL)
+            break;
+          entries = grown;
+        }
+      entries[num_entries].mtime = st.st_mtime;
+      entries[num_entries].size = st.st_size;
+      strcpy (entries[num_entries].name, de->d_name);
+      ++num_entries;
+      total += st.st_size;
+    }
+  closedir (dir);
+
+  if (total > cache_max_size)
+    {
+      qsort (entries, num_entries, sizeof (entry_info), compare_mtime);
+      for (i = 0; i < num_entries && total > cache_max_size; ++i)
+        {
+          snprintf (path, POCL_FILENAME_LENGTH, "%s/%s", cache_dir,
+                    entries[i].name);
+          if (unlink (path) == 0)
+            {
+              total -= entries[i].size;
+              __sync_fetch_and_add (&evictions, 1);
+            }
+        }
+    }
+  free (entries);
+}
+
+/* Creates a temporary file in the cache directory for writing an entry.
+   Returns the file descriptor, -1 on failure. */
+static int
+create_temp_file (char *temp_path)
+{
+  snprintf (temp_path, POCL_FILENAME_LENGTH, "%s/tmp-XXXXXX", cache_dir);
+  return mkstemp (temp_path);
+}
+
+/* Renames the written temporary file to the entry. Other processes can
+   publish the same entry at the same time, in which case one of the
+   identical files wins. */
+static void
+publish (const char *temp_path, const char *key, entry_kind kind)
+{
+  char path[POCL_FILENAME_LENGTH];
+  int lock_fd;
+
+  snprintf (path, POCL_FILENAME_LENGTH, "%s/lock", cache_dir);
+  lock_fd = open (path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  if (lock_fd != -1)
+    flock (lock_fd, LOCK_EX);
+
+  entry_path (key, kind, path);
+  if (rename (temp_path, path) == 0)
+    {
+      __sync_fetch_and_add (&stores, 1);
+      evict ();
+    }
+  else
+    unlink (temp_path);
+
+  /* closing releases the lock */
+  if (lock_fd != -1)
+    close (lock_fd);
+}
+
+static void
+store (const char *key, entry_kind kind, const char *filename)
+{
+  char temp_path[POCL_FILENAME_LENGTH];
+  int fd;
+
+  fd = create_temp_file (temp_path);
+  if (fd == -1)
+    return;
+  close (fd);
+  if (copy_file (filename, temp_path) == 0)
+    publish (temp_path, key, kind);
+  else
+    unlink (temp_path);
+}
+
+int
+pocl_cache_init_program (cl_program program, cl_device_id device, 
+                         int device_i)
+{
+  pocl_sha1_ctx ctx;
+  char key[KEY_LENGTH];
+  unsigned i;
+  int j;
+
+  for (i = 0; i < program->num_devices; ++i)
+    {
+      if (program->devices[i] == device)
+        break;
+    }
+  if (i == program->num_devices)
+    return 0;
+  if (program->cache_keys == NULL)
+    {
+      program->cache_keys = (char**)calloc (program->num_devices, 
+                                            sizeof (char*));
+      if (program->cache_keys == NULL)
+        return 0;
+    }
+  /* the program is rebuilt */
+  free (program->cache_keys[i]);
+  program->cache_keys[i] = NULL;
+
+  if (!pocl_cache_enabled () || device->ops->init_build != NULL ||
+      includes_files (program))
+    return 0;
+
+  pocl_sha1_init (&ctx);
+  hash_string (&ctx, "pocl " PACKAGE_VERSION);
+  hash_string (&ctx, "LLVM " POCL_LLVM_VERSION);
+  hash_string (&ctx, device->short_name);
+  hash_string (&ctx, device->llvm_target_triplet);
+  hash_string (&ctx, device->llvm_cpu);
+  pocl_sha1_update (&ctx, &device->has_64bit_long, sizeof (int));
+  pocl_sha1_update (&ctx, &device->wi_sub_ranges, sizeof (int));
+  for (j = 0; compiler_options[j] != NULL; ++j)
+    hash_string (&ctx, pocl_get_string_option (compiler_options[j], NULL));
+  hash_string (&ctx, program->compiler_options);
+  if (program->source != NULL)
+    hash_string (&ctx, program->source);
+  else
+    pocl_sha1_update (&ctx, program->binaries[device_i], 
+                      program->binary_sizes[device_i]);
+  final_key (&ctx, key);
+
+  program->cache_keys[i] = strdup (key);
+  return program->cache_keys[i] != NULL;
+}
+
+int
+pocl_cache_get_program (cl_program program, cl_device_id device,
+                        const char *filename)
+{
+  const char *key = program_key (program, device);
+
+  return key != NULL && fetch (key, ENTRY_PROGRAM, filename);
+}
+
+void
+pocl_cache_put_program (cl_program program, cl_device_id device,
+                        const char *filename)
+{
+  const char *key = program_key (program, device);
+
+  if (key != NULL)
+    store (key, ENTRY_PROGRAM, filename);
+}
+
+/* The strings are written as their length and the characters, -1 for
+   NULL. */
+static void
+write_string (FILE *f, const char *s)
+{
+  if (s == NULL)
+    fprintf (f, "-1\n");
+  else
+    fprintf (f, "%u %s\n", (unsigned)strlen (s), s);
+}
+
+static int
+read_string (FILE *f, char **s)
+{
+  int len;
+
+  *s = NULL;
+  if (fscanf (f, "%d", &len) != 1)
+    return -1;
+  if (len < 0)
+    return fgetc (f) == '\n' ? 0 : -1;
+  if (fgetc (f) != ' ' || (*s = (char*)malloc (len + 1)) == NULL)
+    return -1;
+  if (fread (*s, 1, len, f) != (size_t)len || fgetc (f) != '\n')
+    {
+      free (*s);
+      *s = NULL;
+      return -1;
+    }
+  (*s)[len] = '\0';
+  return 0;
+}
+
+int
+pocl_cache_get_kernel_metadata (cl_program program, cl_device_id device,
+                                cl_kernel kernel, const char *kernel_name,
+                                const char *device_tmpdir)
+{
+  char key[KEY_LENGTH];
+  char path[POCL_FILENAME_LENGTH];
+  char header[sizeof (METADATA_HEADER)];
+  struct pocl_argument *dyn_arguments = NULL;
+  struct pocl_argument_info *arg_info = NULL;
+  int *reqd_wg_size = NULL;
+  unsigned num_args, num_locals, i;
+  unsigned long has_arg_metadata;
+  int complete = 0;
+  FILE *f;
+
+  if (kernel_key (program, device, kernel_name, NULL, key) == NULL)
+    return 0;
+  entry_path (key, ENTRY_METADATA, path);
+  f = fopen (path, "r");
+  if (f == NULL)
+    {
+      __sync_fetch_and_add (&misses[ENTRY_METADATA], 1);
+      return 0;
+    }
+
+  reqd_wg_size = (int*)malloc (3 * sizeof (int));
+  if (reqd_wg_size == NULL ||
+      fgets (header, sizeof (header), f) == NULL ||
+      strcmp (header, METADATA_HEADER) != 0 ||
+      fscanf (f, "%u %u %lu %d %d %d", &num_args, &num_locals, 
+              &has_arg_metadata, &reqd_wg_size[0], &reqd_wg_size[1],
+              &reqd_wg_size[2]) != 6 ||
+      num_args > MAX_METADATA_ARGS || num_locals > MAX_METADATA_ARGS)
+    goto DONE;
+
+  dyn_arguments = (struct pocl_argument*)
+    malloc ((num_args + num_locals + 1) * sizeof (struct pocl_argument));
+  arg_info = (struct pocl_argument_info*)
+    calloc (num_args + 1, sizeof (struct pocl_argument_info));
+  if (dyn_arguments == NULL || arg_info == NULL)
+    goto DONE;
+
+  for (i = 0; i < num_args + num_locals; ++i)
+    {
+      dyn_arguments[i].value = NULL;
+      dyn_arguments[i].size = 0;
+    }
+  for (i = 0; i < num_locals; ++i)
+    {
+      if (fscanf (f, "%zu", &dyn_arguments[num_args + i].size) != 1)
+        goto DONE;
+    }
+  for (i = 0; i < num_args; ++i)
+    {
+      struct pocl_argument_info *ai = &arg_info[i];
+      unsigned address_qualifier, access_qualifier;
+      unsigned long type_qualifier;
+      int type, is_local;
+
+      if (fscanf (f, "%d %d %u %u %lu", &type, &is_local, &address_qualifier,
+                  &access_qualifier, &type_qualifier) != 5)
+        goto DONE;
+      ai->type = (pocl_argument_type)type;
+      ai->is_local = is_local;
+      ai->address_qualifier = address_qualifier;
+      ai->access_qualifier = access_qualifier;
+      ai->type_qualifier = type_qualifier;
+      if (read_string (f, &ai->type_name) != 0 ||
+          read_string (f, &ai->name) != 0)
+        goto DONE;
+    }
+  complete = 1;
+
+ DONE:
+  fclose (f);
+  if (!complete)
+    {
+      /* a corrupted entry, replaced when the kernel is compiled */
+      if (arg_info != NULL)
+        {
+          for (i = 0; i < num_args; ++i)
+            {
+              free (arg_info[i].type_name);
+              free (arg_info[i].name);
+            }
+        }
+      free (arg_info);
+      free (dyn_arguments);
+      free (reqd_wg_size);
+      __sync_fetch_and_add (&misses[ENTRY_METADATA], 1);
+      return 0;
+    }
+
+  kernel->num_args = num_args;
+  kernel->num_locals = num_locals;
+  kernel->has_arg_metadata = has_arg_metadata;
+  kernel->arg_info = arg_info;
+  kernel->dyn_arguments = dyn_arguments;
+  kernel->reqd_wg_size = reqd_wg_size;
+
+  /* The work-group functions are generated to the kernel's directory. */
+  snprintf (path, POCL_FILENAME_LENGTH, "%s/%s", device_tmpdir, kernel_name);
+  mkdir (path, S_IRWXU);
+
+  entry_path (key, ENTRY_METADATA, path);
+  entry_used (path, ENTRY_METADATA);
+  return 1;
+}
+
+void
+pocl_cache_put_kernel_metadata (cl_program program, cl_device_id device,
+                                cl_kernel kernel, const char *kernel_name)
+{
+  char key[KEY_LENGTH];
+  char temp_path[POCL_FILENAME_LENGTH];
+  unsigned i;
+  FILE *f;
+  int fd;
+
+  if (kernel_key (program, device, kernel_name, NULL, key) == NULL)
+    return;
+  fd = create_temp_file (temp_path);
+  if (fd == -1)
+    return;
+  f = fdopen (fd, "w");
+  if (f == NULL)
+    {
+      close (fd);
+      unlink (temp_path);
+      return;
+    }
+
+  fputs (METADATA_HEADER, f);
+  fprintf (f, "%u %u %lu %d %d %d\n", kernel->num_args, kernel->num_locals,
+           (unsigned long)kernel->has_arg_metadata, kernel->reqd_wg_size[0],
+           kernel->reqd_wg_size[1], kernel->reqd_wg_size[2]);
+  for (i = 0; i < kernel->num_locals; ++i)
+    fprintf (f, "%zu\n", kernel->dyn_arguments[kernel->num_args + i].size);
+  for (i = 0; i < kernel->num_args; ++i)
+    {
+      struct pocl_argument_info *ai = &kernel->arg_info[i];
+      fprintf (f, "%d %d %u %u %lu\n", (int)ai->type, (int)ai->is_local,
+               (unsigned)ai->address_qualifier,
+               (unsigned)ai->access_qualifier,
+               (unsigned long)ai->type_qualifier);
+      write_string (f, ai->type_name);
+      write_string (f, ai->name);
+    }
+
+  if (ferror (f) | fclose (f))
+    unlink (temp_path);
+  else
+    publish (temp_path, key, ENTRY_METADATA);
+}
+
+static const char *
+workgroup_key (cl_kernel kernel, cl_device_id device, size_t local_x,
+               size_t local_y, size_t local_z, char *key)
+{
+  size_t local_size[3];
+
+  local_size[0] = local_x;
+  local_size[1] = local_y;
+  local_size[2] = local_z;
+  return kernel_key (kernel->program, device, kernel->name, local_size, key);
+}
+
+int
+pocl_cache_get_workgroup_function (cl_kernel kernel, cl_device_id device,
+                                   size_t local_x, size_t local_y,
+                                   size_t local_z, const char *filename)
+{
+  char key[KEY_LENGTH];
+
+  if (workgroup_key (kernel, device, local_x, local_y, local_z, key) == NULL)
+    return 0;
+  return fetch (key, ENTRY_WORKGROUP, filename);
+}
+
+void
+pocl_cache_put_workgroup_function (cl_kernel kernel, cl_device_id device,
+                                   size_t local_x, size_t local_y,
+                                   size_t local_z, const char *filename)
+{
+  char key[KEY_LENGTH];
+  char path[POCL_FILENAME_LENGTH];
+
+  if (workgroup_key (kernel, device, local_x, local_y, local_z, key) == NULL)
+    return;
+  /* fetched from the cache */
+  entry_path (key, ENTRY_WORKGROUP, path);
+  if (access (path, F_OK) == 0)
+    return;
+  store (key, ENTRY_WORKGROUP, filename);
+}
+
+/* Reads the whole file to a malloc()ed buffer. Returns 0 on success. */
+static int
+read_file (const char *path, char **data, size_t *size)
+{
+  struct stat st;
+  char *buf;
+  size_t done = 0;
+  ssize_t n;
+  int fd;
+
+  fd = open (path, O_RDONLY);
+  if (fd == -1)
+    return -1;
+  if (fstat (fd, &st) != 0 || st.st_size == 0 ||
+      (buf = (char*)malloc (st.st_size)) == NULL)
+    {
+      close (fd);
+      return -1;
+    }
+  while (done < (size_t)st.st_size &&
+         (n = read (fd, buf + done, st.st_size - done)) > 0)
+    done += n;
+  close (fd);
+  if (done != (size_t)st.st_size)
+    {
+      free (buf);
+      return -1;
+    }
+  *data = buf;
+  *size = done;
+  return 0;
+}
+
+int
+pocl_cache_get_workgroup_object (cl_kernel kernel, cl_device_id device,
+                                 size_t local_x, size_t local_y,
+                                 size_t local_z, char **data, size_t *size)
+{
+  char key[KEY_LENGTH];
+  char path[POCL_FILENAME_LENGTH];
+
+  if (workgroup_key (kernel, device, local_x, local_y, local_z, key) == NULL)
+    return 0;
+  entry_path (key, ENTRY_OBJECT, path);
+  if (read_file (path, data, size) != 0)
+    {
+      __sync_fetch_and_add (&misses[ENTRY_OBJECT], 1);
+      return 0;
+    }
+  entry_used (path, ENTRY_OBJECT);
+  return 1;
+}
+
+void
+pocl_cache_put_workgroup_object (cl_kernel kernel, cl_device_id device,
+                                 size_t local_x, size_t local_y,
+                                 size_t local_z, const char *data,
+                                 size_t size)
+{
+  char key[KEY_LENGTH];
+  char temp_path[POCL_FILENAME_LENGTH];
+  size_t done = 0;
+  ssize_t n = 0;
+  int fd;
+
+  if (workgroup_key (kernel, device, local_x, local_y, local_z, key) == NULL)
+    return;
+  fd = create_temp_file (temp_path);
+  if (fd == -1)
+    return;
+  while (done < size && (n = write (fd, data + done, size - done)) > 0)
+    done += n;
+  if (close (fd) == 0 && done == size)
+    publish (temp_path, key, ENTRY_OBJECT);
+  else
+    unlink (temp_path);
+}
+
+void
+pocl_cache_print_stats (void)
+{
+  int i;
+
+  if (!initialized || cache_dir == NULL)
+    return;
+  fprintf (stderr, "pocl: kernel cache %s:\n", cache_dir);
+  for (i = 0; i < NUM_ENTRY_KINDS; ++i)
+    fprintf (stderr, "  %s: %lu hits, %lu misses\n", entry_name[i],
+             hits[i], misses[i]);
+  fprintf (stderr, "  entries stored: %lu, evicted: %lu\n", stores,
+           evictions);
+}
@@ -0,0 +1,121 @@
+/* OpenCL runtime library: the persistent kernel cache
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+/**
+ * @file pocl_cache.h
+ *
+ * The compilation results are stored to a cache directory shared by all
+ * the processes of the user, thus a restarted application does not
+ * compile its kernels again. The directory holds four kinds of entries:
+ * the program bitcode produced by Clang (.bc), the metadata of a kernel
+ * of the program (.md) and the work-group function of a kernel for a
+ * local size, either linked to a shared library (.so) or as the object
+ * compiled in memory by the JIT (.o).
+ *
+ * The entries are named by a SHA-1 key. The key of a program build hashes
+ * the versions of pocl and LLVM, the device's target triple and CPU, the
+ * options affecting the kernel compiler, the build options and the source
+ * (or the binary if the program was created from one). The keys of the
+ * kernels hash the program key with the kernel name and the local size.
+ *
+ * An entry is written to a temporary file which is renamed to the final
+ * name, thus the readers never see a partial entry. The renames and the
+ * eviction of the least recently used entries when the cache exceeds its
+ * size limit are serialized by a lock file.
+ *
+ * The devices adding their own build options (init_build) are not cached
+ * because the options may depend on the device configuration.
+ */
+
+#ifndef POCL_CACHE_H
+#define POCL_CACHE_H
+
+#include "pocl_cl.h"
+
+#pragma GCC visibility push(hidden)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returns non-zero if the cache is enabled and its directory exists. */
+int pocl_cache_enabled (void);
+
+/* Computes the key of the build of the program for the device. The
+   binary of index 'device_i' is hashed if the program has no source.
+   Returns 0 if the build is not cached, e.g. because it includes 
+   headers whose contents the key would not cover. */
+int pocl_cache_init_program (cl_program program, cl_device_id device,
+                             int device_i);
+
+/* Copies the cached program bitcode to 'filename'. Returns 0 if not
+   found. */
+int pocl_cache_get_program (cl_program program, cl_device_id device,
+                            const char *filename);
+
+void pocl_cache_put_program (cl_program program, cl_device_id device,
+                             const char *filename);
+
+/* Fills the argument information of the kernel from the cache. Creates
+   the kernel's directory in 'device_tmpdir' like the kernel compiler.
+   Returns 0 if not found, leaving the kernel untouched. */
+int pocl_cache_get_kernel_metadata (cl_program program, cl_device_id device,
+                                    cl_kernel kernel, const char *kernel_name,
+                                    const char *device_tmpdir);
+
+void pocl_cache_put_kernel_metadata (cl_program program, cl_device_id device,
+                                     cl_kernel kernel,
+                                     const char *kernel_name);
+
+/* Copies the cached work-group function library of the local size to
+   'filename'. Returns 0 if not found. */
+int pocl_cache_get_workgroup_function (cl_kernel kernel, cl_device_id device,
+                                       size_t local_x, size_t local_y,
+                                       size_t local_z, const char *filename);
+
+/* Stores the work-group function library unless already cached. */
+void pocl_cache_put_workgroup_function (cl_kernel kernel, cl_device_id device,
+                                        size_t local_x, size_t local_y,
+                                        size_t local_z,
+                                        const char *filename);
+
+/* Reads the cached object of the work-group function compiled in memory
+   for the local size to a malloc()ed buffer. Returns 0 if not found. */
+int pocl_cache_get_workgroup_object (cl_kernel kernel, cl_device_id device,
+                                     size_t local_x, size_t local_y,
+                                     size_t local_z, char **data,
+                                     size_t *size);
+
+void pocl_cache_put_workgroup_object (cl_kernel kernel, cl_device_id device,
+                                      size_t local_x, size_t local_y,
+                                      size_t local_z, const char *data,
+                                      size_t size);
+
+/* Prints the hits and misses to the standard error, for
+   POCL_DEVICE_STATS. */
+void pocl_cache_print_stats (void);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
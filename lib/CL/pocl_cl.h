@@ -36,6 +36,7 @@
 #  include "pocl_icd.h"
 #endif
 #include "pocl.h"
+#include "CL/cl_ext_pocl.h"
 
 #define POCL_FILENAME_LENGTH 1024
 
@@ -279,6 +280,10 @@ void (*fill_rect) (void *data,
   void* (*unmap_mem) (void *data, void *host_ptr, void *device_start_ptr, size_t size);
   
   void (*compile_submitted_kernels) (_cl_command_node* cmd);
+  /* Optional. Compiles the work-group function of the kernel variant of
+     the command before it is launched, like compile_submitted_kernels()
+     but returning non-zero on failure instead of aborting. */
+  int (*precompile_kernel) (_cl_command_node* cmd);
   void (*run) (void *data, _cl_command_node* cmd);
   void (*run_native) (void *data, _cl_command_node* cmd);
 
@@ -295,6 +300,10 @@ void (*fill_rect) (void *data,
   cl_int (*get_supported_image_formats) (cl_mem_flags flags,
                                          const cl_image_format **image_formats,
                                          cl_int *num_image_formats);
+
+  /* Prints device specific runtime statistics to stderr at exit in
+     case POCL_DEVICE_STATS is set. Optional. */
+  void (*print_stats) (cl_device_id device);
 };
 
 struct _cl_device_id {
@@ -378,6 +387,19 @@ struct _cl_device_id {
   int dev_id;
   int global_mem_id; /* identifier for device global memory */
   int has_64bit_long;  /* Does the device have 64bit longs */
+  /* Should the work-group functions support executing a sub-range of the
+     work items (see pocl_context.local_range) so a work group can be
+     split to multiple threads */
+  int wi_sub_ranges;
+  /* Non-zero if the device compiles the work-group functions in memory
+     with pocl_llvm_jit_workgroup_function() at the first launch instead
+     of loading a library linked from the parallel.bc */
+  int jit_workgroup_functions;
+  /* The maximum number of commands executed concurrently on the device.
+     Each command is executed by a thread of its own. */
+  cl_uint max_concurrent_commands;
+  /* The command executors of the device (pocl_scheduler.c). */
+  struct pocl_device_executors *executors;
 
   struct pocl_device_ops *ops; /* Device operations, shared amongst same devices */
 };
@@ -411,6 +433,22 @@ struct _cl_command_queue {
   cl_command_queue_properties properties;
   /* implementation */
   _cl_command_node *root;
+  /* The event of the last command enqueued to an in-order queue until
+     the command has been executed. Holds a reference to the event. */
+  cl_event last_event;
+  /* In out-of-order queues and in in-order queues with dependency 
+     analysis, the event of the last barrier and the commands enqueued
+     after it, until they have been executed. Hold references to the
+     events of the commands. */
+  cl_event barrier_event;
+  _cl_command_node **outstanding_commands;
+  unsigned num_outstanding_commands;
+  unsigned outstanding_commands_size;
+  /* Run the commands of an in-order queue not accessing the same buffers
+     concurrently (POCL_DEPENDENCY_ANALYSIS). */
+  int analyze_dependencies;
+  /* The number of enqueued commands not yet executed. */
+  volatile int num_pending;
 };
 
 /* memory identifier: id to point the global memory where memory resides 
@@ -447,6 +485,9 @@ struct _cl_mem {
   /* in case this is a sub buffer, this points to the parent
      buffer */
   cl_mem_t *parent;
+  /* The offset of a sub buffer in the parent buffer, 0 for the other
+     memory objects. The sub buffers share the memory of the parent. */
+  size_t origin;
   /* Image flags */
   cl_bool                 is_image;
   cl_channel_order        image_channel_order;
@@ -462,6 +503,10 @@ struct _cl_mem {
   cl_uint                 num_mip_levels;
   cl_uint                 num_samples;
   cl_mem                  buffer;
+  /* The file mapping backing a buffer created with 
+     clCreateBufferFromFilePOCL, unmapped when the buffer is freed. */
+  void                    *file_map;
+  size_t                  file_map_size;
 };
 
 struct _cl_program {
@@ -483,8 +528,37 @@ struct _cl_program {
   char *temp_dir;
   /* implementation */
   cl_kernel kernels;
-  /* Used to store the llvm IR of the build to save disk I/O. */
+  /* Used to store the llvm IR of the build to save disk I/O. Each
+     llvm::Module has an LLVMContext of its own. */
   void **llvm_irs;
+  /* Serializes the accesses to the llvm_irs and the lazily created
+     binaries, the work-group functions of the kernels are generated
+     from them in parallel. */
+  pocl_lock_t llvm_lock;
+  /* The keys of the builds in the persistent kernel cache for each
+     device, NULL if not cached (see pocl_cache.h). */
+  char **cache_keys;
+  /* The status of the last build for each device, NULL before the first
+     clBuildProgram(). */
+  cl_build_status *build_status;
+  /* Non-zero while an asynchronous build is running on the compiler
+     threads. */
+  int build_in_progress;
+};
+
+/* A work-group function of a kernel generated for a device and a local
+   size. */
+typedef struct pocl_kernel_variant pocl_kernel_variant;
+struct pocl_kernel_variant
+{
+  cl_device_id device;
+  size_t local_size[3];
+  /* The directory of the parallel.bc of the variant. */
+  char *tmp_dir;
+  /* Set by the device once it has loaded the work-group function. */
+  int sub_range_dim;
+  pocl_workgroup volatile wg;
+  pocl_kernel_variant *next;
 };
 
 struct _cl_kernel {
@@ -505,6 +579,13 @@ struct _cl_kernel {
   /* The kernel arguments that are set with clSetKernelArg().
      These are copied to the command queue command at enqueue. */
   struct pocl_argument *dyn_arguments;
+  /* The variants generated so far. Only prepended to (with the kernel
+     locked), thus can be searched without locking. */
+  pocl_kernel_variant * volatile variants;
+  /* Held while generating a work-group function of the kernel. */
+  pocl_lock_t compile_lock;
+  /* The argument blocks of the finished launches for reuse. */
+  void *free_arg_blocks;
   struct _cl_kernel *next;
 };
 
@@ -517,6 +598,14 @@ struct event_callback_item
   void *next;
 };
 
+/* A flushed command waiting for an event to complete. */
+typedef struct event_dependent event_dependent;
+struct event_dependent
+{
+  _cl_command_node *command;
+  event_dependent *next;
+};
+
 typedef struct _cl_event _cl_event;
 struct _cl_event {
   POCL_ICD_OBJECT
@@ -527,8 +616,13 @@ struct _cl_event {
   /* list of callback functions */
   event_callback_item* callback_list;
 
+  /* The commands to notify when the event completes (pocl_scheduler.c). */
+  event_dependent *dependents;
+
   /* The execution status of the command this event is monitoring. */
   cl_int status;
+  /* Broadcast with the event locked when the command has completed. */
+  pthread_cond_t completion_cond;
 
   /* Profiling data: time stamps of the different phases of execution. */
   cl_ulong time_queue;  /* the enqueue time */
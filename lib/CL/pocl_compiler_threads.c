@@ -0,0 +1,156 @@
+/* OpenCL runtime library: the compiler threads
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_compiler_threads.h"
+#include "pocl_cl.h"
+#include "pocl_runtime_config.h"
+#include "utlist.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct compiler_task compiler_task;
+struct compiler_task
+{
+  void (*func) (void *);
+  void *arg;
+  compiler_task *next;
+};
+
+static pocl_lock_t compiler_lock = POCL_LOCK_INITIALIZER;
+/* Signalled when tasks are added to the list. */
+static pthread_cond_t compiler_cond = PTHREAD_COND_INITIALIZER;
+/* Signalled when a task has finished. */
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static compiler_task *tasks = NULL;
+static int threads_started = 0;
+static int running_tasks = 0;
+static int exiting = 0;
+/* Non-zero in the compiler threads. */
+static __thread int is_compiler_thread = 0;
+
+static void *
+compiler_thread_main (void *arg)
+{
+  is_compiler_thread = 1;
+  POCL_LOCK (compiler_lock);
+  for (;;)
+    {
+      compiler_task *task;
+
+      while (tasks == NULL)
+        pthread_cond_wait (&compiler_cond, &compiler_lock);
+      task = tasks;
+      LL_DELETE (tasks, task);
+      ++running_tasks;
+      POCL_UNLOCK (compiler_lock);
+
+      task->func (task->arg);
+      free (task);
+
+      POCL_LOCK (compiler_lock);
+      --running_tasks;
+      pthread_cond_broadcast (&idle_cond);
+    }
+  return NULL;
+}
+
+/* The compilers must not run while the static data of LLVM is destroyed
+   at exit. Drops the tasks not started yet, e.g. the speculative
+   compilations, and waits for the running ones. */
+static void
+stop_compiler_threads (void)
+{
+  compiler_task *task, *tmp;
+
+  POCL_LOCK (compiler_lock);
+  exiting = 1;
+  LL_FOREACH_SAFE (tasks, task, tmp)
+    {
+      LL_DELETE (tasks, task);
+      free (task);
+    }
+  while (running_tasks > is_compiler_thread)
+    pthread_cond_wait (&idle_cond, &compiler_lock);
+  POCL_UNLOCK (compiler_lock);
+}
+
+/* The number of the compiler threads, POCL_COMPILER_THREADS or the
+   number of the processors online. */
+static int
+num_compiler_threads (void)
+{
+  long num = sysconf (_SC_NPROCESSORS_ONLN);
+  if (num < 1)
+    num = 1;
+  num = pocl_get_int_option ("POCL_COMPILER_THREADS", num);
+  return num < 1 ? 1 : num;
+}
+
+/* Must be called with compiler_lock held. */
+static void
+start_compiler_threads (void)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  int i, n;
+
+  n = num_compiler_threads ();
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  for (i = 0; i < n; ++i)
+    {
+      if (pthread_create (&thread, &attr, compiler_thread_main, NULL) != 0)
+        POCL_ABORT ("pocl: could not create a compiler thread\n");
+    }
+  pthread_attr_destroy (&attr);
+  atexit (stop_compiler_threads);
+  threads_started = 1;
+}
+
+void
+pocl_run_compiler_task (void (*func) (void *), void *arg)
+{
+  compiler_task *task = (compiler_task*)malloc (sizeof (compiler_task));
+  if (task == NULL)
+    {
+      /* Run the task on the calling thread instead. */
+      func (arg);
+      return;
+    }
+  task->func = func;
+  task->arg = arg;
+
+  POCL_LOCK (compiler_lock);
+  if (exiting)
+    {
+      POCL_UNLOCK (compiler_lock);
+      free (task);
+      return;
+    }
+  if (!threads_started)
+    start_compiler_threads ();
+  LL_APPEND (tasks, task);
+  pthread_cond_signal (&compiler_cond);
+  POCL_UNLOCK (compiler_lock);
+}
@@ -0,0 +1,52 @@
+/* OpenCL runtime library: the compiler threads
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/**
+ * @file pocl_compiler_threads.h
+ *
+ * A pool of threads for compiling in the background, e.g., the
+ * asynchronous clBuildProgram() calls and the speculative work-group
+ * function compilations. The threads are started at the first task and
+ * run until the process exits; the tasks not started by then are
+ * dropped. The kernel compiler is reentrant, thus the tasks run in
+ * parallel.
+ */
+
+#ifndef POCL_COMPILER_THREADS_H
+#define POCL_COMPILER_THREADS_H
+
+#pragma GCC visibility push(hidden)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Runs 'func (arg)' on a compiler thread. The tasks are started in the
+   order they were added. */
+void pocl_run_compiler_task (void (*func) (void *), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
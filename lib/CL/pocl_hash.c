@@ -0,0 +1,136 @@
+/* OpenCL runtime library: SHA-1 for the kernel cache keys
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_hash.h"
+
+#include <string.h>
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+sha1_block (uint32_t state[5], const unsigned char *block)
+{
+  uint32_t w[80];
+  uint32_t a, b, c, d, e, f, k, t;
+  int i;
+
+  for (i = 0; i < 16; ++i)
+    w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+      (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+  for (i = 16; i < 80; ++i)
+    w[i] = ROTL (w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  for (i = 0; i < 80; ++i)
+    {
+      if (i < 20)
+        {
+          f = (b & c) | (~b & d);
+          k = 0x5a827999;
+        }
+      else if (i < 40)
+        {
+          f = b ^ c ^ d;
+          k = 0x6ed9eba1;
+        }
+      else if (i < 60)
+        {
+          f = (b & c) | (b & d) | (c & d);
+          k = 0x8f1bbcdc;
+        }
+      else
+        {
+          f = b ^ c ^ d;
+          k = 0xca62c1d6;
+        }
+      t = ROTL (a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = ROTL (b, 30);
+      b = a;
+      a = t;
+    }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+void
+pocl_sha1_init (pocl_sha1_ctx *ctx)
+{
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->state[4] = 0xc3d2e1f0;
+  ctx->length = 0;
+}
+
+void
+pocl_sha1_update (pocl_sha1_ctx *ctx, const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char*)data;
+  size_t used = ctx->length % 64;
+
+  ctx->length += size;
+  if (used > 0)
+    {
+      size_t n = 64 - used < size ? 64 - used : size;
+      memcpy (ctx->buffer + used, p, n);
+      p += n;
+      size -= n;
+      if (used + n < 64)
+        return;
+      sha1_block (ctx->state, ctx->buffer);
+    }
+  for (; size >= 64; p += 64, size -= 64)
+    sha1_block (ctx->state, p);
+  memcpy (ctx->buffer, p, size);
+}
+
+void
+pocl_sha1_final (pocl_sha1_ctx *ctx,
+                 unsigned char digest[POCL_SHA1_DIGEST_SIZE])
+{
+  uint64_t bits = ctx->length * 8;
+  unsigned char pad[72];
+  size_t pad_size = 64 - (ctx->length + 8) % 64;
+  int i;
+
+  /* A one bit, zeros up to 8 bytes before a block boundary and the
+     length in bits as a big-endian number. */
+  memset (pad, 0, sizeof (pad));
+  pad[0] = 0x80;
+  for (i = 0; i < 8; ++i)
+    pad[pad_size + i] = (unsigned char)(bits >> (56 - 8 * i));
+  pocl_sha1_update (ctx, pad, pad_size + 8);
+
+  for (i = 0; i < POCL_SHA1_DIGEST_SIZE; ++i)
+    digest[i] = (unsigned char)(ctx->state[i / 4] >> (24 - 8 * (i % 4)));
+}
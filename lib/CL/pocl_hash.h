@@ -0,0 +1,58 @@
+/* OpenCL runtime library: SHA-1 for the kernel cache keys
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#ifndef POCL_HASH_H
+#define POCL_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#pragma GCC visibility push(hidden)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POCL_SHA1_DIGEST_SIZE 20
+
+typedef struct pocl_sha1_ctx
+{
+  uint32_t state[5];
+  uint64_t length;
+  unsigned char buffer[64];
+} pocl_sha1_ctx;
+
+void pocl_sha1_init (pocl_sha1_ctx *ctx);
+
+void pocl_sha1_update (pocl_sha1_ctx *ctx, const void *data, size_t size);
+
+/* Writes the digest of the data hashed so far. The context must be
+   initialized again before reusing it. */
+void pocl_sha1_final (pocl_sha1_ctx *ctx,
+                      unsigned char digest[POCL_SHA1_DIGEST_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
@@ -24,6 +24,7 @@
 #include "pocl_cl.h"
 #include "pocl_image_util.h"
 #include "assert.h"
+#include "pocl_util.h"
 
 extern cl_int 
 pocl_check_image_origin_region (const cl_mem image, 
@@ -117,6 +118,9 @@ pocl_write_image(cl_mem               image,
        image_row_pitch * (tuned_region[1]-1) +
        image_slice_pitch * (tuned_region[2]-1) >= image->size))
     return CL_INVALID_VALUE;
+
+  if (pocl_mem_alloc_for_device (image, device_id) != CL_SUCCESS)
+    return CL_MEM_OBJECT_ALLOCATION_FAILURE;
   
   device_id->ops->write_rect (device_id->data, ptr, 
                          image->device_ptrs[device_id->dev_id].mem_ptr,
@@ -169,6 +173,9 @@ pocl_read_image(cl_mem               image,
   
   if (image->type != CL_MEM_OBJECT_IMAGE3D && region[2] != 1)
     return CL_INVALID_VALUE;
+
+  if (pocl_mem_alloc_for_device (image, device_id) != CL_SUCCESS)
+    return CL_MEM_OBJECT_ALLOCATION_FAILURE;
   
   device_id->ops->read_rect(device_id->data, ptr, 
                        image->device_ptrs[device_id->dev_id].mem_ptr,
@@ -30,6 +30,7 @@
 
 POdeclsym(clBuildProgram)
 POdeclsym(clCreateBuffer)
+POdeclsym(clCreateBufferFromFilePOCL)
 POdeclsym(clCreateCommandQueue)
 POdeclsym(clCreateContext)
 POdeclsym(clCreateContextFromType)
@@ -67,6 +68,7 @@ POdeclsym(clEnqueueWriteBuffer)
 POdeclsym(clEnqueueWriteBufferRect)
 POdeclsym(clEnqueueWriteImage)
 POdeclsym(clEnqueueFillImage)
+POdeclsym(clEnqueueFillBuffer)
 POdeclsym(clFinish)
 POdeclsym(clFlush)
 POdeclsym(clGetCommandQueueInfo)
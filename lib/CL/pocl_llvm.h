@@ -30,6 +30,10 @@ extern "C" {
 #endif
 
 /* Compiles an .cl file into LLVM IR.
+ *
+ * The functions of this interface can be called from multiple threads at
+ * the same time, each compilation uses an LLVMContext of its own. The
+ * accesses to the same program are serialized with its llvm_lock.
  */
 int pocl_llvm_build_program
 (cl_program program,
@@ -59,26 +63,49 @@ int pocl_llvm_get_kernel_metadata
  * a function that executes all work-items in a work-group.
  *
  * Output is a LLVM bitcode file that contains a work-group function
- * and its associated launchers. 
- *
- * TODO: this is not thread-safe, it changes the LLVM global options to
- * control the compilation. We should enforce only one compilations is done
- * at a time or control the options through thread safe methods.
+ * and its associated launchers. The parameters of the compilation are
+ * passed to the passes in the module, thus work-group functions can be
+ * generated in parallel.
  */
 int pocl_llvm_generate_workgroup_function
 (cl_device_id device,
  cl_kernel kernel,
  size_t local_x, size_t local_y, size_t local_z,
- const char* parallel_filename,
- const char* kernel_filename);
+ const char* parallel_filename);
+
+/* Returns non-zero if the work-group functions can be compiled in memory
+ * with pocl_llvm_jit_workgroup_function(), i.e., pocl was built with
+ * MCJIT support and POCL_KERNEL_JIT is not set to 0.
+ */
+int pocl_llvm_jit_available (void);
+
+/* Generates the work-group function for the local size like
+ * pocl_llvm_generate_workgroup_function() and compiles it with MCJIT
+ * to executable memory of the host without temporary files or external
+ * processes. The object is stored to and loaded from the persistent
+ * kernel cache. Returns the entry point and the dimension the function
+ * can split (-1 if it cannot execute sub-ranges), 0 on success.
+ */
+int pocl_llvm_jit_workgroup_function
+(cl_device_id device,
+ cl_kernel kernel,
+ size_t local_x, size_t local_y, size_t local_z,
+ pocl_workgroup *wg,
+ int *sub_range_dim);
 
 /**
  * Update the program->binaries[] representation of the kernels
  * from the program->llvm_irs[] representation.
- * Also updates the 'program.bc' file in the POCL_TEMP_DIR cache.
+ * Also updates the 'program.bc' file in the temp dir if it is left
+ * for debugging (POCL_LEAVE_TEMP_DIRS).
  */
 void pocl_llvm_update_binaries (cl_program program);
 
+/**
+ * Frees the llvm::Modules of the program and their LLVMContexts.
+ */
+void pocl_llvm_free_program (cl_program program);
+
 /**
  * Find the "__kernel" function names in 'program',
  * filling the callee-allocated array with pointer to the program binary.
@@ -58,7 +58,9 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Mutex.h"
 #include "llvm/Support/MutexGuard.h"
 #include "llvm/Support/raw_os_ostream.h"
 #include "llvm/Support/SourceMgr.h"
@@ -72,6 +74,19 @@
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include <sys/stat.h>
 
+// MCJIT can load multiple modules and cache the objects since LLVM 3.5.
+#if !(defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+#define POCL_USE_MCJIT
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/Support/DynamicLibrary.h"
+#endif
+
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+#include "llvm/Support/Threading.h"
+#endif
+
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -82,6 +97,8 @@
 // causing compilation error if they are included before the LLVM headers.
 #include "pocl_llvm.h"
 #include "pocl_runtime_config.h"
+#include "pocl_cache.h"
+#include "pocl_util.h"
 #include "install-paths.h"
 #include "LLVMUtils.h"
 #include "linker.h"
@@ -101,24 +118,14 @@ using llvm::sys::fs::F_Binary;
 
 
 /**
- * Use one global LLVMContext across all LLVM bitcodes. This is because
- * we want to cache the bitcode IR libraries and reuse them when linking
- * new kernels. The CloneModule etc. seem to assume we are linking
- * bitcodes with a same LLVMContext. Unfortunately, this requires serializing
- * all calls to the LLVM APIs with mutex.
- * Freeing/deleting the context crashes LLVM 3.2 (at program exit), as a
- * work-around, allocate this from heap.
+ * The kernel compiler is reentrant: an LLVMContext is used by one thread
+ * at a time, thus the compilations with different contexts can run in
+ * parallel. Each program build creates a context for its llvm::Module,
+ * which is accessed with the program's llvm_lock held. The kernel
+ * compilations take a context with the per-device kernel library, passes
+ * and target machine from a pool (see CompilerContext below) and parse
+ * the program bitcode to it.
  */
-static LLVMContext *globalContext = NULL;
-LLVMContext *GlobalContext() {
-  if (globalContext == NULL) globalContext = new LLVMContext();
-  return globalContext;
-}
-
-/* The LLVM API interface functions are not at the moment not thread safe,
-   ensure only one thread is using this layer at the time with a mutex. */
-
-static llvm::sys::Mutex kernelCompilerLock;
 
 static void InitializeLLVM();
 
@@ -183,6 +190,112 @@ ParseIRFile(const char* fname, SMDiagnostic &Err, llvm::LLVMContext &ctx)
 }
 #endif
 
+/* Holds the llvm_lock of the program for the scope. */
+class ProgramLockGuard {
+public:
+  ProgramLockGuard(cl_program program) : program(program) {
+    POCL_LOCK(program->llvm_lock);
+  }
+  ~ProgramLockGuard() {
+    POCL_UNLOCK(program->llvm_lock);
+  }
+private:
+  cl_program program;
+};
+
+/* Parses an LLVM bitcode in memory to the context. Returns NULL on
+   errors. */
+static llvm::Module*
+parse_bitcode(const unsigned char *data, size_t size, llvm::LLVMContext &ctx)
+{
+  StringRef bitcode((const char*)data, size);
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  MemoryBuffer *buffer = MemoryBuffer::getMemBuffer(bitcode, "", false);
+  llvm::Module *mod = ParseBitcodeFile(buffer, ctx);
+  delete buffer;
+  return mod;
+#elif defined LLVM_3_5
+  MemoryBuffer *buffer = MemoryBuffer::getMemBuffer(bitcode, "", false);
+  ErrorOr<llvm::Module*> mod = parseBitcodeFile(buffer, ctx);
+  delete buffer;
+  return mod ? mod.get() : NULL;
+#else
+  ErrorOr<llvm::Module*> mod =
+    parseBitcodeFile(MemoryBufferRef(bitcode, ""), ctx);
+  return mod ? mod.get() : NULL;
+#endif
+}
+
+/* Deletes a module of a program built or parsed to a context of its own,
+   and the context. */
+static void
+free_program_module(llvm::Module *mod)
+{
+  if (mod == NULL)
+    return;
+  LLVMContext *ctx = &mod->getContext();
+  delete mod;
+#ifndef LLVM_3_2
+  // Freeing/deleting the context crashes LLVM 3.2, leak it.
+  delete ctx;
+#endif
+}
+
+/* Returns the module of the program for the device, parsing it from the
+   binary to a new context if the program was loaded from a binary or
+   the kernel cache. Called with the program's llvm_lock held. */
+static llvm::Module*
+program_module(cl_program program, int device_i)
+{
+  if (program->llvm_irs[device_i] == NULL)
+    {
+      LLVMContext *ctx = new LLVMContext();
+      llvm::Module *mod = parse_bitcode(program->binaries[device_i],
+                                        program->binary_sizes[device_i],
+                                        *ctx);
+      if (mod == NULL)
+        {
+          delete ctx;
+          return NULL;
+        }
+      program->llvm_irs[device_i] = mod;
+    }
+  return (llvm::Module*)program->llvm_irs[device_i];
+}
+
+/* Stores the bitcode of the module of the program to the binary of the
+   device, unless already up to date. Called with the program's llvm_lock
+   held. */
+static void
+update_program_binary(cl_program program, int device_i)
+{
+  if (program->binaries[device_i] != NULL ||
+      program->llvm_irs[device_i] == NULL)
+    return;
+
+  std::string bitcode;
+  raw_string_ostream os(bitcode);
+  WriteBitcodeToFile((llvm::Module*)program->llvm_irs[device_i], os);
+  os.flush();
+
+  unsigned char *binary = (unsigned char *) malloc(bitcode.size());
+  if (binary == NULL)
+    POCL_ABORT("Failed allocating memory for the binary.");
+  memcpy(binary, bitcode.data(), bitcode.size());
+  program->binary_sizes[device_i] = bitcode.size();
+  program->binaries[device_i] = binary;
+}
+
+/* The index of the device in the per-device arrays of the program. */
+static int
+program_device_index(cl_program program, cl_device_id device)
+{
+  for (unsigned i = 0; i < program->num_devices; ++i)
+    if (program->devices[i] == device)
+      return i;
+  POCL_ABORT("The program is not built for the device.");
+}
+
 int pocl_llvm_build_program(cl_program program, 
                             cl_device_id device, 
                             int device_i,     
@@ -192,7 +305,6 @@ int pocl_llvm_build_program(cl_program program,
                             const char* user_options)
 
 { 
-  llvm::MutexGuard lockHolder(kernelCompilerLock);
   InitializeLLVM();
 
   // Use CompilerInvocation::CreateFromArgs to initialize
@@ -353,7 +465,9 @@ int pocl_llvm_build_program(cl_program program,
   FrontendOptions &fe = pocl_build.getFrontendOpts();
   // The CreateFromArgs created an stdin input which we should remove first.
   fe.Inputs.clear(); 
-  if (load_source(fe, temp_dir, program)!=0)
+  // Each device writes its own copy of the source as the devices can be
+  // built in parallel.
+  if (load_source(fe, (std::string(device_tmpdir) + "/").c_str(), program)!=0)
     return CL_OUT_OF_HOST_MEMORY;
 
   CodeGenOptions &cg = pocl_build.getCodeGenOpts();
@@ -366,24 +480,30 @@ int pocl_llvm_build_program(cl_program program,
 
   bool success = true;
   clang::CodeGenAction *action = NULL;
-  action = new clang::EmitLLVMOnlyAction(GlobalContext());
+  // The module of the build owns the context (see free_program_module()).
+  action = new clang::EmitLLVMOnlyAction(new LLVMContext());
   success |= CI.ExecuteAction(*action);
   // FIXME: memleak, see FIXME below
   if (!success) return CL_BUILD_PROGRAM_FAILURE;
 
-  llvm::Module **mod = (llvm::Module **)&program->llvm_irs[device_i];
-  if (*mod != NULL)
-    delete (llvm::Module*)*mod;
 #if LLVM_VERSION_MAJOR==3 && LLVM_VERSION_MINOR<6
-  *mod = action->takeModule();
+  llvm::Module *mod = action->takeModule();
 #else
-  *mod = action->takeModule().release();
+  llvm::Module *mod = action->takeModule().release();
 #endif
-  if (*mod == NULL)
+  if (mod == NULL)
     return CL_BUILD_PROGRAM_FAILURE;
 
-  if (pocl_get_bool_option("POCL_LEAVE_TEMP_DIRS", 0))
-    write_temporary_file(*mod, binary_file_name);
+  // The bitcode is also stored to the persistent kernel cache.
+  if (pocl_get_bool_option("POCL_LEAVE_TEMP_DIRS", 0) ||
+      pocl_cache_enabled())
+    write_temporary_file(mod, binary_file_name);
+
+  POCL_LOCK (program->llvm_lock);
+  llvm::Module *old_mod = (llvm::Module*)program->llvm_irs[device_i];
+  program->llvm_irs[device_i] = mod;
+  POCL_UNLOCK (program->llvm_lock);
+  free_program_module(old_mod);
 
   // FIXME: cannot delete action as it contains something the llvm::Module
   // refers to. We should create it globally, at compiler initialization time.
@@ -525,25 +645,12 @@ int pocl_llvm_get_kernel_metadata(cl_program program,
 {
 
   int i;
-  unsigned n;
   llvm::Module *input = NULL;
-  SMDiagnostic Err;
-  FILE *binary_file;
-  char binary_filename[POCL_FILENAME_LENGTH];
   char tmpdir[POCL_FILENAME_LENGTH];
 
   assert(program->devices[device_i]->llvm_target_triplet && 
          "Device has no target triple set"); 
 
-  if (program->llvm_irs != NULL &&
-      program->llvm_irs[device_i] != NULL)
-    {
-      input = (llvm::Module*)program->llvm_irs[device_i];
-#ifdef DEBUG_POCL_LLVM_API
-      printf("### use a saved llvm::Module\n");
-#endif
-    }
-
   snprintf (tmpdir, POCL_FILENAME_LENGTH, "%s/%s", 
             device_tmpdir, kernel_name);
   mkdir(tmpdir, S_IRWXU);
@@ -551,34 +658,14 @@ int pocl_llvm_get_kernel_metadata(cl_program program,
   (void) snprintf(descriptor_filename, POCL_FILENAME_LENGTH,
                     "%s/%s/descriptor.so", device_tmpdir, kernel_name);
 
+  // The module is only read here, but the lock must be held as the
+  // other kernels of the program may be created at the same time.
+  ProgramLockGuard lockHolder(program);
+  input = program_module(program, device_i);
   if (input == NULL)
     {
-      (void) snprintf(binary_filename, POCL_FILENAME_LENGTH,
-                       "%s/kernel.bc",
-                       tmpdir);
-
-      binary_file = fopen(binary_filename, "w+");
-      if (binary_file == NULL)
-        return CL_OUT_OF_HOST_MEMORY;
-
-      n = fwrite(program->binaries[device_i], 1,
-                 program->binary_sizes[device_i], binary_file);
-      if (n < program->binary_sizes[device_i])
-        return CL_OUT_OF_HOST_MEMORY;
-      fclose(binary_file); 
-
-      input = ParseIRFile(binary_filename, Err, *GlobalContext());
-      if (program->llvm_irs != NULL)
-        program->llvm_irs[device_i] = input;
-      assert(&input->getContext() == GlobalContext());
-      if (!input) 
-        {
-          // TODO:
-          raw_os_ostream os(std::cout);
-          Err.print("pocl error: bad kernel file ", os);
-          os.flush();
-          exit(1);
-        }
+      *errcode = CL_INVALID_PROGRAM_EXECUTABLE;
+      return 1;
     }
 
 
@@ -832,10 +919,86 @@ static TargetMachine* GetTargetMachine(cl_device_id device,
 }
 /* helpers copied from LLVM opt END */
 
+/**
+ * The state of LLVM one kernel compilation uses at a time: the context
+ * and, for each device, the kernel library parsed to it and the kernel
+ * compiler passes and the target machine, which store state during the
+ * compilation. They are created once per context and device.
+ *
+ * The contexts are taken from a pool with CompilerContextGuard, thus the
+ * number of contexts grows to the number of concurrent compilations.
+ * They are never freed, deleting a context crashes LLVM 3.2 at the
+ * program exit.
+ */
+struct CompilerContext {
+  LLVMContext *context;
+  std::map<cl_device_id, llvm::Module*> kernel_libraries;
+  std::map<cl_device_id, PassManager*> passes;
+  std::map<cl_device_id, TargetMachine*> machines;
+};
+
+static llvm::sys::Mutex compilerContextLock;
+static std::vector<CompilerContext*> freeCompilerContexts;
+
+/* Takes a free compiler context from the pool, or a new one, for the
+   scope. */
+class CompilerContextGuard {
+public:
+  CompilerContextGuard() {
+    llvm::MutexGuard lockHolder(compilerContextLock);
+    if (freeCompilerContexts.empty())
+      {
+        ctx = new CompilerContext();
+        ctx->context = new LLVMContext();
+      }
+    else
+      {
+        ctx = freeCompilerContexts.back();
+        freeCompilerContexts.pop_back();
+      }
+  }
+  ~CompilerContextGuard() {
+    llvm::MutexGuard lockHolder(compilerContextLock);
+    freeCompilerContexts.push_back(ctx);
+  }
+  CompilerContext *operator->() const {
+    return ctx;
+  }
+  CompilerContext *get() const {
+    return ctx;
+  }
+private:
+  CompilerContext *ctx;
+};
+
+/* The target machine of the device, created once per compiler context
+   and shared by the kernel compiler passes and the code generation. */
+static TargetMachine* GetDeviceTargetMachine(CompilerContext *ctx,
+                                             cl_device_id device) {
+
+  std::map<cl_device_id, TargetMachine*>::iterator i =
+    ctx->machines.find(device);
+  if (i != ctx->machines.end())
+    return i->second;
+
+  TargetMachine *machine = GetTargetMachine(device);
+  ctx->machines[device] = machine;
+  return machine;
+}
+
+static llvm::sys::Mutex initializationLock;
+
 static void InitializeLLVM() {
   
+  llvm::MutexGuard lockHolder(initializationLock);
   static bool LLVMInitialized = false;
   if (LLVMInitialized) return;
+
+#if (defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
+  // The later versions are always thread safe.
+  llvm_start_multithreaded();
+#endif
+
   // We have not initialized any pass managers for any device yet.
   // Run the global LLVM pass initialization functions.
   InitializeAllTargets();
@@ -843,20 +1006,66 @@ static void InitializeLLVM() {
   InitializeAllAsmPrinters();
   InitializeAllAsmParsers();
 
+  PassRegistry &Registry = *PassRegistry::getPassRegistry();
+  initializeCore(Registry);
+  initializeScalarOpts(Registry);
+  initializeVectorization(Registry);
+  initializeIPO(Registry);
+  initializeAnalysis(Registry);
+  initializeIPA(Registry);
+  initializeTransformUtils(Registry);
+  initializeInstCombine(Registry);
+  initializeInstrumentation(Registry);
+  initializeTarget(Registry);
+
+#ifndef LLVM_3_2
+  const std::string wg_method = 
+    pocl_get_string_option("POCL_WORK_GROUP_METHOD", "auto");
+  if (wg_method == "loopvec")
+    {
+      // The options are global, thus one cannot compile with different
+      // options to different devices at one run.
+      StringMap<llvm::cl::Option*> opts;
+      llvm::cl::getRegisteredOptions(opts);
+
+      llvm::cl::Option *O = opts["vectorizer-min-trip-count"];
+      assert(O && "could not find LLVM option 'vectorizer-min-trip-count'");
+      O->addOccurrence(1, StringRef("vectorizer-min-trip-count"), StringRef("2"), false); 
+
+#if !(defined LLVM_3_3 || defined LLVM_3_4)
+      if (pocl_is_option_set("POCL_SCALARIZE_KERNELS"))
+        {
+          O = opts["scalarize-load-store"];
+          assert(O && "could not find LLVM option 'scalarize-load-store'");
+          O->addOccurrence(1, StringRef("scalarize-load-store"), StringRef(""), false); 
+        }
+#endif
+
+#ifdef DEBUG_POCL_LLVM_API        
+      printf ("### autovectorizer enabled\n");
+
+      O = opts["debug-only"];
+      assert(O && "could not find LLVM option 'debug'");
+      O->addOccurrence(1, StringRef("debug-only"), StringRef("loop-vectorize"), false); 
+
+#endif
+    }
+#endif
+
   LLVMInitialized = true;
 }
 
 /**
  * Prepare the kernel compiler passes.
  *
- * The passes are created only once per program run per device.
+ * The passes are created only once per compiler context per device.
  * The returned pass manager should not be modified, only the Module
  * should be optimized using it.
  */
 static PassManager& kernel_compiler_passes
-(cl_device_id device, std::string module_data_layout)
+(CompilerContext *ctx, cl_device_id device, std::string module_data_layout)
 {
-  static std::map<cl_device_id, PassManager*> kernel_compiler_passes;
+  std::map<cl_device_id, PassManager*> &kernel_compiler_passes = ctx->passes;
 
   if (kernel_compiler_passes.find(device) != 
       kernel_compiler_passes.end())
@@ -867,22 +1076,6 @@ static PassManager& kernel_compiler_passes
   Triple triple(device->llvm_target_triplet);
   PassRegistry &Registry = *PassRegistry::getPassRegistry();
 
-  const bool first_initialization_call = kernel_compiler_passes.size() == 0;
-
-  if (first_initialization_call) {
-    // TODO: do this globally, and just once per program
-    initializeCore(Registry);
-    initializeScalarOpts(Registry);
-    initializeVectorization(Registry);
-    initializeIPO(Registry);
-    initializeAnalysis(Registry);
-    initializeIPA(Registry);
-    initializeTransformUtils(Registry);
-    initializeInstCombine(Registry);
-    initializeInstrumentation(Registry);
-    initializeTarget(Registry);
-  }
-
 #if !(defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
   // Scalarizer is in LLVM upstream since 3.4.
   const bool SCALARIZE = pocl_is_option_set("POCL_SCALARIZE_KERNELS");
@@ -890,15 +1083,10 @@ static PassManager& kernel_compiler_passes
   const bool SCALARIZE = false;
 #endif
 
-#ifndef LLVM_3_2
-  StringMap<llvm::cl::Option*> opts;
-  llvm::cl::getRegisteredOptions(opts);
-#endif
-
   PassManager *Passes = new PassManager();
 
   // Need to setup the target info for target specific passes. */
-  TargetMachine *Machine = GetTargetMachine(device);
+  TargetMachine *Machine = GetDeviceTargetMachine(ctx, device);
   // Add internal analysis passes from the target machine.
 #ifndef LLVM_3_2
   if (Machine != NULL)
@@ -994,32 +1182,7 @@ static PassManager& kernel_compiler_passes
           passes.push_back("scalarizer");
         }
 
-      if (kernel_compiler_passes.size() == 0) 
-        {
-          // Set the options only once. TODO: fix it so that each
-          // device can reset their own options. Now one cannot compile
-          // with different options to different devices at one run.
-   
-          llvm::cl::Option *O = opts["vectorizer-min-trip-count"];
-          assert(O && "could not find LLVM option 'vectorizer-min-trip-count'");
-          O->addOccurrence(1, StringRef("vectorizer-min-trip-count"), StringRef("2"), false); 
-
-          if (SCALARIZE) 
-            {
-              O = opts["scalarize-load-store"];
-              assert(O && "could not find LLVM option 'scalarize-load-store'");
-              O->addOccurrence(1, StringRef("scalarize-load-store"), StringRef(""), false); 
-            }
-
-#ifdef DEBUG_POCL_LLVM_API        
-          printf ("### autovectorizer enabled\n");
-
-          O = opts["debug-only"];
-          assert(O && "could not find LLVM option 'debug'");
-          O->addOccurrence(1, StringRef("debug-only"), StringRef("loop-vectorize"), false); 
-
-#endif
-        }
+      // The vectorizer options are set in InitializeLLVM().
       passes.push_back("mem2reg");
       passes.push_back("loop-vectorize");
       passes.push_back("slp-vectorizer");
@@ -1066,24 +1229,15 @@ static PassManager& kernel_compiler_passes
   return *Passes;
 }
 
-/* This is used to communicate the work-group dimensions command-line parameter to the 
-   workitem loop. */
-namespace pocl {
-extern llvm::cl::list<int> LocalSize;
-} 
-
 /**
  * Return the OpenCL C built-in function library bitcode
- * for the given device.
+ * for the given device, parsed to the compiler context.
  */
 static llvm::Module*
 kernel_library
-(cl_device_id device, llvm::Module* root)
+(CompilerContext *ctx, cl_device_id device)
 {
-  llvm::MutexGuard lockHolder(kernelCompilerLock);
-  InitializeLLVM();
-
-  static std::map<cl_device_id, llvm::Module*> libs;
+  std::map<cl_device_id, llvm::Module*> &libs = ctx->kernel_libraries;
 
   Triple triple(device->llvm_target_triplet);
 
@@ -1131,135 +1285,301 @@ kernel_library
 
 
   SMDiagnostic Err;
-  llvm::Module *lib = ParseIRFile(kernellib.c_str(), Err, *GlobalContext());
+  llvm::Module *lib = ParseIRFile(kernellib.c_str(), Err, *ctx->context);
   assert (lib != NULL);
   libs[device] = lib;
 
   return lib;
 }
 
-/* This is used to control the kernel we want to process in the kernel compilation. */
-extern cl::opt<std::string> KernelName;
-
-int pocl_llvm_generate_workgroup_function(cl_device_id device,
-                                          cl_kernel kernel,
-                                          size_t local_x, size_t local_y, size_t local_z,
-                                          const char* parallel_filename,
-                                          const char* kernel_filename)
+/**
+ * Links the kernel and the built-in library and runs the kernel compiler
+ * passes to produce the work-group function for the local size. The
+ * parameters of the passes are stored to the module, thus multiple
+ * threads can generate work-group functions at the same time.
+ */
+static llvm::Module*
+generate_workgroup_module(CompilerContext *ctx,
+                          cl_device_id device,
+                          cl_kernel kernel,
+                          size_t local_x, size_t local_y, size_t local_z)
 {
-  llvm::MutexGuard lockHolder(kernelCompilerLock);
-  InitializeLLVM();
-
-#ifdef DEBUG_POCL_LLVM_API        
-  printf("### calling the kernel compiler for kernel %s local_x %zu "
-         "local_y %zu local_z %zu parallel_filename: %s\n",
-         kernel->name, local_x, local_y, local_z, parallel_filename);
-#endif
-
-  Triple triple(device->llvm_target_triplet);
-
-  SMDiagnostic Err;
-  std::string errmsg;
+  cl_program program = kernel->program;
+  int device_i = program_device_index(program, device);
 
   // Link the kernel and runtime library
   llvm::Module *input = NULL;
-  if (kernel->program->llvm_irs != NULL && 
-      kernel->program->llvm_irs[device->dev_id] != NULL) 
-    {
-#ifdef DEBUG_POCL_LLVM_API        
-      printf("### cloning the preloaded LLVM IR\n");
-#endif
-      input = 
-        llvm::CloneModule
-        ((llvm::Module*)kernel->program->llvm_irs[device->dev_id]);
-    }
-  else
-    {
+  {
+    ProgramLockGuard lockHolder(program);
+    // The program module is in a context of its own, parse the bitcode
+    // to the compiler context instead of cloning the module.
+    update_program_binary(program, device_i);
 #ifdef DEBUG_POCL_LLVM_API        
-      printf("### loading the kernel bitcode from disk\n");
+    printf("### parsing the program bitcode\n");
 #endif
-      input = ParseIRFile(kernel_filename, Err, *GlobalContext());
-    }
+    input = parse_bitcode(program->binaries[device_i],
+                          program->binary_sizes[device_i],
+                          *ctx->context);
+  }
+  if (input == NULL)
+    return NULL;
 
   // Later this should be replaced with indexed linking of source code
   // and/or bitcode for each kernel.
-  llvm::Module *libmodule = kernel_library(device, input);
+  llvm::Module *libmodule = kernel_library(ctx, device);
   assert (libmodule != NULL);
   link(input, libmodule);
-    
-  /* Now finally run the set of passes assembled above */
-  // TODO pass these as parameters instead, this is not thread safe!
-  pocl::LocalSize.clear();
-  pocl::LocalSize.addValue(local_x);
-  pocl::LocalSize.addValue(local_y);
-  pocl::LocalSize.addValue(local_z);
-  KernelName = kernel->name;
 
+  std::ostringstream local_size;
+  local_size << local_x << " " << local_y << " " << local_z;
+  pocl::setModuleParameter(*input, "local_size", local_size.str());
+  pocl::setModuleParameter(*input, "kernel", kernel->name);
+  pocl::setModuleParameter(*input, "wi_sub_ranges",
+                           device->wi_sub_ranges ? "1" : "0");
+  // The options of the passes read from the environment.
+  const char *options[] = {
+    "POCL_WORK_GROUP_METHOD", "POCL_FULL_REPLICATION_THRESHOLD",
+    "POCL_WILOOPS_MAX_UNROLL_COUNT" };
+  for (unsigned i = 0; i < sizeof(options) / sizeof(options[0]); ++i)
+    {
+      if (pocl_is_option_set(options[i]))
+        pocl::setModuleParameter(*input, options[i],
+                                 pocl_get_string_option(options[i], ""));
+    }
+
+  /* Now finally run the set of passes assembled above */
   if (strcmp(device->short_name, "ptx") != 0) 
     {
 #if (defined LLVM_3_2 or defined LLVM_3_3 or defined LLVM_3_4)
-      kernel_compiler_passes(device, input->getDataLayout()).run(*input);
+      kernel_compiler_passes(ctx, device, input->getDataLayout()).run(*input);
 #else
-      kernel_compiler_passes(device,
+      kernel_compiler_passes(ctx, device,
                              input->getDataLayout()->getStringRepresentation())
                              .run(*input);
 #endif
     }
-  // TODO: don't write this once LLC is called via API, not system()
+  return input;
+}
+
+int pocl_llvm_generate_workgroup_function(cl_device_id device,
+                                          cl_kernel kernel,
+                                          size_t local_x, size_t local_y, size_t local_z,
+                                          const char* parallel_filename)
+{
+  InitializeLLVM();
+  CompilerContextGuard ctx;
+
+#ifdef DEBUG_POCL_LLVM_API        
+  printf("### calling the kernel compiler for kernel %s local_x %zu "
+         "local_y %zu local_z %zu parallel_filename: %s\n",
+         kernel->name, local_x, local_y, local_z, parallel_filename);
+#endif
+
+  llvm::Module *input = generate_workgroup_module(ctx.get(), device, kernel,
+                                                  local_x, local_y, local_z);
+  if (input == NULL)
+    return CL_INVALID_PROGRAM_EXECUTABLE;
   write_temporary_file(input, parallel_filename);
 
-#ifndef LLVM_3_2
-  // In LLVM 3.2 the Linker object deletes the associated Modules.
-  // If we delete here, it will crash.
   /* OPTIMIZE: store the fully linked work-group function llvm::Module 
      and pass it to code generation without writing to disk. */
-#endif
+  delete input;
 
   return 0;
 }
 
-void pocl_llvm_update_binaries (cl_program program) {
+#ifdef POCL_USE_MCJIT
+/**
+ * Passes the objects of the work-group functions between MCJIT and the
+ * persistent kernel cache. The cached object is read before generating
+ * the module, thus a hit skips the kernel compiler passes as well.
+ */
+class WorkGroupObjectCache : public llvm::ObjectCache {
+public:
+  WorkGroupObjectCache(cl_kernel kernel, cl_device_id device,
+                       size_t local_x, size_t local_y, size_t local_z) :
+    kernel(kernel), device(device), data(NULL), size(0) {
+    local_size[0] = local_x;
+    local_size[1] = local_y;
+    local_size[2] = local_z;
+    pocl_cache_get_workgroup_object(kernel, device, local_x, local_y,
+                                    local_z, &data, &size);
+  }
+
+  virtual ~WorkGroupObjectCache() {
+    free(data);
+  }
+
+  bool hasObject() const {
+    return data != NULL;
+  }
+
+#ifdef LLVM_3_5
+  virtual void notifyObjectCompiled(const llvm::Module *,
+                                    const MemoryBuffer *obj) {
+    store(obj->getBufferStart(), obj->getBufferSize());
+  }
+
+  virtual MemoryBuffer *getObject(const llvm::Module *) {
+    if (data == NULL)
+      return NULL;
+    return MemoryBuffer::getMemBufferCopy(StringRef(data, size));
+  }
+#else
+  virtual void notifyObjectCompiled(const llvm::Module *,
+                                    MemoryBufferRef obj) {
+    store(obj.getBufferStart(), obj.getBufferSize());
+  }
+
+  virtual std::unique_ptr<MemoryBuffer> getObject(const llvm::Module *) {
+    if (data == NULL)
+      return nullptr;
+    return MemoryBuffer::getMemBufferCopy(StringRef(data, size));
+  }
+#endif
+
+private:
+  void store(const char *obj_data, size_t obj_size) {
+    pocl_cache_put_workgroup_object(kernel, device, local_size[0],
+                                    local_size[1], local_size[2],
+                                    obj_data, obj_size);
+  }
+
+  cl_kernel kernel;
+  cl_device_id device;
+  size_t local_size[3];
+  char *data;
+  size_t size;
+};
+#endif
+
+int pocl_llvm_jit_available(void)
+{
+#ifdef POCL_USE_MCJIT
+  return pocl_get_bool_option("POCL_KERNEL_JIT", 1);
+#else
+  return 0;
+#endif
+}
 
-  llvm::MutexGuard lockHolder(kernelCompilerLock);
+int pocl_llvm_jit_workgroup_function(cl_device_id device,
+                                     cl_kernel kernel,
+                                     size_t local_x, size_t local_y,
+                                     size_t local_z,
+                                     pocl_workgroup *wg,
+                                     int *sub_range_dim)
+{
+#ifdef POCL_USE_MCJIT
   InitializeLLVM();
 
-  // Dump the LLVM IR Modules to memory buffers. 
-  assert (program->llvm_irs != NULL);
+  {
+    static llvm::sys::Mutex process_symbols_lock;
+    static bool process_symbols_loaded = false;
+    llvm::MutexGuard lockHolder(process_symbols_lock);
+    if (!process_symbols_loaded)
+      {
+        // The calls to the C library left in the kernels are resolved to
+        // the symbols of the process.
+        llvm::sys::DynamicLibrary::LoadLibraryPermanently(NULL);
+        process_symbols_loaded = true;
+      }
+  }
+
 #ifdef DEBUG_POCL_LLVM_API        
-  printf("### refreshing the binaries of the program %p\n", program);
+  printf("### JIT compiling kernel %s local_x %zu local_y %zu "
+         "local_z %zu\n", kernel->name, local_x, local_y, local_z);
 #endif
 
-   for (size_t i = 0; i < program->num_devices; ++i)
+  std::string wg_name =
+    std::string("_") + kernel->function_name + "_workgroup";
+  std::string sub_range_dim_name =
+    std::string("_") + kernel->function_name + "_sub_range_dim";
+
+  CompilerContextGuard ctx;
+  WorkGroupObjectCache cache(kernel, device, local_x, local_y, local_z);
+  llvm::Module *mod;
+  if (cache.hasObject())
     {
-      assert (program->llvm_irs[i] != NULL);
+      // MCJIT loads the cached object in place of the code of the
+      // empty module.
+      mod = new llvm::Module(wg_name, *ctx->context);
+      mod->setTargetTriple(device->llvm_target_triplet);
+    }
+  else
+    {
+      mod = generate_workgroup_module(ctx.get(), device, kernel,
+                                      local_x, local_y, local_z);
+      if (mod == NULL)
+        return CL_INVALID_PROGRAM_EXECUTABLE;
+    }
 
-      std::string binary_filename =
-        std::string(program->temp_dir) + "/" + 
-        program->devices[i]->short_name + "/" +
-        POCL_PROGRAM_BC_FILENAME;
+  // The engine owns the module and the target machine selected for it.
+  // The engines are never deleted, like the work-group function
+  // libraries loaded with dlopen() are never closed. The module stays
+  // in the compiler context, but it is not used after the compilation.
+  std::string error;
+#ifdef LLVM_3_5
+  EngineBuilder builder(mod);
+  builder.setUseMCJIT(true);
+#else
+  EngineBuilder builder(std::unique_ptr<llvm::Module>(mod));
+#endif
+  builder.setEngineKind(EngineKind::JIT);
+  builder.setErrorStr(&error);
+  builder.setOptLevel(CodeGenOpt::Aggressive);
+  builder.setTargetOptions(GetTargetOptions());
+  if (device->llvm_cpu != NULL)
+    builder.setMCPU(device->llvm_cpu);
 
-      write_temporary_file((llvm::Module*)program->llvm_irs[i],
-                           binary_filename.c_str()); 
+  ExecutionEngine *engine = builder.create();
+  if (engine == NULL)
+    {
+      std::cerr << "pocl: creating the JIT failed: " << error << std::endl;
+      return CL_OUT_OF_RESOURCES;
+    }
 
-      FILE *binary_file = fopen(binary_filename.c_str(), "r");
-      if (binary_file == NULL)        
-        POCL_ABORT("Failed opening the binary file.");
+  engine->setObjectCache(&cache);
+  engine->finalizeObject();
+  engine->setObjectCache(NULL);
 
-      fseek(binary_file, 0, SEEK_END);
-      
-      program->binary_sizes[i] = ftell(binary_file);
-      fseek(binary_file, 0, SEEK_SET);
+  *wg = (pocl_workgroup)engine->getFunctionAddress(wg_name);
+  const int *dim =
+    (const int*)engine->getGlobalValueAddress(sub_range_dim_name);
+  *sub_range_dim = dim != NULL ? *dim : -1;
 
-      unsigned char *binary = (unsigned char *) malloc(program->binary_sizes[i]);
-      if (binary == NULL)
-        POCL_ABORT("Failed allocating memory for the binary.");
+  return *wg != NULL ? 0 : CL_OUT_OF_RESOURCES;
+#else
+  return CL_INVALID_OPERATION;
+#endif
+}
 
-      size_t n = fread(binary, 1, program->binary_sizes[i], binary_file);
-      if (n < program->binary_sizes[i])
-        POCL_ABORT("Failed reading the binary from disk to memory.");
-      program->binaries[i] = binary;
+void pocl_llvm_update_binaries (cl_program program) {
 
-      fclose (binary_file);
+  // Dump the LLVM IR Modules to memory buffers. 
+  assert (program->llvm_irs != NULL);
+#ifdef DEBUG_POCL_LLVM_API        
+  printf("### refreshing the binaries of the program %p\n", program);
+#endif
+
+  ProgramLockGuard lockHolder(program);
+  for (size_t i = 0; i < program->num_devices; ++i)
+    {
+      // Loaded from the kernel cache or a binary and not parsed yet,
+      // the binary is up to date.
+      if (program->llvm_irs[i] == NULL)
+        continue;
+
+      update_program_binary(program, i);
+
+      if (pocl_get_bool_option("POCL_LEAVE_TEMP_DIRS", 0))
+        {
+          char device_dir[POCL_FILENAME_LENGTH];
+          pocl_program_device_dir(device_dir, program, program->devices[i]);
+          std::string binary_filename =
+            std::string(device_dir) + "/" + POCL_PROGRAM_BC_FILENAME;
+          write_temporary_file((llvm::Module*)program->llvm_irs[i],
+                               binary_filename.c_str()); 
+        }
 
 #ifdef DEBUG_POCL_LLVM_API        
       printf("### binary for device %zi was of size %zu\n", i, program->binary_sizes[i]);
@@ -1271,12 +1591,14 @@ void pocl_llvm_update_binaries (cl_program program) {
 int
 pocl_llvm_get_kernel_names( cl_program program, const char **knames, unsigned max_num_krn )
 {
-  llvm::MutexGuard lockHolder(kernelCompilerLock);
   InitializeLLVM();
 
   // TODO: is it safe to assume every device (i.e. the index 0 here)
   // has the same set of programs & kernels?
-  llvm::Module *mod = (llvm::Module *) program->llvm_irs[0];
+  ProgramLockGuard lockHolder(program);
+  llvm::Module *mod = program_module(program, 0);
+  if (mod == NULL)
+    POCL_ABORT("Failed parsing the program binary.");
   llvm::NamedMDNode *md = mod->getNamedMetadata("opencl.kernels");
   assert(md);
 
@@ -1290,6 +1612,19 @@ pocl_llvm_get_kernel_names( cl_program program, const char **knames, unsigned ma
   return i;
 }
 
+void
+pocl_llvm_free_program (cl_program program)
+{
+  if (program->llvm_irs == NULL)
+    return;
+
+  for (size_t i = 0; i < program->num_devices; ++i)
+    {
+      free_program_module((llvm::Module*)program->llvm_irs[i]);
+      program->llvm_irs[i] = NULL;
+    }
+}
+
 /* Run LLVM codegen on input file (parallel-optimized).
  *
  * Output native object file. */
@@ -1310,9 +1645,14 @@ pocl_llvm_codegen(cl_kernel kernel,
     std::error_code error;
     tool_output_file outfile(outfilename, error, F_Binary);
 #endif
+    InitializeLLVM();
+    CompilerContextGuard ctx;
+
     llvm::Triple triple(device->llvm_target_triplet);
-    llvm::TargetMachine *target = GetTargetMachine(device);
-    llvm::Module *input = ParseIRFile(infilename, Err, *GlobalContext());
+    llvm::TargetMachine *target = GetDeviceTargetMachine(ctx.get(), device);
+    llvm::Module *input = ParseIRFile(infilename, Err, *ctx->context);
+    if (input == NULL)
+      return 1;
     llvm::PassManager PM;
     llvm::TargetLibraryInfo *TLI = new TargetLibraryInfo(triple);
     PM.add(TLI);
@@ -1350,6 +1690,7 @@ pocl_llvm_codegen(cl_kernel kernel,
 
     PM.run(*input);
     outfile.keep();
+    delete input;
 
     return 0;
 }
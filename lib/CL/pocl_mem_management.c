@@ -29,8 +29,10 @@ typedef struct _mem_manager
 {
   pocl_lock_t event_lock;
   pocl_lock_t cmd_lock;
+  pocl_lock_t mapping_lock;
   cl_event event_list;
   _cl_command_node *volatile cmd_list;
+  mem_mapping_t *mapping_list;
 } pocl_mem_manager;
 
 
@@ -47,6 +49,7 @@ void pocl_init_mem_manager (void)
       mm = calloc (1, sizeof (pocl_mem_manager));
       POCL_INIT_LOCK (mm->event_lock);
       POCL_INIT_LOCK (mm->cmd_lock);
+      POCL_INIT_LOCK (mm->mapping_lock);
     }
   POCL_UNLOCK(pocl_init_lock);
 }
@@ -67,6 +70,8 @@ cl_event pocl_mem_manager_new_event ()
     
   ev = calloc (1, sizeof (struct _cl_event));
   POCL_INIT_OBJECT(ev);
+  /* the condition is kept initialized while the event is recycled */
+  pthread_cond_init (&ev->completion_cond, NULL);
   ev->pocl_refcount = 1;
   return ev;
 }
@@ -98,3 +103,24 @@ void pocl_mem_manager_free_command ( _cl_command_node *cmd_ptr)
   LL_PREPEND (mm->cmd_list, cmd_ptr);
   POCL_UNLOCK(mm->cmd_lock);
 }
+
+mem_mapping_t* pocl_mem_manager_new_mapping ()
+{
+  mem_mapping_t *mapping = NULL;
+  POCL_LOCK (mm->mapping_lock);
+  if (mapping = mm->mapping_list)
+    LL_DELETE (mm->mapping_list, mapping);
+  POCL_UNLOCK (mm->mapping_lock);
+
+  if (mapping)
+    return mapping;
+
+  return calloc (1, sizeof (mem_mapping_t));
+}
+
+void pocl_mem_manager_free_mapping (mem_mapping_t *mapping)
+{
+  POCL_LOCK (mm->mapping_lock);
+  LL_PREPEND (mm->mapping_list, mapping);
+  POCL_UNLOCK (mm->mapping_lock);
+}
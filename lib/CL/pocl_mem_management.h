@@ -33,3 +33,7 @@ void pocl_mem_manager_free_event (cl_event event);
 _cl_command_node* pocl_mem_manager_new_command (void);
 
 void pocl_mem_manager_free_command (_cl_command_node *cmd_ptr);
+
+mem_mapping_t* pocl_mem_manager_new_mapping (void);
+
+void pocl_mem_manager_free_mapping (mem_mapping_t *mapping);
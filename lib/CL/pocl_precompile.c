@@ -0,0 +1,286 @@
+/* OpenCL runtime library: ahead-of-time work-group function compilation
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_precompile.h"
+#include "pocl_llvm.h"
+#include "pocl_cache.h"
+#include "pocl_util.h"
+#include "pocl_runtime_config.h"
+#include "pocl_compiler_threads.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//#define DEBUG_NDRANGE
+
+pocl_kernel_variant *
+pocl_generate_kernel_variant (cl_kernel kernel, cl_device_id device,
+                              size_t local_x, size_t local_y, size_t local_z,
+                              cl_int *errcode)
+{
+  char device_dir[POCL_FILENAME_LENGTH];
+  char tmpdir[POCL_FILENAME_LENGTH];
+  char parallel_filename[POCL_FILENAME_LENGTH];
+  char module_filename[POCL_FILENAME_LENGTH];
+  pocl_kernel_variant *variant;
+  int cached;
+  int jit;
+  int error;
+
+  /* The work-group function for the local size has been generated at
+     an earlier launch, skip the file system checks. */
+  variant = pocl_find_kernel_variant (kernel, device, 
+                                      local_x, local_y, local_z);
+  if (variant != NULL)
+    return variant;
+
+  /* A compiler thread might be generating the same variant. */
+  POCL_LOCK (kernel->compile_lock);
+  variant = pocl_find_kernel_variant (kernel, device, 
+                                      local_x, local_y, local_z);
+  if (variant != NULL)
+    goto DONE;
+
+  pocl_program_device_dir (device_dir, kernel->program, device);
+  snprintf (tmpdir, POCL_FILENAME_LENGTH, "%s/%s/%zu-%zu-%zu", 
+            device_dir, kernel->name, local_x, local_y, local_z);
+  mkdir (tmpdir, S_IRWXU);
+
+  error = snprintf
+    (parallel_filename, POCL_FILENAME_LENGTH,
+     "%s/%s", tmpdir, POCL_PARALLEL_BC_FILENAME);
+  if (error < 0)
+    {
+      *errcode = CL_OUT_OF_HOST_MEMORY;
+      goto DONE;
+    }
+
+  /* The work-group function library compiled by an earlier process
+     makes the parallel.bc unnecessary. The devices with the JIT
+     look up the cache when compiling. */
+  jit = device->jit_workgroup_functions;
+  cached = 0;
+  if (!jit)
+    {
+      snprintf (module_filename, POCL_FILENAME_LENGTH, "%s/parallel.so",
+                tmpdir);
+      cached = pocl_cache_get_workgroup_function
+        (kernel, device, local_x, local_y, local_z, module_filename);
+    }
+
+  if (!cached && !jit && access (parallel_filename, F_OK) != 0) 
+    {
+      error = pocl_llvm_generate_workgroup_function
+        (device, kernel, local_x, local_y, local_z, parallel_filename);
+      if (error)
+        {
+          *errcode = error;
+          goto DONE;
+        }
+
+#ifdef DEBUG_NDRANGE
+      printf("[parallel bc created]\n");
+#endif
+    }
+  else
+    {
+#ifdef DEBUG_NDRANGE
+      printf("[parallel bc already created]\n");
+#endif
+    }
+
+  variant = pocl_add_kernel_variant (kernel, device, 
+                                     local_x, local_y, local_z, tmpdir);
+  if (variant == NULL)
+    *errcode = CL_OUT_OF_HOST_MEMORY;
+
+ DONE:
+  POCL_UNLOCK (kernel->compile_lock);
+  return variant;
+}
+
+/* Generates the variant and lets the device compile it the way it does
+   before running the first command using the variant. Failures are
+   ignored, they are reported again at the launch. Only the devices
+   that can compile without aborting on a failure do the device step. */
+static void
+compile_variant (cl_kernel kernel, cl_device_id device, 
+                 const size_t *local_size)
+{
+  _cl_command_node cmd;
+  pocl_kernel_variant *variant;
+  cl_int errcode;
+
+  variant = pocl_generate_kernel_variant (kernel, device, local_size[0],
+                                          local_size[1], local_size[2],
+                                          &errcode);
+  if (variant == NULL || variant->wg != NULL ||
+      device->ops->precompile_kernel == NULL)
+    return;
+
+  memset (&cmd, 0, sizeof (cmd));
+  cmd.type = CL_COMMAND_NDRANGE_KERNEL;
+  cmd.device = device;
+  cmd.command.run.data = device->data;
+  cmd.command.run.tmp_dir = variant->tmp_dir;
+  cmd.command.run.variant = variant;
+  cmd.command.run.kernel = kernel;
+  cmd.command.run.local_x = local_size[0];
+  cmd.command.run.local_y = local_size[1];
+  cmd.command.run.local_z = local_size[2];
+  cmd.command.run.sub_range_dim = -1;
+  device->ops->precompile_kernel (&cmd);
+}
+
+typedef struct precompile_task
+{
+  cl_kernel kernel;
+  cl_device_id device;
+  size_t local_size[3];
+} precompile_task;
+
+static void
+precompile_task_main (void *arg)
+{
+  precompile_task *task = (precompile_task*)arg;
+
+  compile_variant (task->kernel, task->device, task->local_size);
+  POname(clReleaseKernel) (task->kernel);
+  free (task);
+}
+
+/* Compiles the variant on a compiler thread. The task holds a reference
+   to the kernel. */
+static void
+queue_variant (cl_kernel kernel, cl_device_id device, 
+               const size_t *local_size)
+{
+  precompile_task *task;
+
+  if (pocl_find_kernel_variant (kernel, device, local_size[0],
+                                local_size[1], local_size[2]) != NULL)
+    return;
+
+  task = (precompile_task*)malloc (sizeof (precompile_task));
+  if (task == NULL)
+    return;
+  POname(clRetainKernel) (kernel);
+  task->kernel = kernel;
+  task->device = device;
+  memcpy (task->local_size, local_size, sizeof (task->local_size));
+  pocl_run_compiler_task (precompile_task_main, task);
+}
+
+static int
+fits_device (cl_device_id device, const size_t *local_size)
+{
+  return local_size[0] > 0 && local_size[1] > 0 && local_size[2] > 0 &&
+    local_size[0] <= device->max_work_item_sizes[0] &&
+    local_size[1] <= device->max_work_item_sizes[1] &&
+    local_size[2] <= device->max_work_item_sizes[2] &&
+    local_size[0] * local_size[1] * local_size[2] <= 
+    device->max_work_group_size;
+}
+
+/* Parses the next local size, e.g. "64" or "8x8x2", of a space or comma
+   separated list. Returns 0 at the end of the list. */
+static int
+next_local_size (const char **list, size_t *local_size)
+{
+  const char *s = *list;
+  char *end;
+  int dim;
+
+  s += strspn (s, " ,");
+  if (*s == '\0')
+    return 0;
+
+  local_size[0] = local_size[1] = local_size[2] = 1;
+  for (dim = 0; dim < 3; ++dim)
+    {
+      local_size[dim] = strtoul (s, &end, 10);
+      s = end;
+      if (*s != 'x')
+        break;
+      ++s;
+    }
+  /* Skip the rest of a malformed size. */
+  s += strcspn (s, " ,");
+  *list = s;
+  return 1;
+}
+
+void
+pocl_precompile_kernel (cl_kernel kernel)
+{
+  cl_program program = kernel->program;
+  const char *extra_sizes = 
+    pocl_get_string_option ("POCL_PRECOMPILE_LOCAL_SIZES", "");
+  int speculate = pocl_get_bool_option ("POCL_SPECULATIVE_COMPILATION", 1);
+  const char *s;
+  size_t local_size[3];
+  unsigned i;
+
+  for (i = 0; i < program->num_devices; ++i)
+    {
+      cl_device_id device = program->devices[i];
+
+      if (program->build_status == NULL ||
+          program->build_status[i] != CL_BUILD_SUCCESS)
+        continue;
+
+      /* The only local size the kernel can be launched with, compile it
+         right away. */
+      if (kernel->reqd_wg_size != NULL && kernel->reqd_wg_size[0] > 0)
+        {
+          local_size[0] = kernel->reqd_wg_size[0];
+          local_size[1] = kernel->reqd_wg_size[1];
+          local_size[2] = kernel->reqd_wg_size[2];
+          if (fits_device (device, local_size))
+            compile_variant (kernel, device, local_size);
+          continue;
+        }
+
+      /* The local size clEnqueueNDRangeKernel() picks for the global
+         sizes divisible by the preferred work-group size multiple. */
+      if (speculate)
+        {
+          local_size[0] = device->preferred_wg_size_multiple;
+          local_size[1] = local_size[2] = 1;
+          while (local_size[0] > 1 && !fits_device (device, local_size))
+            local_size[0] /= 2;
+          if (local_size[0] > 0)
+            queue_variant (kernel, device, local_size);
+        }
+
+      s = extra_sizes;
+      while (next_local_size (&s, local_size))
+        {
+          if (fits_device (device, local_size))
+            queue_variant (kernel, device, local_size);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+/* OpenCL runtime library: ahead-of-time work-group function compilation
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+/**
+ * @file pocl_precompile.h
+ *
+ * Generates the work-group functions of the kernels before their first
+ * launch. The work-group function of a kernel with reqd_work_group_size
+ * is compiled already in clCreateKernel(). For the other kernels the
+ * local size clEnqueueNDRangeKernel() picks when none is given, and the
+ * sizes listed in POCL_PRECOMPILE_LOCAL_SIZES, are compiled on the
+ * compiler threads.
+ */
+
+#ifndef POCL_PRECOMPILE_H
+#define POCL_PRECOMPILE_H
+
+#include "pocl_cl.h"
+
+#pragma GCC visibility push(hidden)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returns the variant of the kernel for the device and the local size,
+   generating the work-group function first if needed. Returns NULL and
+   sets *errcode on failure. */
+pocl_kernel_variant *pocl_generate_kernel_variant (cl_kernel kernel,
+                                                   cl_device_id device,
+                                                   size_t local_x,
+                                                   size_t local_y,
+                                                   size_t local_z,
+                                                   cl_int *errcode);
+
+/* Starts compiling the variants of a new kernel likely to be launched. */
+void pocl_precompile_kernel (cl_kernel kernel);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
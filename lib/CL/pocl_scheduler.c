@@ -0,0 +1,394 @@
+/* OpenCL runtime library: the command scheduler
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_scheduler.h"
+#include "pocl_mem_management.h"
+#include "utlist.h"
+
+#include <pthread.h>
+
+/* The executor threads of a device and the flushed commands of the
+   device ready to be executed. */
+typedef struct pocl_device_executors
+{
+  _cl_command_node *ready;
+  /* Signalled when commands are added to the ready list. */
+  pthread_cond_t ready_cond;
+  unsigned num_threads;
+} pocl_device_executors;
+
+/* Protects the dependency graph of the flushed commands, the ready lists
+   of the devices and the pending command counts of the queues. The lock
+   of a queue can be taken before this lock, but not vice versa. Objects
+   must not be released while holding this lock as releasing an event can
+   end up flushing its queue. */
+static pocl_lock_t sched_lock = POCL_LOCK_INITIALIZER;
+/* The dependency graph edges of the completed commands for reuse. */
+static event_dependent *free_dependents = NULL;
+/* Signalled each time a command completes, for the threads waiting for
+   a queue to finish. */
+static pthread_cond_t sched_cond = PTHREAD_COND_INITIALIZER;
+
+static void *executor_main (void *arg);
+
+/* Returns the executors of the device, starting the executor threads
+   at the first call. Must be called with sched_lock held. */
+static pocl_device_executors *
+get_executors (cl_device_id device)
+{
+  pocl_device_executors *ex = device->executors;
+  pthread_attr_t attr;
+  pthread_t thread;
+  unsigned i;
+
+  if (ex != NULL)
+    return ex;
+
+  ex = (pocl_device_executors*)malloc (sizeof (pocl_device_executors));
+  if (ex == NULL)
+    POCL_ABORT ("pocl: could not allocate the command executors\n");
+  ex->ready = NULL;
+  pthread_cond_init (&ex->ready_cond, NULL);
+  ex->num_threads = device->max_concurrent_commands;
+  if (ex->num_threads < 1)
+    ex->num_threads = 1;
+  device->executors = ex;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  for (i = 0; i < ex->num_threads; ++i)
+    {
+      if (pthread_create (&thread, &attr, executor_main, device) != 0)
+        POCL_ABORT ("pocl: could not create a command executor thread\n");
+    }
+  pthread_attr_destroy (&attr);
+  return ex;
+}
+
+/* Must be called with sched_lock held. */
+static void
+make_ready (_cl_command_node *node)
+{
+  pocl_device_executors *ex = get_executors (node->device);
+  LL_APPEND (ex->ready, node);
+  pthread_cond_signal (&ex->ready_cond);
+}
+
+/* Drops the references the queue holds to the event of an executed
+   command. Returns the number of references dropped. */
+static int
+forget_event (cl_command_queue queue, cl_event event)
+{
+  int refs = 0;
+  unsigned i;
+
+  POCL_LOCK_OBJ (queue);
+  if (queue->last_event == event)
+    {
+      queue->last_event = NULL;
+      ++refs;
+    }
+  if (queue->barrier_event == event)
+    {
+      queue->barrier_event = NULL;
+      ++refs;
+    }
+  for (i = 0; i < queue->num_outstanding_commands; ++i)
+    {
+      if (queue->outstanding_commands[i]->event == event)
+        {
+          queue->outstanding_commands[i] = 
+            queue->outstanding_commands[--queue->num_outstanding_commands];
+          ++refs;
+          break;
+        }
+    }
+  POCL_UNLOCK_OBJ (queue);
+  return refs;
+}
+
+/* Notifies the dependents of the executed command and releases the
+   resources it held. */
+static void
+finish_command (_cl_command_node *node)
+{
+  cl_event event = node->event;
+  cl_command_queue queue = event->queue;
+  event_dependent *dep;
+  event_dependent *next;
+  int refs;
+  int i;
+
+  refs = forget_event (queue, event);
+
+  POCL_LOCK_OBJ (event);
+  pthread_cond_broadcast (&event->completion_cond);
+  POCL_UNLOCK_OBJ (event);
+
+  POCL_LOCK (sched_lock);
+  for (dep = event->dependents; dep != NULL; dep = next)
+    {
+      next = dep->next;
+      if (--dep->command->num_unmet_deps == 0)
+        make_ready (dep->command);
+      dep->next = free_dependents;
+      free_dependents = dep;
+    }
+  event->dependents = NULL;
+  __sync_sub_and_fetch (&queue->num_pending, 1);
+  pthread_cond_broadcast (&sched_cond);
+  POCL_UNLOCK (sched_lock);
+
+  for (i = 0; i < node->num_events_in_wait_list; ++i)
+    POname(clReleaseEvent) (node->event_wait_list[i]);
+  if (node->event_wait_list != node->inline_wait_list)
+    free ((cl_event*)node->event_wait_list);
+  free (node->mem_accesses);
+  while (refs-- > 0)
+    POname(clReleaseEvent) (event);
+  POname(clReleaseEvent) (event);
+  pocl_mem_manager_free_command (node);
+}
+
+static void *
+executor_main (void *arg)
+{
+  cl_device_id device = (cl_device_id)arg;
+  pocl_device_executors *ex;
+
+  POCL_LOCK (sched_lock);
+  ex = device->executors;
+  for (;;)
+    {
+      _cl_command_node *node;
+
+      while (ex->ready == NULL)
+        pthread_cond_wait (&ex->ready_cond, &sched_lock);
+      node = ex->ready;
+      LL_DELETE (ex->ready, node);
+      POCL_UNLOCK (sched_lock);
+
+      pocl_exec_command (node);
+      finish_command (node);
+
+      POCL_LOCK (sched_lock);
+    }
+  return NULL;
+}
+
+static void flush_event (cl_event event);
+
+/* Hands the commands removed from the queue over to the scheduler. */
+static void
+submit_commands (cl_command_queue queue, _cl_command_node *list)
+{
+  _cl_command_node *node;
+  int i;
+
+  /* The commands waiting for the commands of other queues not flushed
+     yet would never become ready, thus flush those commands first. The 
+     wait lists keep the events alive. */
+  LL_FOREACH (list, node)
+    {
+      for (i = 0; i < node->num_events_in_wait_list; ++i)
+        {
+          cl_event dep = node->event_wait_list[i];
+          if (dep->status == CL_QUEUED && dep->queue != queue)
+            flush_event (dep);
+        }
+    }
+
+  POCL_LOCK (sched_lock);
+  while (list != NULL)
+    {
+      node = list;
+      LL_DELETE (list, node);
+      node->num_unmet_deps = 0;
+      for (i = 0; i < node->num_events_in_wait_list; ++i)
+        {
+          cl_event ev = node->event_wait_list[i];
+          event_dependent *dep;
+
+          /* The status is set to complete before the dependents are
+             notified under the lock, thus a dependent registered here
+             is always notified. */
+          if (ev->status <= CL_COMPLETE)
+            continue;
+          if ((dep = free_dependents) != NULL)
+            free_dependents = dep->next;
+          else
+            dep = (event_dependent*)malloc (sizeof (event_dependent));
+          if (dep == NULL)
+            POCL_ABORT ("pocl: out of memory in the command scheduler\n");
+          dep->command = node;
+          dep->next = ev->dependents;
+          ev->dependents = dep;
+          ++node->num_unmet_deps;
+        }
+      if (node->num_unmet_deps == 0)
+        make_ready (node);
+    }
+  POCL_UNLOCK (sched_lock);
+}
+
+/* Removes the command of the event from the queue together with the
+   commands of the same queue it depends on, directly or via other 
+   commands. Returns them in the enqueue order. Must be called with the
+   queue locked. */
+static _cl_command_node *
+take_dependencies (cl_command_queue queue, cl_event event)
+{
+  _cl_command_node *node;
+  _cl_command_node *taken = NULL;
+  _cl_command_node *tail = NULL;
+  _cl_command_node **nodes;
+  char *needed;
+  int n = 0;
+  int i, j, k;
+
+  LL_FOREACH (queue->root, node)
+    {
+      ++n;
+      if (node->event == event)
+        break;
+    }
+  /* already flushed */
+  if (node == NULL)
+    return NULL;
+
+  nodes = (_cl_command_node**)malloc (n * sizeof (_cl_command_node*));
+  needed = (char*)calloc (n, 1);
+  if (nodes == NULL || needed == NULL)
+    {
+      /* fall back to flushing the whole queue */
+      free (nodes);
+      free (needed);
+      taken = queue->root;
+      queue->root = NULL;
+      return taken;
+    }
+
+  i = 0;
+  LL_FOREACH (queue->root, node)
+    {
+      nodes[i] = node;
+      if (++i == n)
+        break;
+    }
+
+  /* A command can only wait for commands enqueued before it, thus a 
+     single backwards pass finds all of them. */
+  needed[n - 1] = 1;
+  for (i = n - 1; i > 0; --i)
+    {
+      if (!needed[i])
+        continue;
+      for (k = 0; k < nodes[i]->num_events_in_wait_list; ++k)
+        {
+          cl_event dep = nodes[i]->event_wait_list[k];
+          if (dep->queue != queue || dep->status != CL_QUEUED)
+            continue;
+          for (j = i - 1; j >= 0; --j)
+            {
+              if (nodes[j]->event == dep)
+                {
+                  needed[j] = 1;
+                  break;
+                }
+            }
+        }
+    }
+
+  for (i = 0; i < n; ++i)
+    {
+      if (!needed[i])
+        continue;
+      LL_DELETE (queue->root, nodes[i]);
+      nodes[i]->next = NULL;
+      if (tail == NULL)
+        taken = nodes[i];
+      else
+        tail->next = nodes[i];
+      tail = nodes[i];
+    }
+  free (nodes);
+  free (needed);
+  return taken;
+}
+
+/* Submits the command of the event and the ones it depends on. */
+static void
+flush_event (cl_event event)
+{
+  cl_command_queue queue = event->queue;
+  _cl_command_node *list;
+  _cl_command_node *node;
+
+  POCL_LOCK_OBJ (queue);
+  list = take_dependencies (queue, event);
+  LL_FOREACH (list, node)
+    POCL_UPDATE_EVENT_SUBMITTED (&node->event, queue);
+  POCL_UNLOCK_OBJ (queue);
+
+  if (list != NULL)
+    submit_commands (queue, list);
+}
+
+void
+pocl_flush_queue (cl_command_queue queue)
+{
+  _cl_command_node *list;
+  _cl_command_node *node;
+
+  POCL_LOCK_OBJ (queue);
+  list = queue->root;
+  queue->root = NULL;
+  LL_FOREACH (list, node)
+    POCL_UPDATE_EVENT_SUBMITTED (&node->event, queue);
+  POCL_UNLOCK_OBJ (queue);
+
+  if (list != NULL)
+    submit_commands (queue, list);
+}
+
+void
+pocl_finish_queue (cl_command_queue queue)
+{
+  pocl_flush_queue (queue);
+
+  POCL_LOCK (sched_lock);
+  while (queue->num_pending > 0)
+    pthread_cond_wait (&sched_cond, &sched_lock);
+  POCL_UNLOCK (sched_lock);
+}
+
+void
+pocl_wait_for_event (cl_event event)
+{
+  flush_event (event);
+
+  POCL_LOCK_OBJ (event);
+  while (event->status > CL_COMPLETE)
+    pthread_cond_wait (&event->completion_cond, &event->pocl_lock);
+  POCL_UNLOCK_OBJ (event);
+}
@@ -0,0 +1,77 @@
+/* OpenCL runtime library: the command scheduler
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/**
+ * @file pocl_scheduler.h
+ *
+ * The commands of a queue are collected to the queue's 'root' list by
+ * the clEnqueue* functions. Flushing the queue hands them over to the
+ * scheduler which builds a dependency graph of the flushed commands
+ * from their event wait lists: each command counts its wait list events
+ * not completed yet and registers itself as a dependent of those events.
+ * The commands with no unmet dependencies are put to the ready list of
+ * their device from where the executor threads of the device (at most
+ * max_concurrent_commands, started at the first flush) pick them.
+ * Completing a command decrements the counts of its dependents, which
+ * makes them ready in turn, also across queues and devices.
+ *
+ * The host threads waiting for a queue to finish sleep on a condition
+ * variable signalled at each command completion, the ones waiting for
+ * an event on the condition variable of the event.
+ *
+ * In-order queues make each command depend on the previous one. In
+ * out-of-order queues only the barriers and the markers without a wait
+ * list impose an ordering on the commands of the queue.
+ */
+
+#ifndef POCL_SCHEDULER_H
+#define POCL_SCHEDULER_H
+
+#include "pocl_cl.h"
+
+#pragma GCC visibility push(hidden)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Submits the commands enqueued to the queue to the executor threads.
+   Does not wait for the commands to finish. */
+void pocl_flush_queue (cl_command_queue queue);
+
+/* Flushes the queue and waits until all its commands have completed. */
+void pocl_finish_queue (cl_command_queue queue);
+
+/* Flushes the command of the event and the commands it depends on, but
+   not the rest of its queue, and waits until the event has completed. */
+void pocl_wait_for_event (cl_event event);
+
+/* Executes a single command and updates the status of its event.
+   Called by the executor threads. */
+void pocl_exec_command (_cl_command_node *node);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
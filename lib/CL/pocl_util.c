@@ -21,6 +21,7 @@
    THE SOFTWARE.
 */
 
+#include <assert.h>
 #include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -52,6 +53,21 @@ remove_directory (const char *path_name)
   free (cmd);
 }
 
+int
+pocl_program_device_dir (char *path, cl_program program, 
+                         cl_device_id device)
+{
+  unsigned i;
+
+  for (i = 0; i < program->num_devices; ++i)
+    {
+      if (program->devices[i] == device)
+        break;
+    }
+  return snprintf (path, POCL_FILENAME_LENGTH, "%s/%s-%u", 
+                   program->temp_dir, device->short_name, i);
+}
+
 #define POCL_TEMPDIR_ENV "POCL_TEMP_DIR"
 
 char*
@@ -212,6 +228,7 @@ cl_int pocl_create_event (cl_event *event, cl_command_queue command_queue,
       POname(clRetainCommandQueue) (command_queue);
       (*event)->command_type = command_type;
       (*event)->callback_list = NULL;
+      (*event)->dependents = NULL;
       (*event)->implicit_event = 0;
       (*event)->next = NULL;
     }
@@ -226,6 +243,7 @@ cl_int pocl_create_command (_cl_command_node **cmd,
   int i;
   int err;
   cl_event *event = NULL;
+  cl_event *new_wl;
 
   if ((wait_list == NULL && num_events != 0) ||
       (wait_list != NULL && num_events == 0))
@@ -241,12 +259,26 @@ cl_int pocl_create_command (_cl_command_node **cmd,
 
   if (*cmd == NULL)
     return CL_OUT_OF_HOST_MEMORY;
+
+  /* Reserve one extra slot in the wait list for the dependency to the
+     previous command of an in-order queue added at enqueue time. */
+  if (num_events + 1 <= POCL_INLINE_WAIT_LIST_LENGTH)
+    new_wl = (*cmd)->inline_wait_list;
+  else
+    new_wl = (cl_event*)malloc ((num_events + 1) * sizeof (cl_event));
+  if (new_wl == NULL)
+    {
+      pocl_mem_manager_free_command (*cmd);
+      return CL_OUT_OF_HOST_MEMORY;
+    }
   
   /* if user does not provide event pointer, create event anyway */
   event = &((*cmd)->event);
   err = pocl_create_event(event, command_queue, command_type);
   if (err != CL_SUCCESS)
     {
+      if (new_wl != (*cmd)->inline_wait_list)
+        free (new_wl);
       free (*cmd);
       return err;
     }
@@ -255,33 +287,19 @@ cl_int pocl_create_command (_cl_command_node **cmd,
   else
     (*event)->implicit_event = 1;
   
-  /* if in-order command queue and queue is not empty, add event from 
-     previous command to new commands event_waitlist */
-  if (!(command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) 
-      && command_queue->root != NULL)
-    {
-      _cl_command_node *prev_command;
-      for (prev_command = command_queue->root; prev_command->next != NULL;
-           prev_command = prev_command->next){}
-      //printf("create_command: prev_com=%d prev_com->event = %d \n",prev_command, prev_command->event);
-      cl_event *new_wl = (cl_event*)malloc ((num_events +1)*sizeof (cl_event));
-      for (i = 0; i < num_events; ++i)
-        {
-          new_wl[i] = wait_list[i];
-        }
-      new_wl[i] = prev_command->event;
-      (*cmd)->event_wait_list = new_wl;
-      (*cmd)->num_events_in_wait_list = num_events + 1;
-      for (i = 0; i < num_events + 1; ++i)
-        {
-          //printf("create-command: new_wl[%i]=%d\n", i, new_wl[i]);
-        }
-    }
-  else
+  /* The command keeps its own reference to its event and to the events
+     it waits for, so they stay alive until it has been executed. */
+  if (event_p)
+    POname(clRetainEvent) (*event);
+  for (i = 0; i < num_events; ++i)
     {
-      (*cmd)->event_wait_list = wait_list;  
-      (*cmd)->num_events_in_wait_list = num_events;
+      new_wl[i] = wait_list[i];
+      POname(clRetainEvent) (new_wl[i]);
     }
+  (*cmd)->event_wait_list = new_wl;
+  (*cmd)->num_events_in_wait_list = num_events;
+  (*cmd)->mem_accesses = NULL;
+  (*cmd)->num_mem_accesses = -1;
   (*cmd)->type = command_type;
   (*cmd)->next = NULL;
   (*cmd)->device = command_queue->device;
@@ -292,16 +310,628 @@ cl_int pocl_create_command (_cl_command_node **cmd,
   return CL_SUCCESS;
 }
 
+static void
+set_access (_cl_mem_access *acc, cl_mem buffer, int write)
+{
+  acc->buffer = buffer;
+  acc->host_ptr = NULL;
+  acc->size = 0;
+  acc->write = write;
+}
+
+static void
+set_host_access (_cl_mem_access *acc, const void *host_ptr, size_t size,
+                 int write)
+{
+  acc->buffer = NULL;
+  acc->host_ptr = (const char*)host_ptr;
+  acc->size = size;
+  acc->write = write;
+}
+
+/* Returns non-zero if the kernel argument is a buffer or an image the
+   kernel might write. */
+static int
+arg_may_write (cl_kernel kernel, int i, cl_mem buf)
+{
+  struct pocl_argument_info *ai = &kernel->arg_info[i];
+
+  if (buf == NULL || (buf->flags & CL_MEM_READ_ONLY))
+    return 0;
+  if (ai->type == POCL_ARG_TYPE_IMAGE)
+    return !((kernel->has_arg_metadata & 
+              POCL_HAS_KERNEL_ARG_ACCESS_QUALIFIER) &&
+             ai->access_qualifier == CL_KERNEL_ARG_ACCESS_READ_ONLY);
+  return !(((kernel->has_arg_metadata & 
+             POCL_HAS_KERNEL_ARG_ADDRESS_QUALIFIER) &&
+            ai->address_qualifier == CL_KERNEL_ARG_ADDRESS_CONSTANT) ||
+           ((kernel->has_arg_metadata & 
+             POCL_HAS_KERNEL_ARG_TYPE_QUALIFIER) &&
+            (ai->type_qualifier & CL_KERNEL_ARG_TYPE_CONST)));
+}
+
+/* Collects the buffers and the host memory the command reads and writes.
+   Leaves the command unanalyzed if it is of a type the analysis does not
+   know about. */
+static void
+get_mem_accesses (_cl_command_node *node)
+{
+  _cl_mem_access *acc;
+  cl_kernel kernel;
+  int i, n, b;
+
+  switch (node->type)
+    {
+    case CL_COMMAND_READ_BUFFER:
+    case CL_COMMAND_WRITE_BUFFER:
+    case CL_COMMAND_COPY_BUFFER:
+    case CL_COMMAND_FILL_BUFFER:
+      acc = (_cl_mem_access*)malloc (2 * sizeof (_cl_mem_access));
+      if (acc == NULL)
+        return;
+      n = 0;
+      if (node->type == CL_COMMAND_READ_BUFFER)
+        {
+          set_access (&acc[n++], node->command.read.buffer, 0);
+          set_host_access (&acc[n++], node->command.read.host_ptr,
+                           node->command.read.cb, 1);
+        }
+      else if (node->type == CL_COMMAND_WRITE_BUFFER)
+        {
+          set_access (&acc[n++], node->command.write.buffer, 1);
+          set_host_access (&acc[n++], node->command.write.host_ptr,
+                           node->command.write.cb, 0);
+        }
+      else if (node->type == CL_COMMAND_FILL_BUFFER)
+        set_access (&acc[n++], node->command.fill_image.buffer, 1);
+      else
+        {
+          set_access (&acc[n++], node->command.copy.src_buffer, 0);
+          set_access (&acc[n++], node->command.copy.dst_buffer, 1);
+        }
+      break;
+    case CL_COMMAND_NDRANGE_KERNEL:
+      /* arg_buffers has an entry for each buffer argument, in the 
+         argument order. The images are read from the copied 
+         arguments. */
+      kernel = node->command.run.kernel;
+      acc = (_cl_mem_access*)malloc 
+        ((kernel->num_args + 1) * sizeof (_cl_mem_access));
+      if (acc == NULL)
+        return;
+      n = b = 0;
+      for (i = 0; i < kernel->num_args; ++i)
+        {
+          struct pocl_argument_info *ai = &kernel->arg_info[i];
+          struct pocl_argument *arg = &node->command.run.arguments[i];
+          cl_mem buf;
+          if (ai->is_local || arg->value == NULL)
+            continue;
+          if (ai->type == POCL_ARG_TYPE_POINTER)
+            buf = node->command.run.arg_buffers[b++];
+          else if (ai->type == POCL_ARG_TYPE_IMAGE)
+            buf = *(cl_mem*)arg->value;
+          else
+            continue;
+          set_access (&acc[n++], buf, arg_may_write (kernel, i, buf));
+        }
+      break;
+    default:
+      return;
+    }
+  node->mem_accesses = acc;
+  node->num_mem_accesses = n;
+}
+
+int
+pocl_buffers_overlap (cl_mem a, cl_mem b)
+{
+  cl_mem parent_a = a->parent != NULL ? a->parent : a;
+  cl_mem parent_b = b->parent != NULL ? b->parent : b;
+
+  if (a == b)
+    return 1;
+  if (parent_a != parent_b)
+    return 0;
+  return a->origin < b->origin + b->size && b->origin < a->origin + a->size;
+}
+
+/* The host memory the access touches: the host range itself or the
+   memory of a CL_MEM_USE_HOST_PTR buffer. Returns zero if none. */
+static int
+host_range (const _cl_mem_access *acc, const char **ptr, size_t *size)
+{
+  if (acc->buffer == NULL)
+    {
+      *ptr = acc->host_ptr;
+      *size = acc->size;
+      return acc->host_ptr != NULL;
+    }
+  if ((acc->buffer->flags & CL_MEM_USE_HOST_PTR) && 
+      acc->buffer->mem_host_ptr != NULL)
+    {
+      *ptr = (const char*)acc->buffer->mem_host_ptr;
+      *size = acc->buffer->size;
+      return 1;
+    }
+  return 0;
+}
+
+/* Returns non-zero if the accesses touch overlapping memory and at
+   least one of them writes it. */
+static int
+accesses_overlap (const _cl_mem_access *a, const _cl_mem_access *b)
+{
+  const char *ptr_a, *ptr_b;
+  size_t size_a, size_b;
+
+  if (!a->write && !b->write)
+    return 0;
+  if (a->buffer != NULL && b->buffer != NULL)
+    return pocl_buffers_overlap (a->buffer, b->buffer);
+  if (!host_range (a, &ptr_a, &size_a) || !host_range (b, &ptr_b, &size_b))
+    return 0;
+  return ptr_a < ptr_b + size_b && ptr_b < ptr_a + size_a;
+}
+
+/* Returns non-zero if the analyzed commands access overlapping memory
+   and at least one of them writes it. */
+static int
+accesses_conflict (const _cl_command_node *a, const _cl_command_node *b)
+{
+  int i, j;
+
+  for (i = 0; i < a->num_mem_accesses; ++i)
+    {
+      for (j = 0; j < b->num_mem_accesses; ++j)
+        {
+          if (accesses_overlap (&a->mem_accesses[i], &b->mem_accesses[j]))
+            return 1;
+        }
+    }
+  return 0;
+}
+
+/* Makes the command wait for the previous commands of an out-of-order
+   queue or an in-order queue with dependency analysis it must be ordered
+   after. Returns 0 on success. Must be called with the queue locked. */
+static int
+order_command (cl_command_queue queue, _cl_command_node *node)
+{
+  cl_event *wait_list;
+  unsigned i;
+  int analyzed = node->num_mem_accesses >= 0;
+  /* With the dependency analysis, a marker stands for all the previous
+     commands. It has no accesses of its own, thus the later commands
+     cannot be ordered after it by their accesses and it must block
+     them like a barrier. */
+  int is_barrier = node->type == CL_COMMAND_BARRIER ||
+    (queue->analyze_dependencies &&
+     (!analyzed || node->type == CL_COMMAND_MARKER));
+  int waits_all = is_barrier || (node->type == CL_COMMAND_MARKER &&
+                                 node->num_events_in_wait_list == 0);
+
+  if (queue->num_outstanding_commands == queue->outstanding_commands_size)
+    {
+      unsigned size = queue->outstanding_commands_size * 2 + 8;
+      _cl_command_node **commands = (_cl_command_node**)realloc 
+        (queue->outstanding_commands, size * sizeof (_cl_command_node*));
+      if (commands == NULL)
+        return -1;
+      queue->outstanding_commands = commands;
+      queue->outstanding_commands_size = size;
+    }
+
+  if (pocl_command_reserve_wait_list 
+      (node, node->num_events_in_wait_list + 
+       queue->num_outstanding_commands + 1) != 0)
+    return -1;
+  wait_list = (cl_event*)node->event_wait_list;
+
+  if (!waits_all)
+    {
+      /* an ordinary command waits for the last barrier and, in case of
+         the dependency analysis, for the commands accessing the same
+         buffers. It becomes one of the commands the next barrier waits
+         for. */
+      if (queue->barrier_event != NULL)
+        {
+          POname(clRetainEvent) (queue->barrier_event);
+          wait_list[node->num_events_in_wait_list++] = queue->barrier_event;
+        }
+      if (queue->analyze_dependencies)
+        {
+          for (i = 0; i < queue->num_outstanding_commands; ++i)
+            {
+              _cl_command_node *prev = queue->outstanding_commands[i];
+              if (!accesses_conflict (prev, node))
+                continue;
+              POname(clRetainEvent) (prev->event);
+              wait_list[node->num_events_in_wait_list++] = prev->event;
+            }
+        }
+      POname(clRetainEvent) (node->event);
+      queue->outstanding_commands[queue->num_outstanding_commands++] = node;
+      return 0;
+    }
+
+  /* the references of the queue move to the wait list */
+  for (i = 0; i < queue->num_outstanding_commands; ++i)
+    wait_list[node->num_events_in_wait_list++] = 
+      queue->outstanding_commands[i]->event;
+  queue->num_outstanding_commands = 0;
+
+  if (queue->barrier_event != NULL)
+    {
+      if (!is_barrier)
+        POname(clRetainEvent) (queue->barrier_event);
+      wait_list[node->num_events_in_wait_list++] = queue->barrier_event;
+      if (is_barrier)
+        queue->barrier_event = NULL;
+    }
+
+  POname(clRetainEvent) (node->event);
+  if (is_barrier)
+    queue->barrier_event = node->event;
+  else
+    /* the next barrier waits for the previous commands via the marker */
+    queue->outstanding_commands[queue->num_outstanding_commands++] = node;
+  return 0;
+}
+
 void pocl_command_enqueue(cl_command_queue command_queue, 
                           _cl_command_node *node)
 {
+  cl_event *wait_list = (cl_event*)node->event_wait_list;
+
+  if (command_queue->analyze_dependencies)
+    get_mem_accesses (node);
+
+  POCL_UPDATE_EVENT_QUEUED (&node->event, command_queue);
+  __sync_fetch_and_add (&command_queue->num_pending, 1);
+
   POCL_LOCK_OBJ(command_queue);
+  if (command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE ||
+      command_queue->analyze_dependencies)
+    {
+      if (order_command (command_queue, node) != 0)
+        POCL_ABORT ("pocl: out of memory while enqueuing a command\n");
+    }
+  else
+    {
+      /* in an in-order queue the command must wait for the previous one,
+         unless it has already been executed. The reference of the queue
+         moves to the wait list. */
+      if (command_queue->last_event != NULL)
+        wait_list[node->num_events_in_wait_list++] = 
+          command_queue->last_event;
+      POname(clRetainEvent) (node->event);
+      command_queue->last_event = node->event;
+    }
   LL_APPEND (command_queue->root, node);
   POCL_UNLOCK_OBJ(command_queue);
   #ifdef POCL_DEBUG_BUILD
   if (pocl_is_option_set("POCL_IMPLICIT_FINISH"))
     POclFinish (command_queue);
   #endif
-  POCL_UPDATE_EVENT_QUEUED (&node->event, command_queue);
+}
 
+int
+pocl_command_reserve_wait_list (_cl_command_node *node, int size)
+{
+  cl_event *wait_list;
+
+  if (size <= POCL_INLINE_WAIT_LIST_LENGTH)
+    return 0;
+
+  if (node->event_wait_list == node->inline_wait_list)
+    {
+      wait_list = (cl_event*)malloc (size * sizeof (cl_event));
+      if (wait_list != NULL)
+        memcpy (wait_list, node->inline_wait_list, 
+                node->num_events_in_wait_list * sizeof (cl_event));
+    }
+  else
+    wait_list = (cl_event*)realloc ((cl_event*)node->event_wait_list,
+                                    size * sizeof (cl_event));
+  if (wait_list == NULL)
+    return -1;
+  node->event_wait_list = wait_list;
+  return 0;
+}
+
+int
+pocl_command_can_run_now (cl_command_queue queue, cl_mem buffer, int write,
+                          cl_uint num_events, const cl_event *wait_list)
+{
+  _cl_mem_access acc;
+  int ready;
+  unsigned i;
+  int j;
+
+  for (i = 0; i < num_events; ++i)
+    {
+      if (wait_list[i]->status > CL_COMPLETE)
+        return 0;
+    }
+
+  POCL_LOCK_OBJ (queue);
+  if (queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE ||
+      queue->analyze_dependencies)
+    {
+      /* see order_command() */
+      set_access (&acc, buffer, write);
+      ready = queue->barrier_event == NULL;
+      for (i = 0; ready && queue->analyze_dependencies && 
+             i < queue->num_outstanding_commands; ++i)
+        {
+          const _cl_command_node *prev = queue->outstanding_commands[i];
+          /* the accesses of a marker or an unanalyzed command are not
+             known, assume a conflict */
+          if (prev->num_mem_accesses < 0 || prev->type == CL_COMMAND_MARKER)
+            ready = 0;
+          for (j = 0; j < prev->num_mem_accesses; ++j)
+            {
+              if (accesses_overlap (&prev->mem_accesses[j], &acc))
+                ready = 0;
+            }
+        }
+    }
+  else
+    ready = queue->last_event == NULL;
+  POCL_UNLOCK_OBJ (queue);
+  return ready;
+}
+
+cl_int
+pocl_create_complete_event (cl_event *event, cl_command_queue queue,
+                            cl_command_type command_type)
+{
+  cl_int err;
+
+  if (event == NULL)
+    return CL_SUCCESS;
+
+  err = pocl_create_event (event, queue, command_type);
+  if (err != CL_SUCCESS)
+    return err;
+  POCL_UPDATE_EVENT_QUEUED (event, queue);
+  POCL_UPDATE_EVENT_SUBMITTED (event, queue);
+  POCL_UPDATE_EVENT_RUNNING (event, queue);
+  POCL_UPDATE_EVENT_COMPLETE (event, queue);
+  return CL_SUCCESS;
+}
+
+int
+pocl_mapping_is_zero_copy (cl_mem buffer, cl_device_id device,
+                           const mem_mapping_t *mapping)
+{
+  return (char*)buffer->device_ptrs[device->dev_id].mem_ptr + 
+    mapping->offset == (char*)mapping->host_ptr;
+}
+
+pocl_kernel_variant *
+pocl_find_kernel_variant (cl_kernel kernel, cl_device_id device,
+                          size_t local_x, size_t local_y, size_t local_z)
+{
+  pocl_kernel_variant *v;
+
+  for (v = kernel->variants; v != NULL; v = v->next)
+    {
+      if (v->device == device && v->local_size[0] == local_x &&
+          v->local_size[1] == local_y && v->local_size[2] == local_z)
+        return v;
+    }
+  return NULL;
+}
+
+pocl_kernel_variant *
+pocl_add_kernel_variant (cl_kernel kernel, cl_device_id device,
+                         size_t local_x, size_t local_y, size_t local_z,
+                         const char *tmp_dir)
+{
+  pocl_kernel_variant *v;
+  pocl_kernel_variant *old;
+
+  v = (pocl_kernel_variant*)malloc (sizeof (pocl_kernel_variant));
+  if (v == NULL)
+    return NULL;
+  v->tmp_dir = strdup (tmp_dir);
+  if (v->tmp_dir == NULL)
+    {
+      free (v);
+      return NULL;
+    }
+  v->device = device;
+  v->local_size[0] = local_x;
+  v->local_size[1] = local_y;
+  v->local_size[2] = local_z;
+  v->sub_range_dim = -1;
+  v->wg = NULL;
+
+  POCL_LOCK_OBJ (kernel);
+  /* another thread might have generated the same variant meanwhile */
+  old = pocl_find_kernel_variant (kernel, device, local_x, local_y, local_z);
+  if (old == NULL)
+    {
+      v->next = kernel->variants;
+      /* the searchers must not see the variant before it is initialized */
+      __sync_synchronize ();
+      kernel->variants = v;
+    }
+  POCL_UNLOCK_OBJ (kernel);
+
+  if (old != NULL)
+    {
+      free (v->tmp_dir);
+      free (v);
+      return old;
+    }
+  return v;
+}
+
+/* The header of a block of copied kernel arguments. */
+typedef struct arg_block arg_block;
+struct arg_block
+{
+  arg_block *next;
+  size_t size;
+};
+
+#define ARG_BLOCK_ALIGNMENT MAX_EXTENDED_ALIGNMENT
+#define ARG_BLOCK_HEADER_SIZE \
+  ((sizeof (arg_block) + ARG_BLOCK_ALIGNMENT - 1) & ~(ARG_BLOCK_ALIGNMENT - 1))
+#define ALIGN_UP(__SIZE__, __ALIGN__) \
+  (((__SIZE__) + (__ALIGN__) - 1) & ~((size_t)(__ALIGN__) - 1))
+
+/* The alignment of a copied argument value. 
+   FIXME: this is a cludge to determine an acceptable alignment,
+   we should probably extract the argument alignment from the
+   LLVM bytecode during kernel header generation. */
+static size_t
+arg_alignment (size_t size)
+{
+  size_t alignment = pocl_size_ceil2 (size);
+  if (alignment >= MAX_EXTENDED_ALIGNMENT)
+    alignment = MAX_EXTENDED_ALIGNMENT;
+  if (alignment == 0)
+    alignment = 1;
+  return alignment;
+}
+
+static int
+is_buffer_arg (cl_kernel kernel, int i)
+{
+  return i < kernel->num_args && !kernel->arg_info[i].is_local && 
+    kernel->arg_info[i].type == POCL_ARG_TYPE_POINTER &&
+    kernel->dyn_arguments[i].value != NULL;
+}
+
+struct pocl_argument *
+pocl_copy_kernel_arguments (cl_kernel kernel, cl_mem **arg_buffers,
+                            int *arg_buffer_count)
+{
+  unsigned num_args = kernel->num_args + kernel->num_locals;
+  struct pocl_argument *arguments;
+  arg_block *block;
+  arg_block **prev;
+  size_t size;
+  size_t offset;
+  int count = 0;
+  unsigned i;
+
+  for (i = 0; i < kernel->num_args; ++i)
+    if (is_buffer_arg (kernel, i))
+      ++count;
+
+  /* The layout: header, the argument array, the buffer array and the
+     argument values, each aligned for its size. */
+  size = ARG_BLOCK_HEADER_SIZE + num_args * sizeof (struct pocl_argument) +
+    count * sizeof (cl_mem);
+  for (i = 0; i < num_args; ++i)
+    {
+      size_t arg_size = kernel->dyn_arguments[i].size;
+      size_t alignment = arg_alignment (arg_size);
+      if (kernel->dyn_arguments[i].value == NULL)
+        continue;
+      size = ALIGN_UP (size, alignment) + 
+        (arg_size < alignment ? alignment : arg_size);
+    }
+  size = ALIGN_UP (size, ARG_BLOCK_ALIGNMENT);
+
+  POCL_LOCK_OBJ (kernel);
+  for (prev = (arg_block**)&kernel->free_arg_blocks; *prev != NULL; 
+       prev = &(*prev)->next)
+    {
+      if ((*prev)->size >= size)
+        break;
+    }
+  block = *prev;
+  if (block != NULL)
+    *prev = block->next;
+  POCL_UNLOCK_OBJ (kernel);
+
+  if (block == NULL)
+    {
+      block = (arg_block*)pocl_aligned_malloc (ARG_BLOCK_ALIGNMENT, size);
+      if (block == NULL)
+        return NULL;
+      block->size = size;
+    }
+
+  arguments = (struct pocl_argument*)((char*)block + ARG_BLOCK_HEADER_SIZE);
+  *arg_buffers = (cl_mem*)(arguments + num_args);
+  *arg_buffer_count = count;
+  offset = ARG_BLOCK_HEADER_SIZE + num_args * sizeof (struct pocl_argument) +
+    count * sizeof (cl_mem);
+
+  count = 0;
+  for (i = 0; i < num_args; ++i)
+    {
+      struct pocl_argument *arg = &arguments[i];
+      size_t alignment = arg_alignment (kernel->dyn_arguments[i].size);
+
+      arg->size = kernel->dyn_arguments[i].size;
+      if (kernel->dyn_arguments[i].value == NULL)
+        {
+          arg->value = NULL;
+          continue;
+        }
+      offset = ALIGN_UP (offset, alignment);
+      arg->value = (char*)block + offset;
+      memcpy (arg->value, kernel->dyn_arguments[i].value, arg->size);
+      offset += arg->size < alignment ? alignment : arg->size;
+
+      if (is_buffer_arg (kernel, i))
+        (*arg_buffers)[count++] = *(cl_mem*)arg->value;
+    }
+  return arguments;
+}
+
+void
+pocl_free_kernel_arguments (cl_kernel kernel, struct pocl_argument *arguments)
+{
+  arg_block *block = 
+    (arg_block*)((char*)arguments - ARG_BLOCK_HEADER_SIZE);
+
+  POCL_LOCK_OBJ (kernel);
+  block->next = (arg_block*)kernel->free_arg_blocks;
+  kernel->free_arg_blocks = block;
+  POCL_UNLOCK_OBJ (kernel);
+}
+
+void
+pocl_free_kernel_variants (cl_kernel kernel)
+{
+  pocl_kernel_variant *v;
+  arg_block *block;
+
+  while ((v = kernel->variants) != NULL)
+    {
+      kernel->variants = v->next;
+      free (v->tmp_dir);
+      free (v);
+    }
+  while ((block = (arg_block*)kernel->free_arg_blocks) != NULL)
+    {
+      kernel->free_arg_blocks = block->next;
+      pocl_aligned_free (block);
+    }
+}
+
+cl_int
+pocl_mem_alloc_for_device (cl_mem mem, cl_device_id device)
+{
+  cl_int error = CL_SUCCESS;
+
+  if (mem->device_ptrs[device->dev_id].mem_ptr != NULL)
+    return CL_SUCCESS;
+
+  /* The sub-buffers are created from allocated parents. */
+  assert (mem->parent == NULL);
+  POCL_LOCK_OBJ (mem);
+  if (mem->device_ptrs[device->dev_id].mem_ptr == NULL)
+    error = device->ops->alloc_mem_obj (device, mem);
+  POCL_UNLOCK_OBJ (mem);
+  return error == CL_SUCCESS ? CL_SUCCESS : CL_MEM_OBJECT_ALLOCATION_FAILURE;
 }
@@ -41,6 +41,14 @@ extern "C" {
 char *pocl_create_temp_dir();
 void remove_directory (const char *path_name);
 
+/* Writes the path of the temporary directory of the builds of the 
+   program for the device to 'path' of POCL_FILENAME_LENGTH bytes and
+   returns the length like snprintf(). The directory is named after the
+   index of the device in the program as the devices of the same type
+   must not share it. */
+int pocl_program_device_dir (char *path, cl_program program, 
+                             cl_device_id device);
+
 uint32_t byteswap_uint32_t (uint32_t word, char should_swap);
 float byteswap_float (float word, char should_swap);
 
@@ -100,4 +108,73 @@ cl_int pocl_create_command (_cl_command_node **cmd,
 void pocl_command_enqueue(cl_command_queue command_queue, 
                           _cl_command_node *node);
 
+/* Returns non-zero if the memory objects share memory: they are the same
+   object, a sub buffer and its parent, or overlapping sub buffers of the
+   same parent. */
+int pocl_buffers_overlap (cl_mem a, cl_mem b);
+
+/* Grows the wait list of the command to hold at least 'size' events.
+   Returns 0 on success. */
+int pocl_command_reserve_wait_list (_cl_command_node *node, int size);
+
+/* Returns non-zero if a command accessing the buffer (writing it if
+   'write' is non-zero) enqueued to the queue would not have to wait for
+   anything, thus it can be executed directly at enqueue time. */
+int pocl_command_can_run_now (cl_command_queue queue, cl_mem buffer, 
+                              int write, cl_uint num_events, 
+                              const cl_event *wait_list);
+
+/* Creates an already completed event for a command executed directly at
+   enqueue time. Does nothing if 'event' is NULL. */
+cl_int pocl_create_complete_event (cl_event *event, cl_command_queue queue,
+                                   cl_command_type command_type);
+
+/* Returns non-zero if the mapped host memory of the mapping is the device
+   memory of the buffer itself, thus needs no data movement. */
+int pocl_mapping_is_zero_copy (cl_mem buffer, cl_device_id device,
+                               const mem_mapping_t *mapping);
+
+/* Returns the variant of the kernel for the device and the local size,
+   NULL if it has not been generated yet. */
+pocl_kernel_variant *pocl_find_kernel_variant (cl_kernel kernel, 
+                                               cl_device_id device,
+                                               size_t local_x, size_t local_y,
+                                               size_t local_z);
+
+/* Registers a generated variant. Returns NULL if out of memory. */
+pocl_kernel_variant *pocl_add_kernel_variant (cl_kernel kernel, 
+                                              cl_device_id device,
+                                              size_t local_x, size_t local_y,
+                                              size_t local_z,
+                                              const char *tmp_dir);
+
+/* Copies the current arguments of the kernel to a single block of memory
+   recycled between the launches of the kernel. The buffer arguments are
+   listed in *arg_buffers which is stored in the same block. Returns NULL
+   if out of memory. */
+struct pocl_argument *pocl_copy_kernel_arguments (cl_kernel kernel, 
+                                                  cl_mem **arg_buffers,
+                                                  int *arg_buffer_count);
+
+/* Returns the block of the arguments copied by pocl_copy_kernel_arguments()
+   to the kernel for reuse. */
+void pocl_free_kernel_arguments (cl_kernel kernel, 
+                                 struct pocl_argument *arguments);
+
+/* Frees the variants and the argument blocks of a released kernel. */
+void pocl_free_kernel_variants (cl_kernel kernel);
+
+/* The implementation of clCreateBuffer. The size is checked against the
+   maximum allocation size of the devices only if 'check_size' is 
+   non-zero. */
+cl_mem pocl_create_buffer (cl_context context, cl_mem_flags flags, 
+                           size_t size, void *host_ptr, int check_size,
+                           cl_int *errcode_ret);
+
+/* Allocates the memory of the buffer for the device unless already
+   allocated. The buffers without contents to copy at creation are
+   allocated by the first command using them on the device. Returns
+   CL_MEM_OBJECT_ALLOCATION_FAILURE if out of memory. */
+cl_int pocl_mem_alloc_for_device (cl_mem mem, cl_device_id device);
+
 #endif
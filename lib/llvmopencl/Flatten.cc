@@ -63,12 +63,13 @@ bool
 Flatten::runOnModule(Module &M)
 {
   bool changed = false;
+  std::string kernelName = pocl::Workgroup::getKernelName(M);
   for (llvm::Module::iterator i = M.begin(), e = M.end(); i != e; ++i)
     {
       llvm::Function *f = i;
       if (f->isDeclaration()) continue;
-      if (KernelName == f->getName() || 
-          (KernelName == "" && pocl::Workgroup::isKernelToProcess(*f)))
+      if (kernelName == f->getName() || 
+          (kernelName == "" && pocl::Workgroup::isKernelToProcess(*f)))
         {
 #ifdef LLVM_3_1
           f->removeFnAttr(Attribute::AlwaysInline);
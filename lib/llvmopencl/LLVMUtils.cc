@@ -25,6 +25,8 @@
 #include "pocl.h"
 #include "config.h"
 
+#include <cstdlib>
+
 #ifdef LLVM_3_2
 #include <llvm/Module.h>
 #include <llvm/Metadata.h>
@@ -91,5 +93,47 @@ regenerate_kernel_metadata(llvm::Module &M, FunctionMapping &kernels)
   }
 }
 
+void
+setModuleParameter(llvm::Module &M, const std::string &name,
+                   const std::string &value)
+{
+  NamedMDNode *md = M.getNamedMetadata("pocl." + name);
+  if (md != NULL)
+    M.eraseNamedMetadata(md);
+
+  md = M.getOrInsertNamedMetadata("pocl." + name);
+  Value *str = MDString::get(M.getContext(), value);
+  md->addOperand(MDNode::get(M.getContext(), ArrayRef<Value *>(str)));
 }
 
+bool
+getModuleParameter(const llvm::Module &M, const std::string &name,
+                   std::string &value)
+{
+  NamedMDNode *md = M.getNamedMetadata("pocl." + name);
+  if (md == NULL || md->getNumOperands() == 0 ||
+      md->getOperand(0)->getNumOperands() == 0)
+    return false;
+
+  MDString *str = dyn_cast<MDString>(md->getOperand(0)->getOperand(0));
+  if (str == NULL)
+    return false;
+  value = str->getString().str();
+  return true;
+}
+
+bool
+getCompilerOption(const llvm::Module &M, const char *name,
+                  std::string &value)
+{
+  if (getModuleParameter(M, name, value))
+    return true;
+
+  const char *env = getenv(name);
+  if (env == NULL)
+    return false;
+  value = env;
+  return true;
+}
+
+}
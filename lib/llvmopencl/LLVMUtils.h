@@ -52,6 +52,26 @@ typedef std::map<llvm::Function*, llvm::Function*> FunctionMapping;
 void
 regenerate_kernel_metadata(llvm::Module &M, FunctionMapping &kernels);
 
+/* The parameters of a kernel compiler invocation are stored to the module
+   as "pocl.<name>" metadata by the runtime instead of global options, thus
+   multiple kernels can be compiled in parallel. */
+void
+setModuleParameter(llvm::Module &M, const std::string &name,
+                   const std::string &value);
+
+/* Returns false if the module has no such parameter, e.g., when the
+   passes are run with opt. */
+bool
+getModuleParameter(const llvm::Module &M, const std::string &name,
+                   std::string &value);
+
+/* Reads an option of the passes named like the environment variable
+   from the module parameters, or from the environment if the module has
+   no such parameter. Returns false if not set. */
+bool
+getCompilerOption(const llvm::Module &M, const char *name,
+                  std::string &value);
+
 inline bool
 is_automatic_local(const std::string& funcName, llvm::GlobalVariable &var) 
 {
@@ -42,6 +42,7 @@
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Atomic.h"
 #include <vector>
 #include <sstream>
 
@@ -126,7 +127,7 @@ class Kernel;
 
     /// Identifier for the parallel region.
     int pRegionId;
-    static int idGen;
+    static llvm::sys::cas_flag idGen;
 
   };
     
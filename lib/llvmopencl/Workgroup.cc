@@ -30,6 +30,7 @@
 #include "llvm/Analysis/ConstantFolding.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ThreadLocal.h"
 #include "config.h"
 #ifdef LLVM_3_1
 #include "llvm/Support/IRBuilder.h"
@@ -64,6 +65,7 @@
 #include <iostream>
 
 #include "pocl.h"
+#include "LLVMUtils.h"
 
 #define STRING_LENGTH 32
 
@@ -73,6 +75,7 @@ using namespace pocl;
 
 static Function *createLauncher(Module &M, Function *F);
 static void privatizeContext(Module &M, Function *F);
+static void addTeamBarriers(Module &M, Function *F, Value *context);
 static void createWorkgroup(Module &M, Function *F);
 static void createWorkgroupFast(Module &M, Function *F);
 
@@ -93,22 +96,29 @@ namespace llvm {
   template<bool xcompile> class TypeBuilder<PoclContext, xcompile> {
   public:
     static StructType *get(LLVMContext &Context) {
-      if (size_t_width == 64)
+      const int *width = size_t_width.get();
+      if (width != NULL && *width == 64)
         {
           return StructType::get
             (TypeBuilder<types::i<32>, xcompile>::get(Context),
              TypeBuilder<types::i<64>[3], xcompile>::get(Context),
              TypeBuilder<types::i<64>[3], xcompile>::get(Context),
              TypeBuilder<types::i<64>[3], xcompile>::get(Context),
+             TypeBuilder<types::i<64>[2], xcompile>::get(Context),
+             TypeBuilder<types::i<8>*, xcompile>::get(Context),
+             TypeBuilder<types::i<8>*, xcompile>::get(Context),
              NULL);
         }
-      else if (size_t_width == 32)
+      else if (width != NULL && *width == 32)
         {
           return StructType::get
             (TypeBuilder<types::i<32>, xcompile>::get(Context),
              TypeBuilder<types::i<32>[3], xcompile>::get(Context),
              TypeBuilder<types::i<32>[3], xcompile>::get(Context),
              TypeBuilder<types::i<32>[3], xcompile>::get(Context),
+             TypeBuilder<types::i<32>[2], xcompile>::get(Context),
+             TypeBuilder<types::i<8>*, xcompile>::get(Context),
+             TypeBuilder<types::i<8>*, xcompile>::get(Context),
              NULL);
         }
       else
@@ -123,26 +133,30 @@ namespace llvm {
      * type that depends on the pointer type. 
      *
      * This should be set when the correct type is known. This is a hack
-     * until a better way is found. It's not thread safe, e.g. if one
-     * compiles multiple Modules for multiple different pointer widths in
-     * a same process with multiple threads. */
+     * until a better way is found. The width is stored per thread as
+     * Modules for different pointer widths can be compiled in parallel. */
     static void setSizeTWidth(int width) {
-      size_t_width = width;
+      static const int widths[] = { 32, 64 };
+      size_t_width.set(width == 64 ? &widths[1] : &widths[0]);
     }    
   
     enum Fields {
       WORK_DIM,
       NUM_GROUPS,
       GROUP_ID,
-      GLOBAL_OFFSET
+      GLOBAL_OFFSET,
+      LOCAL_RANGE,
+      BARRIER,
+      TEAM
     };
   private:
-    static int size_t_width;
+    static llvm::sys::ThreadLocal<const int> size_t_width;
     
   };  
 
   template<bool xcompile>  
-  int TypeBuilder<PoclContext, xcompile>::size_t_width = 0;
+  llvm::sys::ThreadLocal<const int>
+  TypeBuilder<PoclContext, xcompile>::size_t_width;
 
 }  // namespace llvm
   
@@ -325,15 +339,71 @@ createLauncher(Module &M, Function *F)
     }
   }
 
+  /* The work-item range of a work group split to multiple threads. */
+  ptr = builder.CreateStructGEP(ai,
+				TypeBuilder<PoclContext, true>::LOCAL_RANGE);
+  for (int i = 0; i < 2; ++i) {
+    gv = M.getGlobalVariable(i == 0 ? "_local_range_begin" : 
+                             "_local_range_end");
+    if (gv != NULL) {
+      if (size_t_width == 64)
+        {
+          v = builder.CreateLoad(builder.CreateConstGEP2_64(ptr, 0, i));
+        }
+      else
+        {
+          v = builder.CreateLoad(builder.CreateConstGEP2_32(ptr, 0, i));
+        }
+      builder.CreateStore(v, gv);
+    }
+  }
+
   CallInst *c = builder.CreateCall(F, ArrayRef<Value*>(arguments));
   builder.CreateRetVoid();
 
   InlineFunctionInfo IFI;
   InlineFunction(c, IFI);
+
+  if (M.getGlobalVariable("_local_range_begin") != NULL)
+    addTeamBarriers(M, L, ai);
   
   return L;
 }
 
+/**
+ * Makes the barriers of a work-group function that executes a sub-range
+ * of the work items synchronize with the other threads executing the 
+ * same work group, by calling the barrier function given in the context.
+ */
+static void
+addTeamBarriers(Module &M, Function *F, Value *context)
+{
+  SmallVector<Instruction *, 8> barriers;
+  for (Function::iterator i = F->begin(), e = F->end(); i != e; ++i) {
+    for (BasicBlock::iterator ii = i->begin(), ee = i->end();
+         ii != ee; ++ii) {
+      Instruction *instr = ii;
+      if (isa<Barrier>(instr))
+        barriers.push_back(instr);
+    }
+  }
+
+  FunctionType *ft =
+    TypeBuilder<void(types::i<8>*), true>::get(M.getContext());
+
+  for (SmallVector<Instruction *, 8>::iterator i = barriers.begin(),
+         e = barriers.end(); i != e; ++i) {
+    IRBuilder<> builder(*i);
+    Value *barrier = builder.CreateLoad
+      (builder.CreateStructGEP(context, 
+                               TypeBuilder<PoclContext, true>::BARRIER));
+    Value *team = builder.CreateLoad
+      (builder.CreateStructGEP(context, TypeBuilder<PoclContext, true>::TEAM));
+    builder.CreateCall
+      (builder.CreateBitCast(barrier, ft->getPointerTo()), team);
+  }
+}
+
 static void
 privatizeContext(Module &M, Function *F)
 {
@@ -444,6 +514,25 @@ privatizeContext(Module &M, Function *F)
     }
   }
   
+  // Privatize _local_range_begin and _local_range_end
+  for (int i = 0; i < 2; ++i) {
+    gv[i] = M.getGlobalVariable(i == 0 ? "_local_range_begin" : 
+                                "_local_range_end");
+    ai[i] = NULL;
+    if (gv[i] != NULL) {
+      ai[i] = builder.CreateAlloca(gv[i]->getType()->getElementType(),
+                                   0, gv[i]->getName());
+    }
+  }
+  gv[2] = NULL;
+  for (Function::iterator i = F->begin(), e = F->end(); i != e; ++i) {
+    for (BasicBlock::iterator ii = i->begin(), ee = i->end();
+         ii != ee; ++ii) {
+      for (int j = 0; j < 2; ++j)
+        ii->replaceUsesOfWith(gv[j], ai[j]);
+    }
+  }
+
   // Privatize _global_offset
   for (int i = 0; i < 3; ++i) {
     snprintf(s, STRING_LENGTH, "_global_offset_%c", 'x' + i);
@@ -620,9 +709,10 @@ Workgroup::isKernelToProcess(const Function &F)
 
   NamedMDNode *kernels = m->getNamedMetadata("opencl.kernels");
   if (kernels == NULL) {
-    if (KernelName == "")
+    std::string kernelName = getKernelName(*m);
+    if (kernelName == "")
       return true;
-    if (F.getName() == KernelName)
+    if (F.getName() == kernelName)
       return true;
 
     return false;
@@ -638,3 +728,12 @@ Workgroup::isKernelToProcess(const Function &F)
 
   return false;
 }
+
+std::string
+Workgroup::getKernelName(const Module &M)
+{
+  std::string name;
+  if (getModuleParameter(M, "kernel", name))
+    return name;
+  return KernelName;
+}
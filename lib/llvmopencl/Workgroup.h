@@ -31,6 +31,8 @@
 #endif
 #include "llvm/Pass.h"
 
+#include <string>
+
 namespace pocl {
   class Workgroup : public llvm::ModulePass {  
   public:
@@ -47,6 +49,11 @@ namespace pocl {
 
     static bool isKernelToProcess(const llvm::Function &F);
 
+    /* The name of the kernel to process in the module, the "kernel"
+       parameter of the module or the -kernel option. Empty for all the
+       kernels. */
+    static std::string getKernelName(const llvm::Module &M);
+
   };
 }
 
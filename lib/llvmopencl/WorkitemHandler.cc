@@ -43,6 +43,7 @@
 #include "WorkitemHandler.h"
 #include "Kernel.h"
 #include "DebugHelpers.h"
+#include "LLVMUtils.h"
 
 //#define DEBUG_REFERENCE_FIXING
 
@@ -73,9 +74,18 @@ WorkitemHandler::Initialize(Kernel *K) {
 
   llvm::Module *M = K->getParent();
   
-  LocalSizeX = LocalSize[0];
-  LocalSizeY = LocalSize[1];
-  LocalSizeZ = LocalSize[2];
+  std::string localSize;
+  if (getModuleParameter(*M, "local_size", localSize))
+    {
+      std::istringstream sizes(localSize);
+      sizes >> LocalSizeX >> LocalSizeY >> LocalSizeZ;
+    }
+  else
+    {
+      LocalSizeX = LocalSize[0];
+      LocalSizeY = LocalSize[1];
+      LocalSizeZ = LocalSize[2];
+    }
   
   llvm::NamedMDNode *size_info = M->getNamedMetadata("opencl.kernel_wg_size_info");
   if (size_info) {
@@ -29,6 +29,7 @@
 #include "Workgroup.h"
 #include "CanonicalizeBarriers.h"
 #include "Kernel.h"
+#include "LLVMUtils.h"
 
 #include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/LoopInfo.h"
@@ -66,18 +67,14 @@ WorkitemHandlerChooser::runOnFunction(Function &F)
 
   Kernel *K = cast<Kernel> (&F);
 
-  /* FIXME: this is not thread safe. We cannot compile multiple kernels at
-     the same time with the same instances of these passes as they store
-     to private attributes and use global values to pass in the dimensions.
-     In the LLVMAPI version this logic should be at higher-level when
-     constructing the passes for the kernel, or done fully inside a single
-     FunctionPass that delegates to other passes. */    
+  /* The instances of the passes store to private attributes, thus each
+     thread compiling kernels in parallel needs its own pass manager. The
+     dimensions and the options are read from the module. */
   Initialize(K);
 
   std::string method = "auto";
-  if (getenv("POCL_WORK_GROUP_METHOD") != NULL)
+  if (getCompilerOption(*F.getParent(), "POCL_WORK_GROUP_METHOD", method))
     {
-      method = getenv("POCL_WORK_GROUP_METHOD");
       if (method == "repl" || method == "workitemrepl")
         chosenHandler_ = POCL_WIH_FULL_REPLICATION;
       else if (method == "loops" || method == "workitemloops" || method == "loopvec")
@@ -92,9 +89,11 @@ WorkitemHandlerChooser::runOnFunction(Function &F)
   if (method == "auto") 
     {
       int ReplThreshold = 2;
-      if (getenv("POCL_FULL_REPLICATION_THRESHOLD") != NULL) 
+      std::string threshold;
+      if (getCompilerOption(*F.getParent(), "POCL_FULL_REPLICATION_THRESHOLD",
+                            threshold))
       {
-        ReplThreshold = atoi(getenv("POCL_FULL_REPLICATION_THRESHOLD"));
+        ReplThreshold = atoi(threshold.c_str());
       }
       
       if (LocalSizeX*LocalSizeY*LocalSizeZ <= ReplThreshold)
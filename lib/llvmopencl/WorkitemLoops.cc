@@ -84,6 +84,15 @@ namespace {
 
 char WorkitemLoops::ID = 0;
 
+namespace pocl {
+/* Set for devices that can execute a work group with multiple threads,
+   each running a sub-range of the work items. */
+cl::opt<bool>
+WISubRanges("wi-sub-ranges", cl::init(false), cl::Hidden,
+  cl::desc("Iterate the outermost work-item loops over the range given "
+           "in the context at launch instead of the whole local size."));
+}
+
 void
 WorkitemLoops::getAnalysisUsage(AnalysisUsage &AU) const
 {
@@ -171,7 +180,7 @@ WorkitemLoops::CreateLoopAround
 (ParallelRegion &region,
  llvm::BasicBlock *entryBB, llvm::BasicBlock *exitBB, 
  bool peeledFirst, llvm::Value *localIdVar, size_t LocalSizeForDim,
- bool addIncBlock) 
+ bool addIncBlock, llvm::Value *rangeBegin, llvm::Value *rangeEnd) 
 {
   assert (localIdVar != NULL);
 
@@ -281,6 +290,10 @@ WorkitemLoops::CreateLoopAround
       builder.CreateStore
         (ConstantInt::get(IntegerType::get(C, size_t_width), 0), localIdXFirstVar);
     }
+  else if (rangeBegin != NULL)
+    {
+      builder.CreateStore(builder.CreateLoad(rangeBegin), localIdVar);
+    }
   else
     {
       builder.CreateStore
@@ -296,12 +309,12 @@ WorkitemLoops::CreateLoopAround
     }
 
   builder.SetInsertPoint(forCondBB);
+  llvm::Value *loopBound = 
+    rangeEnd != NULL ? (llvm::Value*)builder.CreateLoad(rangeEnd) :
+    (llvm::Value*)ConstantInt::get
+    (IntegerType::get(C, size_t_width), LocalSizeForDim);
   llvm::Value *cmpResult = 
-    builder.CreateICmpULT
-    (builder.CreateLoad(localIdVar),
-     (ConstantInt::get
-      (IntegerType::get(C, size_t_width), 
-       LocalSizeForDim)));
+    builder.CreateICmpULT(builder.CreateLoad(localIdVar), loopBound);
       
   Instruction *loopBranch =
       builder.CreateCondBr(cmpResult, loopBodyEntryBB, loopEndBB);
@@ -419,6 +432,56 @@ WorkitemLoops::ProcessFunction(Function &F)
   std::cerr << "### After context code addition:" << std::endl;
   F.viewCFG();
 #endif
+
+  int unrollCount;
+  std::string maxUnroll;
+  if (getCompilerOption(*F.getParent(), "POCL_WILOOPS_MAX_UNROLL_COUNT",
+                        maxUnroll))
+    unrollCount = atoi(maxUnroll.c_str());
+  else
+    unrollCount = 1;
+  /* Find a two's exponent unroll count, if available. */
+  while (unrollCount >= 1)
+    {
+      if (LocalSizeX % unrollCount == 0 &&
+          unrollCount <= LocalSizeX)
+        {
+          break;
+        }
+      unrollCount /= 2;
+    }
+
+  bool hasPeeledRegions = false;
+  for (std::map<llvm::BasicBlock*, int>::iterator i = entryCounts.begin(),
+         e = entryCounts.end(); i != e; ++i)
+    hasPeeledRegions |= i->second > 1;
+
+  /* In case a work group can be executed by multiple threads, the 
+     outermost work-item loop iterates only the range given in the
+     context. The peeled and unrolled loops assume a zero start, thus
+     such work groups cannot be split. The dimension of the split is
+     exported to the runtime in _KERNEL_sub_range_dim. */
+  int subRangeDim = -1;
+  llvm::Value *rangeBegin = NULL, *rangeEnd = NULL;
+  bool subRanges = WISubRanges;
+  std::string subRangesParam;
+  if (getModuleParameter(*F.getParent(), "wi_sub_ranges", subRangesParam))
+    subRanges = subRangesParam == "1";
+  if (subRanges && unrollCount <= 1 && !hasPeeledRegions)
+    {
+      llvm::Module *M = F.getParent();
+      llvm::Type *SizeT = IntegerType::get(F.getContext(), size_t_width);
+      llvm::Type *Int32 = IntegerType::get(F.getContext(), 32);
+
+      subRangeDim = LocalSizeZ > 1 ? 2 : (LocalSizeY > 1 ? 1 : 0);
+      rangeBegin = M->getOrInsertGlobal("_local_range_begin", SizeT);
+      rangeEnd = M->getOrInsertGlobal("_local_range_end", SizeT);
+      new GlobalVariable
+        (*M, Int32, true, GlobalValue::ExternalLinkage, 
+         ConstantInt::get(Int32, subRangeDim), 
+         "_" + F.getName().str() + "_sub_range_dim");
+    }
+
   std::map<ParallelRegion*, bool> peeledRegion;
   for (ParallelRegion::ParallelRegionVector::iterator
            i = original_parallel_regions->begin(), 
@@ -483,22 +546,6 @@ WorkitemLoops::ProcessFunction(Function &F)
             preds.push_back(bb);
           }
 
-        int unrollCount;
-        if (getenv("POCL_WILOOPS_MAX_UNROLL_COUNT") != NULL)
-            unrollCount = atoi(getenv("POCL_WILOOPS_MAX_UNROLL_COUNT"));
-        else
-            unrollCount = 1;
-        /* Find a two's exponent unroll count, if available. */
-        while (unrollCount >= 1)
-          {
-            if (LocalSizeX % unrollCount == 0 &&
-                unrollCount <= LocalSizeX)
-              {
-                break;
-              }
-            unrollCount /= 2;
-          }
-
         if (unrollCount > 1) {
             ParallelRegion *prev = original;
             llvm::BasicBlock *lastBB = 
@@ -527,13 +574,19 @@ WorkitemLoops::ProcessFunction(Function &F)
       }
 
     if (LocalSizeX > 1)
-      l = CreateLoopAround(*original, l.first, l.second, peelFirst, localIdX, LocalSizeX, !unrolled);
+      l = CreateLoopAround(*original, l.first, l.second, peelFirst, localIdX, LocalSizeX, !unrolled,
+                           subRangeDim == 0 ? rangeBegin : NULL,
+                           subRangeDim == 0 ? rangeEnd : NULL);
 
     if (LocalSizeY > 1)
-      l = CreateLoopAround(*original, l.first, l.second, false, localIdY, LocalSizeY);
+      l = CreateLoopAround(*original, l.first, l.second, false, localIdY, LocalSizeY, true,
+                           subRangeDim == 1 ? rangeBegin : NULL,
+                           subRangeDim == 1 ? rangeEnd : NULL);
 
     if (LocalSizeZ > 1)
-      l = CreateLoopAround(*original, l.first, l.second, false, localIdZ, LocalSizeZ);
+      l = CreateLoopAround(*original, l.first, l.second, false, localIdZ, LocalSizeZ, true,
+                           subRangeDim == 2 ? rangeBegin : NULL,
+                           subRangeDim == 2 ? rangeEnd : NULL);
 
     /* Loop edges coming from another region mean B-loops which means 
        we have to fix the loop edge to jump to the beginning of the wi-loop 
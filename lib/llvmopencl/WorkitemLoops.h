@@ -86,7 +86,8 @@ namespace pocl {
     CreateLoopAround
         (ParallelRegion &region, llvm::BasicBlock *entryBB, llvm::BasicBlock *exitBB, 
          bool peeledFirst, llvm::Value *localIdVar, size_t LocalSizeForDim,
-         bool addIncBlock=true);
+         bool addIncBlock=true, llvm::Value *rangeBegin=NULL,
+         llvm::Value *rangeEnd=NULL);
 
     llvm::BasicBlock *
       AppendIncBlock
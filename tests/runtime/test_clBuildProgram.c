@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <CL/cl.h>
 #include <poclu.h>
 #include "pocl_tests.h"
@@ -42,6 +43,37 @@ char kernel[] =
 char invalid_kernel[] =
   "kernel void test_kernel(constant int a, j) { return 3; }\n";
 
+/* Set by the callback of the asynchronous builds. */
+static volatile cl_program notified_program = NULL;
+
+static void CL_CALLBACK
+build_notify (cl_program program, void *user_data)
+{
+  *(int*)user_data += 1;
+  notified_program = program;
+}
+
+/* Waits for the asynchronous build to finish on the device and returns
+   its final status. */
+static cl_build_status
+wait_for_build (cl_program program, cl_device_id device)
+{
+  cl_build_status status;
+  cl_int err;
+
+  do
+    {
+      err = clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_STATUS,
+                                   sizeof (status), &status, NULL);
+      if (err != CL_SUCCESS)
+        return CL_BUILD_NONE;
+      if (status == CL_BUILD_IN_PROGRESS || notified_program != program)
+        usleep (1000);
+    }
+  while (status == CL_BUILD_IN_PROGRESS || notified_program != program);
+  return status;
+}
+
 int
 main(void){
   cl_int err;
@@ -90,5 +122,52 @@ main(void){
   err = clBuildProgram(program, num_devices, devices, NULL, NULL, NULL);
   TEST_ASSERT(err == CL_BUILD_PROGRAM_FAILURE);
 
+  err = clReleaseProgram(program);
+  CHECK_OPENCL_ERROR_IN("clReleaseProgram");
+
+  /* The builds with a callback return immediately, the devices are built
+     on the compiler threads. */
+  int notifications = 0;
+  kernel_size = strlen(kernel);
+  kernel_buffer = kernel;
+
+  program = clCreateProgramWithSource(context, 1, (const char**)&kernel_buffer,
+                                      &kernel_size, &err);
+  CHECK_OPENCL_ERROR_IN("clCreateProgramWithSource");
+
+  err = clBuildProgram(program, num_devices, devices,
+     "-D__FUNC__=helper_func -I./test_data", build_notify, &notifications);
+  CHECK_OPENCL_ERROR_IN("clBuildProgram");
+
+  for (i = 0; i < num_devices; ++i)
+    TEST_ASSERT(wait_for_build(program, devices[i]) == CL_BUILD_SUCCESS);
+  TEST_ASSERT(notifications == 1);
+
+  err = clReleaseProgram(program);
+  CHECK_OPENCL_ERROR_IN("clReleaseProgram");
+
+  kernel_size = strlen(invalid_kernel);
+  kernel_buffer = invalid_kernel;
+
+  program = clCreateProgramWithSource(context, 1, (const char**)&kernel_buffer,
+                                      &kernel_size, &err);
+  CHECK_OPENCL_ERROR_IN("clCreateProgramWithSource");
+
+  /* The errors are reported through the build status. */
+  notified_program = NULL;
+  err = clBuildProgram(program, num_devices, devices, NULL, build_notify,
+                       &notifications);
+  CHECK_OPENCL_ERROR_IN("clBuildProgram");
+
+  for (i = 0; i < num_devices; ++i)
+    TEST_ASSERT(wait_for_build(program, devices[i]) == CL_BUILD_ERROR);
+  TEST_ASSERT(notifications == 2);
+
+  cl_kernel k = clCreateKernel(program, "test_kernel", &err);
+  TEST_ASSERT(k == NULL && err == CL_INVALID_PROGRAM_EXECUTABLE);
+
+  err = clReleaseProgram(program);
+  CHECK_OPENCL_ERROR_IN("clReleaseProgram");
+
   return EXIT_SUCCESS;
 }
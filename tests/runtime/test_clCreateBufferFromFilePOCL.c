@@ -0,0 +1,197 @@
+/* Tests the cl_pocl_file_buffer extension
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+/* The extension functions are looked up with the 1.1 function. */
+#define CL_USE_DEPRECATED_OPENCL_1_1_APIS
+#include <CL/cl.h>
+#include <CL/cl_ext_pocl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define N (1024 * 1024)
+/* The first element of the file used, to test an unaligned offset. */
+#define SKIP 3
+
+char kernelSourceCode[] =
+"kernel \n"
+"void test_kernel(global const int *input, global int *output) {\n"
+"    size_t i = get_global_id(0);\n"
+"    output[i] = input[i] * 2;\n"
+"}\n";
+
+int main()
+{
+  size_t global_work_size[1] = { N - SKIP };
+  cl_int err;
+  cl_platform_id platforms[1];
+  cl_uint nplatforms;
+  cl_device_id devices[1];
+  cl_uint num_devices;
+  cl_context context = NULL;
+  cl_command_queue queue = NULL;
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_mem input = NULL;
+  cl_mem cow = NULL;
+  const char *sources[] = { kernelSourceCode };
+  char filename[] = "/tmp/pocl_file_buffer_XXXXXX";
+  clCreateBufferFromFilePOCL_fn create_from_file;
+  cl_int *data;
+  FILE *file;
+  int fd;
+  int i;
+
+  data = (cl_int*)malloc (N * sizeof (cl_int));
+  if (data == NULL)
+    return EXIT_FAILURE;
+  for (i = 0; i < N; ++i)
+    data[i] = i;
+
+  fd = mkstemp (filename);
+  if (fd == -1)
+    return EXIT_FAILURE;
+  file = fdopen (fd, "wb");
+  if (file == NULL || fwrite (data, sizeof (cl_int), N, file) != N)
+    return EXIT_FAILURE;
+  fclose (file);
+
+  err = clGetPlatformIDs(1, platforms, &nplatforms);
+  if (err != CL_SUCCESS && !nplatforms)
+    return EXIT_FAILURE;
+
+  err = clGetDeviceIDs(platforms[0], CL_DEVICE_TYPE_ALL, 1,
+                       devices, &num_devices);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  context = clCreateContext(NULL, num_devices, devices, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  queue = clCreateCommandQueue(context, devices[0], 0, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  program = clCreateProgramWithSource(context, 1, sources, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  err = clBuildProgram(program, num_devices, devices, NULL, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  kernel = clCreateKernel(program, "test_kernel", &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  create_from_file = (clCreateBufferFromFilePOCL_fn)
+    clGetExtensionFunctionAddress("clCreateBufferFromFilePOCL");
+  if (create_from_file == NULL)
+    return EXIT_FAILURE;
+
+  /* A range outside of the file fails. */
+  input = create_from_file(context, CL_MEM_READ_ONLY, filename,
+                           N * sizeof(cl_int), 0, &err);
+  if (input != NULL || err != CL_INVALID_VALUE)
+    return EXIT_FAILURE;
+
+  input = create_from_file(context, CL_MEM_READ_ONLY, filename,
+                           SKIP * sizeof(cl_int), 0, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  /* The copy-on-write buffer is used as the output, the file must not
+     change. */
+  cow = create_from_file(context, CL_MEM_READ_WRITE, filename,
+                         SKIP * sizeof(cl_int), 0, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &cow);
+  err |= clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                                NULL, 0, NULL, NULL);
+  err |= clEnqueueReadBuffer(queue, cow, CL_TRUE, 0,
+                             (N - SKIP) * sizeof(cl_int), data, 0, NULL,
+                             NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  for (i = 0; i < N - SKIP; ++i)
+    {
+      if (data[i] != (i + SKIP) * 2)
+        {
+          printf("FAIL: output %d is %d\n", i, data[i]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  /* The host can write to a read-only buffer, the file must not change
+     either. */
+  for (i = 0; i < N - SKIP; ++i)
+    data[i] = -i;
+  err = clEnqueueWriteBuffer(queue, input, CL_TRUE, 0,
+                             (N - SKIP) * sizeof(cl_int), data, 0, NULL,
+                             NULL);
+  for (i = 0; i < N - SKIP; ++i)
+    data[i] = 0;
+  err |= clEnqueueReadBuffer(queue, input, CL_TRUE, 0,
+                             (N - SKIP) * sizeof(cl_int), data, 0, NULL,
+                             NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  for (i = 0; i < N - SKIP; ++i)
+    {
+      if (data[i] != -i)
+        {
+          printf("FAIL: read-only buffer %d is %d\n", i, data[i]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  clReleaseMemObject(cow);
+  clReleaseMemObject(input);
+
+  file = fopen (filename, "rb");
+  if (file == NULL || fread (data, sizeof (cl_int), N, file) != N)
+    return EXIT_FAILURE;
+  fclose (file);
+  unlink (filename);
+  for (i = 0; i < N; ++i)
+    {
+      if (data[i] != i)
+        {
+          printf("FAIL: the file was modified\n");
+          return EXIT_FAILURE;
+        }
+    }
+
+  free (data);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
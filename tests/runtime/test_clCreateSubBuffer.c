@@ -0,0 +1,179 @@
+/* Tests clCreateSubBuffer()
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include <CL/cl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N (64 * 1024)
+#define TILES 4
+#define TILE (N / TILES)
+
+char kernelSourceCode[] =
+"kernel \n"
+"void test_kernel(global int *data, int value) {\n"
+"    size_t i = get_global_id(0);\n"
+"    data[i] += value;\n"
+"}\n";
+
+int main()
+{
+  size_t global_work_size[1] = { TILE };
+  cl_int err;
+  cl_platform_id platforms[1];
+  cl_uint nplatforms;
+  cl_device_id devices[1];
+  cl_uint num_devices;
+  cl_context context = NULL;
+  cl_command_queue queue = NULL;
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_mem parent = NULL;
+  cl_mem tiles[TILES];
+  cl_mem assoc;
+  const char *sources[] = { kernelSourceCode };
+  cl_buffer_region region;
+  cl_int *host;
+  cl_int *mapped;
+  cl_int value;
+  size_t offset;
+  int i, t;
+
+  if (posix_memalign ((void**)&host, 4096, N * sizeof (cl_int)) != 0)
+    return EXIT_FAILURE;
+  for (i = 0; i < N; ++i)
+    host[i] = i;
+
+  err = clGetPlatformIDs(1, platforms, &nplatforms);
+  if (err != CL_SUCCESS && !nplatforms)
+    return EXIT_FAILURE;
+
+  err = clGetDeviceIDs(platforms[0], CL_DEVICE_TYPE_ALL, 1,
+                       devices, &num_devices);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  context = clCreateContext(NULL, num_devices, devices, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  queue = clCreateCommandQueue(context, devices[0], 0, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  program = clCreateProgramWithSource(context, 1, sources, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  err = clBuildProgram(program, num_devices, devices, NULL, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  kernel = clCreateKernel(program, "test_kernel", &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  parent = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                          N * sizeof(cl_int), host, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  /* A sub buffer origin not aligned for any device fails. */
+  region.origin = 1;
+  region.size = sizeof(cl_int);
+  clCreateSubBuffer(parent, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+  if (err != CL_MISALIGNED_SUB_BUFFER_OFFSET)
+    return EXIT_FAILURE;
+
+  for (t = 0; t < TILES; ++t)
+    {
+      region.origin = t * TILE * sizeof(cl_int);
+      region.size = TILE * sizeof(cl_int);
+      tiles[t] = clCreateSubBuffer(parent, 0, CL_BUFFER_CREATE_TYPE_REGION,
+                                   &region, &err);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+
+      err = clGetMemObjectInfo(tiles[t], CL_MEM_OFFSET, sizeof(offset),
+                               &offset, NULL);
+      err |= clGetMemObjectInfo(tiles[t], CL_MEM_ASSOCIATED_MEMOBJECT,
+                                sizeof(assoc), &assoc, NULL);
+      if (err != CL_SUCCESS || offset != region.origin || assoc != parent)
+        return EXIT_FAILURE;
+    }
+
+  /* Each tile gets its own addend, the parent sees all the writes. */
+  for (t = 0; t < TILES; ++t)
+    {
+      value = (t + 1) * N;
+      err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &tiles[t]);
+      err |= clSetKernelArg(kernel, 1, sizeof(cl_int), &value);
+      err |= clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                                    NULL, 0, NULL, NULL);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+    }
+
+  /* The tile is a view to the same memory, mapping it gives the host
+     memory of the parent at the offset of the tile. */
+  mapped = (cl_int*)clEnqueueMapBuffer(queue, tiles[1], CL_TRUE, CL_MAP_READ,
+                                       0, TILE * sizeof(cl_int), 0, NULL,
+                                       NULL, &err);
+  if (err != CL_SUCCESS || mapped != host + TILE)
+    {
+      printf("FAIL: the sub buffer was not mapped in place\n");
+      return EXIT_FAILURE;
+    }
+  err = clEnqueueUnmapMemObject(queue, tiles[1], mapped, 0, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  mapped = (cl_int*)clEnqueueMapBuffer(queue, parent, CL_TRUE, CL_MAP_READ,
+                                       0, N * sizeof(cl_int), 0, NULL, NULL,
+                                       &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  for (i = 0; i < N; ++i)
+    {
+      if (mapped[i] != i + (i / TILE + 1) * N)
+        {
+          printf("FAIL: element %d is %d\n", i, mapped[i]);
+          return EXIT_FAILURE;
+        }
+    }
+  err = clEnqueueUnmapMemObject(queue, parent, mapped, 0, NULL, NULL);
+  err |= clFinish(queue);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  for (t = 0; t < TILES; ++t)
+    clReleaseMemObject(tiles[t]);
+  clReleaseMemObject(parent);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  free (host);
+
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
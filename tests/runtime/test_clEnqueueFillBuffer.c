@@ -0,0 +1,165 @@
+/* Tests clEnqueueFillBuffer() and the rectangular buffer reads
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include <CL/cl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Large enough for the pthread device to split the fills to threads. */
+#define N (4 * 1024 * 1024)
+
+/* The rect read: a box of W x H x D bytes at (X, Y, Z) of the buffer
+   seen as rows of PITCH bytes and slices of PITCH * ROWS bytes. */
+#define PITCH 1024
+#define ROWS 64
+#define X 100
+#define Y 3
+#define Z 2
+#define W 200
+#define H 10
+#define D 4
+
+static int
+check_fill (const unsigned char *data, size_t offset, size_t size,
+            const unsigned char *pattern, size_t pattern_size)
+{
+  size_t i;
+  for (i = 0; i < size; ++i)
+    {
+      if (data[offset + i] != pattern[i % pattern_size])
+        {
+          printf ("FAIL: byte %u is %u\n", (unsigned)(offset + i),
+                  data[offset + i]);
+          return 1;
+        }
+    }
+  return 0;
+}
+
+int main()
+{
+  cl_int err;
+  cl_platform_id platforms[1];
+  cl_uint nplatforms;
+  cl_device_id devices[1];
+  cl_uint num_devices;
+  cl_context context = NULL;
+  cl_command_queue queue = NULL;
+  cl_mem buf = NULL;
+  unsigned char pattern[128];
+  unsigned char zero = 0;
+  unsigned char *data;
+  unsigned char *box;
+  size_t buffer_origin[3] = { X, Y, Z };
+  size_t host_origin[3] = { 0, 0, 0 };
+  size_t region[3] = { W, H, D };
+  size_t i, x, y, z;
+
+  data = (unsigned char*)malloc (N);
+  box = (unsigned char*)malloc (W * H * D);
+  if (data == NULL || box == NULL)
+    return EXIT_FAILURE;
+  for (i = 0; i < sizeof (pattern); ++i)
+    pattern[i] = i * 7 + 1;
+
+  err = clGetPlatformIDs(1, platforms, &nplatforms);
+  if (err != CL_SUCCESS && !nplatforms)
+    return EXIT_FAILURE;
+
+  err = clGetDeviceIDs(platforms[0], CL_DEVICE_TYPE_ALL, 1,
+                       devices, &num_devices);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  context = clCreateContext(NULL, num_devices, devices, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  queue = clCreateCommandQueue(context, devices[0], 0, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  buf = clCreateBuffer(context, CL_MEM_READ_WRITE, N, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  /* Invalid pattern sizes and offsets. */
+  if (clEnqueueFillBuffer(queue, buf, pattern, 3, 0, 12, 0, NULL, NULL)
+      != CL_INVALID_VALUE ||
+      clEnqueueFillBuffer(queue, buf, pattern, 256, 0, 256, 0, NULL, NULL)
+      != CL_INVALID_VALUE ||
+      clEnqueueFillBuffer(queue, buf, pattern, 4, 2, 4, 0, NULL, NULL)
+      != CL_INVALID_VALUE ||
+      clEnqueueFillBuffer(queue, buf, pattern, 4, N - 4, 8, 0, NULL, NULL)
+      != CL_INVALID_VALUE)
+    return EXIT_FAILURE;
+
+  /* Each pattern size over a range starting at an unaligned offset. */
+  for (i = 1; i <= sizeof (pattern); i *= 2)
+    {
+      size_t offset = i * 3;
+      size_t size = N - i * 8;
+      err = clEnqueueFillBuffer(queue, buf, &zero, 1, 0, N, 0, NULL, NULL);
+      err |= clEnqueueFillBuffer(queue, buf, pattern, i, offset, size, 0,
+                                 NULL, NULL);
+      err |= clEnqueueReadBuffer(queue, buf, CL_TRUE, 0, N, data, 0, NULL,
+                                 NULL);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+      if (check_fill (data, 0, offset, &zero, 1) ||
+          check_fill (data, offset, size, pattern, i) ||
+          check_fill (data, offset + size, N - offset - size, &zero, 1))
+        {
+          printf ("FAIL: pattern size %u\n", (unsigned)i);
+          return EXIT_FAILURE;
+        }
+    }
+
+  /* Read a box of the last fill back with a rect read. */
+  err = clEnqueueReadBufferRect(queue, buf, CL_TRUE, buffer_origin,
+                                host_origin, region, PITCH, PITCH * ROWS,
+                                W, W * H, box, 0, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  for (z = 0; z < D; ++z)
+    for (y = 0; y < H; ++y)
+      for (x = 0; x < W; ++x)
+        {
+          size_t offset = (Z + z) * PITCH * ROWS + (Y + y) * PITCH + X + x;
+          if (box[z * W * H + y * W + x] != data[offset])
+            {
+              printf ("FAIL: rect read at %u %u %u\n", (unsigned)x,
+                      (unsigned)y, (unsigned)z);
+              return EXIT_FAILURE;
+            }
+        }
+
+  clReleaseMemObject(buf);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  free (box);
+  free (data);
+
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+/* Tests the command ordering of in-order queues with dependency analysis
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include <CL/cl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N (64 * 1024)
+
+/* The busy loop keeps the kernel running long enough for a wrongly
+   ordered command to see the old contents of the buffer. */
+#define ITERATIONS 2000
+
+static const char *source =
+"kernel void write_slowly(global uint *x, global uint *y, uint n) {\n"
+"  size_t i = get_global_id(0);\n"
+"  uint v = i;\n"
+"  for (uint k = 0; k < n; ++k)\n"
+"    v = v * 1664525u + 1013904223u;\n"
+"  y[i] = v;\n"
+"  x[i] = i + 1;\n"
+"}\n";
+
+static int
+check_written (const cl_uint *data, const char *what)
+{
+  unsigned i;
+  for (i = 0; i < N; ++i)
+    {
+      if (data[i] != i + 1)
+        {
+          printf ("FAIL: %s: element %u is %u\n", what, i, data[i]);
+          return 1;
+        }
+    }
+  return 0;
+}
+
+int main()
+{
+  cl_int err;
+  cl_platform_id platforms[1];
+  cl_uint nplatforms;
+  cl_device_id devices[1];
+  cl_uint num_devices;
+  cl_context context = NULL;
+  cl_command_queue queue = NULL;
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_mem x = NULL;
+  cl_mem y = NULL;
+  cl_mem z = NULL;
+  cl_event marker = NULL;
+  cl_uint iterations = ITERATIONS;
+  size_t global_work_size[1] = { N };
+  cl_uint *data;
+  cl_uint *host;
+  cl_uint *mapped;
+
+  /* read by clCreateCommandQueue() */
+  setenv ("POCL_DEPENDENCY_ANALYSIS", "1", 1);
+
+  data = (cl_uint*)calloc (N, sizeof (cl_uint));
+  host = (cl_uint*)calloc (N, sizeof (cl_uint));
+  if (data == NULL || host == NULL)
+    return EXIT_FAILURE;
+
+  err = clGetPlatformIDs(1, platforms, &nplatforms);
+  if (err != CL_SUCCESS && !nplatforms)
+    return EXIT_FAILURE;
+
+  err = clGetDeviceIDs(platforms[0], CL_DEVICE_TYPE_ALL, 1,
+                       devices, &num_devices);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  context = clCreateContext(NULL, num_devices, devices, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  queue = clCreateCommandQueue(context, devices[0], 0, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  program = clCreateProgramWithSource(context, 1, &source, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  kernel = clCreateKernel(program, "write_slowly", &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  x = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                     N * sizeof (cl_uint), data, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  y = clCreateBuffer(context, CL_MEM_READ_WRITE, N * sizeof (cl_uint),
+                     NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  z = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                     N * sizeof (cl_uint), host, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  err = clSetKernelArg(kernel, 0, sizeof (cl_mem), &x);
+  err |= clSetKernelArg(kernel, 1, sizeof (cl_mem), &y);
+  err |= clSetKernelArg(kernel, 2, sizeof (cl_uint), &iterations);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  /* A read after a marker waits for the kernel enqueued before the
+     marker. */
+  err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                               NULL, 0, NULL, NULL);
+  err |= clEnqueueMarkerWithWaitList(queue, 0, NULL, &marker);
+  err |= clEnqueueReadBuffer(queue, x, CL_TRUE, 0, N * sizeof (cl_uint),
+                             data, 0, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  if (check_written (data, "read after a marker"))
+    return EXIT_FAILURE;
+  clReleaseEvent(marker);
+
+  /* A zero-copy map after a marker is not completed at enqueue time
+     while the kernel enqueued before the marker still writes the
+     buffer. */
+  err = clSetKernelArg(kernel, 0, sizeof (cl_mem), &z);
+  err |= clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                                NULL, 0, NULL, NULL);
+  err |= clEnqueueMarkerWithWaitList(queue, 0, NULL, &marker);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  mapped = (cl_uint*)clEnqueueMapBuffer(queue, z, CL_TRUE, CL_MAP_READ, 0,
+                                        N * sizeof (cl_uint), 0, NULL, NULL,
+                                        &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  if (check_written (mapped, "map after a marker"))
+    return EXIT_FAILURE;
+  err = clEnqueueUnmapMemObject(queue, z, mapped, 0, NULL, NULL);
+  err |= clFinish(queue);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  clReleaseEvent(marker);
+
+  clReleaseMemObject(z);
+  clReleaseMemObject(y);
+  clReleaseMemObject(x);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+  free (host);
+  free (data);
+
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
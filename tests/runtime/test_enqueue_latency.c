@@ -0,0 +1,372 @@
+/* Measures the latency from enqueueing a trivial kernel to its start,
+   or the first launch of kernels of new programs
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include <CL/cl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define WARMUP_LAUNCHES 10
+#define TIMED_LAUNCHES 1000
+/* The default number of programs built by the first-launch benchmark. */
+#define FIRST_LAUNCH_PROGRAMS 20
+
+char kernelSourceCode[] =
+"kernel \n"
+"void test_kernel(global int *output, int value) {\n"
+"    output[get_global_id(0)] = value;\n"
+"}\n"
+"kernel __attribute__((reqd_work_group_size(4, 1, 1)))\n"
+"void reqd_kernel(global int *output) {\n"
+"    output[get_global_id(0)] = get_local_size(0);\n"
+"}\n";
+
+/* The reqd_work_group_size of reqd_kernel. */
+#define REQD_SIZE 4
+
+static double
+now_usec ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* Adds the time the command of EVENT waited in the queue before it was
+   submitted, and before it started, to the sums in microseconds. */
+static int
+add_latency (cl_event event, double *to_submit, double *to_start)
+{
+  cl_ulong queued, submit, started;
+  cl_int err;
+
+  err = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED,
+                                sizeof(cl_ulong), &queued, NULL);
+  err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT,
+                                 sizeof(cl_ulong), &submit, NULL);
+  err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
+                                 sizeof(cl_ulong), &started, NULL);
+  if (err != CL_SUCCESS)
+    return 0;
+
+  *to_submit += (submit - queued) / 1e3;
+  *to_start += (started - queued) / 1e3;
+  return 1;
+}
+
+/* Checks that the first SIZE elements of OUTPUT hold EXPECTED. */
+static int
+check_output (cl_command_queue queue, cl_mem output, size_t size,
+              cl_int expected)
+{
+  cl_int result[8];
+  size_t i;
+
+  if (clEnqueueReadBuffer(queue, output, CL_TRUE, 0, size * sizeof(cl_int),
+                          result, 0, NULL, NULL) != CL_SUCCESS)
+    return 0;
+  for (i = 0; i < size; ++i)
+    {
+      if (result[i] != expected)
+        {
+          printf("FAIL: output[%zu] is %d instead of %d\n",
+                 i, result[i], expected);
+          return 0;
+        }
+    }
+  return 1;
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+/* Times the first launch of a kernel of a new program, the generation,
+   compilation and loading of its work-group function included. ROUND
+   makes the build options, thus the program, unique. */
+static int
+time_first_launch (cl_context context, cl_device_id device,
+                   cl_command_queue queue, cl_mem output, cl_int round,
+                   double *usec)
+{
+  size_t global_work_size[1] = { 1 }, local_work_size[1]= { 1 };
+  const char *sources[] = { kernelSourceCode };
+  cl_program program;
+  cl_kernel kernel;
+  char options[32];
+  double start;
+  cl_int err;
+
+  snprintf(options, sizeof(options), "-DROUND=%d", round);
+  program = clCreateProgramWithSource(context, 1, sources, NULL, &err);
+  if (err != CL_SUCCESS)
+    return 0;
+  err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return 0;
+  kernel = clCreateKernel(program, "test_kernel", &err);
+  if (err != CL_SUCCESS)
+    return 0;
+
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_int), &round);
+  if (err != CL_SUCCESS)
+    return 0;
+  start = now_usec ();
+  err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                               local_work_size, 0, NULL, NULL);
+  err |= clFinish(queue);
+  if (err != CL_SUCCESS)
+    return 0;
+  *usec = now_usec () - start;
+
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+  return check_output(queue, output, 1, round);
+}
+
+/* With the argument "first-launch [programs]" only the first launches of
+   kernels of new programs are timed. Compare the runs with 
+   POCL_KERNEL_JIT=0 and 1 to see what compiling the work-group functions
+   in memory saves. */
+static int
+first_launch_benchmark (cl_context context, cl_device_id device,
+                        cl_command_queue queue, cl_mem output, int programs)
+{
+  double samples[programs];
+  int i;
+
+  for (i = 0; i < programs; ++i)
+    {
+      if (!time_first_launch(context, device, queue, output, i, &samples[i]))
+        return 0;
+    }
+  qsort(samples, programs, sizeof(double), compare_doubles);
+  printf("first launch of %d programs: min %.0f us, median %.0f us, "
+         "max %.0f us\n", programs, samples[0], samples[programs / 2],
+         samples[programs - 1]);
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  size_t global_work_size[1] = { 1 }, local_work_size[1]= { 1 };
+  cl_int err;
+  cl_platform_id platforms[1];
+  cl_uint nplatforms;
+  cl_device_id devices[1];
+  cl_uint num_devices;
+  cl_context context = NULL;
+  cl_command_queue queue = NULL;
+  cl_program program = NULL;
+  cl_kernel kernel = NULL;
+  cl_kernel reqd_kernel = NULL;
+  cl_event event = NULL;
+  cl_mem output = NULL;
+  cl_int reqd_output[REQD_SIZE * 2];
+  size_t reqd_global_work_size[1] = { REQD_SIZE * 2 };
+  size_t reqd_local_work_size[1] = { REQD_SIZE };
+  const char *sources[] = { kernelSourceCode };
+  double start, first, first_reqd, single, batched;
+  double to_submit = 0.0, to_start = 0.0;
+  int programs = 0;
+  int i;
+
+  if (argc > 1 && strcmp(argv[1], "first-launch") == 0)
+    {
+      programs = argc > 2 ? atoi(argv[2]) : FIRST_LAUNCH_PROGRAMS;
+      if (programs < 1)
+        return EXIT_FAILURE;
+      /* The cached work-group functions would hide the compilation. */
+      setenv("POCL_KERNEL_CACHE", "0", 1);
+    }
+
+  err = clGetPlatformIDs(1, platforms, &nplatforms);
+  if (err != CL_SUCCESS && !nplatforms)
+    return EXIT_FAILURE;
+
+  err = clGetDeviceIDs(platforms[0], CL_DEVICE_TYPE_ALL, 1,
+                       devices, &num_devices);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  context = clCreateContext(NULL, num_devices, devices, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  queue = clCreateCommandQueue(context, devices[0],
+                               CL_QUEUE_PROFILING_ENABLE, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  program = clCreateProgramWithSource(context, 1, sources, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  err = clBuildProgram(program, num_devices, devices, NULL, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  kernel = clCreateKernel(program, "test_kernel", &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  output = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(reqd_output),
+                          NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  if (programs > 0)
+    {
+      if (!first_launch_benchmark(context, devices[0], queue, output,
+                                  programs))
+        return EXIT_FAILURE;
+      printf("OK\n");
+      return EXIT_SUCCESS;
+    }
+
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  /* The first launch generates and loads the work-group function. */
+  start = now_usec ();
+  i = 0;
+  err = clSetKernelArg(kernel, 1, sizeof(cl_int), &i);
+  err |= clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                                local_work_size, 0, NULL, NULL);
+  err |= clFinish(queue);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  first = now_usec () - start;
+  if (!check_output(queue, output, 1, 0))
+    return EXIT_FAILURE;
+
+  for (i = 1; i < WARMUP_LAUNCHES; ++i)
+    {
+      err = clSetKernelArg(kernel, 1, sizeof(cl_int), &i);
+      err |= clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                                    local_work_size, 0, NULL, NULL);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+    }
+  if (clFinish(queue) != CL_SUCCESS)
+    return EXIT_FAILURE;
+  if (!check_output(queue, output, 1, WARMUP_LAUNCHES - 1))
+    return EXIT_FAILURE;
+
+  /* A round trip per launch on an otherwise idle queue, so the time from
+     enqueue to start is the launch latency of the runtime alone. */
+  start = now_usec ();
+  for (i = 0; i < TIMED_LAUNCHES; ++i)
+    {
+      err = clSetKernelArg(kernel, 1, sizeof(cl_int), &i);
+      err |= clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                                    local_work_size, 0, NULL, &event);
+      err |= clFinish(queue);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+      if (!add_latency(event, &to_submit, &to_start))
+        return EXIT_FAILURE;
+      clReleaseEvent(event);
+    }
+  single = (now_usec () - start) / TIMED_LAUNCHES;
+  if (!check_output(queue, output, 1, TIMED_LAUNCHES - 1))
+    return EXIT_FAILURE;
+
+  /* Back-to-back launches with a single wait at the end. */
+  start = now_usec ();
+  for (i = 0; i < TIMED_LAUNCHES; ++i)
+    {
+      err = clSetKernelArg(kernel, 1, sizeof(cl_int), &i);
+      err |= clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                                    local_work_size, 0, NULL, NULL);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+    }
+  if (clFinish(queue) != CL_SUCCESS)
+    return EXIT_FAILURE;
+  batched = (now_usec () - start) / TIMED_LAUNCHES;
+  if (!check_output(queue, output, 1, TIMED_LAUNCHES - 1))
+    return EXIT_FAILURE;
+
+  /* The work-group function of a kernel with reqd_work_group_size is
+     compiled in clCreateKernel(). The local size must still be given. */
+  reqd_kernel = clCreateKernel(program, "reqd_kernel", &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  err = clSetKernelArg(reqd_kernel, 0, sizeof(cl_mem), &output);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  err = clEnqueueNDRangeKernel(queue, reqd_kernel, 1, NULL,
+                               reqd_global_work_size, NULL, 0, NULL, NULL);
+  if (err != CL_INVALID_WORK_GROUP_SIZE)
+    {
+      printf("FAIL: launched without the required local size\n");
+      return EXIT_FAILURE;
+    }
+
+  start = now_usec ();
+  err = clEnqueueNDRangeKernel(queue, reqd_kernel, 1, NULL,
+                               reqd_global_work_size, reqd_local_work_size,
+                               0, NULL, NULL);
+  err |= clFinish(queue);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  first_reqd = now_usec () - start;
+
+  err = clEnqueueReadBuffer(queue, output, CL_TRUE, 0, sizeof(reqd_output),
+                            reqd_output, 0, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+  for (i = 0; i < REQD_SIZE * 2; ++i)
+    {
+      if (reqd_output[i] != REQD_SIZE)
+        {
+          printf("FAIL: the local size is %d instead of the required\n",
+                 reqd_output[i]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  printf("enqueue to submit: %.2f us, enqueue to start: %.2f us\n",
+         to_submit / TIMED_LAUNCHES, to_start / TIMED_LAUNCHES);
+  printf("first launch: %.0f us, launch+finish: %.2f us, "
+         "launch (batched): %.2f us, first launch (precompiled): %.0f us\n",
+         first, single, batched, first_reqd);
+
+  clReleaseMemObject(output);
+  clReleaseKernel(reqd_kernel);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
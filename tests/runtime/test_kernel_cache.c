@@ -0,0 +1,209 @@
+/* Tests the persistent kernel cache
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include <CL/cl.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N 64
+
+char kernelSourceCode[] =
+"kernel \n"
+"void test_kernel(global const int *input, global int *output) {\n"
+"    size_t i = get_global_id(0);\n"
+"    output[i] = input[i] + get_local_id(0);\n"
+"}\n";
+
+/* Builds and runs the kernel with a new program. The second round
+   uses the program, the kernel metadata and the work-group function
+   stored to the cache by the first one. */
+static int
+run_kernel (cl_context context, cl_device_id device, cl_command_queue queue)
+{
+  size_t global_work_size[1] = { N };
+  size_t local_work_size[1] = { 4 };
+  const char *sources[] = { kernelSourceCode };
+  cl_program program;
+  cl_kernel kernel;
+  cl_mem input, output;
+  cl_int data[N];
+  char name[32];
+  cl_int err;
+  int i;
+
+  for (i = 0; i < N; ++i)
+    data[i] = i;
+
+  program = clCreateProgramWithSource(context, 1, sources, NULL, &err);
+  if (err != CL_SUCCESS)
+    return 0;
+
+  err = clBuildProgram(program, 1, &device, "-cl-kernel-arg-info", NULL,
+                       NULL);
+  if (err != CL_SUCCESS)
+    return 0;
+
+  kernel = clCreateKernel(program, "test_kernel", &err);
+  if (err != CL_SUCCESS)
+    return 0;
+
+  err = clGetKernelArgInfo(kernel, 1, CL_KERNEL_ARG_NAME, sizeof(name),
+                           name, NULL);
+  if (err != CL_SUCCESS || strcmp(name, "output") != 0)
+    {
+      printf("FAIL: wrong argument name\n");
+      return 0;
+    }
+
+  input = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                         sizeof(data), data, &err);
+  if (err != CL_SUCCESS)
+    return 0;
+  output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(data), NULL,
+                          &err);
+  if (err != CL_SUCCESS)
+    return 0;
+
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+  err |= clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size,
+                                local_work_size, 0, NULL, NULL);
+  err |= clEnqueueReadBuffer(queue, output, CL_TRUE, 0, sizeof(data), data,
+                             0, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return 0;
+
+  for (i = 0; i < N; ++i)
+    {
+      if (data[i] != i + i % 4)
+        {
+          printf("FAIL: output %d is %d\n", i, data[i]);
+          return 0;
+        }
+    }
+
+  clReleaseMemObject(output);
+  clReleaseMemObject(input);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+  return 1;
+}
+
+int main()
+{
+  char cache_dir[] = "/tmp/pocl_kernel_cache_XXXXXX";
+  char command[64];
+  cl_int err;
+  cl_platform_id platforms[1];
+  cl_uint nplatforms;
+  cl_device_id devices[1];
+  cl_uint num_devices;
+  cl_context context = NULL;
+  cl_command_queue queue = NULL;
+  static const char *const include_options[] =
+    { "-I%s", "-isystem %s", "-iquote %s" };
+  char options[64];
+  const char *sources[] = { kernelSourceCode };
+  cl_program program;
+  cl_kernel kernel;
+  struct dirent *de;
+  DIR *dir;
+  int entries = 0;
+  int round;
+  unsigned i;
+
+  if (mkdtemp (cache_dir) == NULL)
+    return EXIT_FAILURE;
+  /* The cache is disabled by default in the build tree. */
+  setenv ("POCL_KERNEL_CACHE", "1", 1);
+  setenv ("POCL_KERNEL_CACHE_DIR", cache_dir, 1);
+
+  err = clGetPlatformIDs(1, platforms, &nplatforms);
+  if (err != CL_SUCCESS && !nplatforms)
+    return EXIT_FAILURE;
+
+  err = clGetDeviceIDs(platforms[0], CL_DEVICE_TYPE_ALL, 1,
+                       devices, &num_devices);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  context = clCreateContext(NULL, num_devices, devices, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  queue = clCreateCommandQueue(context, devices[0], 0, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  for (round = 0; round < 2; ++round)
+    {
+      if (!run_kernel (context, devices[0], queue))
+        return EXIT_FAILURE;
+    }
+
+  /* The headers of an include directory are not covered by the key,
+     such builds add no entries. */
+  for (i = 0; i < sizeof (include_options) / sizeof (include_options[0]);
+       ++i)
+    {
+      snprintf (options, sizeof (options), include_options[i], cache_dir);
+      program = clCreateProgramWithSource(context, 1, sources, NULL, &err);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+      err = clBuildProgram(program, 1, devices, options, NULL, NULL);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+      kernel = clCreateKernel(program, "test_kernel", &err);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+      clReleaseKernel(kernel);
+      clReleaseProgram(program);
+    }
+
+  /* The program bitcode, the kernel metadata and the work-group
+     function (a library or a JIT object), and the lock file. */
+  dir = opendir (cache_dir);
+  if (dir == NULL)
+    return EXIT_FAILURE;
+  while ((de = readdir (dir)) != NULL)
+    {
+      if (de->d_name[0] != '.')
+        ++entries;
+    }
+  closedir (dir);
+  if (entries != 4)
+    {
+      printf("FAIL: %d files in the cache\n", entries);
+      return EXIT_FAILURE;
+    }
+
+  snprintf (command, sizeof (command), "rm -rf '%s'", cache_dir);
+  system (command);
+
+  clReleaseCommandQueue(queue);
+  clReleaseContext(context);
+
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
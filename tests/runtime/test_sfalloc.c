@@ -0,0 +1,239 @@
+/* Tests the segregated-fit buffer allocator of the CPU devices
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/* The allocator is used by the pthread device when POCL_PTHREAD_ALLOCATOR
+   is "segregated". Its functions are internal to libpocl, thus sfalloc.c
+   is compiled into this program. */
+
+#include "sfalloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECK(__COND__)                                                 \
+  do {                                                                  \
+    if (!(__COND__))                                                    \
+      {                                                                 \
+        printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #__COND__);     \
+        exit(EXIT_FAILURE);                                             \
+      }                                                                 \
+  } while (0)
+
+/* Enough objects of the largest class to overflow a thread cache. */
+#define NUM_OBJECTS 64
+
+static size_t
+allocated_bytes (sfa_heap *heap)
+{
+  sfa_stats stats;
+  sfa_get_stats (heap, &stats);
+  return stats.allocated_bytes;
+}
+
+/* Every buffer is aligned and usable in full. */
+static void
+test_alignment (void)
+{
+  static const size_t sizes[] =
+    { 0, 1, 100, 128, 129, 1000, 4097, SFA_SMALL_MAX, SFA_SMALL_MAX + 1,
+      100000, SFA_ARENA_SIZE / 4, SFA_ARENA_SIZE / 4 + 1 };
+  const unsigned n = sizeof (sizes) / sizeof (sizes[0]);
+  void *ptrs[sizeof (sizes) / sizeof (sizes[0])];
+  sfa_heap heap;
+  unsigned i, j;
+
+  sfa_init (&heap, 1);
+  for (i = 0; i < n; ++i)
+    {
+      ptrs[i] = sfa_alloc (&heap, sizes[i]);
+      CHECK(ptrs[i] != NULL);
+      CHECK((uintptr_t)ptrs[i] % SFA_ALIGNMENT == 0);
+      memset (ptrs[i], i + 1, sizes[i]);
+    }
+  /* no buffer overlaps another one */
+  for (i = 0; i < n; ++i)
+    for (j = 0; j < sizes[i]; ++j)
+      CHECK(((unsigned char*)ptrs[i])[j] == i + 1);
+
+  for (i = 0; i < n; ++i)
+    sfa_free (&heap, ptrs[i]);
+  CHECK(allocated_bytes (&heap) == 0);
+  sfa_uninit (&heap);
+}
+
+/* The buddy blocks split for the allocations of different orders merge
+   back to a whole arena when freed in any order. */
+static void
+test_split_coalesce (void)
+{
+  static const size_t sizes[] =
+    { SFA_SMALL_MAX + 1, SFA_PAGE_SIZE * 5, 64 * 1024, SFA_SMALL_MAX + 1,
+      1024 * 1024, SFA_PAGE_SIZE * 3, 3 * 1024 * 1024 };
+  static const unsigned free_order[] = { 3, 0, 6, 2, 5, 1, 4 };
+  const unsigned n = sizeof (sizes) / sizeof (sizes[0]);
+  void *ptrs[sizeof (sizes) / sizeof (sizes[0])];
+  sfa_stats stats;
+  sfa_heap heap;
+  unsigned i;
+
+  sfa_init (&heap, 1);
+  for (i = 0; i < n; ++i)
+    {
+      ptrs[i] = sfa_alloc (&heap, sizes[i]);
+      CHECK(ptrs[i] != NULL);
+    }
+  sfa_get_stats (&heap, &stats);
+  CHECK(heap.num_arenas == 1);
+  CHECK(stats.reserved_bytes == SFA_ARENA_SIZE);
+  CHECK(stats.free_bytes + stats.allocated_bytes == SFA_ARENA_SIZE);
+  CHECK(stats.largest_free_block < SFA_ARENA_SIZE);
+
+  for (i = 0; i < n; ++i)
+    sfa_free (&heap, ptrs[free_order[i]]);
+  sfa_get_stats (&heap, &stats);
+  CHECK(stats.allocated_bytes == 0);
+  CHECK(stats.free_bytes == SFA_ARENA_SIZE);
+  CHECK(stats.largest_free_block == SFA_ARENA_SIZE);
+
+  /* The small size classes take their slabs from the same buddy
+     allocator and keep them, the rest of the arena still coalesces. */
+  for (i = 0; i < NUM_OBJECTS; ++i)
+    ptrs[i % n] = sfa_alloc (&heap, 128 << (i % 7));
+  sfa_get_stats (&heap, &stats);
+  CHECK(stats.slab_bytes > 0);
+  CHECK(stats.free_bytes + stats.slab_bytes == SFA_ARENA_SIZE);
+  sfa_uninit (&heap);
+}
+
+typedef struct objects
+{
+  sfa_heap *heap;
+  size_t size;
+  void *ptrs[NUM_OBJECTS];
+} objects;
+
+static void *
+alloc_objects (void *arg)
+{
+  objects *o = (objects*)arg;
+  unsigned i;
+
+  for (i = 0; i < NUM_OBJECTS; ++i)
+    {
+      o->ptrs[i] = sfa_alloc (o->heap, o->size);
+      CHECK(o->ptrs[i] != NULL);
+      memset (o->ptrs[i], 0xa5, o->size);
+    }
+  return NULL;
+}
+
+static void *
+free_objects (void *arg)
+{
+  objects *o = (objects*)arg;
+  unsigned i;
+
+  for (i = 0; i < NUM_OBJECTS; ++i)
+    sfa_free (o->heap, o->ptrs[i]);
+  return NULL;
+}
+
+static void
+run_thread (void *(*func)(void *), objects *o)
+{
+  pthread_t thread;
+  CHECK(pthread_create (&thread, NULL, func, o) == 0);
+  CHECK(pthread_join (thread, NULL) == 0);
+}
+
+/* The small objects freed by another thread than the allocating one,
+   and those left in the cache of an exited thread, are reused. */
+static void
+test_cross_thread_free (void)
+{
+  objects o;
+  sfa_stats before, after;
+  sfa_heap heap;
+
+  sfa_init (&heap, 1);
+  o.heap = &heap;
+  o.size = SFA_SMALL_MAX;
+
+  run_thread (alloc_objects, &o);
+  free_objects (&o);
+  CHECK(allocated_bytes (&heap) == 0);
+  sfa_get_stats (&heap, &before);
+
+  alloc_objects (&o);
+  run_thread (free_objects, &o);
+  CHECK(allocated_bytes (&heap) == 0);
+
+  /* Everything is back on the central free list or in the cache of
+     this thread, no new slab is needed. */
+  alloc_objects (&o);
+  sfa_get_stats (&heap, &after);
+  CHECK(after.slab_bytes == before.slab_bytes);
+  free_objects (&o);
+  sfa_uninit (&heap);
+}
+
+/* Destroying the heap releases all its memory, including the buffers
+   still allocated. */
+static void
+test_uninit (void)
+{
+  sfa_heap heap;
+
+  sfa_init (&heap, 1);
+  CHECK(sfa_alloc (&heap, 100) != NULL);
+  CHECK(sfa_alloc (&heap, 100000) != NULL);
+  CHECK(sfa_alloc (&heap, SFA_ARENA_SIZE / 2) != NULL);
+  CHECK(heap.stats.reserved_bytes == SFA_ARENA_SIZE + SFA_ARENA_SIZE / 2);
+  CHECK(heap.stats.allocated_bytes > 0);
+
+  sfa_uninit (&heap);
+  CHECK(heap.num_arenas == 0);
+  CHECK(heap.huge == NULL);
+  CHECK(heap.stats.reserved_bytes == 0);
+  CHECK(heap.stats.allocated_bytes == 0);
+  CHECK(heap.stats.slab_bytes == 0);
+  CHECK(heap.stats.free_bytes == 0);
+
+  /* the heap can be initialized again */
+  sfa_init (&heap, 0);
+  sfa_free (&heap, sfa_alloc (&heap, 100));
+  sfa_uninit (&heap);
+}
+
+int main()
+{
+  test_alignment ();
+  test_split_coalesce ();
+  test_cross_thread_free ();
+  test_uninit ();
+
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}